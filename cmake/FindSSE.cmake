@@ -143,3 +143,56 @@ if(SSE2_C_FLAGS)
   check_c_source_compiles("${SSE2_C_TEST_SOURCE_SET_EPI64X}" HAVE_SSE2_MM_SET_EPI64X)
   set(CMAKE_REQUIRED_FLAGS "${SAFE_CMAKE_REQUIRED_FLAGS}")
 endif()
+
+# AVX2 is not required, but enables explicitly vectorized code paths 
+# which are selected at runtime.  Only the flags are tested here; 
+# the CPU running the build need not support AVX2.
+set(AVX2_C_TEST_SOURCE
+"
+#include <immintrin.h>
+__m256 foo(__m256 a, __m256 b, __m256 c) {
+    return _mm256_fmadd_ps(a, b, c);
+}
+int main(void) {
+    __m256 one = _mm256_set1_ps(1.f);
+    __m256i idx = _mm256_set1_epi32(0);
+    float f[8] = {0};
+    __m256 g = _mm256_i32gather_ps(f, idx, 4);
+    foo(one, one, g);
+    return 0;
+}
+")
+
+if(AVX2_C_FLAGS)
+else()
+  if(WIN32)
+    set(AVX2_C_FLAG_CANDIDATES "/arch:AVX2")
+  else()
+    set(AVX2_C_FLAG_CANDIDATES "-mavx2 -mfma")
+  endif()
+
+  include(CheckCSourceCompiles)
+
+  foreach(FLAG IN LISTS AVX2_C_FLAG_CANDIDATES)
+    set(SAFE_CMAKE_REQUIRED_FLAGS "${CMAKE_REQUIRED_FLAGS}")
+    set(CMAKE_REQUIRED_FLAGS "${FLAG}")
+    unset(HAVE_AVX2 CACHE)
+    check_c_source_compiles("${AVX2_C_TEST_SOURCE}" HAVE_AVX2)
+    set(CMAKE_REQUIRED_FLAGS "${SAFE_CMAKE_REQUIRED_FLAGS}")
+    if(HAVE_AVX2)
+      set(AVX2_C_FLAGS_INTERNAL "${FLAG}")
+      break()
+    endif()
+  endforeach()
+  unset(AVX2_C_FLAG_CANDIDATES)
+
+  set(AVX2_C_FLAGS "${AVX2_C_FLAGS_INTERNAL}"
+    CACHE STRING "C compiler flags for AVX2 intrinsics")
+  mark_as_advanced(AVX2_C_FLAGS)
+endif()
+
+if(AVX2_C_FLAGS)
+  set(AVX2_FOUND true)
+else()
+  set(AVX2_FOUND false)
+endif()
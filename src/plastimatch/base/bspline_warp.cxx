@@ -4,6 +4,8 @@
 #include "plm_config.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <vector>
 #if (OPENMP_FOUND)
 #include <omp.h>
 #endif
@@ -22,38 +24,158 @@
 #include "volume_macros.h"
 #include "volume.h"
 
+Bspline_warp_target::Bspline_warp_target (
+    Volume *vout,
+    Volume *moving,
+    int linear_interp,
+    float default_val
+)
+{
+    this->vout = vout;
+    this->moving = moving;
+    this->linear_interp = linear_interp;
+    this->default_val = default_val;
+}
+
+template <class T>
+static void
+bspline_warp_set_default (Bspline_warp_target& tgt)
+{
+    T* vout_img = (T*) tgt.vout->img;
+    T default_val = (T) tgt.default_val;
+    plm_long n = tgt.vout->npix * tgt.vout->vox_planes;
+    for (plm_long vidx = 0; vidx < n; vidx++) {
+        vout_img[vidx] = default_val;
+    }
+}
+
+/* Resample a single target at the moving image position 
+   which corresponds to fixed image voxel fv */
+template <class T>
+static inline void
+bspline_warp_voxel (
+    const Bspline_warp_target& tgt,
+    plm_long fv,             /* Linear index within fixed image (vox) */
+    const float fxyz[3],     /* Position within fixed image (mm) */
+    const float dxyz[3]      /* Deformation vector (mm) */
+)
+{
+    Volume *moving = tgt.moving;
+    T* vout_img = (T*) tgt.vout->img;
+    T* m_img = (T*) moving->img;
+    float mxyz[3];   /* Position within moving image (mm) */
+    float mijk[3];   /* Index within moving image (vox) */
+    plm_long mijk_f[3]; /* Floor index within moving image (vox) */
+    plm_long mijk_r[3]; /* Round index within moving image (vox) */
+    plm_long mvf;    /* Floor linear index within moving image */
+    float li_1[3];   /* Fraction of interpolant in lower index */
+    float li_2[3];   /* Fraction of interpolant in upper index */
+
+    /* Compute moving image coordinate of fixed image voxel */
+    mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
+    mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
+    mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
+    mijk[2] = PROJECT_Z (mxyz, moving->proj);
+    mijk[1] = PROJECT_Y (mxyz, moving->proj);
+    mijk[0] = PROJECT_X (mxyz, moving->proj);
+
+    if (!moving->is_inside (mijk)) return;
+
+    li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
+
+    if (tgt.linear_interp) {
+        /* Find linear index of "corner voxel" in moving image */
+        mvf = volume_index (moving->dim, mijk_f);
+
+        /* Macro is slightly faster than function */
+        /* Compute moving image intensity using linear 
+           interpolation */
+        T m_val;
+        LI_VALUE (m_val, 
+            li_1[0], li_2[0],
+            li_1[1], li_2[1],
+            li_1[2], li_2[2],
+            mvf, m_img, moving);
+
+        /* Assign warped value to output image */
+        vout_img[fv] = m_val;
+
+    } else {
+        /* Find linear index of "nearest voxel" in moving image */
+        mvf = volume_index (moving->dim, mijk_r);
+
+        /* Loop through planes */
+        /* Note: We omit looping through planes when linear 
+           interpolation is enabled, with the understanding 
+           that this is only used for warping structure sets */
+        for (int plane = 0; plane < moving->vox_planes; plane++)
+        {
+            /* Get moving image value */
+            T m_val;
+            m_val = m_img[mvf*moving->vox_planes+plane];
+
+            /* Assign to output image */
+            vout_img[fv*moving->vox_planes+plane] = m_val;
+        }
+    }
+}
+
 /* This only warps voxels within the ROI.  If you need the whole 
    image, call bspline_xform_extend. */
-template <class T, int PIX_TYPE>
 void
-bspline_warp_dcos (
-    Volume *vout,       /* Output image (sized and allocated) */
+bspline_warp_multi (
+    std::vector<Bspline_warp_target>& targets, /* Images to warp */
     Volume *vf_out,     /* Output vf (sized and allocated, can be null) */
-    Bspline_xform* bxf, /* Bspline transform coefficients */
-    Volume *moving,     /* Input image */
-    int linear_interp,  /* 1 = trilinear, 0 = nearest neighbors */
-    T default_val       /* Fill in this value outside of image */
+    Bspline_xform* bxf  /* Bspline transform coefficients */
 )
 {
-    T* vout_img = (T*) vout->img;
-    T* m_img = (T*) moving->img;
-
     /* A few sanity checks */
-    if (vout->pix_type != PIX_TYPE) {
-        print_and_exit ("Error: bspline_warp pix type mismatch\n");
-        return;
-    }
-    for (int d = 0; d < 3; d++) {
-        if (vout->dim[d] != bxf->img_dim[d]) {
-            print_and_exit ("Error: bspline_warp dim mismatch\n");
+    for (size_t t = 0; t < targets.size(); t++) {
+        Volume *vout = targets[t].vout;
+        Volume *moving = targets[t].moving;
+        if (vout->pix_type != moving->pix_type) {
+            print_and_exit ("Error: bspline_warp pix type mismatch\n");
             return;
         }
-        if (vout->origin[d] != bxf->img_origin[d]) {
-            print_and_exit ("Error: bspline_warp origin mismatch\n");
+        if (vout->vox_planes < moving->vox_planes) {
+            print_and_exit ("Error: bspline_warp planes mismatch\n");
             return;
         }
-        if (vout->spacing[d] != bxf->img_spacing[d]) {
-            print_and_exit ("Error: bspline_warp pix spacing mismatch\n");
+        for (int d = 0; d < 3; d++) {
+            if (vout->dim[d] != bxf->img_dim[d]) {
+                print_and_exit ("Error: bspline_warp dim mismatch\n");
+                return;
+            }
+            if (vout->origin[d] != bxf->img_origin[d]) {
+                print_and_exit ("Error: bspline_warp origin mismatch\n");
+                return;
+            }
+            if (vout->spacing[d] != bxf->img_spacing[d]) {
+                print_and_exit ("Error: bspline_warp pix spacing mismatch\n");
+                return;
+            }
+        }
+        switch (moving->pix_type) {
+        case PT_UCHAR:
+        case PT_UCHAR_VEC_INTERLEAVED:
+            bspline_warp_set_default<unsigned char> (targets[t]);
+            break;
+        case PT_SHORT:
+            bspline_warp_set_default<short> (targets[t]);
+            break;
+        case PT_UINT16:
+            bspline_warp_set_default<uint16_t> (targets[t]);
+            break;
+        case PT_UINT32:
+            bspline_warp_set_default<uint32_t> (targets[t]);
+            break;
+        case PT_FLOAT:
+            bspline_warp_set_default<float> (targets[t]);
+            break;
+        case PT_VF_FLOAT_INTERLEAVED:
+        case PT_VF_FLOAT_PLANAR:
+        default:
+            print_and_exit ("bspline_warp: sorry, this is not supported.\n");
             return;
         }
     }
@@ -61,17 +183,22 @@ bspline_warp_dcos (
         print_and_exit ("Error: bspline_warp requires interleaved vf\n");
         return;
     }
-
-    /* Set default */
-    for (plm_long vidx = 0; vidx < vout->npix; vidx++) {
-        vout_img[vidx] = default_val;
-    }
     if (vf_out) {
         memset (vf_out->img, 0, vf_out->pix_size * vf_out->npix);
     }
 
+    /* All targets share the output geometry, which is the 
+       geometry of the B-spline */
+    const Volume *vgeom = targets.size() ? targets[0].vout : vf_out;
+    if (!vgeom) {
+        return;
+    }
+    size_t num_targets = targets.size();
+
+    /* The deformation is evaluated once per voxel, 
+       and then used to resample every target */
 #pragma omp parallel for 
-    LOOP_Z_OMP (k, vout) {
+    LOOP_Z_OMP (k, vgeom) {
         plm_long fijk[3];      /* Index within fixed image (vox) */
         float fxyz[3];         /* Position within fixed image (mm) */
         plm_long p[3];
@@ -80,21 +207,14 @@ bspline_warp_dcos (
         float dxyz[3];
 
         fijk[2] = k;
-        fxyz[2] = vout->origin[2] + fijk[2] * vout->step[2*3+2];
+        fxyz[2] = vgeom->origin[2] + fijk[2] * vgeom->step[2*3+2];
         p[2] = REGION_INDEX_Z (fijk, bxf);
         q[2] = REGION_OFFSET_Z (fijk, bxf);
-        LOOP_Y (fijk, fxyz, vout) {
+        LOOP_Y (fijk, fxyz, vgeom) {
             p[1] = REGION_INDEX_Y (fijk, bxf);
             q[1] = REGION_OFFSET_Y (fijk, bxf);
-            LOOP_X (fijk, fxyz, vout) {
+            LOOP_X (fijk, fxyz, vgeom) {
                 plm_long fv;     /* Linear index within fixed image (vox) */
-                float mxyz[3];   /* Position within moving image (mm) */
-                float mijk[3];   /* Index within moving image (vox) */
-                plm_long mijk_f[3]; /* Floor index within moving image (vox) */
-                plm_long mijk_r[3]; /* Round index within moving image (vox) */
-                plm_long mvf;    /* Floor linear index within moving image */
-                float li_1[3];   /* Fraction of interpolant in lower index */
-                float li_2[3];   /* Fraction of interpolant in upper index */
                 p[0] = REGION_INDEX_X (fijk, bxf);
                 q[0] = REGION_OFFSET_X (fijk, bxf);
 
@@ -104,7 +224,7 @@ bspline_warp_dcos (
                 bspline_interp_pix_b (dxyz, bxf, pidx, qidx);
 
                 /* Compute linear index of fixed image voxel */
-                fv = volume_index (vout->dim, fijk);
+                fv = volume_index (vgeom->dim, fijk);
 
                 /* Assign deformation */
                 if (vf_out) {
@@ -114,51 +234,29 @@ bspline_warp_dcos (
                     vf_out_img[3*fv+2] = dxyz[2];
                 }
 
-                /* Compute moving image coordinate of fixed image voxel */
-                mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
-                mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
-                mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
-                mijk[2] = PROJECT_Z (mxyz, moving->proj);
-                mijk[1] = PROJECT_Y (mxyz, moving->proj);
-                mijk[0] = PROJECT_X (mxyz, moving->proj);
-
-                if (!moving->is_inside (mijk)) continue;
-
-                li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
-
-                if (linear_interp) {
-                    /* Find linear index of "corner voxel" in moving image */
-                    mvf = volume_index (moving->dim, mijk_f);
-
-                    /* Macro is slightly faster than function */
-                    /* Compute moving image intensity using linear 
-                       interpolation */
-                    T m_val;
-                    LI_VALUE (m_val, 
-                        li_1[0], li_2[0],
-                        li_1[1], li_2[1],
-                        li_1[2], li_2[2],
-                        mvf, m_img, moving);
-
-                    /* Assign warped value to output image */
-                    vout_img[fv] = m_val;
-
-                } else {
-                    /* Find linear index of "nearest voxel" in moving image */
-                    mvf = volume_index (moving->dim, mijk_r);
-
-                    /* Loop through planes */
-                    /* Note: We omit looping through planes when linear 
-                       interpolation is enabled, with the understanding 
-                       that this is only used for warping structure sets */
-                    for (int plane = 0; plane < moving->vox_planes; plane++)
-                    {
-                        /* Get moving image value */
-                        T m_val;
-                        m_val = m_img[mvf*moving->vox_planes+plane];
-
-                        /* Assign to output image */
-                        vout_img[fv*moving->vox_planes+plane] = m_val;
+                /* Resample each target */
+                for (size_t t = 0; t < num_targets; t++) {
+                    const Bspline_warp_target& tgt = targets[t];
+                    switch (tgt.moving->pix_type) {
+                    case PT_UCHAR:
+                    case PT_UCHAR_VEC_INTERLEAVED:
+                        bspline_warp_voxel<unsigned char> (
+                            tgt, fv, fxyz, dxyz);
+                        break;
+                    case PT_SHORT:
+                        bspline_warp_voxel<short> (tgt, fv, fxyz, dxyz);
+                        break;
+                    case PT_UINT16:
+                        bspline_warp_voxel<uint16_t> (tgt, fv, fxyz, dxyz);
+                        break;
+                    case PT_UINT32:
+                        bspline_warp_voxel<uint32_t> (tgt, fv, fxyz, dxyz);
+                        break;
+                    case PT_FLOAT:
+                        bspline_warp_voxel<float> (tgt, fv, fxyz, dxyz);
+                        break;
+                    default:
+                        break;
                     }
                 }
             }
@@ -177,40 +275,10 @@ bspline_warp (
     float default_val   /* Fill in this value outside of image */
 )
 {
-    switch (moving->pix_type)
-    {
-    case PT_UCHAR:
-        bspline_warp_dcos<unsigned char, PT_UCHAR> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    case PT_SHORT:
-        bspline_warp_dcos<short, PT_SHORT> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    case PT_UINT16:
-        bspline_warp_dcos<uint16_t, PT_UINT16> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    case PT_UINT32:
-        bspline_warp_dcos<uint32_t, PT_UINT32> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    case PT_FLOAT:
-        bspline_warp_dcos<float, PT_FLOAT> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    case PT_VF_FLOAT_INTERLEAVED:
-    case PT_VF_FLOAT_PLANAR:
-        print_and_exit ("bspline_warp: sorry, this is not supported.\n");
-        break;
-    case PT_UCHAR_VEC_INTERLEAVED:
-        bspline_warp_dcos<unsigned char, PT_UCHAR_VEC_INTERLEAVED> (
-            vout, vf_out, bxf, moving, linear_interp, default_val);
-        break;
-    default:
-        print_and_exit ("bspline_warp: sorry, this is not supported.\n");
-        break;
-    }
+    std::vector<Bspline_warp_target> targets;
+    targets.push_back (
+        Bspline_warp_target (vout, moving, linear_interp, default_val));
+    bspline_warp_multi (targets, vf_out, bxf);
 }
 
 void
@@ -5,10 +5,37 @@
 #define _bspline_warp_h_
 
 #include "plmbase_config.h"
+#include <vector>
 #include "volume.h"
 
 class Bspline_xform;
 
+/*! \brief
+ * One image to be resampled by bspline_warp_multi().  The output 
+ * image must have the geometry of the B-spline, and the same pixel 
+ * type as the input image.  Input images may have any geometry.
+ */
+class PLMBASE_API Bspline_warp_target {
+public:
+    Volume *vout;         /* Output image (already sized and allocated) */
+    Volume *moving;       /* Input image */
+    int linear_interp;    /* 1 = trilinear, 0 = nearest neighbors */
+    float default_val;    /* Fill in this value outside of image */
+public:
+    Bspline_warp_target (Volume *vout, Volume *moving, 
+        int linear_interp, float default_val);
+};
+
+/*! \brief Warp several images with the same transform.  The 
+  deformation is evaluated once per output voxel, and each target 
+  is resampled from it in the same pass.  Targets of different 
+  pixel types, including uchar vector images, can be mixed. */
+PLMBASE_API void bspline_warp_multi (
+    std::vector<Bspline_warp_target>& targets, /* Images to warp */
+    Volume *vf_out,       /* Output vf (already sized and allocated, can be null) */
+    Bspline_xform* bxf    /* Bspline transform coefficients */
+);
+
 /* This should become obsolete */
 PLMBASE_API void bspline_warp (
     Volume *vout,         /* Output image (already sized and allocated) */
@@ -18,6 +18,9 @@
 #include "file_util.h"
 #include "interpolate_macros.h"
 #include "logfile.h"
+#include "path_util.h"
+#include "plm_endian.h"
+#include "plm_fwrite.h"
 #include "plm_math.h"
 #include "print_and_exit.h"
 #include "string_util.h"
@@ -111,8 +114,102 @@ bspline_basis_eval (
     }
 }
 
+/* Layout of the binary format header.  All fields are little-endian. 
+   The coefficients start at header_size, which is a multiple of 16, 
+   so that they are aligned if the file is mapped into memory. */
+#define BXF_BINARY_VERSION          1
+#define BXF_BINARY_HEADER_SIZE      256
+#define BXF_OFS_VERSION             16
+#define BXF_OFS_HEADER_SIZE         20
+#define BXF_OFS_IMG_ORIGIN          24
+#define BXF_OFS_IMG_SPACING         36
+#define BXF_OFS_IMG_DIM             48
+#define BXF_OFS_ROI_OFFSET          60
+#define BXF_OFS_ROI_DIM             72
+#define BXF_OFS_VOX_PER_RGN         84
+#define BXF_OFS_DIRECTION_COSINES   96
+#define BXF_OFS_NUM_COEFF           132
+
+static void
+bxf_header_put_float (unsigned char *hdr, int ofs, const float *val, int n)
+{
+    memcpy (&hdr[ofs], val, n * sizeof(float));
+    endian4_native_to_little (&hdr[ofs], n);
+}
+
+static void
+bxf_header_put_uint32 (unsigned char *hdr, int ofs, const plm_long *val, int n)
+{
+    for (int i = 0; i < n; i++) {
+        uint32_t v = (uint32_t) val[i];
+        memcpy (&hdr[ofs + 4*i], &v, 4);
+    }
+    endian4_native_to_little (&hdr[ofs], n);
+}
+
+static void
+bxf_header_get_float (float *val, const unsigned char *hdr, int ofs, int n)
+{
+    memcpy (val, &hdr[ofs], n * sizeof(float));
+    endian4_little_to_native (val, n);
+}
+
+static void
+bxf_header_get_uint32 (plm_long *val, const unsigned char *hdr, int ofs, int n)
+{
+    uint32_t v[9];
+    memcpy (v, &hdr[ofs], n * 4);
+    endian4_little_to_native (v, n);
+    for (int i = 0; i < n; i++) {
+        val[i] = v[i];
+    }
+}
+
 void
 Bspline_xform::save (const char* filename)
+{
+    if (extension_is (filename, ".bxf")) {
+        this->save_binary (filename);
+    } else {
+        this->save_text (filename);
+    }
+}
+
+void
+Bspline_xform::save_binary (const char* filename)
+{
+    FILE* fp;
+
+    make_parent_directories (filename);
+    fp = fopen (filename, "wb");
+    if (!fp) return;
+
+    unsigned char hdr[BXF_BINARY_HEADER_SIZE];
+    memset (hdr, 0, BXF_BINARY_HEADER_SIZE);
+    memcpy (hdr, BSPLINE_XFORM_BINARY_MAGIC, 
+        strlen (BSPLINE_XFORM_BINARY_MAGIC));
+    plm_long version = BXF_BINARY_VERSION;
+    plm_long header_size = BXF_BINARY_HEADER_SIZE;
+    plm_long num_coeff = this->num_coeff;
+    bxf_header_put_uint32 (hdr, BXF_OFS_VERSION, &version, 1);
+    bxf_header_put_uint32 (hdr, BXF_OFS_HEADER_SIZE, &header_size, 1);
+    bxf_header_put_float (hdr, BXF_OFS_IMG_ORIGIN, this->img_origin, 3);
+    bxf_header_put_float (hdr, BXF_OFS_IMG_SPACING, this->img_spacing, 3);
+    bxf_header_put_uint32 (hdr, BXF_OFS_IMG_DIM, this->img_dim, 3);
+    bxf_header_put_uint32 (hdr, BXF_OFS_ROI_OFFSET, this->roi_offset, 3);
+    bxf_header_put_uint32 (hdr, BXF_OFS_ROI_DIM, this->roi_dim, 3);
+    bxf_header_put_uint32 (hdr, BXF_OFS_VOX_PER_RGN, this->vox_per_rgn, 3);
+    bxf_header_put_float (hdr, BXF_OFS_DIRECTION_COSINES, 
+        this->dc.get_matrix (), 9);
+    bxf_header_put_uint32 (hdr, BXF_OFS_NUM_COEFF, &num_coeff, 1);
+
+    plm_fwrite (hdr, 1, BXF_BINARY_HEADER_SIZE, fp, false);
+    plm_fwrite (this->coeff, sizeof(float), this->num_coeff, fp, true);
+    fclose (fp);
+}
+
+void
+Bspline_xform::save_text (const char* filename)
 {
     FILE* fp;
 
@@ -161,6 +258,109 @@ Bspline_xform::save (const char* filename)
     fclose (fp);
 }
 
+static Bspline_xform* 
+bspline_xform_load_binary (const char* filename)
+{
+    FILE *fp = fopen (filename, "rb");
+    if (!fp) {
+        return 0;
+    }
+
+    unsigned char hdr[BXF_BINARY_HEADER_SIZE];
+    if (fread (hdr, 1, BXF_BINARY_HEADER_SIZE, fp) 
+        != BXF_BINARY_HEADER_SIZE)
+    {
+        logfile_printf ("Error reading bxf header: %s\n", filename);
+        fclose (fp);
+        return 0;
+    }
+
+    plm_long version, header_size, num_coeff;
+    bxf_header_get_uint32 (&version, hdr, BXF_OFS_VERSION, 1);
+    bxf_header_get_uint32 (&header_size, hdr, BXF_OFS_HEADER_SIZE, 1);
+    if (version > BXF_BINARY_VERSION 
+        || header_size < BXF_BINARY_HEADER_SIZE)
+    {
+        logfile_printf ("Error, unsupported bxf version %d: %s\n", 
+            (int) version, filename);
+        fclose (fp);
+        return 0;
+    }
+
+    float img_origin[3], img_spacing[3], dc[9];
+    plm_long img_dim[3], roi_offset[3], roi_dim[3], vox_per_rgn[3];
+    bxf_header_get_float (img_origin, hdr, BXF_OFS_IMG_ORIGIN, 3);
+    bxf_header_get_float (img_spacing, hdr, BXF_OFS_IMG_SPACING, 3);
+    bxf_header_get_uint32 (img_dim, hdr, BXF_OFS_IMG_DIM, 3);
+    bxf_header_get_uint32 (roi_offset, hdr, BXF_OFS_ROI_OFFSET, 3);
+    bxf_header_get_uint32 (roi_dim, hdr, BXF_OFS_ROI_DIM, 3);
+    bxf_header_get_uint32 (vox_per_rgn, hdr, BXF_OFS_VOX_PER_RGN, 3);
+    bxf_header_get_float (dc, hdr, BXF_OFS_DIRECTION_COSINES, 9);
+    bxf_header_get_uint32 (&num_coeff, hdr, BXF_OFS_NUM_COEFF, 1);
+
+    /* Allocate memory and build LUTs */
+    Bspline_xform* bxf = new Bspline_xform;
+    bxf->initialize (img_origin, img_spacing, img_dim,
+        roi_offset, roi_dim, vox_per_rgn, dc);
+    if (bxf->num_coeff < 1 || bxf->num_coeff != num_coeff) {
+        logfile_printf ("Error loading bxf file, wrong number of "
+            "coefficients: %s\n", filename);
+        delete bxf;
+        fclose (fp);
+        return 0;
+    }
+
+    /* Coefficients are stored in the same order as in memory, 
+       so they are read with a single call */
+    if (fseek (fp, (long) header_size, SEEK_SET) != 0
+        || fread (bxf->coeff, sizeof(float), bxf->num_coeff, fp) 
+        != (size_t) bxf->num_coeff)
+    {
+        logfile_printf ("Error reading bxf coefficients: %s\n", filename);
+        delete bxf;
+        fclose (fp);
+        return 0;
+    }
+    endian4_little_to_native (bxf->coeff, bxf->num_coeff);
+
+    fclose (fp);
+    return bxf;
+}
+
+/* Read the first line of a file, up to len-1 characters */
+static bool
+bxf_read_first_line (char *buf, int len, const char* filename)
+{
+    FILE *fp = fopen (filename, "rb");
+    if (!fp) {
+        return false;
+    }
+    bool rc = fgets (buf, len, fp) != 0;
+    fclose (fp);
+    return rc;
+}
+
+bool
+bspline_xform_probe (const char* filename)
+{
+    char buf[64];
+    if (!bxf_read_first_line (buf, sizeof(buf), filename)) {
+        return false;
+    }
+    return string_starts_with (buf, "MGH_GPUIT_BSP")
+        || string_starts_with (buf, BSPLINE_XFORM_BINARY_MAGIC);
+}
+
+bool
+bspline_xform_is_binary (const char* filename)
+{
+    char buf[64];
+    if (!bxf_read_first_line (buf, sizeof(buf), filename)) {
+        return false;
+    }
+    return string_starts_with (buf, BSPLINE_XFORM_BINARY_MAGIC);
+}
+
 Bspline_xform* 
 bspline_xform_load (const char* filename)
 {
@@ -189,6 +389,10 @@ bspline_xform_load (const char* filename)
     /* Check magic number */
     std::string line;
     getline (ifs, line);
+    if (string_starts_with (line + "\n", BSPLINE_XFORM_BINARY_MAGIC)) {
+        ifs.close ();
+        return bspline_xform_load_binary (filename);
+    }
     if (!string_starts_with (line, "MGH_GPUIT_BSP")) {
         return 0;
     }
@@ -73,7 +73,15 @@ public:
         plm_long vox_per_rgn[3],      /* Knot spacing (in vox) */
         float direction_cosines[9]    /* Direction cosines */
     );
+    /*! \brief Save the coefficients.  Files with extension ".bxf" 
+      are written in binary format, others in text format. */
     void save (const char* filename);
+    /*! \brief Save in MGH_GPUIT_BSP text format */
+    void save_text (const char* filename);
+    /*! \brief Save in binary format.  The header is followed by 
+      the coefficients, stored as interleaved little-endian floats 
+      in the same order as the coeff array. */
+    void save_binary (const char* filename);
     void fill_coefficients (float val);
     /*! \brief This function jitters the coefficients if they are all zero. 
      *  It is used to prevent local minima artifact when optimizing an MI cost 
@@ -84,7 +92,18 @@ public:
     void log_header ();
 };
 
+/* Magic number of the binary format, including its trailing newline */
+#define BSPLINE_XFORM_BINARY_MAGIC "PLM_BXF_BINARY\n"
+
+/*! \brief Load a B-spline transform in either text or binary format. 
+  Returns null if the file cannot be read. */
 PLMBASE_C_API Bspline_xform* bspline_xform_load (const char* filename);
+/*! \brief Return true if the file is a B-spline transform, 
+  in either text or binary format */
+PLMBASE_API bool bspline_xform_probe (const char* filename);
+/*! \brief Return true if the file is a B-spline transform 
+  in binary format */
+PLMBASE_API bool bspline_xform_is_binary (const char* filename);
 
 /* Debugging routines */
 PLMBASE_C_API void bspline_xform_dump_coeff (Bspline_xform* bxf, const char* fn);
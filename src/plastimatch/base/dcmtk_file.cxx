@@ -13,6 +13,12 @@
 #include "print_and_exit.h"
 #include "string_util.h"
 
+/* Elements longer than this are not read by load_header(). 
+   DCMTK leaves their value in the file, and reads it the first time 
+   it is accessed.  In particular, PixelData is only read for the 
+   series which are actually loaded. */
+#define DCMTK_FILE_MAX_READ_LENGTH 4096
+
 class Dcmtk_file_private {
 public:
     std::string m_fn;
@@ -20,6 +26,9 @@ public:
     Volume_header m_vh;
     float m_zpos;
     bool m_valid;
+    bool m_loaded;
+    std::string m_series_uid;
+    std::string m_modality;
     
 public:
     Dcmtk_file_private () {
@@ -27,10 +36,26 @@ public:
         m_fn = "";
         m_zpos = 0.f;
         m_valid = false;
+        m_loaded = false;
     }
     ~Dcmtk_file_private () {
         delete m_dfile;
     }
+public:
+    /* Headers restored from the scan cache are not parsed until 
+       the dataset is first needed */
+    DcmDataset* get_dataset () {
+        if (!m_loaded) {
+            m_loaded = true;
+            OFCondition cond = m_dfile->loadFile (m_fn.c_str(), 
+                EXS_Unknown, EGL_noChange, DCMTK_FILE_MAX_READ_LENGTH);
+            if (cond.bad()) {
+                logfile_printf ("Warning, failed to load dicom file %s\n",
+                    m_fn.c_str());
+            }
+        }
+        return m_dfile->getDataset();
+    }
 };
 
 Dcmtk_file::Dcmtk_file () {
@@ -52,6 +77,24 @@ Dcmtk_file::is_valid () const
     return d_ptr->m_valid;
 }
 
+const std::string&
+Dcmtk_file::get_filename () const
+{
+    return d_ptr->m_fn;
+}
+
+const std::string&
+Dcmtk_file::get_series_uid () const
+{
+    return d_ptr->m_series_uid;
+}
+
+const std::string&
+Dcmtk_file::get_modality () const
+{
+    return d_ptr->m_modality;
+}
+
 void
 Dcmtk_file::debug () const
 {
@@ -62,7 +105,7 @@ Dcmtk_file::debug () const
 DcmDataset*
 Dcmtk_file::get_dataset (void) const
 {
-    return d_ptr->m_dfile->getDataset();
+    return d_ptr->get_dataset();
 }
 
 /* Look up DICOM value from tag */
@@ -70,7 +113,7 @@ const char*
 Dcmtk_file::get_cstr (const DcmTagKey& tag_key) const
 {
     const char *c = 0;
-    DcmDataset *dset = d_ptr->m_dfile->getDataset();
+    DcmDataset *dset = d_ptr->get_dataset();
     if (dset->findAndGetString(tag_key, c).good() && c) {
 	return c;
     }
@@ -80,21 +123,21 @@ Dcmtk_file::get_cstr (const DcmTagKey& tag_key) const
 bool
 Dcmtk_file::get_uint8 (const DcmTagKey& tag_key, uint8_t* val) const
 {
-    return d_ptr->m_dfile->getDataset()->findAndGetUint8 (
+    return d_ptr->get_dataset()->findAndGetUint8 (
         tag_key, (*val)).good();
 }
 
 bool
 Dcmtk_file::get_uint16 (const DcmTagKey& tag_key, uint16_t* val) const
 {
-    return d_ptr->m_dfile->getDataset()->findAndGetUint16 (
+    return d_ptr->get_dataset()->findAndGetUint16 (
         tag_key, (*val)).good();
 }
 
 bool
 Dcmtk_file::get_float (const DcmTagKey& tag_key, float* val) const
 {
-    return d_ptr->m_dfile->getDataset()->findAndGetFloat32 (
+    return d_ptr->get_dataset()->findAndGetFloat32 (
         tag_key, (*val)).good();
 }
 
@@ -115,7 +158,7 @@ Dcmtk_file::get_uint8_array (const DcmTagKey& tag_key,
     const uint8_t** val, unsigned long* count) const
 {
     const Uint8* foo;
-    OFCondition rc = d_ptr->m_dfile->getDataset()->findAndGetUint8Array (
+    OFCondition rc = d_ptr->get_dataset()->findAndGetUint8Array (
 	tag_key, foo, count, OFFalse);
     if (val) {
         *val = foo;
@@ -128,7 +171,7 @@ Dcmtk_file::get_int16_array (const DcmTagKey& tag_key,
     const int16_t** val, unsigned long* count) const
 {
     const Sint16* foo;
-    OFCondition rc = d_ptr->m_dfile->getDataset()->findAndGetSint16Array (
+    OFCondition rc = d_ptr->get_dataset()->findAndGetSint16Array (
 	tag_key, foo, count, OFFalse);
     *val = foo;
     return rc.good();
@@ -139,7 +182,7 @@ Dcmtk_file::get_uint16_array (const DcmTagKey& tag_key,
     const uint16_t** val, unsigned long* count) const
 {
     const Uint16* foo;
-    OFCondition rc = d_ptr->m_dfile->getDataset()->findAndGetUint16Array (
+    OFCondition rc = d_ptr->get_dataset()->findAndGetUint16Array (
 	tag_key, foo, count, OFFalse);
     if (val) {
         *val = foo;
@@ -150,17 +193,24 @@ Dcmtk_file::get_uint16_array (const DcmTagKey& tag_key,
 bool
 Dcmtk_file::get_element (const DcmTagKey& tag_key, DcmElement* val) const
 {
-    return d_ptr->m_dfile->getDataset()->findAndGetElement(tag_key, val).good();
+    return d_ptr->get_dataset()->findAndGetElement(tag_key, val).good();
 }
 
 bool
 Dcmtk_file::get_sequence (const DcmTagKey& tag_key, 
     DcmSequenceOfItems*& seq) const
 {
-    return d_ptr->m_dfile->getDataset()->findAndGetSequence (
+    return d_ptr->get_dataset()->findAndGetSequence (
         tag_key, seq).good();
 }
 
+/* Test for presence of a tag without reading its value */
+bool
+Dcmtk_file::has_tag (const DcmTagKey& tag_key) const
+{
+    return d_ptr->get_dataset()->tagExists (tag_key);
+}
+
 const Volume_header*
 Dcmtk_file::get_volume_header () const
 {
@@ -188,21 +238,29 @@ Dcmtk_file::load_header (const char *fn) {
     d_ptr->m_fn = fn;
 
     /* Open the file */
-    OFCondition cond = d_ptr->m_dfile->loadFile (fn, EXS_Unknown, EGL_noChange);
+    d_ptr->m_loaded = true;
+    OFCondition cond = d_ptr->m_dfile->loadFile (fn, EXS_Unknown, 
+        EGL_noChange, DCMTK_FILE_MAX_READ_LENGTH);
     if (cond.bad()) {
         /* If it's not a dicom file, loadFile() fails. */
         return;
     }
 
     /* Load image header */
-    DcmDataset *dset = d_ptr->m_dfile->getDataset();    
+    DcmDataset *dset = d_ptr->get_dataset();    
     OFCondition ofrc;
     const char *c;
     uint16_t rows;
     uint16_t cols;
 
+    /* SeriesInstanceUID, Modality */
+    c = this->get_cstr (DCM_SeriesInstanceUID);
+    d_ptr->m_series_uid = c ? c : "";
+    c = this->get_cstr (DCM_Modality);
+    d_ptr->m_modality = c ? c : "";
+
     /* ImagePositionPatient */
-    float origin[3];
+    float origin[3] = { 0.f, 0.f, 0.f };
     ofrc = dset->findAndGetString (DCM_ImagePositionPatient, c);
     if (ofrc.good() && c) {
 	int rc = parse_dicom_float3 (origin, c);
@@ -225,7 +283,8 @@ Dcmtk_file::load_header (const char *fn) {
     }
 
     /* ImageOrientationPatient */
-    float direction_cosines[9];
+    float direction_cosines[9] = {
+        1.f, 0.f, 0.f, 0.f, 1.f, 0.f, 0.f, 0.f, 1.f };
     ofrc = dset->findAndGetString (DCM_ImageOrientationPatient, c);
     if (ofrc.good() && c) {
 	int rc = parse_dicom_float6 (direction_cosines, c);
@@ -263,6 +322,24 @@ Dcmtk_file::load_header (const char *fn) {
     d_ptr->m_valid = true;
 }
 
+void
+Dcmtk_file::restore_header (
+    const char *fn,
+    bool valid,
+    const std::string& series_uid,
+    const std::string& modality,
+    const Volume_header& vh,
+    float zpos)
+{
+    d_ptr->m_fn = fn;
+    d_ptr->m_valid = valid;
+    d_ptr->m_loaded = false;
+    d_ptr->m_series_uid = series_uid;
+    d_ptr->m_modality = modality;
+    d_ptr->m_vh.clone (&vh);
+    d_ptr->m_zpos = zpos;
+}
+
 bool
 dcmtk_file_compare_z_position (const Dcmtk_file* f1, const Dcmtk_file* f2)
 {
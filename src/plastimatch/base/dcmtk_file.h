@@ -5,6 +5,7 @@
 #define _dcmtk_file_h_
 
 #include "plmbase_config.h"
+#include <string>
 #include "plm_int.h"
 #include "smart_pointer.h"
 #include "volume_header.h"
@@ -28,6 +29,11 @@ public:
 
 public:
     bool is_valid () const;
+    const std::string& get_filename () const;
+    /*! \brief Return the SeriesInstanceUID, or an empty string 
+      if the file does not have one */
+    const std::string& get_series_uid () const;
+    const std::string& get_modality () const;
     void debug () const;
     DcmDataset* get_dataset (void) const;
     const char* get_cstr (const DcmTagKey& tag_key) const;
@@ -48,11 +54,18 @@ public:
     bool get_element (const DcmTagKey& tag_key, DcmElement* val) const;
     bool get_sequence (const DcmTagKey& tag_key, 
         DcmSequenceOfItems*& seq) const;
+    bool has_tag (const DcmTagKey& tag_key) const;
     const Volume_header* get_volume_header () const;
     const Direction_cosines& get_direction_cosines () const;
     float get_z_position () const;
 
     void load_header (const char *fn);
+    /*! \brief Initialize from header fields saved by a previous 
+      load_header(), without reading the file.  The dataset is 
+      read the first time it is accessed. */
+    void restore_header (const char *fn, bool valid,
+        const std::string& series_uid, const std::string& modality,
+        const Volume_header& vh, float zpos);
 };
 
 
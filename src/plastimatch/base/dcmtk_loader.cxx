@@ -60,65 +60,13 @@ Dcmtk_loader::set_rt_study_metadata (Rt_study_metadata::Pointer drs)
 void
 Dcmtk_loader::insert_file (const char* fn)
 {
-    Dcmtk_file::Pointer df = Dcmtk_file::New (fn);
-
-    /* Discard non-dicom files */
-    if (!df->is_valid()) {
-        return;
-    }
-
-    /* Get the SeriesInstanceUID */
-    const char *c = NULL;
-    std::string series_uid;
-    c = df->get_cstr (DCM_SeriesInstanceUID);
-    if (c) {
-        series_uid = std::string (c);
-    } else {
-	/* 2014-12-17.  Oncentra data missing SeriesInstanceUID? 
-           If that happens, make something up. */
-        series_uid = dicom_uid ();
-    }
-
-    /* Look for the SeriesInstanceUID in the map */
-    Dcmtk_series_map::iterator it;
-    it = d_ptr->m_smap.find (series_uid);
-
-    /* If we didn't find the UID, add a new entry into the map */
-    if (it == d_ptr->m_smap.end()) {
-	std::pair<Dcmtk_series_map::iterator,bool> ret 
-	    = d_ptr->m_smap.insert (Dcmtk_series_map_pair (series_uid, 
-		    new Dcmtk_series()));
-	if (ret.second == false) {
-	    print_and_exit (
-		"Error inserting UID %s into dcmtk_series_map.\n", c);
-	}
-	it = ret.first;
-    }
-
-    /* Add the file to the Dcmtk_series object for this UID */
-    Dcmtk_series *ds = (*it).second;
-    ds->insert (df);
+    dcmtk_series_map_insert_file (d_ptr->m_smap, fn);
 }
 
 void
 Dcmtk_loader::insert_directory (const char* dir)
 {
-    OFBool recurse = OFFalse;
-    OFList<OFString> input_files;
-
-    /* On windows, searchDirectoryRecursively doesn't work 
-       if the path is like c:/dir/dir; instead it must be c:\dir\dir */
-    std::string fixed_path = make_windows_slashes (std::string(dir));
-
-    OFStandard::searchDirectoryRecursively (
-	fixed_path.c_str(), input_files, "", "", recurse);
-
-    OFListIterator(OFString) if_iter = input_files.begin();
-    OFListIterator(OFString) if_last = input_files.end();
-    while (if_iter != if_last) {
-	const char *current = (*if_iter++).c_str();
-	this->insert_file (current);
-    }
+    dcmtk_series_map_insert_directory (d_ptr->m_smap, dir);
 }
 
 void
@@ -213,8 +161,9 @@ Dcmtk_loader::parse_directory (void)
 
 	/* Check for image.  An image is anything with a PixelData.
            Current heuristic: load the image with the most slices
-           (as determined by the number of files) */
-	bool rc = ds->get_uint16_array (DCM_PixelData, 0, 0);
+           (as determined by the number of files).  Only test for 
+           presence, so that pixels are not read for unused series. */
+	bool rc = ds->has_tag (DCM_PixelData);
         if (rc) {
             size_t num_slices = ds->get_number_of_files ();
             if (num_slices > best_image_slices) {
@@ -8,6 +8,7 @@
 #include <map>
 #include <string>
 #include "dcmtk_series.h"
+#include "dcmtk_series_map.h"
 #include "plm_image.h"
 #include "rt_study_metadata.h"
 #include "rtss.h"
@@ -15,10 +16,6 @@
 
 class Dcmtk_rt_study;
 
-/* Map from SeriesInstanceUID to Dcmtk_series */
-typedef std::map<std::string, Dcmtk_series*> Dcmtk_series_map;
-typedef std::pair<std::string, Dcmtk_series*> Dcmtk_series_map_pair;
-
 class Dcmtk_loader_private {
 public:
 	Rt_study_metadata::Pointer rt_meta; // m_drs;
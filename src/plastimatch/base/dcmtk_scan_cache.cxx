@@ -0,0 +1,322 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmbase_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#if SQLITE_FOUND
+#include "sqlite3.h"
+#endif
+
+#include "dcmtk_file.h"
+#include "dcmtk_scan_cache.h"
+#include "file_util.h"
+#include "logfile.h"
+#include "path_util.h"
+#include "volume_header.h"
+
+/* Increment this when the table layout or the meaning of
+   any field changes.  Old tables are then discarded. */
+#define DCMTK_SCAN_CACHE_VERSION 1
+
+class Dcmtk_scan_cache_private {
+public:
+#if SQLITE_FOUND
+    sqlite3 *db;
+    sqlite3_stmt *select_stmt;
+    sqlite3_stmt *insert_stmt;
+#endif
+    std::string cwd;
+public:
+    Dcmtk_scan_cache_private () {
+#if SQLITE_FOUND
+        db = 0;
+        select_stmt = 0;
+        insert_stmt = 0;
+#endif
+    }
+    ~Dcmtk_scan_cache_private () {
+        this->close ();
+    }
+public:
+    void close () {
+#if SQLITE_FOUND
+        if (select_stmt) {
+            sqlite3_finalize (select_stmt);
+            select_stmt = 0;
+        }
+        if (insert_stmt) {
+            sqlite3_finalize (insert_stmt);
+            insert_stmt = 0;
+        }
+        if (db) {
+            sqlite3_close (db);
+            db = 0;
+        }
+#endif
+    }
+    /* Files are indexed by absolute path, so that the same
+       database can be used from different working directories */
+    std::string make_key (const std::string& fn) {
+        if (fn.empty() || fn[0] == '/' || fn[0] == '\\'
+            || (fn.size() > 1 && fn[1] == ':'))
+        {
+            return fn;
+        }
+        return compose_filename (cwd, fn);
+    }
+#if SQLITE_FOUND
+    bool exec (const char *sql) {
+        char *errmsg = 0;
+        int rc = sqlite3_exec (db, sql, 0, 0, &errmsg);
+        if (rc != SQLITE_OK) {
+            logfile_printf ("Dicom scan cache error: %s\n",
+                errmsg ? errmsg : sqlite3_errmsg (db));
+            sqlite3_free (errmsg);
+            return false;
+        }
+        return true;
+    }
+    bool create_tables ();
+#endif
+};
+
+#if SQLITE_FOUND
+bool
+Dcmtk_scan_cache_private::create_tables ()
+{
+    /* Discard tables written by a different version */
+    sqlite3_stmt *stmt;
+    int version = 0;
+    if (sqlite3_prepare_v2 (db, "PRAGMA user_version;", -1, &stmt, 0)
+        != SQLITE_OK)
+    {
+        return false;
+    }
+    if (sqlite3_step (stmt) == SQLITE_ROW) {
+        version = sqlite3_column_int (stmt, 0);
+    }
+    sqlite3_finalize (stmt);
+
+    if (version != DCMTK_SCAN_CACHE_VERSION) {
+        char sql[128];
+        sprintf (sql, "PRAGMA user_version = %d;", DCMTK_SCAN_CACHE_VERSION);
+        if (!exec ("DROP TABLE IF EXISTS dcmtk_scan_cache;")
+            || !exec (sql))
+        {
+            return false;
+        }
+    }
+
+    /* Arrays are stored as blobs of native floats */
+    return exec (
+        "CREATE TABLE IF NOT EXISTS dcmtk_scan_cache ( "
+        "  filename TEXT PRIMARY KEY, "
+        "  size INTEGER, "
+        "  mtime INTEGER, "
+        "  valid INTEGER, "
+        "  series_uid TEXT, "
+        "  modality TEXT, "
+        "  dim_x INTEGER, "
+        "  dim_y INTEGER, "
+        "  dim_z INTEGER, "
+        "  origin BLOB, "
+        "  spacing BLOB, "
+        "  direction_cosines BLOB, "
+        "  zpos REAL "
+        ");");
+}
+
+static bool
+get_float_blob (sqlite3_stmt *stmt, int col, float *val, int n)
+{
+    if (sqlite3_column_bytes (stmt, col) != (int) (n * sizeof(float))) {
+        return false;
+    }
+    memcpy (val, sqlite3_column_blob (stmt, col), n * sizeof(float));
+    return true;
+}
+
+static std::string
+get_text (sqlite3_stmt *stmt, int col)
+{
+    const unsigned char *c = sqlite3_column_text (stmt, col);
+    return c ? std::string ((const char*) c) : std::string ("");
+}
+#endif
+
+Dcmtk_scan_cache::Dcmtk_scan_cache ()
+{
+    d_ptr = new Dcmtk_scan_cache_private;
+}
+
+Dcmtk_scan_cache::~Dcmtk_scan_cache ()
+{
+    delete d_ptr;
+}
+
+bool
+Dcmtk_scan_cache::open_default ()
+{
+    const char *env = getenv ("PLM_DICOM_SCAN_CACHE");
+    if (!env || !env[0]) {
+        return false;
+    }
+    return this->open (env);
+}
+
+bool
+Dcmtk_scan_cache::open (const char *db_fn)
+{
+#if SQLITE_FOUND
+    d_ptr->close ();
+
+    char buf[4096];
+    d_ptr->cwd = plm_getcwd (buf, sizeof(buf)) ? buf : "";
+
+    make_parent_directories (db_fn);
+    if (sqlite3_open (db_fn, &d_ptr->db) != SQLITE_OK) {
+        logfile_printf ("Dicom scan cache error: can't open %s (%s)\n",
+            db_fn, sqlite3_errmsg (d_ptr->db));
+        d_ptr->close ();
+        return false;
+    }
+
+    /* Several processes may share the cache; wait for their
+       writes to finish instead of failing */
+    sqlite3_busy_timeout (d_ptr->db, 30000);
+
+    if (!d_ptr->create_tables ()
+        || sqlite3_prepare_v2 (d_ptr->db,
+            "SELECT size, mtime, valid, series_uid, modality, "
+            "dim_x, dim_y, dim_z, origin, spacing, direction_cosines, zpos "
+            "FROM dcmtk_scan_cache WHERE filename = ?;",
+            -1, &d_ptr->select_stmt, 0) != SQLITE_OK
+        || sqlite3_prepare_v2 (d_ptr->db,
+            "INSERT OR REPLACE INTO dcmtk_scan_cache VALUES "
+            "(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);",
+            -1, &d_ptr->insert_stmt, 0) != SQLITE_OK)
+    {
+        logfile_printf ("Dicom scan cache error: can't use %s (%s)\n",
+            db_fn, sqlite3_errmsg (d_ptr->db));
+        d_ptr->close ();
+        return false;
+    }
+    return true;
+#else
+    logfile_printf ("Dicom scan cache requires sqlite, ignoring %s\n",
+        db_fn);
+    return false;
+#endif
+}
+
+bool
+Dcmtk_scan_cache::is_open () const
+{
+#if SQLITE_FOUND
+    return d_ptr->db != 0;
+#else
+    return false;
+#endif
+}
+
+Dcmtk_file::Pointer
+Dcmtk_scan_cache::lookup (const std::string& fn)
+{
+    Dcmtk_file::Pointer df;
+#if SQLITE_FOUND
+    if (!d_ptr->db) {
+        return df;
+    }
+    std::string key = d_ptr->make_key (fn);
+    sqlite3_stmt *stmt = d_ptr->select_stmt;
+    sqlite3_reset (stmt);
+    sqlite3_bind_text (stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+    if (sqlite3_step (stmt) == SQLITE_ROW
+        /* Skip files which have changed since they were indexed */
+        && sqlite3_column_int64 (stmt, 0)
+        == (sqlite3_int64) file_size (fn.c_str())
+        && sqlite3_column_int64 (stmt, 1)
+        == (sqlite3_int64) file_modified_time (fn.c_str()))
+    {
+        plm_long dim[3];
+        float origin[3], spacing[3], dc[9];
+        dim[0] = (plm_long) sqlite3_column_int64 (stmt, 5);
+        dim[1] = (plm_long) sqlite3_column_int64 (stmt, 6);
+        dim[2] = (plm_long) sqlite3_column_int64 (stmt, 7);
+        if (get_float_blob (stmt, 8, origin, 3)
+            && get_float_blob (stmt, 9, spacing, 3)
+            && get_float_blob (stmt, 10, dc, 9))
+        {
+            Volume_header vh;
+            vh.set (dim, origin, spacing, dc);
+            df = Dcmtk_file::New ();
+            df->restore_header (fn.c_str(),
+                sqlite3_column_int (stmt, 2) != 0,
+                get_text (stmt, 3), get_text (stmt, 4), vh,
+                (float) sqlite3_column_double (stmt, 11));
+        }
+    }
+
+    /* Release the read lock */
+    sqlite3_reset (stmt);
+#endif
+    return df;
+}
+
+void
+Dcmtk_scan_cache::store (const std::vector<Dcmtk_file::Pointer>& df_list)
+{
+#if SQLITE_FOUND
+    if (!d_ptr->db || df_list.empty()) {
+        return;
+    }
+
+    /* One transaction for the whole list, otherwise sqlite
+       syncs the database file once per row */
+    if (!d_ptr->exec ("BEGIN IMMEDIATE;")) {
+        return;
+    }
+    sqlite3_stmt *stmt = d_ptr->insert_stmt;
+    for (size_t i = 0; i < df_list.size(); i++) {
+        const Dcmtk_file::Pointer& df = df_list[i];
+        const std::string& fn = df->get_filename ();
+        const Volume_header *vh = df->get_volume_header ();
+        const plm_long *dim = vh->get_dim ();
+        std::string key = d_ptr->make_key (fn);
+
+        sqlite3_reset (stmt);
+        sqlite3_bind_text (stmt, 1, key.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int64 (stmt, 2,
+            (sqlite3_int64) file_size (fn.c_str()));
+        sqlite3_bind_int64 (stmt, 3,
+            (sqlite3_int64) file_modified_time (fn.c_str()));
+        sqlite3_bind_int (stmt, 4, df->is_valid() ? 1 : 0);
+        sqlite3_bind_text (stmt, 5, df->get_series_uid().c_str(), -1,
+            SQLITE_TRANSIENT);
+        sqlite3_bind_text (stmt, 6, df->get_modality().c_str(), -1,
+            SQLITE_TRANSIENT);
+        sqlite3_bind_int64 (stmt, 7, (sqlite3_int64) dim[0]);
+        sqlite3_bind_int64 (stmt, 8, (sqlite3_int64) dim[1]);
+        sqlite3_bind_int64 (stmt, 9, (sqlite3_int64) dim[2]);
+        sqlite3_bind_blob (stmt, 10, vh->get_origin(),
+            3 * sizeof(float), SQLITE_TRANSIENT);
+        sqlite3_bind_blob (stmt, 11, vh->get_spacing(),
+            3 * sizeof(float), SQLITE_TRANSIENT);
+        sqlite3_bind_blob (stmt, 12,
+            vh->get_direction_cosines().get_matrix(),
+            9 * sizeof(float), SQLITE_TRANSIENT);
+        sqlite3_bind_double (stmt, 13, df->get_z_position ());
+        if (sqlite3_step (stmt) != SQLITE_DONE) {
+            logfile_printf ("Dicom scan cache error: %s\n",
+                sqlite3_errmsg (d_ptr->db));
+            break;
+        }
+    }
+    sqlite3_reset (stmt);
+    d_ptr->exec ("COMMIT;");
+#endif
+}
@@ -0,0 +1,47 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _dcmtk_scan_cache_h_
+#define _dcmtk_scan_cache_h_
+
+#include "plmbase_config.h"
+#include <string>
+#include <vector>
+#include "dcmtk_file.h"
+
+class Dcmtk_scan_cache_private;
+
+/*! \brief
+ * The Dcmtk_scan_cache class is an on-disk index of dicom file headers,
+ * stored in an sqlite database.  For each file, it records the
+ * file size and modification time, together with the header fields
+ * needed to sort files into series.  When a directory is scanned
+ * again, files which have not changed are restored from the index
+ * instead of being parsed.  The index is enabled by setting the
+ * environment variable PLM_DICOM_SCAN_CACHE to the name of the
+ * database file.
+ */
+class PLMBASE_API Dcmtk_scan_cache {
+public:
+    Dcmtk_scan_cache_private *d_ptr;
+public:
+    Dcmtk_scan_cache ();
+    ~Dcmtk_scan_cache ();
+public:
+    /*! \brief Open the database named by PLM_DICOM_SCAN_CACHE.
+      Returns false if the variable is not set, or if the database
+      could not be opened. */
+    bool open_default ();
+    /*! \brief Open or create the database file.  Returns false
+      if the database could not be opened. */
+    bool open (const char *db_fn);
+    bool is_open () const;
+    /*! \brief Return the cached header of the file, or a null
+      pointer if the file is not in the cache or has changed.
+      The returned Dcmtk_file reads its dataset on first access. */
+    Dcmtk_file::Pointer lookup (const std::string& fn);
+    /*! \brief Save the headers of newly parsed files */
+    void store (const std::vector<Dcmtk_file::Pointer>& df_list);
+};
+
+#endif
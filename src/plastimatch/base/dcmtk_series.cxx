@@ -88,10 +88,16 @@ Dcmtk_series::get_uint16_array (const DcmTagKey& tag_key,
     return d_ptr->m_flist.front()->get_uint16_array (tag_key, val, count);
 }
 
+bool
+Dcmtk_series::has_tag (const DcmTagKey& tag_key) const
+{
+    return d_ptr->m_flist.front()->has_tag (tag_key);
+}
+
 std::string 
 Dcmtk_series::get_modality (void) const
 {
-    return get_string (DCM_Modality);
+    return d_ptr->m_flist.front()->get_modality ();
 }
 
 std::string 
@@ -41,6 +41,7 @@ public:
     bool get_uint16 (const DcmTagKey& tag_key, uint16_t* val) const;
     bool get_uint16_array (const DcmTagKey& tag_key, 
         const uint16_t** val, unsigned long* count) const;
+    bool has_tag (const DcmTagKey& tag_key) const;
 
     std::string get_modality (void) const;
     std::string get_referenced_uid (void) const;
@@ -0,0 +1,129 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmbase_config.h"
+#include <string>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
+#include "dcmtk_config.h"
+#include "dcmtk/ofstd/ofstd.h"
+#include "dcmtk/dcmdata/dctk.h"
+
+#include "dcmtk_file.h"
+#include "dcmtk_scan_cache.h"
+#include "dcmtk_series.h"
+#include "dcmtk_series_map.h"
+#include "dicom_util.h"
+#include "logfile.h"
+#include "path_util.h"
+#include "print_and_exit.h"
+
+static void
+dcmtk_series_map_insert (Dcmtk_series_map& smap, Dcmtk_file::Pointer& df)
+{
+    /* Discard non-dicom files */
+    if (!df->is_valid()) {
+        return;
+    }
+
+    /* Get the SeriesInstanceUID */
+    std::string series_uid = df->get_series_uid ();
+    if (series_uid == "") {
+	/* 2014-12-17.  Oncentra data missing SeriesInstanceUID? 
+           If that happens, make something up. */
+        series_uid = dicom_uid ();
+    }
+
+    /* Look for the SeriesInstanceUID in the map */
+    Dcmtk_series_map::iterator it;
+    it = smap.find (series_uid);
+
+    /* If we didn't find the UID, add a new entry into the map */
+    if (it == smap.end()) {
+	std::pair<Dcmtk_series_map::iterator,bool> ret 
+	    = smap.insert (Dcmtk_series_map_pair (series_uid, 
+		    new Dcmtk_series()));
+	if (ret.second == false) {
+	    print_and_exit (
+		"Error inserting UID %s into dcmtk_series_map.\n", 
+                series_uid.c_str());
+	}
+	it = ret.first;
+    }
+
+    /* Add the file to the Dcmtk_series object for this UID */
+    Dcmtk_series *ds = (*it).second;
+    ds->insert (df);
+}
+
+void
+dcmtk_series_map_insert_file (Dcmtk_series_map& smap, const char *fn)
+{
+    Dcmtk_file::Pointer df = Dcmtk_file::New (fn);
+    dcmtk_series_map_insert (smap, df);
+}
+
+void
+dcmtk_series_map_insert_directory (Dcmtk_series_map& smap, const char *dir)
+{
+    OFBool recurse = OFFalse;
+    OFList<OFString> input_files;
+
+    /* On windows, searchDirectoryRecursively doesn't work 
+       if the path is like c:/dir/dir; instead it must be c:\dir\dir */
+    std::string fixed_path = make_windows_slashes (std::string(dir));
+
+    OFStandard::searchDirectoryRecursively (
+	fixed_path.c_str(), input_files, "", "", recurse);
+
+    std::vector<std::string> fn_list;
+    OFListIterator(OFString) if_iter = input_files.begin();
+    OFListIterator(OFString) if_last = input_files.end();
+    while (if_iter != if_last) {
+        fn_list.push_back (std::string ((*if_iter++).c_str()));
+    }
+
+    /* Restore unchanged files from the scan cache, if enabled */
+    long num_files = (long) fn_list.size();
+    std::vector<Dcmtk_file::Pointer> df_list (num_files);
+    std::vector<long> parse_list;
+    Dcmtk_scan_cache cache;
+    cache.open_default ();
+    for (long i = 0; i < num_files; i++) {
+        if (cache.is_open()) {
+            df_list[i] = cache.lookup (fn_list[i]);
+        }
+        if (!df_list[i]) {
+            parse_list.push_back (i);
+        }
+    }
+
+    /* Reading the headers is dominated by file access and parsing, 
+       and each file is independent.  Files vary in size (images 
+       vs. structure sets), so they are handed out dynamically. */
+    long num_parse = (long) parse_list.size();
+#pragma omp parallel for schedule (dynamic)
+    for (long j = 0; j < num_parse; j++) {
+        long i = parse_list[j];
+        df_list[i] = Dcmtk_file::New (fn_list[i].c_str());
+    }
+
+    if (cache.is_open()) {
+        if (num_parse > 0) {
+            std::vector<Dcmtk_file::Pointer> parsed (num_parse);
+            for (long j = 0; j < num_parse; j++) {
+                parsed[j] = df_list[parse_list[j]];
+            }
+            cache.store (parsed);
+        }
+        logfile_printf ("Dicom scan cache: %ld of %ld files parsed\n",
+            num_parse, num_files);
+    }
+
+    /* Merge in directory order */
+    for (long i = 0; i < num_files; i++) {
+        dcmtk_series_map_insert (smap, df_list[i]);
+    }
+}
@@ -4,7 +4,9 @@
 #ifndef _dcmtk_series_map_h_
 #define _dcmtk_series_map_h_
 
+#include "plmbase_config.h"
 #include <map>
+#include <string>
 
 class Dcmtk_series;
 
@@ -12,4 +14,17 @@ class Dcmtk_series;
 typedef std::map<std::string, Dcmtk_series*> Dcmtk_series_map;
 typedef std::pair<std::string, Dcmtk_series*> Dcmtk_series_map_pair;
 
+/*! \brief Read the header of a single file, and add it to the 
+  series map.  Non-dicom files are ignored. */
+PLMBASE_API void dcmtk_series_map_insert_file (
+    Dcmtk_series_map& smap, const char *fn);
+/*! \brief Read the headers of all files in a directory, and add them 
+  to the series map.  The headers are read in parallel, but they 
+  are inserted in directory order, so the result does not depend 
+  on the number of threads.  Pixel data is not read.  If the 
+  environment variable PLM_DICOM_SCAN_CACHE is set, unchanged files 
+  are restored from the scan cache instead of being read. */
+PLMBASE_API void dcmtk_series_map_insert_directory (
+    Dcmtk_series_map& smap, const char *dir);
+
 #endif
@@ -263,10 +263,10 @@ hnd_load (Proj_image *proj, const char *fn, const double xy_offset[2])
     }
 
     /* Convert hnd to proj_image */
-    proj->dim[0] = hnd.SizeX;
-    proj->dim[1] = hnd.SizeY;
-    proj->img = (float*) malloc (
-        hnd.SizeX * hnd.SizeY * sizeof(float));
+    int dim[2];
+    dim[0] = hnd.SizeX;
+    dim[1] = hnd.SizeY;
+    proj_image_create_img (proj, dim);
     if (!proj->img) {
         print_and_exit ("Error allocating memory\n");
     }
@@ -295,6 +295,7 @@ hnd_load (Proj_image *proj, const char *fn, const double xy_offset[2])
  read_error:
 
     fprintf (stderr, "Error reading hnd file\n");
+    proj->clear ();
     free (pt_lut);
     free (buf);
     fclose (fp);
@@ -5,183 +5,184 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string>
 #if (defined(_WIN32) || defined(WIN32))
 #include <io.h>        // windows //
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #include "file_util.h"
+#include "logfile.h"
 #include "mha_io.h"
+#include "path_util.h"
 #include "plm_endian.h"
 #include "plm_fwrite.h"
 #include "print_and_exit.h"
 #include "string_util.h"
 #include "volume.h"
+#include "volume_header.h"
 
 #define LINELEN 512
 
+/* Voxel data is read and written in blocks of this many bytes,
+   so that byte swapping and interleaving are done while the block
+   is still in cache */
+#define MHA_IO_BLOCK (4*1024*1024)
+
 /* -----------------------------------------------------------------------
    Private functions
    ----------------------------------------------------------------------- */
-static void 
-write_mha_internal (
-    const char* filename,    /* Input: filename to write to */
-    const Volume* vol        /* Input: volume to write */
-)
-{
-    FILE* fp;
-    char* mha_header = 
-	"ObjectType = Image\n"
-	"NDims = 3\n"
-	"BinaryData = True\n"
-	"BinaryDataByteOrderMSB = False\n"
-	"TransformMatrix = %g %g %g %g %g %g %g %g %g\n"
-	"Offset = %g %g %g\n"
-	"CenterOfRotation = 0 0 0\n"
-	"ElementSpacing = %g %g %g\n"
-	"DimSize = %d %d %d\n"
-	"AnatomicalOrientation = RAI\n"
-	"%s"
-	"ElementType = %s\n"
-	"ElementDataFile = LOCAL\n";
-    char* element_type;
-
-    if (vol->pix_type == PT_VF_FLOAT_PLANAR) {
-	fprintf (stderr, "Error, PT_VF_FLOAT_PLANAR not implemented\n");
-	exit (-1);
+class Mha_header {
+public:
+    plm_long dim[3];
+    float origin[3];
+    float spacing[3];
+    float dc[9];
+    bool have_direction_cosines;
+    enum Volume_pixel_type pix_type;
+    int pix_size;
+    bool big_endian_input;
+    std::string data_fn;         /* File which holds the voxel data */
+    int64_t data_offset;         /* Offset of voxel data within data_fn */
+public:
+    Mha_header () {
+        for (int d = 0; d < 3; d++) {
+            dim[d] = 0;
+            origin[d] = 0.f;
+            spacing[d] = 1.f;
+        }
+        have_direction_cosines = false;
+        pix_type = PT_UNDEFINED;
+        pix_size = -1;
+        big_endian_input = false;
+        data_offset = 0;
     }
-    fp = plm_fopen (filename,"wb");
-    if (!fp) {
-	fprintf (stderr, "Can't open file %s for write\n", filename);
-	return;
+public:
+    bool read (const char* filename);
+    plm_long get_npix () const {
+        return dim[0] * dim[1] * dim[2];
     }
-    switch (vol->pix_type) {
-    case PT_UCHAR:
-	element_type = "MET_UCHAR";
-	break;
-    case PT_SHORT:
-	element_type = "MET_SHORT";
-	break;
-    case PT_UINT32:
-	element_type = "MET_UINT";
-	break;
-    case PT_FLOAT:
-	element_type = "MET_FLOAT";
-	break;
-    case PT_VF_FLOAT_INTERLEAVED:
-	element_type = "MET_FLOAT";
-	break;
-    case PT_VF_FLOAT_PLANAR:
-    default:
-	fprintf (stderr, "Unhandled type in write_mha().\n");
-	exit (-1);
+    /* Size of the elements which are byte swapped */
+    int get_element_size () const {
+        if (pix_type == PT_VF_FLOAT_INTERLEAVED) {
+            return sizeof(float);
+        }
+        return pix_size;
     }
-    fprintf (fp, mha_header, 
-	vol->direction_cosines[0], 
-        vol->direction_cosines[3], 
-	vol->direction_cosines[6], 
-        vol->direction_cosines[1], 
-	vol->direction_cosines[4], 
-        vol->direction_cosines[7], 
-	vol->direction_cosines[2], 
-        vol->direction_cosines[5], 
-	vol->direction_cosines[8], 
-	vol->origin[0], vol->origin[1], vol->origin[2], 
-	vol->spacing[0], vol->spacing[1], vol->spacing[2], 
-	vol->dim[0], vol->dim[1], vol->dim[2],
-	(vol->pix_type == PT_VF_FLOAT_INTERLEAVED) 
-	? "ElementNumberOfChannels = 3\n" : "",
-	element_type);
-    fflush (fp);
+    /* Return a volume with the file geometry, but without image data */
+    Volume* create_volume () const;
+};
 
-    if (vol->pix_type == PT_VF_FLOAT_INTERLEAVED) {
-	plm_fwrite (vol->img, sizeof(float), 3 * vol->npix, fp, true);
-    } else {
-	plm_fwrite (vol->img, vol->pix_size, vol->npix, fp, true);
+/* Returns the size of the file in bytes, or -1 if it can't be opened */
+static int64_t
+mha_file_size (const char* filename)
+{
+    FILE *fp = fopen (filename, "rb");
+    if (!fp) {
+        return -1;
     }
-
+#if _MSC_VER
+    _fseeki64 (fp, 0, SEEK_END);
+    int64_t file_size = _ftelli64 (fp);
+#else
+    fseeko (fp, 0, SEEK_END);
+    int64_t file_size = (int64_t) ftello (fp);
+#endif
     fclose (fp);
+    return file_size;
 }
 
-static Volume* 
-read_mha_internal (
-    const char* filename     /* Input: filename to read from */
-)
+/* Parse the header.  Returns false if the file could not be opened. */
+bool
+Mha_header::read (const char* filename)
 {
-    size_t rc;
     char linebuf[LINELEN];
-    Volume* vol;
     int tmp;
-    FILE* fp;
-    bool have_direction_cosines = false;
-    bool big_endian_input = false;
     unsigned int a, b, c;
-    float dc[9];
+    long header_size = 0;
+    bool local_data = false;
 
-    fp = fopen (filename,"rb");
+    FILE *fp = fopen (filename,"rb");
     if (!fp) {
 	fprintf (stderr, "File %s not found\n", filename);
-	return 0;
+	return false;
     }
-   
-    fprintf(stdout, "reading %s\n", filename);
- 
-    vol  = new Volume;
-    vol->pix_size = -1;
-    vol->pix_type = PT_UNDEFINED;
+
     while (fgets (linebuf, LINELEN, fp)) {
 	string_util_rtrim_whitespace (linebuf);
 	if (strcmp (linebuf, "ElementDataFile = LOCAL") == 0) {
+            local_data = true;
+	    break;
+	}
+	if (strncmp (linebuf, "ElementDataFile = ",
+                strlen ("ElementDataFile = ")) == 0)
+        {
+            /* Detached data file, relative to the header file */
+            data_fn = linebuf + strlen ("ElementDataFile = ");
+            if (!ISSLASH (data_fn[0])) {
+                std::string dir = file_util_dirname_string (filename);
+                if (dir != "") {
+                    data_fn = compose_filename (dir, data_fn);
+                }
+            }
 	    break;
 	}
 	if (sscanf (linebuf, "DimSize = %d %d %d", &a, &b, &c) == 3) {
-	    vol->dim[0] = a;
-	    vol->dim[1] = b;
-	    vol->dim[2] = c;
-	    vol->npix = vol->dim[0] * vol->dim[1] * vol->dim[2];
+	    dim[0] = a;
+	    dim[1] = b;
+	    dim[2] = c;
 	    continue;
 	}
 	if (sscanf (linebuf, "Offset = %g %g %g",
-		&vol->origin[0],
-		&vol->origin[1],
-		&vol->origin[2]) == 3) {
+		&origin[0], &origin[1], &origin[2]) == 3) {
 	    continue;
 	}
 	if (sscanf (linebuf, "ElementSpacing = %g %g %g",
-		&vol->spacing[0],
-		&vol->spacing[1],
-		&vol->spacing[2]) == 3) {
+		&spacing[0], &spacing[1], &spacing[2]) == 3) {
 	    continue;
 	}
 	if (sscanf (linebuf, "TransformMatrix = %g %g %g %g %g %g %g %g %g",
-		&dc[0], &dc[3], &dc[6], 
-                &dc[1], &dc[4], &dc[7], 
+		&dc[0], &dc[3], &dc[6],
+                &dc[1], &dc[4], &dc[7],
 		&dc[2], &dc[5], &dc[8]) == 9)
 	{
 	    have_direction_cosines = true;
 	    continue;
 	}
+	if (sscanf (linebuf, "HeaderSize = %ld", &header_size) == 1) {
+	    continue;
+	}
 	if (sscanf (linebuf, "ElementNumberOfChannels = %d", &tmp) == 1) {
-	    if (vol->pix_type == PT_UNDEFINED || vol->pix_type == PT_FLOAT) {
-		vol->pix_type = PT_VF_FLOAT_INTERLEAVED;
-		vol->pix_size = 3*sizeof(float);
+	    if (pix_type == PT_UNDEFINED || pix_type == PT_FLOAT) {
+		pix_type = PT_VF_FLOAT_INTERLEAVED;
+		pix_size = 3*sizeof(float);
 	    }
 	    continue;
 	}
 	if (strcmp (linebuf, "ElementType = MET_FLOAT") == 0) {
-	    if (vol->pix_type == PT_UNDEFINED) {
-		vol->pix_type = PT_FLOAT;
-		vol->pix_size = sizeof(float);
+	    if (pix_type == PT_UNDEFINED) {
+		pix_type = PT_FLOAT;
+		pix_size = sizeof(float);
 	    }
 	    continue;
 	}
 	if (strcmp (linebuf, "ElementType = MET_SHORT") == 0) {
-	    vol->pix_type = PT_SHORT;
-	    vol->pix_size = sizeof(short);
+	    pix_type = PT_SHORT;
+	    pix_size = sizeof(short);
+	    continue;
+	}
+	if (strcmp (linebuf, "ElementType = MET_UINT") == 0) {
+	    pix_type = PT_UINT32;
+	    pix_size = sizeof(uint32_t);
 	    continue;
 	}
 	if (strcmp (linebuf, "ElementType = MET_UCHAR") == 0) {
-	    vol->pix_type = PT_UCHAR;
-	    vol->pix_size = sizeof(unsigned char);
+	    pix_type = PT_UCHAR;
+	    pix_size = sizeof(unsigned char);
 	    continue;
 	}
 	if (strcmp (linebuf, "BinaryDataByteOrderMSB = True") == 0) {
@@ -189,10 +190,51 @@ read_mha_internal (
 	}
     }
 
-    if (vol->pix_size <= 0) {
+    if (local_data) {
+        data_fn = filename;
+        data_offset = ftell (fp);
+    }
+    fclose (fp);
+
+    if (pix_size <= 0) {
 	printf ("Oops, couldn't interpret mha data type\n");
 	exit (-1);
     }
+    if (data_fn == "") {
+	printf ("Oops, mha file %s has no ElementDataFile\n", filename);
+	exit (-1);
+    }
+
+    if (!local_data) {
+        if (header_size == -1) {
+            /* HeaderSize = -1 means the voxels are at the end of the
+               data file, after a header of unknown size */
+            int64_t data_size = (int64_t) get_npix() * pix_size;
+            int64_t file_size = mha_file_size (data_fn.c_str());
+            if (file_size < data_size) {
+                print_and_exit ("Oops, mha data file %s is too small\n",
+                    data_fn.c_str());
+            }
+            data_offset = file_size - data_size;
+        } else {
+            data_offset = header_size;
+        }
+    }
+    return true;
+}
+
+Volume*
+Mha_header::create_volume () const
+{
+    Volume *vol = new Volume;
+    for (int d = 0; d < 3; d++) {
+        vol->dim[d] = dim[d];
+        vol->origin[d] = origin[d];
+        vol->spacing[d] = spacing[d];
+    }
+    vol->npix = this->get_npix ();
+    vol->pix_type = pix_type;
+    vol->pix_size = pix_size;
 
     /* Update proj and step matrices */
     if (have_direction_cosines) {
@@ -200,58 +242,508 @@ read_mha_internal (
     } else {
 	vol->set_direction_cosines (0);
     }
+    return vol;
+}
 
-    vol->img = malloc (vol->pix_size*vol->npix);
-    if (!vol->img) {
-	printf ("Oops, out of memory\n");
-	exit (-1);
-    }
+static int
+mha_fseek (FILE *fp, int64_t offset)
+{
+#if _MSC_VER
+    return _fseeki64 (fp, offset, SEEK_SET);
+#else
+    return fseeko (fp, (off_t) offset, SEEK_SET);
+#endif
+}
 
-    rc = fread (vol->img, vol->pix_size, vol->npix, fp);
-    if (rc != (size_t) vol->npix) {
-	printf ("Oops, bad read from file (%u)\n", (unsigned int) rc);
-	exit (-1);
+/* Open the data file, positioned at the given voxel */
+static FILE*
+mha_open_data (const Mha_header& mh, plm_long first_vox)
+{
+    FILE *fp = fopen (mh.data_fn.c_str(), "rb");
+    if (!fp) {
+	fprintf (stderr, "File %s not found\n", mh.data_fn.c_str());
+	return 0;
     }
+    if (mha_fseek (fp, mh.data_offset + (int64_t) first_vox * mh.pix_size))
+    {
+        print_and_exit ("Oops, seek failed in file %s\n",
+            mh.data_fn.c_str());
+    }
+    return fp;
+}
 
-    /* Swap endian-ness if necessary */
-    if (vol->pix_type == PT_VF_FLOAT_INTERLEAVED) {
-	if (big_endian_input) {
-	    endian4_big_to_native (vol->img, 3 * vol->npix);
-	} else {
-	    endian4_little_to_native (vol->img, 3 * vol->npix);
-	}
-    } else if (vol->pix_size == 2) {
+static void
+mha_swap_to_native (void *buf, int elt_size, size_t num_elt,
+    bool big_endian_input)
+{
+    if (elt_size == 2) {
 	if (big_endian_input) {
-	    endian2_big_to_native (vol->img, vol->npix);
+	    endian2_big_to_native (buf, num_elt);
 	} else {
-	    endian2_little_to_native (vol->img, vol->npix);
+	    endian2_little_to_native (buf, num_elt);
 	}
-    } else if (vol->pix_size == 4) {
+    } else if (elt_size == 4) {
 	if (big_endian_input) {
-	    endian4_big_to_native (vol->img, vol->npix);
+	    endian4_big_to_native (buf, num_elt);
 	} else {
-	    endian4_little_to_native (vol->img, vol->npix);
+	    endian4_little_to_native (buf, num_elt);
 	}
-    } else if (vol->pix_size != 1) {
-	print_and_exit ("Unknown pixel size: %u\n", vol->pix_size);
+    } else if (elt_size != 1) {
+	print_and_exit ("Unknown pixel size: %u\n", elt_size);
+    }
+}
+
+/* Read num_vox voxels from the current position of fp, swapping
+   each block to native byte order as soon as it is read */
+static void
+mha_read_voxels (FILE *fp, void *buf, const Mha_header& mh,
+    plm_long num_vox)
+{
+    int elt_size = mh.get_element_size ();
+    size_t num_elt = (size_t) num_vox * (mh.pix_size / elt_size);
+    size_t block_elt = MHA_IO_BLOCK / elt_size;
+    char *cbuf = (char*) buf;
+
+    for (size_t e = 0; e < num_elt; e += block_elt) {
+        size_t n = num_elt - e;
+        if (n > block_elt) {
+            n = block_elt;
+        }
+        size_t rc = fread (&cbuf[e*elt_size], elt_size, n, fp);
+        if (rc != n) {
+            printf ("Oops, bad read from file (%u)\n",
+                (unsigned int) ((e + rc) / (mh.pix_size / elt_size)));
+            exit (-1);
+        }
+        mha_swap_to_native (&cbuf[e*elt_size], elt_size, n,
+            mh.big_endian_input);
+    }
+}
+
+/* Returns false if the pixel type cannot be written */
+static bool
+write_mha_header (
+    FILE *fp,
+    const plm_long dim[3],
+    const float origin[3],
+    const float spacing[3],
+    const float dc[9],
+    enum Volume_pixel_type pix_type
+)
+{
+    const char* mha_header =
+	"ObjectType = Image\n"
+	"NDims = 3\n"
+	"BinaryData = True\n"
+	"BinaryDataByteOrderMSB = False\n"
+	"TransformMatrix = %g %g %g %g %g %g %g %g %g\n"
+	"Offset = %g %g %g\n"
+	"CenterOfRotation = 0 0 0\n"
+	"ElementSpacing = %g %g %g\n"
+	"DimSize = %d %d %d\n"
+	"AnatomicalOrientation = RAI\n"
+	"%s"
+	"ElementType = %s\n"
+	"ElementDataFile = LOCAL\n";
+    const char* element_type;
+    bool vector_field = false;
+
+    switch (pix_type) {
+    case PT_UCHAR:
+	element_type = "MET_UCHAR";
+	break;
+    case PT_SHORT:
+	element_type = "MET_SHORT";
+	break;
+    case PT_UINT32:
+	element_type = "MET_UINT";
+	break;
+    case PT_FLOAT:
+	element_type = "MET_FLOAT";
+	break;
+    case PT_VF_FLOAT_INTERLEAVED:
+    case PT_VF_FLOAT_PLANAR:
+	element_type = "MET_FLOAT";
+        vector_field = true;
+	break;
+    default:
+        return false;
+    }
+    fprintf (fp, mha_header,
+	dc[0], dc[3], dc[6],
+        dc[1], dc[4], dc[7],
+	dc[2], dc[5], dc[8],
+	origin[0], origin[1], origin[2],
+	spacing[0], spacing[1], spacing[2],
+	(int) dim[0], (int) dim[1], (int) dim[2],
+	vector_field ? "ElementNumberOfChannels = 3\n" : "",
+	element_type);
+    fflush (fp);
+    return true;
+}
+
+/* Write the voxels of vol at the current position of fp.
+   Planar vector fields are interleaved a block at a time,
+   rather than converting the whole volume. */
+static void
+write_mha_voxels (FILE *fp, const Volume *vol)
+{
+    if (vol->pix_type == PT_VF_FLOAT_PLANAR) {
+        float **planes = (float**) vol->img;
+        plm_long block_vox = MHA_IO_BLOCK / (3 * sizeof(float));
+        float *buf = (float*) malloc (3 * sizeof(float) * block_vox);
+        for (plm_long v0 = 0; v0 < vol->npix; v0 += block_vox) {
+            plm_long n = vol->npix - v0;
+            if (n > block_vox) {
+                n = block_vox;
+            }
+            for (plm_long v = 0; v < n; v++) {
+                buf[3*v+0] = planes[0][v0+v];
+                buf[3*v+1] = planes[1][v0+v];
+                buf[3*v+2] = planes[2][v0+v];
+            }
+            plm_fwrite (buf, sizeof(float), 3 * n, fp, true);
+        }
+        free (buf);
+    } else if (vol->pix_type == PT_VF_FLOAT_INTERLEAVED) {
+	plm_fwrite (vol->img, sizeof(float), 3 * vol->npix, fp, true);
+    } else {
+	plm_fwrite (vol->img, vol->pix_size, vol->npix, fp, true);
     }
+}
+
+static void
+write_mha_internal (
+    const char* filename,    /* Input: filename to write to */
+    const Volume* vol        /* Input: volume to write */
+)
+{
+    FILE* fp;
+
+    fp = plm_fopen (filename,"wb");
+    if (!fp) {
+	fprintf (stderr, "Can't open file %s for write\n", filename);
+	return;
+    }
+    if (!write_mha_header (fp, vol->dim, vol->origin, vol->spacing,
+            vol->direction_cosines.get_matrix(), vol->pix_type))
+    {
+	fprintf (stderr, "Unhandled type in write_mha().\n");
+	exit (-1);
+    }
+    write_mha_voxels (fp, vol);
+
+    fclose (fp);
+}
+
+static Volume*
+read_mha_internal (
+    const char* filename     /* Input: filename to read from */
+)
+{
+    Mha_header mh;
+    if (!mh.read (filename)) {
+	return 0;
+    }
+
+    FILE *fp = mha_open_data (mh, 0);
+    if (!fp) {
+	return 0;
+    }
+
+    fprintf(stdout, "reading %s\n", filename);
+
+    Volume *vol = mh.create_volume ();
+    vol->img = malloc (vol->pix_size*vol->npix);
+    if (!vol->img) {
+	printf ("Oops, out of memory\n");
+	exit (-1);
+    }
+    mha_read_voxels (fp, vol->img, mh, vol->npix);
 
     fclose (fp);
 
     return vol;
 }
 
+#if !(defined(_WIN32) || defined(WIN32))
+/* Deleter for volumes whose image is a file mapping */
+class Mha_unmap {
+public:
+    void *addr;
+    size_t len;
+public:
+    Mha_unmap (void *addr, size_t len) {
+        this->addr = addr;
+        this->len = len;
+    }
+    void operator() (Volume *vol) {
+        /* The image is not owned by the volume */
+        vol->img = 0;
+        delete vol;
+        munmap (addr, len);
+    }
+};
+#endif
+
 /* -----------------------------------------------------------------------
    Public functions
    ----------------------------------------------------------------------- */
-void 
+void
 write_mha (const char* filename, const Volume* vol)
 {
     write_mha_internal (filename, vol);
 }
 
-Volume* 
+Volume*
 read_mha (const char* filename)
 {
     return read_mha_internal (filename);
 }
+
+Volume::Pointer
+read_mha_mapped (const char* filename)
+{
+#if (defined(_WIN32) || defined(WIN32))
+    /* Not implemented on windows, read into memory instead */
+    return Volume::Pointer (read_mha_internal (filename));
+#else
+    Mha_header mh;
+    if (!mh.read (filename)) {
+	return Volume::Pointer ();
+    }
+
+    /* The file can only be mapped if the voxels are stored in
+       native byte order, and are properly aligned */
+    int elt_size = mh.get_element_size ();
+#if PLM_BIG_ENDIAN
+    bool native_order = (elt_size == 1 || mh.big_endian_input);
+#else
+    bool native_order = (elt_size == 1 || !mh.big_endian_input);
+#endif
+    if (!native_order || mh.data_offset % elt_size != 0) {
+        return Volume::Pointer (read_mha_internal (filename));
+    }
+
+    int fd = open (mh.data_fn.c_str(), O_RDONLY);
+    if (fd < 0) {
+	fprintf (stderr, "File %s not found\n", mh.data_fn.c_str());
+	return Volume::Pointer ();
+    }
+    size_t map_len = mh.data_offset + (size_t) mh.get_npix() * mh.pix_size;
+    struct stat st;
+    if (fstat (fd, &st) != 0 || (uint64_t) st.st_size < map_len) {
+        close (fd);
+	print_and_exit ("Oops, bad read from file %s\n", mh.data_fn.c_str());
+    }
+
+    /* Private writable mapping, so that pages which are modified
+       are copied rather than written back to the file */
+    void *addr = mmap (0, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+        fd, 0);
+    close (fd);
+    if (addr == MAP_FAILED) {
+        return Volume::Pointer (read_mha_internal (filename));
+    }
+
+    fprintf(stdout, "mapping %s\n", filename);
+
+    Volume *vol = mh.create_volume ();
+    vol->img = (void*) ((char*) addr + mh.data_offset);
+    return Volume::Pointer (vol, Mha_unmap (addr, map_len));
+#endif
+}
+
+/* -----------------------------------------------------------------------
+   Mha_slab_reader
+   ----------------------------------------------------------------------- */
+class Mha_slab_reader_private {
+public:
+    Mha_header mh;
+    FILE *fp;
+    plm_long next_slice;         /* Slice at current file position */
+public:
+    Mha_slab_reader_private () {
+        fp = 0;
+        next_slice = 0;
+    }
+};
+
+Mha_slab_reader::Mha_slab_reader ()
+{
+    d_ptr = new Mha_slab_reader_private;
+}
+
+Mha_slab_reader::~Mha_slab_reader ()
+{
+    this->close ();
+    delete d_ptr;
+}
+
+bool
+Mha_slab_reader::open (const char* filename)
+{
+    this->close ();
+    d_ptr->mh = Mha_header ();
+    if (!d_ptr->mh.read (filename)) {
+        return false;
+    }
+    d_ptr->fp = mha_open_data (d_ptr->mh, 0);
+    d_ptr->next_slice = 0;
+    return d_ptr->fp != 0;
+}
+
+void
+Mha_slab_reader::close ()
+{
+    if (d_ptr->fp) {
+        fclose (d_ptr->fp);
+        d_ptr->fp = 0;
+    }
+}
+
+void
+Mha_slab_reader::get_volume_header (Volume_header *vh) const
+{
+    Volume::Pointer vol (d_ptr->mh.create_volume ());
+    vh->set (vol->dim, vol->origin, vol->spacing,
+        vol->direction_cosines);
+}
+
+enum Volume_pixel_type
+Mha_slab_reader::get_pixel_type () const
+{
+    return d_ptr->mh.pix_type;
+}
+
+Volume::Pointer
+Mha_slab_reader::read_slab (plm_long first_slice, plm_long num_slices)
+{
+    const Mha_header& mh = d_ptr->mh;
+    if (!d_ptr->fp || first_slice < 0 || first_slice >= mh.dim[2]) {
+        return Volume::Pointer ();
+    }
+    if (num_slices > mh.dim[2] - first_slice) {
+        num_slices = mh.dim[2] - first_slice;
+    }
+
+    /* The slab has the geometry of the slices within the volume */
+    Volume::Pointer vol (mh.create_volume ());
+    plm_long slab_dim[3] = { mh.dim[0], mh.dim[1], num_slices };
+    float slab_origin[3];
+    for (int d = 0; d < 3; d++) {
+        slab_origin[d] = vol->origin[d] + first_slice * vol->step[3*d+2];
+    }
+    Volume::Pointer slab (new Volume (slab_dim, slab_origin, vol->spacing,
+            vol->direction_cosines, mh.pix_type, 1));
+
+    /* Sequential reads don't need to seek */
+    plm_long slice_vox = mh.dim[0] * mh.dim[1];
+    if (first_slice != d_ptr->next_slice) {
+        if (mha_fseek (d_ptr->fp,
+                mh.data_offset + (int64_t) first_slice * slice_vox
+                * mh.pix_size))
+        {
+            print_and_exit ("Oops, seek failed in file %s\n",
+                mh.data_fn.c_str());
+        }
+    }
+    mha_read_voxels (d_ptr->fp, slab->img, mh, slab->npix);
+    d_ptr->next_slice = first_slice + num_slices;
+    return slab;
+}
+
+/* -----------------------------------------------------------------------
+   Mha_slab_writer
+   ----------------------------------------------------------------------- */
+class Mha_slab_writer_private {
+public:
+    FILE *fp;
+    std::string filename;
+    plm_long dim[3];
+    enum Volume_pixel_type pix_type;
+    plm_long slices_written;
+public:
+    Mha_slab_writer_private () {
+        fp = 0;
+        pix_type = PT_UNDEFINED;
+        slices_written = 0;
+    }
+};
+
+Mha_slab_writer::Mha_slab_writer ()
+{
+    d_ptr = new Mha_slab_writer_private;
+}
+
+Mha_slab_writer::~Mha_slab_writer ()
+{
+    this->close ();
+    delete d_ptr;
+}
+
+bool
+Mha_slab_writer::open (
+    const char* filename,
+    const Volume_header& vh,
+    enum Volume_pixel_type pix_type
+)
+{
+    this->close ();
+    d_ptr->fp = plm_fopen (filename, "wb");
+    if (!d_ptr->fp) {
+	fprintf (stderr, "Can't open file %s for write\n", filename);
+	return false;
+    }
+    if (!write_mha_header (d_ptr->fp, vh.get_dim(), vh.get_origin(),
+            vh.get_spacing(), vh.get_direction_cosines().get_matrix(),
+            pix_type))
+    {
+	fprintf (stderr, "Unhandled type in Mha_slab_writer.\n");
+	exit (-1);
+    }
+    d_ptr->filename = filename;
+    for (int d = 0; d < 3; d++) {
+        d_ptr->dim[d] = vh.get_dim()[d];
+    }
+    d_ptr->pix_type = pix_type;
+    d_ptr->slices_written = 0;
+    return true;
+}
+
+void
+Mha_slab_writer::write_slab (const Volume* slab)
+{
+    if (!d_ptr->fp) {
+        print_and_exit ("Error, Mha_slab_writer is not open\n");
+    }
+    if (slab->dim[0] != d_ptr->dim[0] || slab->dim[1] != d_ptr->dim[1]
+        || slab->pix_type != d_ptr->pix_type)
+    {
+        print_and_exit ("Error, slab does not match mha file %s\n",
+            d_ptr->filename.c_str());
+    }
+    if (d_ptr->slices_written + slab->dim[2] > d_ptr->dim[2]) {
+        print_and_exit ("Error, too many slices written to mha file %s\n",
+            d_ptr->filename.c_str());
+    }
+    write_mha_voxels (d_ptr->fp, slab);
+    d_ptr->slices_written += slab->dim[2];
+}
+
+bool
+Mha_slab_writer::close ()
+{
+    if (!d_ptr->fp) {
+        return true;
+    }
+    fclose (d_ptr->fp);
+    d_ptr->fp = 0;
+    if (d_ptr->slices_written != d_ptr->dim[2]) {
+        lprintf ("Warning, mha file %s is incomplete (%d of %d slices)\n",
+            d_ptr->filename.c_str(), (int) d_ptr->slices_written,
+            (int) d_ptr->dim[2]);
+        return false;
+    }
+    return true;
+}
@@ -5,10 +5,73 @@
 #define _mha_io_h_
 
 #include "plmbase_config.h"
+#include "volume.h"
 
-class Volume;
+class Mha_slab_reader_private;
+class Mha_slab_writer_private;
+class Volume_header;
 
 PLMBASE_C_API Volume* read_mha (const char* filename);
 PLMBASE_C_API void write_mha (const char* filename, const Volume* vol);
 
+/*! \brief Read an uncompressed mha (or mhd/raw) file by mapping its 
+  voxel data into memory instead of copying it.  The volume must be 
+  treated as read-only in the sense that its image must not be 
+  reallocated, for example by Volume::convert().  Modified voxels 
+  are not written back to the file.  If the file can't be mapped, 
+  for example because its byte order is not native, it is read 
+  into memory as with read_mha(). */
+PLMBASE_API Volume::Pointer read_mha_mapped (const char* filename);
+
+/*! \brief
+ * The Mha_slab_reader class reads an uncompressed mha (or mhd/raw) 
+ * file a few slices at a time, so that volumes larger than memory 
+ * can be processed.  Reading the slabs in order avoids seeking.
+ */
+class PLMBASE_API Mha_slab_reader {
+public:
+    Mha_slab_reader_private *d_ptr;
+public:
+    Mha_slab_reader ();
+    ~Mha_slab_reader ();
+public:
+    /*! \brief Read the header, and prepare to read the voxel data.
+      Returns false if the file can't be opened. */
+    bool open (const char* filename);
+    void close ();
+    /*! \brief Get the geometry of the whole volume */
+    void get_volume_header (Volume_header *vh) const;
+    Volume_pixel_type get_pixel_type () const;
+    /*! \brief Read the slices first_slice through 
+      first_slice + num_slices - 1 into a new volume, which is 
+      positioned at the location of those slices.  The slab is 
+      truncated at the last slice of the file.  Returns a null 
+      pointer if first_slice is outside of the file. */
+    Volume::Pointer read_slab (plm_long first_slice, plm_long num_slices);
+};
+
+/*! \brief
+ * The Mha_slab_writer class writes an mha file a few slices at a 
+ * time, so that volumes larger than memory can be written.
+ */
+class PLMBASE_API Mha_slab_writer {
+public:
+    Mha_slab_writer_private *d_ptr;
+public:
+    Mha_slab_writer ();
+    ~Mha_slab_writer ();
+public:
+    /*! \brief Create the file and write the header for a volume 
+      with the given geometry and pixel type */
+    bool open (const char* filename, const Volume_header& vh, 
+        Volume_pixel_type pix_type);
+    /*! \brief Append the slices of the slab to the file.  The slab 
+      must have the same x and y dimensions and pixel type as the 
+      file. */
+    void write_slab (const Volume* slab);
+    /*! \brief Close the file.  Returns false if fewer slices were 
+      written than given in the header. */
+    bool close ();
+};
+
 #endif
@@ -9,6 +9,7 @@
 #include <itksys/SystemTools.hxx>
 #include <itkImageIOBase.h>
 
+#include "bspline_xform.h"
 #include "dicom_probe.h"
 #include "file_util.h"
 #include "gdcm1_dose.h"
@@ -62,6 +63,12 @@ plm_file_format_deduce (const char* path)
     if (!file_exists (path)) {
 	return PLM_FILE_FMT_NO_FILE;
     }
+
+    /* B-spline coefficients, text or binary, are recognized 
+       by their first line */
+    if (bspline_xform_probe (path)) {
+	return PLM_FILE_FMT_BSPLINE_XFORM;
+    }
     
     ext = itksys::SystemTools::GetFilenameLastExtension (std::string (path));
 
@@ -188,6 +195,8 @@ plm_file_format_string (Plm_file_format file_type)
 	return "DICOM-RT dose";
     case PLM_FILE_FMT_SS_IMG_VEC:
 	return "Structure set image";
+    case PLM_FILE_FMT_BSPLINE_XFORM:
+	return "B-spline transform";
     default:
 	return "Unknown/default";
     }
@@ -232,6 +241,9 @@ plm_file_format_parse (const char* string)
     else if (!strcmp (string, "ssimg")) {
 	return PLM_FILE_FMT_SS_IMG_VEC;
     }
+    else if (!strcmp (string, "bxf")) {
+	return PLM_FILE_FMT_BSPLINE_XFORM;
+    }
     else {
 	return PLM_FILE_FMT_UNKNOWN;
     }
@@ -247,6 +259,9 @@ plm_file_format_from_extension (const char* filename)
     else if (extension_is (filename, ".cxt")) {
 	return PLM_FILE_FMT_CXT;
     }
+    else if (extension_is (filename, ".bxf")) {
+	return PLM_FILE_FMT_BSPLINE_XFORM;
+    }
     else {
 	return PLM_FILE_FMT_IMG;
     }
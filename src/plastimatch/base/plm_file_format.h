@@ -24,7 +24,8 @@ enum Plm_file_format {
     PLM_FILE_FMT_DICOM_RTSS,
     PLM_FILE_FMT_DICOM_DOSE,
     PLM_FILE_FMT_DICOM_RTPLAN,
-    PLM_FILE_FMT_SS_IMG_VEC
+    PLM_FILE_FMT_SS_IMG_VEC,
+    PLM_FILE_FMT_BSPLINE_XFORM
 };
 
 PLMBASE_API Plm_file_format plm_file_format_deduce (const char* path);
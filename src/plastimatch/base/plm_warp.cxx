@@ -16,35 +16,16 @@
 #include "volume.h"
 #include "xform.h"
 
+/* Warp an image with an itk vector field */
 static void
-plm_warp_itk (
-    Plm_image::Pointer& im_warped,     /* Output (optional) */
-    DeformationFieldType::Pointer *vf_out,   /* Output (optional) */
-    const Xform::Pointer& xf_in,             /* Input */
-    Plm_image_header *pih,                   /* Input */
-    const Plm_image::Pointer& im_in,                        /* Input */
+plm_warp_itk_image (
+    Plm_image::Pointer& im_warped,           /* Output */
+    const DeformationFieldType::Pointer& vf, /* Input */
+    const Plm_image::Pointer& im_in,         /* Input */
     float default_val,     /* Input:  Value for pixels without match */
     int interp_lin         /* Input:  Trilinear (1) or nn (0) */
 )
 {
-    Xform xform_tmp;
-    DeformationFieldType::Pointer vf;
-
-    /* Create an itk vector field from xf_in */
-    printf ("plm_warp_itk: xform_to_itk_vf\n");
-    xform_to_itk_vf (&xform_tmp, xf_in.get(), pih);
-    vf = xform_tmp.get_itk_vf ();
-
-    /* If caller wants the vf, we assign it here */
-    if (vf_out) {
-	*vf_out = vf;
-    }
-
-    /* If caller only wants the vf, we are done */
-    if (!im_warped) {
-	return;
-    }
-
     /* Convert GPUIT images to ITK */
     printf ("plm_warp_itk: convert_to_itk\n");
     im_in->convert_to_itk ();
@@ -124,32 +105,26 @@ plm_warp_itk (
     }
 }
 
-/* Native warping (only gpuit bspline + float) */
+/* Native warping of several images in a single pass 
+   (only gpuit bspline + types accepted by plm_warp_native_supported) */
 static void
-plm_warp_native (
-    Plm_image::Pointer& im_warped,        /* Output */
-    DeformationFieldType::Pointer *vf,    /* Output */
-    const Xform::Pointer& xf_in,          /* Input */
-    Plm_image_header *pih,                /* Input */
-    const Plm_image::Pointer& im_in,      /* Input */
-    float default_val,     /* Input:  Value for pixels without match */
-    int interp_lin         /* Input:  Trilinear (1) or nn (0) */
+plm_warp_native_multi (
+    std::vector<Plm_warp_target>& targets,  /* Input/Output */
+    DeformationFieldType::Pointer *vf,      /* Output */
+    const Xform::Pointer& xf_in,            /* Input */
+    Plm_image_header *pih                   /* Input */
 )
 {
     Xform xf_tmp;
-    Xform vf_tmp;
     Bspline_xform* bxf_in = xf_in->get_gpuit_bsp ();
     Volume *vf_out = 0;     /* Output vector field */
-    Volume *v_out = 0;      /* Output warped image */
     plm_long dim[3];
     float origin[3];
     float spacing[3];
     float direction_cosines[9];
 
-    /* Convert input image to gpuit format */
-    printf ("Running: plm_warp_native\n");
-    printf ("Converting input image...\n");
-    Volume::Pointer v_in = im_in->get_volume_float ();
+    printf ("Running: plm_warp_native_multi (%d images)\n", 
+	(int) targets.size());
 
     /* Transform input xform to gpuit bspline with correct voxel spacing */
     printf ("Converting xform...\n");
@@ -166,26 +141,39 @@ plm_warp_native (
 	    PT_VF_FLOAT_INTERLEAVED, 3);
     }
 
-    /* Create output image */
-    printf ("Creating output volume...\n");
-    v_out = new Volume (dim, origin, spacing, direction_cosines, 
-	PT_FLOAT, 1);
+    /* Convert input images and create output images.  Scalar 
+       images are warped as float, and then back-converted. */
+    std::vector<Volume::Pointer> v_out (targets.size());
+    std::vector<Bspline_warp_target> bw_targets;
+    for (size_t i = 0; i < targets.size(); i++) {
+	Plm_warp_target& tgt = targets[i];
+	Volume::Pointer v_in;
+	if (tgt.im_in->m_type == PLM_IMG_TYPE_ITK_UCHAR_VEC
+	    || tgt.im_in->m_type == PLM_IMG_TYPE_GPUIT_UCHAR_VEC)
+	{
+	    v_in = tgt.im_in->get_volume_uchar_vec ();
+	    v_out[i] = Volume::New (dim, origin, spacing, direction_cosines, 
+		PT_UCHAR_VEC_INTERLEAVED, v_in->vox_planes);
+	} else {
+	    v_in = tgt.im_in->get_volume_float ();
+	    v_out[i] = Volume::New (dim, origin, spacing, direction_cosines, 
+		PT_FLOAT, 1);
+	}
+	bw_targets.push_back (Bspline_warp_target (v_out[i].get(), 
+	    v_in.get(), tgt.interp_lin, tgt.default_val));
+    }
 
     /* Warp using gpuit native warper */
     printf ("Running native warper...\n");
-    bspline_warp (v_out, vf_out, xf_tmp.get_gpuit_bsp(), v_in, 
-	interp_lin, default_val);
-
-    /* Return output image to caller */
-    if (im_warped) {
-	im_warped->set_volume (v_out);
+    bspline_warp_multi (bw_targets, vf_out, xf_tmp.get_gpuit_bsp());
 
-	/* Bspline_warp only operates on float.  We need to back-convert */
-	printf ("Back convert to original type...\n");
-	im_warped->convert (im_in->m_original_type);
-	im_warped->m_original_type = im_in->m_original_type;
-    } else {
-	delete v_out;
+    /* Return output images to caller */
+    printf ("Back convert to original type...\n");
+    for (size_t i = 0; i < targets.size(); i++) {
+	Plm_warp_target& tgt = targets[i];
+	tgt.im_warped->set_volume (v_out[i]);
+	tgt.im_warped->convert (tgt.im_in->m_original_type);
+	tgt.im_warped->m_original_type = tgt.im_in->m_original_type;
     }
 
     /* Return vf to caller */
@@ -195,81 +183,82 @@ plm_warp_native (
 	printf ("> Conversion complete.\n");
 	delete vf_out;
     }
-    printf ("plm_warp_native is complete.\n");
+    printf ("plm_warp_native_multi is complete.\n");
 }
 
-/* Native vector warping (only gpuit bspline + uchar_vec) */
-static void
-plm_warp_native_vec (
-    Plm_image::Pointer& im_warped,        /* Output */
-    DeformationFieldType::Pointer *vf,    /* Output */
-    const Xform::Pointer& xf_in,          /* Input */
-    Plm_image_header *pih,                /* Input */
-    const Plm_image::Pointer& im_in,      /* Input */
-    float default_val,     /* Input:  Value for pixels without match */
-    int interp_lin         /* Input:  Trilinear (1) or nn (0) */
-)
+static bool
+plm_warp_native_supported (const Plm_image::Pointer& im_in)
 {
-    Xform xf_tmp;
-    Xform vf_tmp;
-    Bspline_xform* bxf_in = xf_in->get_gpuit_bsp ();
-    Volume *vf_out = 0;     /* Output vector field */
-    Volume *v_out = 0;      /* Output warped image */
-    plm_long dim[3];
-    float origin[3];
-    float spacing[3];
-    float direction_cosines[9];
-
-    /* Convert input image to gpuit format */
-    printf ("Running: plm_warp_native_vec\n");
-    printf ("Converting input image...\n");
-    Volume::Pointer v_in = im_in->get_volume_uchar_vec ();
-
-    /* Transform input xform to gpuit bspline with correct voxel spacing */
-    printf ("Converting xform...\n");
-    xform_to_gpuit_bsp (&xf_tmp, xf_in.get(), pih, bxf_in->grid_spac);
-
-    /* Create output vf */
-    pih->get_origin (origin);
-    pih->get_spacing (spacing);
-    pih->get_dim (dim);
-    pih->get_direction_cosines (direction_cosines);
-    if (vf) {
-	printf ("Creating output vf...\n");
-	vf_out = new Volume (dim, origin, spacing, direction_cosines,
-	    PT_VF_FLOAT_INTERLEAVED, 3);
+    switch (im_in->m_type) {
+    case PLM_IMG_TYPE_ITK_UCHAR:
+    case PLM_IMG_TYPE_ITK_SHORT:
+    case PLM_IMG_TYPE_ITK_ULONG:
+    case PLM_IMG_TYPE_ITK_FLOAT:
+    case PLM_IMG_TYPE_GPUIT_UCHAR:
+    case PLM_IMG_TYPE_GPUIT_SHORT:
+    case PLM_IMG_TYPE_GPUIT_UINT32:
+    case PLM_IMG_TYPE_GPUIT_FLOAT:
+    case PLM_IMG_TYPE_ITK_UCHAR_VEC:
+    case PLM_IMG_TYPE_GPUIT_UCHAR_VEC:
+	return true;
+    default:
+	return false;
     }
+}
 
-    /* Create output image */
-    printf ("Creating output volume (%d planes)...\n", v_in->vox_planes);
-    v_out = new Volume (dim, origin, spacing, direction_cosines, 
-	PT_UCHAR_VEC_INTERLEAVED, v_in->vox_planes);
-
-    /* Warp using gpuit native warper */
-    printf ("Running native warper...\n");
-    bspline_warp (v_out, vf_out, xf_tmp.get_gpuit_bsp(), v_in, 
-	interp_lin, default_val);
+Plm_warp_target::Plm_warp_target (
+    const Plm_image::Pointer& im_warped,
+    const Plm_image::Pointer& im_in,
+    float default_val,
+    int interp_lin
+)
+{
+    this->im_warped = im_warped;
+    this->im_in = im_in;
+    this->default_val = default_val;
+    this->interp_lin = interp_lin;
+}
 
-    /* Return output image to caller */
-    if (im_warped) {
-	im_warped->set_volume (v_out);
+void
+plm_warp_multi (
+    std::vector<Plm_warp_target>& targets, /* Input/Output */
+    DeformationFieldType::Pointer* vf,    /* Output: Output vf (optional) */
+    const Xform::Pointer& xf_in, /* Input:  Images warped by this xform */
+    Plm_image_header *pih, /* Input:  Size of output images */
+    int use_itk            /* Input:  Force use of itk (1) or not (0) */
+)
+{
+    /* With no images, there is only work to do if the caller 
+       wants the vf */
+    if (targets.empty() && !vf) {
+	return;
+    }
 
-	/* Bspline_warp only operates on float.  We need to back-convert */
-	printf ("Back convert to original type...\n");
-	im_warped->convert (im_in->m_original_type);
-	im_warped->m_original_type = im_in->m_original_type;
-    } else {
-	delete v_out;
+    /* Use the native warper if it can handle all of the images */
+    bool native = !use_itk && xf_in->m_type == XFORM_GPUIT_BSPLINE;
+    for (size_t i = 0; i < targets.size(); i++) {
+	if (!plm_warp_native_supported (targets[i].im_in)) {
+	    native = false;
+	}
+    }
+    if (native) {
+	plm_warp_native_multi (targets, vf, xf_in, pih);
+	return;
     }
 
-    /* Return vf to caller */
+    /* Otherwise, create the itk vector field once, and warp 
+       each image with it */
+    Xform xform_tmp;
+    printf ("plm_warp_multi: xform_to_itk_vf\n");
+    xform_to_itk_vf (&xform_tmp, xf_in.get(), pih);
+    DeformationFieldType::Pointer itk_vf = xform_tmp.get_itk_vf ();
     if (vf) {
-	printf ("> Convert vf to itk\n");
-	*vf = xform_gpuit_vf_to_itk_vf (vf_out, 0);
-	printf ("> Conversion complete.\n");
-	delete vf_out;
+	*vf = itk_vf;
+    }
+    for (size_t i = 0; i < targets.size(); i++) {
+	plm_warp_itk_image (targets[i].im_warped, itk_vf, 
+	    targets[i].im_in, targets[i].default_val, targets[i].interp_lin);
     }
-    printf ("plm_warp_native is complete.\n");
 }
 
 void
@@ -284,39 +273,12 @@ plm_warp (
     int interp_lin         /* Input:  Trilinear (1) or nn (0) */
 )
 {
-    /* If user requested ITK-based warping, respect their wish */
-    if (use_itk) {
-	plm_warp_itk (im_warped, vf, xf_in, pih, im_in, default_val,
-	    interp_lin);
-	return;
-    }
-
-    /* Otherwise, try to do native warping where possible */
-    if (xf_in->m_type == XFORM_GPUIT_BSPLINE) {
-	switch (im_in->m_type) {
-	case PLM_IMG_TYPE_ITK_UCHAR:
-	case PLM_IMG_TYPE_ITK_SHORT:
-	case PLM_IMG_TYPE_ITK_ULONG:
-	case PLM_IMG_TYPE_ITK_FLOAT:
-	case PLM_IMG_TYPE_GPUIT_UCHAR:
-	case PLM_IMG_TYPE_GPUIT_SHORT:
-	case PLM_IMG_TYPE_GPUIT_UINT32:
-	case PLM_IMG_TYPE_GPUIT_FLOAT:
-	    plm_warp_native (im_warped, vf, xf_in, pih, im_in, default_val,
-		interp_lin);
-	    break;
-	case PLM_IMG_TYPE_ITK_UCHAR_VEC:
-	case PLM_IMG_TYPE_GPUIT_UCHAR_VEC:
-	    plm_warp_native_vec (im_warped, vf, xf_in, pih, im_in, 
-		default_val, interp_lin);
-	    break;
-	default:
-	    plm_warp_itk (im_warped, vf, xf_in, pih, im_in, default_val,
-		interp_lin);
-	    break;
-	}
-    } else {
-	plm_warp_itk (im_warped, vf, xf_in, pih, im_in, default_val,
-	    interp_lin);
+    /* A single image is warped the same way as a group; if the 
+       caller only wants the vf, there are no images to warp */
+    std::vector<Plm_warp_target> targets;
+    if (im_warped) {
+	targets.push_back (Plm_warp_target (im_warped, im_in, 
+		default_val, interp_lin));
     }
+    plm_warp_multi (targets, vf, xf_in, pih, use_itk);
 }
@@ -5,11 +5,28 @@
 #define _plm_warp_h_
 
 #include "plmbase_config.h"
+#include <vector>
 #include "itkBSplineDeformableTransform.h"
 #include "xform.h"
 
 class Plm_image;
 
+/*! \brief
+ * One image to be warped by plm_warp_multi().  The caller creates 
+ * im_warped, which receives the result.
+ */
+class PLMBASE_API Plm_warp_target {
+public:
+    Plm_image::Pointer im_warped;  /* Output: Warped image */
+    Plm_image::Pointer im_in;      /* Input:  Input image */
+    float default_val;     /* Input:  Value for pixels without match */
+    int interp_lin;        /* Input:  Trilinear (1) or nn (0) */
+public:
+    Plm_warp_target (const Plm_image::Pointer& im_warped, 
+        const Plm_image::Pointer& im_in, float default_val, 
+        int interp_lin);
+};
+
 /* -----------------------------------------------------------------------
    Public functions
    ----------------------------------------------------------------------- */
@@ -25,4 +42,17 @@ plm_warp (
     int interp_lin         /* Input:  Trilinear (1) or nn (0) */
 );
 
+/*! \brief Warp several images onto the same output geometry with 
+  the same transform.  The transform is evaluated only once: native 
+  B-spline warping resamples all images in a single pass, and 
+  otherwise a single vector field is shared by all images. */
+PLMBASE_API void
+plm_warp_multi (
+    std::vector<Plm_warp_target>& targets, /* Input/Output */
+    DeformationFieldType::Pointer *vf,    /* Output: Output vf (optional) */
+    const Xform::Pointer& xf_in, /* Input:  Images warped by this xform */
+    Plm_image_header *pih, /* Input:  Size of output images */
+    int use_itk            /* Input:  Force use of itk (1) or not (0) */
+);
+
 #endif
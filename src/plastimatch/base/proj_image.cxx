@@ -99,38 +99,39 @@ raw_load (Proj_image *proj, const char* img_filename)
         exit (-1);
     }
     
-    /* Malloc memory */
-    fs = file_size (img_filename);
-    proj->img = (float*) malloc (fs);
-    if (!proj->img) {
-        fprintf (stderr, "Couldn't malloc memory for input image\n");
-        exit (-1);
-    }
-
     /* Guess image size */
+    int dim[2];
+    fs = file_size (img_filename);
     switch (fs) {
     case (512*384*sizeof(float)):
-        proj->dim[0] = 512;
-        proj->dim[1] = 384;
+        dim[0] = 512;
+        dim[1] = 384;
         break;
     case (1024*384*sizeof(float)):
-        proj->dim[0] = 1024;
-        proj->dim[1] = 384;
+        dim[0] = 1024;
+        dim[1] = 384;
         break;
     case (1024*768*sizeof(float)):
-        proj->dim[0] = 1024;
-        proj->dim[1] = 768;
+        dim[0] = 1024;
+        dim[1] = 768;
         break;
     case (2048*1536*sizeof(float)):
-        proj->dim[0] = 2048;
-        proj->dim[1] = 1536;
+        dim[0] = 2048;
+        dim[1] = 1536;
         break;
     default:
-        proj->dim[0] = 1024;
-        proj->dim[1] = fs / (1024 * sizeof(float));
+        dim[0] = 1024;
+        dim[1] = fs / (1024 * sizeof(float));
         break;
     }
 
+    /* Malloc memory */
+    proj_image_create_img (proj, dim);
+    if (!proj->img) {
+        fprintf (stderr, "Couldn't malloc memory for input image\n");
+        exit (-1);
+    }
+
     /* Load pixels */
     rc = fread (proj->img, sizeof(float), proj->dim[0] * proj->dim[1], fp);
     if (rc != (size_t) (proj->dim[0] * proj->dim[1])) {
@@ -180,8 +181,9 @@ pfm_load (Proj_image *proj, const char* img_filename)
     }
 
     /* Get image resolution */
+    int dim[2];
     fgets (buf, 1024, fp);
-    if (2 != sscanf (buf, "%d %d", &proj->dim[0], &proj->dim[1])) {
+    if (2 != sscanf (buf, "%d %d", &dim[0], &dim[1])) {
         fprintf (stderr, "Couldn't parse file %s as an image [2]\n", 
                  img_filename);
         exit (-1);
@@ -190,7 +192,7 @@ pfm_load (Proj_image *proj, const char* img_filename)
     fgets (buf, 1024, fp);
 
     /* Malloc memory */
-    proj->img = (float*) malloc (sizeof(float) * proj->dim[0] * proj->dim[1]);
+    proj_image_create_img (proj, dim);
     if (!proj->img) {
         fprintf (stderr, "Couldn't malloc memory for input image\n");
         exit (-1);
@@ -392,9 +394,17 @@ proj_image_create_pmat (Proj_image *proj)
     proj->pmat = new Proj_matrix;
 }
 
+/* The existing pixel buffer is kept if it already has the requested 
+   size, so that a Proj_image can be reused for a series of images */
 void
 proj_image_create_img (Proj_image *proj, int dim[2])
 {
+    if (proj->img && proj->dim[0] == dim[0] && proj->dim[1] == dim[1]) {
+        return;
+    }
+    if (proj->img) {
+        free (proj->img);
+    }
     proj->dim[0] = dim[0];
     proj->dim[1] = dim[1];
     proj->img = (float*) malloc (sizeof(float) * proj->dim[0] * proj->dim[1]);
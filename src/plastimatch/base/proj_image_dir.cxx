@@ -11,6 +11,7 @@
 #include "path_util.h"
 #include "proj_image.h"
 #include "proj_image_dir.h"
+#include "proj_matrix.h"
 #include "string_util.h"
 
 Proj_image_dir::Proj_image_dir (const char *dir)
@@ -225,3 +226,22 @@ Proj_image_dir::load_image (int index)
        for hnd files */
     return new Proj_image (this->proj_image_list[index], this->xy_offset);
 }
+
+/* Load image into an existing Proj_image, so that callers can reuse
+   Proj_image objects from one image to the next.  The pixel buffer 
+   is kept, and reused if the new image has the same size. */
+void
+Proj_image_dir::load_image (int index, Proj_image *proj)
+{
+    if (index < 0 || index >= this->num_proj_images) {
+	proj->clear ();
+	return;
+    }
+    if (proj->pmat) {
+	delete proj->pmat;
+	proj->pmat = 0;
+    }
+    proj->xy_offset[0] = this->xy_offset[0];
+    proj->xy_offset[1] = this->xy_offset[1];
+    proj->load (this->proj_image_list[index]);
+}
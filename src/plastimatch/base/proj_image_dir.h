@@ -28,6 +28,7 @@ public:
 
 public:
     Proj_image* load_image (int index);
+    void load_image (int index, Proj_image *proj);
     void select (int first, int skip, int last);
     void set_xy_offset (const double xy_offset[2]);
 
@@ -119,12 +119,39 @@ rasterize_slice (
     const float* x_in,          /* polygon vertices in mm */
     const float* y_in           /* polygon vertices in mm */
 )
+{
+    plm_long win_start[2] = { 0, 0 };
+    plm_long win_dim[2] = { dims[0], dims[1] };
+    rasterize_slice_window (acc_img, dims, spacing, offset, 
+        win_start, win_dim, num_vertices, x_in, y_in);
+}
+
+/* Rasterizes a single closed polygon on a window of a slice.  
+   Pixel coordinates and scan conversion are the same as for the 
+   whole slice; only the scan lines and pixels inside the window 
+   are visited. */
+void
+rasterize_slice_window (
+    unsigned char* acc_img,
+    plm_long* dims,
+    float* spacing,
+    float* offset,
+    const plm_long* win_start,
+    const plm_long* win_dim,
+    size_t num_vertices,
+    const float* x_in,          /* polygon vertices in mm */
+    const float* y_in           /* polygon vertices in mm */
+)
 {
     unsigned char* imgp;
     Edge** edge_table;
     Edge* edge_list;	    /* Global edge list */
     Edge* ael;  		    /* Active edge list */
     float *x, *y;           /* vertices in pixel coordinates */
+    int wy0 = (int) win_start[1];
+    int wy1 = (int) (win_start[1] + win_dim[1] - 1);
+    int wx0 = (int) win_start[0];
+    int wx1 = (int) (win_start[0] + win_dim[0]);
 
     /* Check if last vertex == first vertex.  If so, remove it. */
     if (x_in[num_vertices-1] == x_in[0] && y_in[num_vertices-1] == y_in[0]) {
@@ -140,9 +167,9 @@ rasterize_slice (
     }
 
     /* Make edge table */
-    edge_table = (Edge**) malloc (dims[1] * sizeof(Edge*));
+    edge_table = (Edge**) malloc (win_dim[1] * sizeof(Edge*));
     edge_list = (Edge*) malloc (num_vertices * sizeof(Edge));
-    memset (edge_table, 0, dims[1] * sizeof(Edge*));
+    memset (edge_table, 0, win_dim[1] * sizeof(Edge*));
     for (size_t i = 0; i < num_vertices; i++) {
 	int ymin, ymax;
 	size_t a = i, b = (i==num_vertices-1 ? 0 : i+1);
@@ -158,9 +185,12 @@ rasterize_slice (
 	if (y[a] == ymax) ymax --;
 	/* Reject segments that don't intersect a scan line */
 	if (ymax < ymin) continue;
-	/* Clip segments against image boundary */
-	if (ymin < 0) ymin = 0;
-	if (ymax > dims[1]-1) ymax = dims[1]-1;
+	/* Clip segments against image boundary and window.  Segments 
+	   which end just above the first scan line are rejected here, 
+	   otherwise they are counted as a crossing on that line. */
+	if (ymin < wy0) ymin = wy0;
+	if (ymax > wy1) ymax = wy1;
+	if (ymax < ymin) continue;
 	/* Shorten the segment & fill in edge data */
 	edge_list[i].ymax = ymax;
 	edge_list[i].xincr = (x[a] - x[b]) / (y[a] - y[b]);
@@ -172,15 +202,15 @@ rasterize_slice (
 	    y[b], y[a], x[b], x[a],
 	    ymin, ymax, edge_list[i].x, edge_list[i].xincr);
 #endif
-        insert_ordered_by_x (&edge_table[ymin], &edge_list[i]);
+        insert_ordered_by_x (&edge_table[ymin-wy0], &edge_list[i]);
     }
 
     /* Debug edge table */
 #if defined (commentout)
     printf ("-------------------------------------------\n");
-    for (plm_long i = 0; i < dims[1]; i++) {
+    for (plm_long i = 0; i < win_dim[1]; i++) {
 	if (edge_table[i]) {
-	    printf ("%d: ", i);
+	    printf ("%d: ", i + wy0);
 	    print_edges (edge_table[i]);
 	    printf ("\n");
 	}
@@ -190,14 +220,14 @@ rasterize_slice (
     /* Loop through scanline, rendering each */
     imgp = acc_img;
     ael = 0;
-    for (plm_long i = 0; i < dims[1]; i++) {
+    for (int i = wy0; i <= wy1; i++) {
 	int x, num_crossings;
 	Edge *n, *c;
 	/* Remove old edges from AEL */
 	remove_old_edges (&ael, i);
 
 	/* Add new edges to AEL */
-	c = edge_table[i];
+	c = edge_table[i-wy0];
 	while (c) {
 	    n = c->next;
 	    insert_ordered_by_x (&ael, c);
@@ -206,17 +236,17 @@ rasterize_slice (
 
 	/* Count scan intersections & rasterize */
 	num_crossings = 0;
-	x = 0;
+	x = wx0;
 	c = ael;
 #if defined (commentout)
 	printf ("%d ", i);
 	print_edges (ael);
 #endif
-	while (x < dims[0]) {
+	while (x < wx1) {
 	    int next_x;
 	    while (1) {
 		if (!c) {
-		    next_x = dims[0];
+		    next_x = wx1;
 		    break;
 		} else if (x >= c->x) {
 		    c = c->next;
@@ -224,7 +254,7 @@ rasterize_slice (
 		    continue;
 		} else {
 		    next_x = (int) floor (c->x) + 1;
-		    if (next_x > dims[0]) next_x = dims[0];
+		    if (next_x > wx1) next_x = wx1;
 		    break;
 		}
 	    }
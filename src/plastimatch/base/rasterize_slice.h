@@ -18,6 +18,20 @@ PLMBASE_C_API void rasterize_slice (
     const float* y_in            /* polygon vertices in mm */
 );
 
+/* Same as rasterize_slice(), but only the pixels within the window 
+   are written.  acc_img holds win_dim[0] * win_dim[1] pixels. */
+PLMBASE_C_API void rasterize_slice_window (
+    unsigned char* acc_img,
+    plm_long* dims,
+    float* spacing,
+    float* offset,
+    const plm_long* win_start,   /* first pixel of window */
+    const plm_long* win_dim,     /* size of window */
+    size_t num_vertices,
+    const float* x_in,           /* polygon vertices in mm */
+    const float* y_in            /* polygon vertices in mm */
+);
+
 bool point_in_polygon (
     const float* x_in,           /* polygon vertices in mm */
     const float* y_in,           /* polygon vertices in mm */
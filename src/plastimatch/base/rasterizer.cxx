@@ -7,6 +7,10 @@
 #include <ctype.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
 #include "print_and_exit.h"
 #include "plm_image.h"
@@ -22,70 +26,44 @@
 
 Rasterizer::Rasterizer ()
 {
-    want_prefix_imgs = false;
     want_labelmap = false;
     want_ss_img = false;
 
-    acc_img = 0;
-    uchar_vol = 0;
     labelmap_vol = 0;
     m_ss_img = 0;
     m_use_ss_img_vec = true;
-    curr_struct_no = 0;
-    curr_bit = 0;
     xor_overlapping = false;
 }
 
 Rasterizer::~Rasterizer (void)
 {
-    if (this->uchar_vol) {
-	delete this->uchar_vol;
-    }
     if (this->labelmap_vol) {
 	delete this->labelmap_vol;
     }
     if (this->m_ss_img) {
 	delete this->m_ss_img;
     }
-    free (this->acc_img);
 }
 
 void
 Rasterizer::init (
     Rtss *cxt,            /* Input */
     Plm_image_header *pih,             /* Input */
-    bool want_prefix_imgs,             /* Input */
     bool want_labelmap,                /* Input */
     bool want_ss_img,                  /* Input */
     bool use_ss_img_vec,               /* Input */
     bool xor_overlapping               /* Input */
 )
 {
-    int slice_voxels;
-
     pih->get_origin (this->origin);
     pih->get_spacing (this->spacing);
     pih->get_dim (this->dim);
 
-    slice_voxels = this->dim[0] * this->dim[1];
-
-    this->want_prefix_imgs = want_prefix_imgs;
     this->want_labelmap = want_labelmap;
     this->want_ss_img = want_ss_img;
     this->xor_overlapping = xor_overlapping;
     this->m_use_ss_img_vec = use_ss_img_vec;
 
-    this->acc_img = (unsigned char*) malloc (
-	slice_voxels * sizeof(unsigned char));
-
-    /* Create output volume for mask image.  This is reused for each 
-       structure */
-    this->uchar_vol = new Volume (this->dim, this->origin, 
-	this->spacing, 0, PT_UCHAR, 1);
-    if (this->uchar_vol == 0) {
-	print_and_exit ("ERROR: failed in allocating the volume");
-    }
-
     /* Create output volume for labelmap */
     this->labelmap_vol = 0;
     if (want_labelmap) {
@@ -123,170 +101,189 @@ Rasterizer::init (
             this->m_ss_img->set_volume (vol);
         }
     }
-
-    /* Initialize to start with first structure */
-    this->curr_struct_no = 0;
-    this->curr_bit = 0;
 }
 
-/* Return true if an image was processed */
-bool
-Rasterizer::process_next (
-    Rtss *cxt                          /* In/out */
+/* A contour, and the structure bit it is rasterized into */
+class Rasterizer_job {
+public:
+    const Rtss_contour *contour;
+    int bit;
+};
+
+/* Find the window of pixels which may lie inside the contour. 
+   The window has a margin of one pixel, so that it contains all 
+   pixels set by rasterize_slice().  Returns false if the contour 
+   lies outside of the slice. */
+static bool
+contour_window (
+    plm_long win_start[2],
+    plm_long win_dim[2],
+    const Rtss_contour *contour,
+    const plm_long dim[3],
+    const float origin[3],
+    const float spacing[3]
 )
 {
-    Rtss_roi* curr_structure;
-    unsigned char* uchar_img = (unsigned char*) this->uchar_vol->img;
-    size_t slice_voxels;
-
-    /* If done, return false */
-    if (this->curr_struct_no >= cxt->num_structures) {
-	this->curr_struct_no = cxt->num_structures + 1;
-	return false;
-    }
-
-    /* If not using ss_img_vec, stop at 32 structures */
-    if (!this->m_use_ss_img_vec && this->curr_struct_no >= 32) {
-        printf ("Warning: too many structures.  Dropping some...\n");
-	this->curr_struct_no = cxt->num_structures + 1;
-	return false;
-    }
-
-    curr_structure = cxt->slist[this->curr_struct_no];
-    slice_voxels = this->dim[0] * this->dim[1];
-
-    memset (uchar_img, 0, this->dim[0] * this->dim[1] 
-	* this->dim[2] * sizeof(unsigned char));
-
-    /* Loop through polylines in this structure */
-    for (size_t i = 0; i < curr_structure->num_contours; i++) {
-	Rtss_contour* curr_contour;
-	unsigned char* uchar_slice;
-	plm_long slice_no;
-
-	curr_contour = curr_structure->pslist[i];
-	if (curr_contour->num_vertices == 0) {
-	    continue;
+    const float *v[2] = { contour->x, contour->y };
+    for (int d = 0; d < 2; d++) {
+	float vmin = v[d][0], vmax = v[d][0];
+	for (size_t i = 1; i < contour->num_vertices; i++) {
+	    if (v[d][i] < vmin) vmin = v[d][i];
+	    if (v[d][i] > vmax) vmax = v[d][i];
 	}
-	slice_no = ROUND_PLM_LONG(
-            (curr_contour->z[0] - this->origin[2]) / this->spacing[2]);
-	if (slice_no < 0 || slice_no >= this->dim[2]) {
-	    continue;
+	float pmin = (vmin - origin[d]) / spacing[d];
+	float pmax = (vmax - origin[d]) / spacing[d];
+	if (pmin > pmax) {
+	    float tmp = pmin; pmin = pmax; pmax = tmp;
 	}
+	if (pmax < -1.f || pmin > (float) dim[d]) {
+	    return false;
+	}
+	plm_long a = (plm_long) floor (pmin) - 1;
+	plm_long b = (plm_long) ceil (pmax) + 1;
+	if (a < 0) a = 0;
+	if (b > dim[d] - 1) b = dim[d] - 1;
+	if (b < a) {
+	    return false;
+	}
+	win_start[d] = a;
+	win_dim[d] = b - a + 1;
+    }
+    return true;
+}
 
-	/* Render contour to binary */
-	memset (this->acc_img, 0, slice_voxels * sizeof(unsigned char));
-	rasterize_slice (
-	    this->acc_img, 
-	    this->dim, 
-	    this->spacing, 
-	    this->origin,
-	    curr_contour->num_vertices, 
-	    curr_contour->x, 
-	    curr_contour->y);
-
-	/* Copy from acc_img into mask image */
-	if (this->want_prefix_imgs) {
-	    uchar_slice = &uchar_img[slice_no * slice_voxels];
-	    for (size_t k = 0; k < slice_voxels; k++) {
-		uchar_slice[k] ^= this->acc_img[k];
-	    }
+void
+Rasterizer::process (
+    Rtss *cxt                          /* In/out */
+)
+{
+    /* Assign bits to the structures, and sort their contours 
+       by slice.  Within each slice, contours stay in structure 
+       order, so that later structures win in the labelmap. */
+    std::vector< std::vector<Rasterizer_job> > slice_jobs (this->dim[2]);
+    int curr_bit = 0;
+    for (size_t s = 0; s < cxt->num_structures; s++) {
+
+	/* If not using ss_img_vec, stop at 32 structures */
+	if (!this->m_use_ss_img_vec && s >= 32) {
+	    printf ("Warning: too many structures.  Dropping some...\n");
+	    break;
 	}
 
-	/* Copy from acc_img into labelmask image */
-	if (this->want_labelmap) {
-	    uint32_t* labelmap_img;
-	    uint32_t* uint32_slice;
-	    labelmap_img = (uint32_t*) this->labelmap_vol->img;
-	    uint32_slice = &labelmap_img[slice_no * slice_voxels];
-	    for (size_t k = 0; k < slice_voxels; k++) {
-		if (this->acc_img[k]) {
-		    uint32_slice[k] = this->curr_bit + 1;
-		}
+	Rtss_roi *curr_structure = cxt->slist[s];
+	for (size_t i = 0; i < curr_structure->num_contours; i++) {
+	    Rtss_contour *curr_contour = curr_structure->pslist[i];
+	    if (curr_contour->num_vertices == 0) {
+		continue;
+	    }
+	    plm_long slice_no = ROUND_PLM_LONG(
+		(curr_contour->z[0] - this->origin[2]) / this->spacing[2]);
+	    if (slice_no < 0 || slice_no >= this->dim[2]) {
+		continue;
 	    }
+	    Rasterizer_job job;
+	    job.contour = curr_contour;
+	    job.bit = curr_bit;
+	    slice_jobs[slice_no].push_back (job);
 	}
-
-        /* Copy from acc_img into ss_img */
-	if (this->want_ss_img) {
-
-            if (this->m_use_ss_img_vec) {
-                UCharVecImageType::Pointer ss_img = 
-                    this->m_ss_img->m_itk_uchar_vec;
-
-                /* GCS FIX: This code is replicated in ss_img_extract */
-                unsigned int uchar_no = this->curr_bit / 8;
-                unsigned int bit_no = this->curr_bit % 8;
-                unsigned char bit_mask = 1 << bit_no;
-                if (uchar_no > ss_img->GetVectorLength()) {
-                    print_and_exit (
-                        "Error: bit %d was requested from image of %d bits\n", 
-                        this->curr_bit, 
-                        ss_img->GetVectorLength() * 8);
-                }
-                /* GCS FIX: This is inefficient, due to undesirable construct 
-                   and destruct of itk::VariableLengthVector of each pixel */
-                UCharVecImageType::IndexType idx = {{0, 0, slice_no}};
-                size_t k = 0;
-                for (idx.m_Index[1] = 0; 
-                     idx.m_Index[1] < this->dim[1]; 
-                     idx.m_Index[1]++) {
-                    for (idx.m_Index[0] = 0; 
-                         idx.m_Index[0] < this->dim[0]; 
-                         idx.m_Index[0]++) {
-                        if (this->acc_img[k]) {
-                            itk::VariableLengthVector<unsigned char> v 
-                                = ss_img->GetPixel (idx);
-                            if (this->xor_overlapping) {
-                                v[uchar_no] ^= bit_mask;
-                            } else {
-                                v[uchar_no] |= bit_mask;
-                            }
-                            ss_img->SetPixel (idx, v);
-                        }
-                        k++;
-                    }
-                }
-            }
-            else {
-                uint32_t* ss_img = 0;
-                uint32_t* uint32_slice;
-                uint32_t bit_mask = 1 << this->curr_bit;
-                ss_img = (uint32_t*) this->m_ss_img->get_vol()->img;
-                uint32_slice = &ss_img[slice_no * slice_voxels];
-                for (size_t k = 0; k < slice_voxels; k++) {
-                    if (this->acc_img[k]) {
-                        if (this->xor_overlapping) {
-                            uint32_slice[k] ^= bit_mask;
-                        } else {
-                            uint32_slice[k] |= bit_mask;
-                        }
-                    }
-                }
-            }
-
+	if (curr_structure->num_contours > 0) {
+	    curr_structure->bit = curr_bit;
+	    curr_bit ++;
 	}
     }
 
-    this->curr_struct_no ++;
-    if (curr_structure->num_contours > 0) {
-	curr_structure->bit = this->curr_bit;
-	this->curr_bit ++;
+    /* Get the output buffers */
+    uint32_t *labelmap_img = 0;
+    if (this->want_labelmap) {
+	labelmap_img = (uint32_t*) this->labelmap_vol->img;
+    }
+    unsigned char *ss_vec_img = 0;
+    uint32_t *ss_uint32_img = 0;
+    size_t num_uchar = 0;
+    if (this->want_ss_img) {
+	if (this->m_use_ss_img_vec) {
+	    UCharVecImageType::Pointer ss_img = 
+		this->m_ss_img->m_itk_uchar_vec;
+	    num_uchar = ss_img->GetVectorLength();
+	    if (curr_bit > 0 && (size_t) (curr_bit - 1) / 8 >= num_uchar) {
+		print_and_exit (
+		    "Error: bit %d was requested from image of %d bits\n", 
+		    curr_bit - 1, (int) num_uchar * 8);
+	    }
+	    ss_vec_img = ss_img->GetBufferPointer ();
+	} else {
+	    ss_uint32_img = (uint32_t*) this->m_ss_img->get_vol()->img;
+	}
     }
 
-    return true;
-}
+    /* Slices are independent, so they are rasterized in parallel. 
+       Each contour is rasterized into a scratch image covering 
+       only its bounding box, which is then written directly into 
+       the output images. */
+    plm_long slice_voxels = this->dim[0] * this->dim[1];
+#pragma omp parallel
+    {
+	std::vector<unsigned char> acc_img;
+#pragma omp for schedule (dynamic)
+	for (plm_long k = 0; k < this->dim[2]; k++) {
+	    const std::vector<Rasterizer_job>& jobs = slice_jobs[k];
+	    for (size_t j = 0; j < jobs.size(); j++) {
+		const Rtss_contour *curr_contour = jobs[j].contour;
+		plm_long win_start[2], win_dim[2];
+		if (!contour_window (win_start, win_dim, curr_contour,
+			this->dim, this->origin, this->spacing))
+		{
+		    continue;
+		}
 
-const char*
-Rasterizer::current_name (
-    Rtss *cxt
-)
-{
-    if (this->curr_struct_no < cxt->num_structures + 1) {
-	Rtss_roi *curr_structure;
-	curr_structure = cxt->slist[this->curr_struct_no-1];
-	return curr_structure->name.c_str();
-    } else {
-	return "";
+		/* Render contour to binary */
+		acc_img.resize (win_dim[0] * win_dim[1]);
+		rasterize_slice_window (
+		    &acc_img[0], 
+		    this->dim, 
+		    this->spacing, 
+		    this->origin,
+		    win_start,
+		    win_dim,
+		    curr_contour->num_vertices, 
+		    curr_contour->x, 
+		    curr_contour->y);
+
+		/* Copy from acc_img into labelmap and ss_img */
+		int bit = jobs[j].bit;
+		unsigned int uchar_no = bit / 8;
+		unsigned char uchar_mask = 1 << (bit % 8);
+		uint32_t uint32_mask = ((uint32_t) 1) << bit;
+		const unsigned char *acc = &acc_img[0];
+		for (plm_long r = 0; r < win_dim[1]; r++) {
+		    plm_long v = k * slice_voxels 
+			+ (win_start[1] + r) * this->dim[0] + win_start[0];
+		    for (plm_long c = 0; c < win_dim[0]; c++, v++) {
+			if (!*acc++) {
+			    continue;
+			}
+			if (labelmap_img) {
+			    labelmap_img[v] = bit + 1;
+			}
+			if (ss_vec_img) {
+			    unsigned char *p = &ss_vec_img[v*num_uchar+uchar_no];
+			    if (this->xor_overlapping) {
+				*p ^= uchar_mask;
+			    } else {
+				*p |= uchar_mask;
+			    }
+			}
+			if (ss_uint32_img) {
+			    if (this->xor_overlapping) {
+				ss_uint32_img[v] ^= uint32_mask;
+			    } else {
+				ss_uint32_img[v] |= uint32_mask;
+			    }
+			}
+		    }
+		}
+	    }
+	}
     }
 }
 
@@ -294,13 +291,13 @@ void
 Rasterizer::rasterize (
     Rtss *cxt,            /* Input */
     Plm_image_header *pih,             /* Input */
-    bool want_prefix_imgs,             /* Input */
     bool want_labelmap,                /* Input */
     bool want_ss_img,                  /* Input */
     bool use_ss_img_vec,               /* Input */
     bool xor_overlapping               /* Input */
 )
 {
-    this->init (cxt, pih, false, true, true, use_ss_img_vec, xor_overlapping);
-    while (this->process_next (cxt)) {}
+    this->init (cxt, pih, want_labelmap, true, use_ss_img_vec, 
+        xor_overlapping);
+    this->process (cxt);
 }
@@ -16,7 +16,6 @@ class PLMBASE_API Rasterizer {
     Rasterizer ();
     ~Rasterizer ();
   public:
-    bool want_prefix_imgs;
     bool want_labelmap;
     bool want_ss_img;
 
@@ -28,21 +27,15 @@ class PLMBASE_API Rasterizer {
     float spacing[3];
     plm_long dim[3];
 
-    unsigned char* acc_img;
-    Volume* uchar_vol;
     Volume* labelmap_vol;
 
     Plm_image* m_ss_img;
     bool m_use_ss_img_vec;
 
-    size_t curr_struct_no;
-    int curr_bit;
-
   public:
     void rasterize (
 	Rtss *cxt,
 	Plm_image_header *pih,
-	bool want_prefix_imgs,
 	bool want_labelmap,
 	bool want_ss_img,
 	bool use_ss_img_vec, 
@@ -52,18 +45,14 @@ class PLMBASE_API Rasterizer {
     void init (
 	Rtss *cxt,            /* Input */
 	Plm_image_header *pih,             /* Input */
-	bool want_prefix_imgs,             /* Input */
 	bool want_labelmap,                /* Input */
 	bool want_ss_img,                  /* Input */
         bool use_ss_img_vec,               /* Input */
 	bool xor_overlapping               /* Input */
     );
-    bool process_next (
+    void process (
 	Rtss *cxt                          /* In/out */
     );
-    const char* current_name (
-	Rtss *cxt
-    );
 };
 
 #endif
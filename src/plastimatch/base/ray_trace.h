@@ -31,6 +31,20 @@ PLMBASE_C_API void ray_trace_exact (
     double *p1in,                 /* Input: start point for ray */
     double *p2in                  /* Input: end point for ray */
 );
+/* Compute the starting voxel and crossing distances used by 
+   ray_trace_exact.  Returns 1 if the segment intersects the volume, 
+   and 0 if the segment does not intersect. */
+PLMBASE_C_API int ray_trace_exact_init (
+    int *ai_x, int *ai_y, int *ai_z,
+    int *aixdir, int *aiydir, int *aizdir,
+    double *ao_x, double *ao_y, double *ao_z,
+    double *al_x, double *al_y, double *al_z,
+    double *len,
+    Volume* vol, 
+    Volume_limit *vol_limit,
+    double* p1, 
+    double* p2 
+);
 PLMBASE_C_API void ray_trace_uniform (
     Volume *vol,                  /* Input: volume */
     Volume_limit *vol_limit,      /* Input: min/max coordinates of volume */
@@ -2,6 +2,9 @@
    See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
    ----------------------------------------------------------------------- */
 #include "plmbase_config.h"
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,6 +63,11 @@ static void rpl_ray_trace_callback_range_length (
     size_t vox_index, 
     double vox_len, 
     float vox_value);
+static void rpl_ray_trace_callback_PrSTPR_multi (
+    void *callback_data, 
+    size_t vox_index, 
+    double vox_len, 
+    float vox_value);
 
 typedef struct callback_data Callback_data;
 struct callback_data {
@@ -71,6 +79,85 @@ struct callback_data {
     int last_step_completed;     /* Last step written to output image */
 };
 
+/* Piecewise linear HU curve.  Segment i covers HU values up to 
+   hu_max, the last segment covers everything above. */
+typedef struct hu_curve_segment Hu_curve_segment;
+struct hu_curve_segment {
+    double hu_max;
+    double slope;
+    double offset;
+};
+
+/* Stopping power ratio, from Schneider's paper: 
+   Phys. Med. Biol.41 (1996) 111-124 */
+static const Hu_curve_segment schneider_stpr_curve[] = {
+    { -1000, 0, 0.00106 },
+    { 0, (1 - 0.00106) / 1000, 1 },
+    { 41.46, .001174, 1 },
+    { DBL_MAX, .0005011, 1.0279 }
+};
+static const int schneider_stpr_curve_len 
+    = sizeof (schneider_stpr_curve) / sizeof (Hu_curve_segment);
+
+static inline float
+hu_curve_eval (const Hu_curve_segment *curve, int len, int s, float CT_HU)
+{
+    /* NaN falls through to the last segment */
+    while (s < len - 1 && !(CT_HU <= curve[s].hu_max)) {
+        s++;
+    }
+    if (curve[s].slope == 0) {
+        return curve[s].offset;
+    }
+    return curve[s].slope * CT_HU + curve[s].offset;
+}
+
+/* Lookup table for a piecewise linear HU curve.  Each 1 HU bin 
+   stores the first segment which can contain its values, so that 
+   the lookup skips the breakpoints below the bin, and gives exactly 
+   the same result as evaluating the curve. */
+class Hu_curve_lut {
+public:
+    enum { HU_MIN = -1024, HU_MAX = 4096 };
+    const Hu_curve_segment *curve;
+    int len;
+    unsigned char bin_segment[HU_MAX - HU_MIN];
+public:
+    Hu_curve_lut (const Hu_curve_segment *curve, int len) {
+        this->curve = curve;
+        this->len = len;
+        int s = 0;
+        for (int b = 0; b < HU_MAX - HU_MIN; b++) {
+            double bin_lo = (double) (b + HU_MIN);
+            while (s < len - 1 && bin_lo > curve[s].hu_max) {
+                s++;
+            }
+            bin_segment[b] = (unsigned char) s;
+        }
+    }
+    float lookup (float CT_HU) const {
+        int s = 0;
+        if (CT_HU >= HU_MIN && CT_HU < HU_MAX) {
+            s = bin_segment[(int) floorf (CT_HU) - HU_MIN];
+        } else if (CT_HU >= HU_MAX) {
+            s = bin_segment[HU_MAX - HU_MIN - 1];
+        }
+        return hu_curve_eval (curve, len, s, CT_HU);
+    }
+};
+
+/* Callback data for tracing the stopping power, HU and sigma 
+   volumes in a single pass */
+typedef struct callback_data_multi Callback_data_multi;
+struct callback_data_multi {
+    Callback_data cd;
+    const Hu_curve_lut *stpr_lut;
+    plm_long num_steps;          /* Number of steps in output volumes */
+    float *rpl_img;              /* Output: range length */
+    float *hu_img;               /* Output: HU, may be null */
+    float *sigma_img;            /* Output: range length, may be null */
+};
+
 class Rpl_volume_private {
 public:
     Proj_volume *proj_vol;
@@ -534,7 +621,9 @@ Rpl_volume::compute_rpl_ct_density ()
     d_ptr->proj_vol->set_clipping_dist (clipping_dist);
     d_ptr->proj_vol->allocate ();
     
-    /* Scan through the aperture -- second pass */
+    /* Scan through the aperture -- second pass.  Each ray writes 
+       only its own ray data and its own column of the volume. */
+#pragma omp parallel for schedule (dynamic, 1)
     for (int r = 0; r < ires[1]; r++) {
 
         //if (r % 50 == 0) printf ("Row: %4d/%d\n", r, rows);
@@ -604,6 +693,7 @@ Rpl_volume::compute_rpl_HU ()
     d_ptr->proj_vol->allocate ();
  
     /* Scan through the aperture -- second pass */
+#pragma omp parallel for schedule (dynamic, 1)
     for (int r = 0; r < ires[1]; r++) {
         for (int c = 0; c < ires[0]; c++) {
 
@@ -718,6 +808,7 @@ Rpl_volume::compute_rpl_range_length_rgc ()
     d_ptr->proj_vol->allocate ();
  
     /* Scan through the aperture -- second pass */
+#pragma omp parallel for schedule (dynamic, 1)
     for (int r = 0; r < ires[1]; r++) {
         for (int c = 0; c < ires[0]; c++) {
 
@@ -762,11 +853,19 @@ Rpl_volume::compute_rpl_range_length_rgc ()
 
 void 
 Rpl_volume::compute_rpl_PrSTRP_no_rgc ()
+{
+    this->compute_rpl_PrSTRP_no_rgc (0, 0);
+}
+
+void 
+Rpl_volume::compute_rpl_PrSTRP_no_rgc (
+    Rpl_volume *hu_vol, 
+    Rpl_volume *sigma_vol
+)
 {
     int ires[2];
     /* A couple of abbreviations */
     Proj_volume *proj_vol = d_ptr->proj_vol;
-    const double *src = proj_vol->get_src();
     ires[0] = d_ptr->proj_vol->get_image_dim (0);
     ires[1] = d_ptr->proj_vol->get_image_dim (1);
 
@@ -791,7 +890,60 @@ Rpl_volume::compute_rpl_PrSTRP_no_rgc ()
 
     d_ptr->proj_vol->allocate ();
 
-    /* Scan through the aperture -- second pass */
+    /* Compute intersection with front clipping plane */
+    plm_long num_rays = (plm_long) ires[0] * ires[1];
+    for (plm_long ap_idx = 0; ap_idx < num_rays; ap_idx++) {
+        Ray_data *ray_data = &d_ptr->ray_data[ap_idx];
+        vec3_scale3 (ray_data->cp, ray_data->ray, 
+            d_ptr->front_clipping_dist);
+        vec3_add2 (ray_data->cp, ray_data->p2);
+    }
+
+    /* The HU and sigma volumes are geometrically equal to this one, 
+       so they get a copy of the ray data, clipping planes and CT 
+       instead of computing their own */
+    Rpl_volume *aux_vol[2] = { hu_vol, sigma_vol };
+    float *aux_img[2] = { 0, 0 };
+    for (int i = 0; i < 2; i++) {
+        Rpl_volume *aux = aux_vol[i];
+        if (!aux) {
+            continue;
+        }
+        if (aux->d_ptr->proj_vol->get_image_dim (0) != ires[0]
+            || aux->d_ptr->proj_vol->get_image_dim (1) != ires[1])
+        {
+            print_and_exit ("Error, rpl volumes traced together must "
+                "have the same aperture dimensions\n");
+        }
+        if (aux->d_ptr->ray_data 
+            && aux->d_ptr->ray_data != d_ptr->ray_data)
+        {
+            delete[] aux->d_ptr->ray_data;
+        }
+        aux->d_ptr->ray_data = new Ray_data[num_rays];
+        for (plm_long ap_idx = 0; ap_idx < num_rays; ap_idx++) {
+            aux->d_ptr->ray_data[ap_idx] = d_ptr->ray_data[ap_idx];
+        }
+        aux->d_ptr->ct = d_ptr->ct;
+        aux->set_ct_limit (&d_ptr->ct_limit);
+        aux->d_ptr->front_clipping_dist = d_ptr->front_clipping_dist;
+        aux->d_ptr->back_clipping_dist = d_ptr->back_clipping_dist;
+        aux->d_ptr->proj_vol->set_clipping_dist (clipping_dist);
+        aux->d_ptr->proj_vol->allocate ();
+        if (aux->get_vol()->dim[2] != this->get_vol()->dim[2]) {
+            print_and_exit ("Error, rpl volumes traced together must "
+                "have the same number of steps\n");
+        }
+        aux_img[i] = (float*) aux->get_vol()->img;
+    }
+
+    /* Scan through the aperture -- second pass.  Each ray is traced 
+       once, filling in all of the requested volumes. */
+    Hu_curve_lut stpr_lut (schneider_stpr_curve, schneider_stpr_curve_len);
+    float *rpl_img = (float*) this->get_vol()->img;
+    plm_long num_steps = this->get_vol()->dim[2];
+    double step_length = proj_vol->get_step_length ();
+#pragma omp parallel for schedule (dynamic, 1)
     for (int r = 0; r < ires[1]; r++) {
         for (int c = 0; c < ires[0]; c++) {
 
@@ -800,30 +952,55 @@ Rpl_volume::compute_rpl_PrSTRP_no_rgc ()
 
             /* Make some aliases */
             Ray_data *ray_data = &d_ptr->ray_data[ap_idx];
+            if (!ray_data->intersects_volume) {
+                continue;
+            }
 
-            /* Compute intersection with front clipping plane */
-            vec3_scale3 (ray_data->cp, ray_data->ray, 
-                d_ptr->front_clipping_dist);
-            vec3_add2 (ray_data->cp, ray_data->p2);
-
-#if VERBOSE
-            global_debug = false;
-            if (r == 49 && (c == 49 || c == 50)) {
-                global_debug = true;
+            /* Initialize callback data for this ray.  The first step 
+               is at the aperture, as in rpl_ray_trace(). */
+            Callback_data_multi cdm;
+            cdm.cd.rpl_vol = this;
+            cdm.cd.ray_data = ray_data;
+            cdm.cd.ires = ires;
+            cdm.cd.step_offset = 0;
+            cdm.cd.accum = 0;
+            cdm.cd.last_step_completed = -1;
+            cdm.stpr_lut = &stpr_lut;
+            cdm.num_steps = num_steps;
+            cdm.rpl_img = rpl_img;
+            cdm.hu_img = aux_img[0];
+            cdm.sigma_img = aux_img[1];
+            ray_data->step_offset = 0;
+            for (int i = 0; i < 2; i++) {
+                if (aux_vol[i]) {
+                    aux_vol[i]->d_ptr->ray_data[ap_idx].step_offset = 0;
+                }
             }
-            if (global_debug) {
-                printf ("Tracing ray (%d,%d)\n", r, c);
+
+            ray_trace_uniform (
+                ct_vol,                     // INPUT: CT volume
+                &d_ptr->ct_limit,           // INPUT: CT volume bounding box
+                rpl_ray_trace_callback_PrSTPR_multi, // INPUT: callback
+                &cdm,                       // INPUT: callback data
+                ray_data->p2,               // INPUT: ray starting point
+                ray_data->ip2,              // INPUT: ray ending point
+                step_length);               // INPUT: uniform ray step size
+
+            /* Ray tracer will stop short of rpl volume for central 
+               rays.  Pad the remaining voxels, the range length 
+               keeps its last value and the HU is zero. */
+            for (plm_long s = cdm.cd.last_step_completed + 1; 
+                 s < num_steps; s++)
+            {
+                plm_long idx = num_rays * s + ap_idx;
+                rpl_img[idx] = cdm.cd.accum;
+                if (cdm.hu_img) {
+                    cdm.hu_img[idx] = 0;
+                }
+                if (cdm.sigma_img) {
+                    cdm.sigma_img[idx] = cdm.cd.accum;
+                }
             }
-#endif
-            this->rpl_ray_trace (
-                ct_vol,            /* I: CT volume */
-                ray_data,          /* I: Pre-computed data for this ray */
-                rpl_ray_trace_callback_PrSTPR, /* I: callback */
-                &d_ptr->ct_limit,  /* I: CT bounding region */
-                src,               /* I: @ source */
-                0,            /* I: range compensator thickness */
-                ires               /* I: ray cast resolution */
-            );
         }
     }
     /* Now we only have a rpl_volume without compensator, from which we need to compute the sigma along this ray */
@@ -909,19 +1086,18 @@ Rpl_volume::compute_proj_wed_volume (
   
     const int *ires = proj_vol->get_image_dim();
 
-    int ap_ij[2]; //ray index of rvol
-    plm_long ap_idx = 0;  //ray number
-    Ray_data *ray_data;
-    double ray_ap[3]; //vector from src to ray intersection with ap plane
-    double ray_ap_length; //length of vector from src to ray intersection with ap plane
-    double rglength; //length that we insert into get_rgdepth for each ray
+#pragma omp parallel for schedule (dynamic, 1)
+    for (int r = 0; r < ires[1]; r++) {
+        int ap_ij[2] = { 0, r }; //ray index of rvol
+        double ray_ap[3]; //vector from src to ray intersection with ap plane
+        double ray_ap_length; //length of vector from src to ray intersection with ap plane
+        double rglength; //length that we insert into get_rgdepth for each ray
 
-    for (ap_ij[1] = 0; ap_ij[1] < ires[1]; ap_ij[1]++) {
         for (ap_ij[0] = 0; ap_ij[0] < ires[0]; ap_ij[0]++) {
 
             /* Ray number */
-            ap_idx = ap_ij[1] * ires[0] + ap_ij[0];
-            ray_data = &d_ptr->ray_data[ap_idx];
+            plm_long ap_idx = ap_ij[1] * ires[0] + ap_ij[0];
+            Ray_data *ray_data = &d_ptr->ray_data[ap_idx];
 
             /* Set each ray to "background", defined in wed_main (default 0) */
             proj_wed_vol_img[ap_idx] = background;
@@ -952,12 +1128,14 @@ Rpl_volume::compute_wed_volume (
     float *wed_vol_img = (float*) wed_vol->img;
     const int *ires = proj_vol->get_image_dim();
 
-    plm_long wijk[3];  /* Index within wed_volume */
-
     /* Fill the wed_vol with background values */
     volume_fill (wed_vol, background);
-   
-    for (wijk[1] = 0; wijk[1] < ires[1]; wijk[1]++) {
+
+    /* Each ray writes only its own column of the wed_vol */
+#pragma omp parallel for schedule (dynamic, 1)
+    for (int r = 0; r < ires[1]; r++) {
+        plm_long wijk[3];  /* Index within wed_volume */
+        wijk[1] = r;
         for (wijk[0] = 0; wijk[0] < ires[0]; wijk[0]++) {
 
             /* Compute index of aperture pixel */
@@ -987,8 +1165,8 @@ Rpl_volume::compute_wed_volume (
 
             /* GCS FIX: Why do this?  Is the ray data not already valid? */
 	    if (!volume_limit_clip_segment (&d_ptr->ct_limit, ray_start, ray_end, ray_data->p2, ray_data->ip2)) {
-                printf("Error in ray clipping, exiting...\n");
-                return;
+                printf("Error in ray clipping, skipping ray...\n");
+                continue;
 	    }
 
             /* Loop, looking for each output voxel */
@@ -1671,22 +1849,8 @@ float compute_PrSTPR_from_HU(float CT_HU)
 float 
 compute_PrSTPR_Schneider_weq_from_HU (float CT_HU) // From Schneider's paper: Phys. Med. Biol.41 (1996) 111124
 {
-    if (CT_HU <= -1000)
-    {
-        return 0.00106;
-    }
-    else if (CT_HU > -1000 && CT_HU <= 0)
-    {
-        return (1 - 0.00106) / 1000 * CT_HU + 1;
-    }
-    else if (CT_HU > 0 && CT_HU <= 41.46)
-    {
-        return .001174 * CT_HU + 1;
-    }
-    else
-    {
-        return .0005011 * CT_HU + 1.0279;
-    }
+    return hu_curve_eval (schneider_stpr_curve, 
+        schneider_stpr_curve_len, 0, CT_HU);
 }
 
 float
@@ -1780,6 +1944,7 @@ Rpl_volume::rpl_ray_trace (
     cd.ray_data = ray_data;
     cd.accum = rc_thk;
     cd.ires = ires;
+    cd.last_step_completed = -1;
 
     /* Figure out how many steps to first step within volume */
     cd.step_offset = 0;
@@ -1961,6 +2126,40 @@ rpl_ray_trace_callback_PrSTPR (
     depth_img[ap_area*step_num + ap_idx] = cd->accum;
 }
 
+static
+void
+rpl_ray_trace_callback_PrSTPR_multi (
+    void *callback_data, 
+    size_t vox_index, 
+    double vox_len, 
+    float vox_value
+)
+{
+    Callback_data_multi *cdm = (Callback_data_multi *) callback_data;
+    Callback_data *cd = &cdm->cd;
+    int ap_idx = cd->ray_data->ap_idx;
+    int ap_area = cd->ires[0] * cd->ires[1];
+    size_t step_num = vox_index + cd->step_offset;
+
+    cd->accum += vox_len * cdm->stpr_lut->lookup (vox_value); //vox_value = CT_HU
+
+    cd->last_step_completed = step_num;
+
+    /* Same workaround as rpl_ray_trace_callback_PrSTPR() */
+    if ((plm_long) step_num >= cdm->num_steps) {
+        return;
+    }
+
+    size_t idx = ap_area*step_num + ap_idx;
+    cdm->rpl_img[idx] = cd->accum;
+    if (cdm->hu_img) {
+        cdm->hu_img[idx] = vox_value;
+    }
+    if (cdm->sigma_img) {
+        cdm->sigma_img[idx] = cd->accum;
+    }
+}
+
 static
 void
 rpl_ray_trace_callback_range_length (
@@ -85,6 +85,12 @@ public:
 
     void compute_rpl_range_length_rgc(); // range length volume creation taking into account the range compensator
     void compute_rpl_PrSTRP_no_rgc (); // compute Proton Stopping Power Ratio volume without considering the range compensator
+    /*! \brief Compute the range length volume as above, and in the 
+      same traversal fill hu_vol with the CT in HU and sigma_vol with 
+      a copy of the range length.  Either may be null.  Both must 
+      have the same geometry as this volume, and they receive a copy 
+      of its ray data, clipping planes and CT. */
+    void compute_rpl_PrSTRP_no_rgc (Rpl_volume *hu_vol, Rpl_volume *sigma_vol);
 
     double compute_farthest_penetrating_ray_on_nrm(float range); // return the distance from aperture to the farthest which rg_lenght > range
 
@@ -714,7 +714,7 @@ Segmentation::rasterize (
     bool use_ss_img_vec = true;
 
     printf ("Rasterizing...\n");
-    rasterizer.rasterize (d_ptr->m_rtss.get(), pih, false, want_labelmap, true,
+    rasterizer.rasterize (d_ptr->m_rtss.get(), pih, want_labelmap, true,
         use_ss_img_vec, xor_overlapping);
 
     /* Convert rasterized structure sets from vol to plm_image */
@@ -766,19 +766,24 @@ Segmentation::warp_nondestructive (
         Rtss::clone_empty (0, d_ptr->m_rtss.get()));
     rtss_warped->d_ptr->m_rtss_valid = false;
 
+    /* The labelmap and ss_img share one evaluation of the transform */
+    std::vector<Plm_warp_target> targets;
     if (d_ptr->m_labelmap) {
         printf ("Warping labelmap.\n");
-        Plm_image::Pointer tmp = Plm_image::New();
-        plm_warp (tmp, 0, xf, pih, d_ptr->m_labelmap, 0, use_itk, 0);
-        rtss_warped->d_ptr->m_labelmap = tmp;
-        rtss_warped->d_ptr->m_labelmap->convert (PLM_IMG_TYPE_ITK_ULONG);
+        rtss_warped->d_ptr->m_labelmap = Plm_image::New();
+        targets.push_back (Plm_warp_target (
+                rtss_warped->d_ptr->m_labelmap, d_ptr->m_labelmap, 0, 0));
     }
-
     if (d_ptr->m_ss_img) {
         printf ("Warping ss_img.\n");
-        Plm_image::Pointer tmp = Plm_image::New();
-        plm_warp (tmp, 0, xf, pih, d_ptr->m_ss_img, 0, use_itk, 0);
-        rtss_warped->d_ptr->m_ss_img = tmp;
+        rtss_warped->d_ptr->m_ss_img = Plm_image::New();
+        targets.push_back (Plm_warp_target (
+                rtss_warped->d_ptr->m_ss_img, d_ptr->m_ss_img, 0, 0));
+    }
+    plm_warp_multi (targets, 0, xf, pih, use_itk);
+
+    if (rtss_warped->d_ptr->m_labelmap) {
+        rtss_warped->d_ptr->m_labelmap->convert (PLM_IMG_TYPE_ITK_ULONG);
     }
 
     return rtss_warped;
@@ -790,19 +795,41 @@ Segmentation::warp (
     Plm_image_header *pih, 
     bool use_itk)
 {
+    std::vector<Plm_warp_target> other_targets;
+    this->warp (xf, pih, other_targets, 0, use_itk);
+}
+
+void
+Segmentation::warp (
+    const Xform::Pointer& xf, 
+    Plm_image_header *pih, 
+    std::vector<Plm_warp_target>& other_targets,
+    DeformationFieldType::Pointer *vf,
+    bool use_itk)
+{
+    /* Images are warped together with the caller's images */
+    std::vector<Plm_warp_target> targets = other_targets;
+    Plm_image::Pointer labelmap_warped, ss_img_warped;
     if (d_ptr->m_labelmap) {
         printf ("Warping labelmap.\n");
-        Plm_image::Pointer tmp = Plm_image::New();
-        plm_warp (tmp, 0, xf, pih, d_ptr->m_labelmap, 0, use_itk, 0);
-        d_ptr->m_labelmap = tmp;
-        d_ptr->m_labelmap->convert (PLM_IMG_TYPE_ITK_ULONG);
+        labelmap_warped = Plm_image::New();
+        targets.push_back (Plm_warp_target (
+                labelmap_warped, d_ptr->m_labelmap, 0, 0));
     }
-
     if (d_ptr->m_ss_img) {
         printf ("Warping ss_img.\n");
-        Plm_image::Pointer tmp = Plm_image::New();
-        plm_warp (tmp, 0, xf, pih, d_ptr->m_ss_img, 0, use_itk, 0);
-        d_ptr->m_ss_img = tmp;
+        ss_img_warped = Plm_image::New();
+        targets.push_back (Plm_warp_target (
+                ss_img_warped, d_ptr->m_ss_img, 0, 0));
+    }
+    plm_warp_multi (targets, vf, xf, pih, use_itk);
+
+    if (labelmap_warped) {
+        d_ptr->m_labelmap = labelmap_warped;
+        d_ptr->m_labelmap->convert (PLM_IMG_TYPE_ITK_ULONG);
+    }
+    if (ss_img_warped) {
+        d_ptr->m_ss_img = ss_img_warped;
     }
 
     /* The cxt polylines are now obsolete */
@@ -5,6 +5,7 @@
 #define _segmentation_h_
 
 #include "plmbase_config.h"
+#include <vector>
 
 #include "itk_image_type.h"
 #include "metadata.h"
@@ -14,6 +15,7 @@
 
 class Plm_image;
 class Plm_image_header;
+class Plm_warp_target;
 class Rt_study;
 class Segmentation_private;
 class Rtss_roi;
@@ -81,6 +83,13 @@ public:
         bool use_itk = false) const;
     void warp (const Xform::Pointer& xf, Plm_image_header *pih, 
         bool use_itk = false);
+    /*! \brief Warp the structures together with other images, 
+      see plm_warp_multi().  The transform is evaluated only once 
+      for the structures and the other images. */
+    void warp (const Xform::Pointer& xf, Plm_image_header *pih, 
+        std::vector<Plm_warp_target>& other_targets,
+        DeformationFieldType::Pointer *vf = 0,
+        bool use_itk = false);
     void warp (const Xform::Pointer& xf, Plm_image_header *pih, 
         Warp_parms *parms);
 
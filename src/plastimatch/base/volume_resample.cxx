@@ -10,254 +10,367 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <algorithm>
 
-#include "interpolate.h"
-#include "interpolate_macros.h"
 #include "plm_int.h"
 #include "plm_math.h"
 #include "print_and_exit.h"
 #include "volume.h"
 #include "volume_header.h"
+#include "volume_macros.h"
 #include "volume_resample.h"
 
+/* -----------------------------------------------------------------------
+   The output voxel coordinates are mapped to input voxel coordinates 
+   by an affine map, which accounts for the origin, spacing, and 
+   direction cosines of both volumes.  The output is processed one 
+   row at a time, with rows distributed among threads.  Within a row, 
+   the input coordinate is stepped by a constant increment.
+   ----------------------------------------------------------------------- */
+class Resample_map {
+public:
+    float origin[3];    /* Input coordinates of output voxel (0,0,0) */
+    float step[9];      /* Column c is the increment for output index c */
+public:
+    Resample_map (const Volume *vol_in, const Volume *vol_out) {
+        float d[3];
+        for (int r = 0; r < 3; r++) {
+            d[r] = vol_out->origin[r] - vol_in->origin[r];
+        }
+        for (int r = 0; r < 3; r++) {
+            origin[r] = PROJECT_X (d, (&vol_in->proj[3*r]));
+            for (int c = 0; c < 3; c++) {
+                step[3*r+c] = vol_in->proj[3*r+0] * vol_out->step[3*0+c]
+                    + vol_in->proj[3*r+1] * vol_out->step[3*1+c]
+                    + vol_in->proj[3*r+2] * vol_out->step[3*2+c];
+            }
+        }
+    }
+    /* Input coordinates of first voxel of row (j,k), and the 
+       increment along the row */
+    void row (float start[3], float inc[3], plm_long j, plm_long k) const {
+        for (int r = 0; r < 3; r++) {
+            start[r] = origin[r] + j * step[3*r+1] + k * step[3*r+2];
+            inc[r] = step[3*r+0];
+        }
+    }
+};
+
+/* Voxels are computed in blocks, so that the interpolation weights 
+   can be computed with straight-line arithmetic across the block, 
+   separately from the gathers */
+#define RESAMPLE_BLOCK 64
+
+/* A coordinate is inside the volume if it rounds to a valid index. 
+   This is the same test as Volume::is_inside() */
+#define RESAMPLE_INSIDE(x,y,z,dim)                                      \
+    ((x) > -0.5f && (x) < (dim)[0] - 0.5f                               \
+        && (y) > -0.5f && (y) < (dim)[1] - 0.5f                         \
+        && (z) > -0.5f && (z) < (dim)[2] - 0.5f)
+
+/* Nearest neighbor interpolation of one row.  Outside voxels 
+   get index -1. */
+static void
+resample_row_nn_index (
+    plm_long *idx,
+    plm_long n,
+    const float start[3],
+    const float inc[3],
+    const plm_long *dim)
+{
+    for (plm_long i = 0; i < n; i++) {
+        float x = start[0] + i * inc[0];
+        float y = start[1] + i * inc[1];
+        float z = start[2] + i * inc[2];
+        if (RESAMPLE_INSIDE (x, y, z, dim)) {
+            idx[i] = (plm_long) (x + 0.5f)
+                + dim[0] * ((plm_long) (y + 0.5f)
+                    + dim[1] * (plm_long) (z + 0.5f));
+        } else {
+            idx[i] = -1;
+        }
+    }
+}
+
 /* Nearest neighbor interpolation */
-/* GCS FIX: doesn't respect direction cosines */
-static Volume::Pointer
+static void
 volume_resample_float_nn (
-    const Volume::Pointer& vol_in, 
-    const plm_long* dim, 
-    const float* origin, 
-    const float* spacing)
+    Volume *vol_out,
+    const Volume *vol_in)
 {
-    plm_long i, j, k, v;
-    float x, y, z;
-    float x_in, y_in, z_in;
-    plm_long ijk[3];
-    Volume::Pointer vol_out;
-    float *in_img, *out_img;
-    float val;
-    float default_val = 0.0f;
-
-    vol_out = Volume::New(
-        dim, origin, spacing, vol_in->direction_cosines, PT_FLOAT, 1);
-    in_img = (float*) vol_in->img;
-    out_img = (float*) vol_out->img;
-
-    for (k = 0, v = 0, z = origin[2]; k < dim[2]; k++, z += spacing[2]) {
-        z_in = (z - vol_in->origin[2]) / vol_in->spacing[2];
-        ijk[2] = ROUND_INT (z_in);
-        for (j = 0, y = origin[1]; j < dim[1]; j++, y += spacing[1]) {
-            y_in = (y - vol_in->origin[1]) / vol_in->spacing[1];
-            ijk[1] = ROUND_INT (y_in);
-            for (i = 0, x = origin[0]; i < dim[0]; i++, x += spacing[0], v++) {
-                x_in = (x - vol_in->origin[0]) / vol_in->spacing[0];
-                ijk[0] = ROUND_INT (x_in);
-                if (index_in_volume (vol_in->dim, ijk)) {
-                    plm_long idx = volume_index (vol_in->dim, ijk);
-                    val = in_img[idx];
-                } else {
-                    val = default_val;
-                }
-                out_img[v] = val;
+    const Resample_map map (vol_in, vol_out);
+    const float *in_img = (const float*) vol_in->img;
+    float *out_img = (float*) vol_out->img;
+    const float default_val = 0.0f;
+    plm_long num_rows = vol_out->dim[1] * vol_out->dim[2];
+
+#pragma omp parallel for
+    for (plm_long row = 0; row < num_rows; row++) {
+        plm_long idx[RESAMPLE_BLOCK];
+        float start[3], inc[3];
+        map.row (start, inc, row % vol_out->dim[1], row / vol_out->dim[1]);
+        float *out = &out_img[row * vol_out->dim[0]];
+        for (plm_long b0 = 0; b0 < vol_out->dim[0]; b0 += RESAMPLE_BLOCK) {
+            plm_long nb = std::min ((plm_long) RESAMPLE_BLOCK, 
+                vol_out->dim[0] - b0);
+            float bstart[3];
+            for (int d = 0; d < 3; d++) {
+                bstart[d] = start[d] + b0 * inc[d];
+            }
+            resample_row_nn_index (idx, nb, bstart, inc, vol_in->dim);
+            for (plm_long b = 0; b < nb; b++) {
+                out[b0+b] = (idx[b] < 0) ? default_val : in_img[idx[b]];
             }
         }
     }
-
-    return vol_out;
 }
 
-/* Linear interpolation */
-static Volume::Pointer
+/* Linear interpolation.  Samples inside the volume are clamped 
+   the same way as li_clamp_3d(). */
+static void
 volume_resample_float_li (
-    const Volume::Pointer& vol_in, 
-    const plm_long* dim, 
-    const float* origin, 
-    const float* spacing)
+    Volume *vol_out,
+    const Volume *vol_in)
 {
-    plm_long i, j, k, v;
-    float x, y, z;
-    //float x_in, y_in, z_in;
-    plm_long xidx, yidx, zidx;
-    Volume::Pointer vol_out;
-    float *in_img, *out_img;
-    float val;
-    float default_val = 0.0f;
-    float ijk[3];
-
-    vol_out = Volume::New (
-        dim, origin, spacing, vol_in->direction_cosines, PT_FLOAT, 1);
-    in_img = (float*) vol_in->img;
-    out_img = (float*) vol_out->img;
-
-    for (k = 0, v = 0, z = origin[2]; k < dim[2]; k++, z += spacing[2]) {
-        ijk[2] = (z - vol_in->origin[2]) / vol_in->spacing[2];
-        zidx = ROUND_INT (ijk[2]);
-        for (j = 0, y = origin[1]; j < dim[1]; j++, y += spacing[1]) {
-            ijk[1] = (y - vol_in->origin[1]) / vol_in->spacing[1];
-            yidx = ROUND_INT (ijk[1]);
-            for (i = 0, x = origin[0]; i < dim[0]; i++, x += spacing[0], v++) {
-                ijk[0] = (x - vol_in->origin[0]) / vol_in->spacing[0];
-                xidx = ROUND_INT (ijk[0]);
-                if (zidx < 0 || zidx >= vol_in->dim[2] || 
-                    yidx < 0 || yidx >= vol_in->dim[1] || 
-                    xidx < 0 || xidx >= vol_in->dim[0])
-                {
-                    val = default_val;
-                } else {
-                    plm_long ijk_floor[3];
-                    plm_long ijk_round[3];
-                    float li_1[3], li_2[3];
-                    plm_long idx_floor;
-
-                    // Compute linear interpolation fractions
-                    li_clamp_3d (ijk, ijk_floor, ijk_round,
-                        li_1, li_2, vol_in.get());
-
-                    // Find linear indices for moving image
-                    idx_floor = volume_index (vol_in->dim, ijk_floor);
-
-                    // Calc. moving voxel intensity via linear interpolation
-                    LI_VALUE (
-                        val, 
-                        li_1[0], li_2[0],
-                        li_1[1], li_2[1],
-                        li_1[2], li_2[2],
-                        idx_floor,
-                        in_img, vol_in
-                    );
+    const Resample_map map (vol_in, vol_out);
+    const float *in_img = (const float*) vol_in->img;
+    float *out_img = (float*) vol_out->img;
+    const float default_val = 0.0f;
+    const plm_long *dim = vol_in->dim;
+    plm_long num_rows = vol_out->dim[1] * vol_out->dim[2];
+
+    /* Neighbor offsets, which are zero along axes of length one */
+    const plm_long sx = (dim[0] > 1) ? 1 : 0;
+    const plm_long sy = (dim[1] > 1) ? dim[0] : 0;
+    const plm_long sz = (dim[2] > 1) ? dim[0] * dim[1] : 0;
+    const float fmax[3] = {
+        (float) std::max (dim[0] - 2, (plm_long) 0),
+        (float) std::max (dim[1] - 2, (plm_long) 0),
+        (float) std::max (dim[2] - 2, (plm_long) 0)
+    };
+
+#pragma omp parallel for
+    for (plm_long row = 0; row < num_rows; row++) {
+        plm_long idx[RESAMPLE_BLOCK];
+        float w[8][RESAMPLE_BLOCK];
+        bool inside[RESAMPLE_BLOCK];
+        float start[3], inc[3];
+        map.row (start, inc, row % vol_out->dim[1], row / vol_out->dim[1]);
+        float *out = &out_img[row * vol_out->dim[0]];
+
+        for (plm_long b0 = 0; b0 < vol_out->dim[0]; b0 += RESAMPLE_BLOCK) {
+            plm_long nb = std::min ((plm_long) RESAMPLE_BLOCK, 
+                vol_out->dim[0] - b0);
+
+            /* Weights */
+            for (plm_long b = 0; b < nb; b++) {
+                float x = start[0] + (b0 + b) * inc[0];
+                float y = start[1] + (b0 + b) * inc[1];
+                float z = start[2] + (b0 + b) * inc[2];
+                inside[b] = RESAMPLE_INSIDE (x, y, z, dim);
+                float fx = std::min (std::max (floorf (x), 0.f), fmax[0]);
+                float fy = std::min (std::max (floorf (y), 0.f), fmax[1]);
+                float fz = std::min (std::max (floorf (z), 0.f), fmax[2]);
+                float x2 = std::min (std::max (x - fx, 0.f), 1.f);
+                float y2 = std::min (std::max (y - fy, 0.f), 1.f);
+                float z2 = std::min (std::max (z - fz, 0.f), 1.f);
+                float x1 = 1.f - x2, y1 = 1.f - y2, z1 = 1.f - z2;
+                w[0][b] = x1 * y1 * z1;
+                w[1][b] = x2 * y1 * z1;
+                w[2][b] = x1 * y2 * z1;
+                w[3][b] = x2 * y2 * z1;
+                w[4][b] = x1 * y1 * z2;
+                w[5][b] = x2 * y1 * z2;
+                w[6][b] = x1 * y2 * z2;
+                w[7][b] = x2 * y2 * z2;
+                idx[b] = (plm_long) fx 
+                    + dim[0] * ((plm_long) fy + dim[1] * (plm_long) fz);
+            }
+
+            /* Gathers */
+            for (plm_long b = 0; b < nb; b++) {
+                if (!inside[b]) {
+                    out[b0+b] = default_val;
+                    continue;
                 }
-                out_img[v] = val;
+                const float *p = &in_img[idx[b]];
+                out[b0+b] = w[0][b] * p[0] + w[1][b] * p[sx]
+                    + w[2][b] * p[sy] + w[3][b] * p[sy+sx]
+                    + w[4][b] * p[sz] + w[5][b] * p[sz+sx]
+                    + w[6][b] * p[sz+sy] + w[7][b] * p[sz+sy+sx];
             }
         }
     }
-
-    return vol_out;
 }
 
 /* Nearest neighbor interpolation */
-static Volume::Pointer
+static void
 volume_resample_vf_float_interleaved (
-    const Volume::Pointer& vol_in, const plm_long* dim, 
-    const float* origin, const float* spacing)
+    Volume *vol_out,
+    const Volume *vol_in)
 {
-    plm_long d, i, j, k, v;
-    float x, y, z;
-    float x_in, y_in, z_in;
-    plm_long xidx, yidx, zidx;
-    Volume::Pointer vol_out;
-    float *in_img, *out_img;
-    float* val;
-    float default_val[3] = { 0.0f, 0.0f, 0.0f };
-
-    vol_out = Volume::New (dim, origin, spacing, vol_in->direction_cosines, 
-        PT_VF_FLOAT_INTERLEAVED, 3);
-    in_img = (float*) vol_in->img;
-    out_img = (float*) vol_out->img;
-
-    for (k = 0, v = 0, z = origin[2]; k < dim[2]; k++, z += spacing[2]) {
-        z_in = (z - vol_in->origin[2]) / vol_in->spacing[2];
-        zidx = ROUND_INT (z_in);
-        for (j = 0, y = origin[1]; j < dim[1]; j++, y += spacing[1]) {
-            y_in = (y - vol_in->origin[1]) / vol_in->spacing[1];
-            yidx = ROUND_INT (y_in);
-            for (i = 0, x = origin[0]; i < dim[0]; i++, x += spacing[0]) {
-                x_in = (x - vol_in->origin[0]) / vol_in->spacing[0];
-                xidx = ROUND_INT (x_in);
-                if (zidx < 0 || zidx >= vol_in->dim[2] || yidx < 0 || yidx >= vol_in->dim[1] || xidx < 0 || xidx >= vol_in->dim[0]) {
-                    val = default_val;
+    const Resample_map map (vol_in, vol_out);
+    const float *in_img = (const float*) vol_in->img;
+    float *out_img = (float*) vol_out->img;
+    plm_long num_rows = vol_out->dim[1] * vol_out->dim[2];
+
+#pragma omp parallel for
+    for (plm_long row = 0; row < num_rows; row++) {
+        plm_long idx[RESAMPLE_BLOCK];
+        float start[3], inc[3];
+        map.row (start, inc, row % vol_out->dim[1], row / vol_out->dim[1]);
+        float *out = &out_img[3 * row * vol_out->dim[0]];
+        for (plm_long b0 = 0; b0 < vol_out->dim[0]; b0 += RESAMPLE_BLOCK) {
+            plm_long nb = std::min ((plm_long) RESAMPLE_BLOCK, 
+                vol_out->dim[0] - b0);
+            float bstart[3];
+            for (int d = 0; d < 3; d++) {
+                bstart[d] = start[d] + b0 * inc[d];
+            }
+            resample_row_nn_index (idx, nb, bstart, inc, vol_in->dim);
+            for (plm_long b = 0; b < nb; b++) {
+                float *o = &out[3*(b0+b)];
+                if (idx[b] < 0) {
+                    o[0] = o[1] = o[2] = 0.0f;      /* Default value */
                 } else {
-                    plm_long idx = zidx*vol_in->dim[1]*vol_in->dim[0] + yidx*vol_in->dim[0] + xidx;
-                    val = &in_img[idx*3];
-                }
-                for (d = 0; d < 3; d++, v++) {
-                    out_img[v] = val[d];
+                    o[0] = in_img[3*idx[b]+0];
+                    o[1] = in_img[3*idx[b]+1];
+                    o[2] = in_img[3*idx[b]+2];
                 }
             }
         }
     }
-
-    return vol_out;
 }
 
 /* Nearest neighbor interpolation */
-static Volume::Pointer
+static void
 volume_resample_vf_float_planar (
-    const Volume::Pointer& vol_in, const plm_long* dim, 
-    const float* origin, const float* spacing)
+    Volume *vol_out,
+    const Volume *vol_in)
 {
-    plm_long d, i, j, k, v;
-    float x, y, z;
-    float x_in, y_in, z_in;
-    plm_long xidx, yidx, zidx;
-    Volume::Pointer vol_out;
-    float **in_img, **out_img;
-
-    vol_out = Volume::New (dim, origin, spacing, vol_in->direction_cosines, 
-        PT_VF_FLOAT_PLANAR, 3);
-    in_img = (float**) vol_in->img;
-    out_img = (float**) vol_out->img;
-
-    for (k = 0, v = 0, z = origin[2]; k < dim[2]; k++, z += spacing[2]) {
-        z_in = (z - vol_in->origin[2]) / vol_in->spacing[2];
-        zidx = ROUND_INT (z_in);
-        for (j = 0, y = origin[1]; j < dim[1]; j++, y += spacing[1]) {
-            y_in = (y - vol_in->origin[1]) / vol_in->spacing[1];
-            yidx = ROUND_INT (y_in);
-            for (i = 0, x = origin[0]; i < dim[0]; i++, x += spacing[0], v++) {
-                x_in = (x - vol_in->origin[0]) / vol_in->spacing[0];
-                xidx = ROUND_INT (x_in);
-                if (zidx < 0 || zidx >= vol_in->dim[2] || yidx < 0 || yidx >= vol_in->dim[1] || xidx < 0 || xidx >= vol_in->dim[0]) {
-                    for (d = 0; d < 3; d++) {
-                        out_img[d][v] = 0.0;            /* Default value */
-                    }
-                } else {
-                    for (d = 0; d < 3; d++) {
-                        plm_long idx = zidx*vol_in->dim[1]*vol_in->dim[0] + yidx*vol_in->dim[0] + xidx;
-                        out_img[d][v] = in_img[d][idx];
-                    }
+    const Resample_map map (vol_in, vol_out);
+    const float * const *in_img = (const float * const *) vol_in->img;
+    float **out_img = (float**) vol_out->img;
+    plm_long num_rows = vol_out->dim[1] * vol_out->dim[2];
+
+#pragma omp parallel for
+    for (plm_long row = 0; row < num_rows; row++) {
+        plm_long idx[RESAMPLE_BLOCK];
+        float start[3], inc[3];
+        map.row (start, inc, row % vol_out->dim[1], row / vol_out->dim[1]);
+        plm_long v = row * vol_out->dim[0];
+        for (plm_long b0 = 0; b0 < vol_out->dim[0]; b0 += RESAMPLE_BLOCK) {
+            plm_long nb = std::min ((plm_long) RESAMPLE_BLOCK, 
+                vol_out->dim[0] - b0);
+            float bstart[3];
+            for (int d = 0; d < 3; d++) {
+                bstart[d] = start[d] + b0 * inc[d];
+            }
+            resample_row_nn_index (idx, nb, bstart, inc, vol_in->dim);
+            for (int d = 0; d < 3; d++) {
+                for (plm_long b = 0; b < nb; b++) {
+                    out_img[d][v+b0+b] = (idx[b] < 0) 
+                        ? 0.0f : in_img[d][idx[b]];
                 }
             }
         }
     }
+}
 
+/* Resample vol_in onto the geometry of vol_out, which must already 
+   be allocated with the same pixel type */
+static Volume::Pointer
+volume_resample_into (
+    const Volume::Pointer& vol_in, 
+    const Volume::Pointer& vol_out,
+    bool nearest_neighbor)
+{
+    switch (vol_in->pix_type) {
+    case PT_FLOAT:
+        if (nearest_neighbor) {
+            volume_resample_float_nn (vol_out.get(), vol_in.get());
+        } else {
+            volume_resample_float_li (vol_out.get(), vol_in.get());
+        }
+        break;
+    case PT_VF_FLOAT_INTERLEAVED:
+        volume_resample_vf_float_interleaved (vol_out.get(), vol_in.get());
+        break;
+    case PT_VF_FLOAT_PLANAR:
+        volume_resample_vf_float_planar (vol_out.get(), vol_in.get());
+        break;
+    default:
+        break;
+    }
     return vol_out;
 }
 
-Volume::Pointer
-volume_resample (
+/* Allocate the output volume for the supported pixel types, 
+   or return an empty volume */
+static Volume::Pointer
+volume_resample_create (
     const Volume::Pointer& vol_in, 
     const plm_long* dim, 
     const float* origin, 
-    const float* spacing)
+    const float* spacing,
+    const Direction_cosines& dc,
+    bool nearest_neighbor)
 {
-    Volume::Pointer error_volume = Volume::New();
     switch (vol_in->pix_type) {
     case PT_UCHAR:
+        if (nearest_neighbor) {
+            Volume::Pointer rvol = vol_in->clone (PT_FLOAT);
+            Volume::Pointer vol_out = Volume::New (
+                dim, origin, spacing, dc, PT_FLOAT, 1);
+            volume_resample_into (rvol, vol_out, true);
+            vol_out->convert (PT_UCHAR);
+            return vol_out;
+        }
+        /* Fall through */
     case PT_SHORT:
     case PT_UINT32:
-        fprintf (stderr, "Error, resampling PT_SHORT, PT_UCHAR, PT_UINT32 is unsupported\n");
-        return error_volume;
+        fprintf (stderr, "Error, resampling PT_SHORT, PT_UCHAR, PT_UINT32 "
+            "is unsupported\n");
+        return Volume::New();
     case PT_FLOAT:
-        return volume_resample_float_li (vol_in, dim, origin, spacing);
+        return volume_resample_into (vol_in, 
+            Volume::New (
+                dim, origin, spacing, dc, PT_FLOAT, 1), nearest_neighbor);
     case PT_VF_FLOAT_INTERLEAVED:
-        return volume_resample_vf_float_interleaved (vol_in, dim, origin, spacing);
+        return volume_resample_into (vol_in, 
+            Volume::New (
+                dim, origin, spacing, dc, PT_VF_FLOAT_INTERLEAVED, 3), nearest_neighbor);
     case PT_VF_FLOAT_PLANAR:
-        return volume_resample_vf_float_planar (vol_in, dim, origin, spacing);
+        return volume_resample_into (vol_in, 
+            Volume::New (
+                dim, origin, spacing, dc, PT_VF_FLOAT_PLANAR, 3), nearest_neighbor);
     case PT_UCHAR_VEC_INTERLEAVED:
-        fprintf (stderr, "Error, resampling PT_UCHAR_VEC_INTERLEAVED is unsupported\n");
-        return error_volume;
+        fprintf (stderr, "Error, resampling PT_UCHAR_VEC_INTERLEAVED "
+            "is unsupported\n");
+        return Volume::New();
     default:
         print_and_exit ("Error, unknown pix_type: %d\n", vol_in->pix_type);
-        return error_volume;
+        return Volume::New();
     }
 }
 
+Volume::Pointer
+volume_resample (
+    const Volume::Pointer& vol_in, 
+    const plm_long* dim, 
+    const float* origin, 
+    const float* spacing)
+{
+    return volume_resample_create (vol_in, dim, origin, spacing,
+        vol_in->get_direction_cosines(), false);
+}
+
 Volume::Pointer
 volume_resample (const Volume::Pointer& vol_in, const Volume_header *vh)
 {
-    /* GCS FIX: direction cosines */
-    return volume_resample (vol_in, vh->get_dim(), vh->get_origin(), 
-        vh->get_spacing());
+    return volume_resample_create (vol_in, vh->get_dim(), 
+        vh->get_origin(), vh->get_spacing(), vh->get_direction_cosines(),
+        false);
 }
 
 Volume::Pointer
@@ -267,31 +380,16 @@ volume_resample_nn (
     const float* origin, 
     const float* spacing)
 {
-    Volume::Pointer error_volume = Volume::New();
-    switch (vol_in->pix_type) {
-    case PT_UCHAR: {
-        Volume::Pointer rvol = vol_in->clone (PT_FLOAT);
-        rvol = volume_resample_float_nn (rvol, dim, origin, spacing);
-        rvol->convert (PT_UCHAR);
-        return rvol;
-    }
-    case PT_SHORT:
-    case PT_UINT32:
-        fprintf (stderr, "Error, resampling PT_SHORT and PT_UINT32 is unsupported\n");
-        return error_volume;
-    case PT_FLOAT:
-        return volume_resample_float_nn (vol_in, dim, origin, spacing);
-    case PT_VF_FLOAT_INTERLEAVED:
-        return volume_resample_vf_float_interleaved (vol_in, dim, origin, spacing);
-    case PT_VF_FLOAT_PLANAR:
-        return volume_resample_vf_float_planar (vol_in, dim, origin, spacing);
-    case PT_UCHAR_VEC_INTERLEAVED:
-        fprintf (stderr, "Error, resampling PT_UCHAR_VEC_INTERLEAVED is unsupported\n");
-        return error_volume;
-    default:
-        fprintf (stderr, "Error, unknown pix_type: %d\n", vol_in->pix_type);
-        return error_volume;
-    }
+    return volume_resample_create (vol_in, dim, origin, spacing,
+        vol_in->get_direction_cosines(), true);
+}
+
+Volume::Pointer
+volume_resample_nn (const Volume::Pointer& vol_in, const Volume_header *vh)
+{
+    return volume_resample_create (vol_in, vh->get_dim(), 
+        vh->get_origin(), vh->get_spacing(), vh->get_direction_cosines(),
+        true);
 }
 
 Volume::Pointer
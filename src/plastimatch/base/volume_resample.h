@@ -12,6 +12,9 @@ PLMBASE_API Volume::Pointer volume_resample (
     const float* offset,
     const float* spacing
 );
+/*! \brief Resample onto the geometry of vh, including its 
+  direction cosines.  Float images use linear interpolation, 
+  vector fields use nearest neighbor interpolation. */
 PLMBASE_API Volume::Pointer volume_resample (
     const Volume::Pointer& vol_in, const Volume_header *vh);
 PLMBASE_API Volume::Pointer volume_resample_nn (
@@ -20,6 +23,10 @@ PLMBASE_API Volume::Pointer volume_resample_nn (
     const float* offset,
     const float* spacing
 );
+/*! \brief Resample onto the geometry of vh, including its 
+  direction cosines, using nearest neighbor interpolation. */
+PLMBASE_API Volume::Pointer volume_resample_nn (
+    const Volume::Pointer& vol_in, const Volume_header *vh);
 PLMBASE_API Volume::Pointer volume_subsample_vox (
     const Volume::Pointer& vol_in, const float* sampling_rate);
 PLMBASE_API Volume::Pointer volume_subsample_vox_nn (
@@ -353,7 +353,9 @@ Xform::load (const char* fn)
     } else if (plm_strcmp (buf,"ObjectType = MGH_XFORM") == 0) {
         xform_legacy_load (this, fp);
         fclose(fp);
-    } else if (plm_strcmp(buf,"MGH_GPUIT_BSP <experimental>")==0) {
+    } else if (plm_strcmp(buf,"MGH_GPUIT_BSP <experimental>")==0
+        || plm_strcmp(buf,BSPLINE_XFORM_BINARY_MAGIC)==0)
+    {
         fclose (fp);
         load_gpuit_bsp (this, fn);
     } else {
@@ -404,7 +406,11 @@ load_gpuit_bsp (Xform *xf, const char* fn)
     Bspline_xform* bxf;
 
 #if PLM_CONFIG_LEGACY_BSPLINE_XFORM_IO
-    bxf = bspline_xform_legacy_load ((char*)fn);
+    if (bspline_xform_is_binary (fn)) {
+        bxf = bspline_xform_load ((char*)fn);
+    } else {
+        bxf = bspline_xform_legacy_load ((char*)fn);
+    }
 #else
     bxf = bspline_xform_load ((char*)fn);
 #endif
@@ -2,30 +2,586 @@
    See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
    ----------------------------------------------------------------------- */
 #include "plmcli_config.h"
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <list>
+#include <string>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
+#include "bspline_mi.h"
+#include "bspline_mse.h"
+#include "bspline_optimize.h"
+#include "bspline_parms.h"
+#include "bspline_state.h"
+#include "bspline_warp.h"
+#include "bspline_xform.h"
+#include "demons.h"
+#include "distance_map.h"
+#include "drr.h"
+#include "fdk.h"
+#include "file_util.h"
+#include "gamma_dose_comparison.h"
+#include "metric_state.h"
 #include "pcmd_benchmark.h"
 #include "plm_clp.h"
+#include "plm_image.h"
+#include "plm_math.h"
+#include "plm_timer.h"
+#include "plm_version.h"
+#include "print_and_exit.h"
+#include "proj_image.h"
+#include "proj_matrix.h"
+#include "rt_study.h"
+#include "similarity_metric_type.h"
+#include "string_util.h"
+#include "synthetic_mha.h"
+#include "volume.h"
+#include "volume_grad.h"
+#include "volume_resample.h"
 
 class Benchmark_parms {
 public:
     std::string output_fn;
-    std::string input_fn;
+    int dim[3];
+    int vox_per_rgn;
+    int repeat;
+    std::vector<std::string> kernels;
+    std::vector<int> threads;
+public:
+    Benchmark_parms () {
+        dim[0] = dim[1] = dim[2] = 64;
+        vox_per_rgn = 10;
+        repeat = 3;
+    }
+};
+
+/* Inputs shared by all of the benchmarked kernels.  Everything is
+   created once up front, so that only the kernel itself is timed. */
+class Benchmark_data {
+public:
+    Volume::Pointer fixed;
+    Volume::Pointer moving;
+    Volume::Pointer moving_grad;
+    Volume::Pointer fixed_mask;
+    Volume::Pointer attenuation;
+    Plm_image::Pointer fixed_pli;
+    Plm_image::Pointer moving_pli;
+    Plm_image::Pointer mask_pli;
+
+    Bspline_xform *bxf;
+    Bspline_parms bsp_parms;
+    Bspline_optimize bod;
+    Metric_state::Pointer ms_mse;
+    Metric_state::Pointer ms_mi;
+
+    Volume::Pointer warped;
+    Volume::Pointer recon;
+    Proj_image *proj;
+    Drr_options drr_options;
+    double drr_ps[2];
+public:
+    Benchmark_data () {
+        bxf = 0;
+        proj = 0;
+    }
+    ~Benchmark_data () {
+        delete bxf;
+        delete proj;
+    }
+};
+
+typedef void (*Benchmark_fn) (Benchmark_data *bd, char flavor);
+
+class Benchmark_kernel {
+public:
+    std::string name;
+    Benchmark_fn fn;
+    char flavor;
+    /* Number of voxels processed by one invocation */
+    plm_long num_vox;
+public:
+    Benchmark_kernel (const std::string& name, Benchmark_fn fn,
+        char flavor, plm_long num_vox)
+        : name(name), fn(fn), flavor(flavor), num_vox(num_vox) {}
+};
+
+class Benchmark_result {
+public:
+    int threads;
+    double min_time;
+    double mean_time;
 };
 
+static Volume::Pointer
+benchmark_synth_volume (const Benchmark_parms *parms, float offset)
+{
+    Rt_study rtds;
+    Synthetic_mha_parms sm_parms;
+    sm_parms.pattern = PATTERN_GAUSS;
+    sm_parms.background = 0.f;
+    sm_parms.foreground = 100.f;
+    for (int d = 0; d < 3; d++) {
+        sm_parms.dim[d] = parms->dim[d];
+        sm_parms.spacing[d] = 2.f;
+        sm_parms.origin[d] = - 0.5f * sm_parms.spacing[d]
+            * (sm_parms.dim[d] - 1);
+        sm_parms.gauss_center[d] = offset;
+        sm_parms.gauss_std[d] = 0.2f * sm_parms.spacing[d] * sm_parms.dim[d];
+    }
+    synthetic_mha (&rtds, &sm_parms);
+    return rtds.get_image()->get_volume_float()->clone();
+}
+
+static void
+benchmark_set_threads (int threads)
+{
+#if (OPENMP_FOUND)
+    omp_set_num_threads (threads);
+#endif
+}
+
+static int
+benchmark_max_threads ()
+{
+#if (OPENMP_FOUND)
+    return omp_get_max_threads ();
+#else
+    return 1;
+#endif
+}
+
+/* -----------------------------------------------------------------------
+   Kernels
+   ----------------------------------------------------------------------- */
+static void
+bench_bspline_mse (Benchmark_data *bd, char flavor)
+{
+    Bspline_state *bst = bd->bod.get_bspline_state ();
+    bd->bsp_parms.implementation = flavor;
+    bst->set_metric_state (bd->ms_mse);
+    bst->ssd.reset_score ();
+    bspline_score_mse (&bd->bod);
+}
+
+static void
+bench_bspline_mi (Benchmark_data *bd, char flavor)
+{
+    Bspline_state *bst = bd->bod.get_bspline_state ();
+    bd->bsp_parms.implementation = flavor;
+    bd->bsp_parms.mi_hist_accum = MI_HIST_ACCUM_COPIES;
+    bst->set_metric_state (bd->ms_mi);
+    bst->ssd.reset_score ();
+    bspline_score_mi (&bd->bod);
+}
+
+static void
+bench_bspline_mi_private (Benchmark_data *bd, char flavor)
+{
+    Bspline_state *bst = bd->bod.get_bspline_state ();
+    bd->bsp_parms.implementation = flavor;
+    bd->bsp_parms.mi_hist_accum = MI_HIST_ACCUM_PRIVATE;
+    bst->set_metric_state (bd->ms_mi);
+    bst->ssd.reset_score ();
+    bspline_score_mi (&bd->bod);
+}
+
+static void
+bench_bspline_warp (Benchmark_data *bd, char flavor)
+{
+    bspline_warp (bd->warped.get(), 0, bd->bxf, bd->moving, 1, 0.f);
+}
+
+static void
+bench_volume_resample (Benchmark_data *bd, char flavor)
+{
+    /* Upsample by a factor of two in-plane */
+    const Volume *vin = bd->moving.get();
+    plm_long dim[3] = { 2 * vin->dim[0], 2 * vin->dim[1], vin->dim[2] };
+    float spacing[3] = {
+        0.5f * vin->spacing[0], 0.5f * vin->spacing[1], vin->spacing[2] };
+    Volume::Pointer vout = volume_resample (
+        bd->moving, dim, vin->origin, spacing);
+}
+
+static void
+bench_fdk (Benchmark_data *bd, char flavor)
+{
+    switch (flavor) {
+    case 'a':
+        project_volume_onto_image_a (bd->recon.get(), bd->proj, 1.f);
+        break;
+    case 'b':
+        project_volume_onto_image_b (bd->recon.get(), bd->proj, 1.f);
+        break;
+    case 'c':
+        project_volume_onto_image_c (bd->recon.get(), bd->proj, 1.f);
+        break;
+    case 'd':
+        project_volume_onto_image_d (bd->recon.get(), bd->proj, 1.f);
+        break;
+    case 'e': {
+        /* One full batch, using the same image for each slot */
+        Proj_image *batch[FDK_BATCH_SIZE];
+        for (int i = 0; i < FDK_BATCH_SIZE; i++) {
+            batch[i] = bd->proj;
+        }
+        project_volume_onto_images_e (bd->recon.get(), batch,
+            FDK_BATCH_SIZE, 1.f);
+        break;
+    }
+    }
+}
+
+static void
+bench_drr (Benchmark_data *bd, char flavor)
+{
+    switch (flavor) {
+    case 'e':
+        bd->drr_options.algorithm = DRR_ALGORITHM_EXACT;
+        break;
+    case 'u':
+        bd->drr_options.algorithm = DRR_ALGORITHM_UNIFORM;
+        break;
+    }
+    drr_render_volume_perspective (bd->proj, bd->attenuation.get(),
+        bd->drr_ps, 0, &bd->drr_options);
+}
+
+static void
+bench_demons (Benchmark_data *bd, char flavor)
+{
+    Demons_parms parms;
+    demons_default_parms (&parms);
+    parms.threading = (flavor == 's') 
+        ? THREADING_CPU_SINGLE : THREADING_CPU_OPENMP;
+    parms.max_its = 5;
+    Volume *vf = demons (bd->fixed.get(), bd->moving.get(),
+        bd->moving_grad.get(), 0, &parms);
+    delete vf;
+}
+
+static void
+bench_dmap (Benchmark_data *bd, char flavor)
+{
+    Distance_map dmap;
+    dmap.set_input_image (bd->mask_pli);
+    dmap.set_algorithm ("native_danielsson");
+    dmap.run ();
+}
+
+static void
+bench_gamma (Benchmark_data *bd, char flavor)
+{
+    Gamma_dose_comparison gdc;
+    gdc.set_reference_image (bd->fixed_pli);
+    gdc.set_compare_image (bd->moving_pli);
+    gdc.set_spatial_tolerance (3.f);
+    gdc.set_dose_difference_tolerance (0.03f);
+    gdc.set_analysis_threshold (0.1f);
+    gdc.run ();
+}
+
+/* -----------------------------------------------------------------------
+   Setup
+   ----------------------------------------------------------------------- */
+static void
+benchmark_setup_registration (Benchmark_data *bd,
+    const Benchmark_parms *parms)
+{
+    Volume *fixed = bd->fixed.get();
+    plm_long roi_offset[3] = { 0, 0, 0 };
+    plm_long vox_per_rgn[3] = {
+        parms->vox_per_rgn, parms->vox_per_rgn, parms->vox_per_rgn };
+
+    bd->bxf = new Bspline_xform;
+    bd->bxf->initialize (fixed->origin, fixed->spacing, fixed->dim,
+        roi_offset, fixed->dim, vox_per_rgn,
+        fixed->get_direction_matrix());
+
+    /* Use a small, non-trivial deformation so that all voxels
+       take the same code path as in a real registration */
+    bd->bxf->fill_coefficients (0.f);
+    bd->bxf->jitter_if_zero ();
+
+    bd->ms_mse = Metric_state::New ();
+    bd->ms_mse->metric_type = SIMILARITY_METRIC_MSE;
+    bd->ms_mse->fixed_ss = bd->fixed;
+    bd->ms_mse->moving_ss = bd->moving;
+    bd->ms_mse->moving_grad = bd->moving_grad;
+
+    bd->ms_mi = Metric_state::New ();
+    bd->ms_mi->metric_type = SIMILARITY_METRIC_MI_MATTES;
+    bd->ms_mi->fixed_ss = bd->fixed;
+    bd->ms_mi->moving_ss = bd->moving;
+    bd->ms_mi->moving_grad = bd->moving_grad;
+
+    Bspline_state *bst = bd->bod.get_bspline_state ();
+    bst->similarity_data.push_back (bd->ms_mse);
+    bst->similarity_data.push_back (bd->ms_mi);
+    bd->bod.set_bspline_parms (&bd->bsp_parms);
+    bd->bod.set_bspline_xform (bd->bxf);
+    bst->initialize (bd->bxf, &bd->bsp_parms);
+    bst->initialize_mi_histograms ();
+
+    bd->warped = Volume::New (fixed->dim, fixed->origin, fixed->spacing,
+        fixed->direction_cosines, PT_FLOAT, 1);
+}
+
+static void
+benchmark_setup_projection (Benchmark_data *bd,
+    const Benchmark_parms *parms)
+{
+    Volume *fixed = bd->fixed.get();
+
+    bd->recon = bd->fixed->clone_empty ();
+    bd->attenuation = bd->fixed->clone ();
+    drr_preprocess_attenuation (bd->attenuation.get());
+
+    /* Panel geometry is scaled so that the volume fills the panel */
+    int ires[2] = { (int) (2 * fixed->dim[0]), (int) (2 * fixed->dim[2]) };
+    double sad = 1000.;
+    double sid = 1500.;
+    double extent = 0.;
+    for (int d = 0; d < 3; d++) {
+        double e = fixed->spacing[d] * fixed->dim[d];
+        if (e > extent) extent = e;
+    }
+    double mag = sid / sad;
+    double ps[2] = { 1.5 * mag * extent / ires[0],
+                     1.5 * mag * extent / ires[1] };
+    double ic[2] = { (ires[0] - 1) / 2., (ires[1] - 1) / 2. };
+    double cam[3] = { 0., - sad, 0. };
+    double tgt[3] = { 0., 0., 0. };
+    double vup[3] = { 0., 0., 1. };
+
+    bd->proj = new Proj_image;
+    proj_image_create_pmat (bd->proj);
+    proj_image_create_img (bd->proj, ires);
+    bd->proj->pmat->set (cam, tgt, vup, sid, ic, ps, ires);
+    for (plm_long i = 0; i < (plm_long) ires[0] * ires[1]; i++) {
+        bd->proj->img[i] = 1.f;
+    }
+
+    Drr_options *opt = &bd->drr_options;
+    opt->threading = THREADING_CPU_OPENMP;
+    opt->image_resolution[0] = ires[0];
+    opt->image_resolution[1] = ires[1];
+    opt->image_window[0] = 0;
+    opt->image_window[1] = ires[1] - 1;
+    opt->image_window[2] = 0;
+    opt->image_window[3] = ires[0] - 1;
+    opt->have_image_window = 1;
+    opt->sad = sad;
+    opt->sid = sid;
+    opt->scale = 1.f;
+    opt->exponential_mapping = 0;
+    opt->hu_conversion = PREPROCESS_CONVERSION;
+    opt->algorithm = DRR_ALGORITHM_EXACT;
+    opt->output_details_fn = "";
+    bd->drr_ps[0] = ps[0];
+    bd->drr_ps[1] = ps[1];
+}
+
+static void
+benchmark_setup (Benchmark_data *bd, const Benchmark_parms *parms)
+{
+    bd->fixed = benchmark_synth_volume (parms, 0.f);
+    bd->moving = benchmark_synth_volume (parms, 3.f);
+    bd->moving_grad = volume_gradient (bd->moving);
+
+    /* Mask for distance map */
+    bd->fixed_mask = Volume::New (bd->fixed->dim, bd->fixed->origin,
+        bd->fixed->spacing, bd->fixed->direction_cosines, PT_UCHAR, 1);
+    const float *f_img = bd->fixed->get_raw<float> ();
+    unsigned char *m_img = bd->fixed_mask->get_raw<unsigned char> ();
+    for (plm_long i = 0; i < bd->fixed->npix; i++) {
+        m_img[i] = (f_img[i] > 50.f) ? 1 : 0;
+    }
+
+    bd->fixed_pli = Plm_image::New (bd->fixed->clone());
+    bd->moving_pli = Plm_image::New (bd->moving->clone());
+    bd->mask_pli = Plm_image::New (bd->fixed_mask);
+
+    benchmark_setup_registration (bd, parms);
+    benchmark_setup_projection (bd, parms);
+}
+
+static void
+benchmark_kernel_list (
+    std::list<Benchmark_kernel>& kl,
+    const Benchmark_data *bd)
+{
+    plm_long nv = bd->fixed->npix;
+    const char *mse_flavors = "cghiklm";
+    const char *mi_flavors = "cdefghikl";
+    const char *fdk_flavors = "abcd";
+
+    for (const char *f = mse_flavors; *f; f++) {
+        kl.push_back (Benchmark_kernel (
+                string_format ("bspline-mse-%c", *f),
+                &bench_bspline_mse, *f, nv));
+    }
+    for (const char *f = mi_flavors; *f; f++) {
+        kl.push_back (Benchmark_kernel (
+                string_format ("bspline-mi-%c", *f),
+                &bench_bspline_mi, *f, nv));
+    }
+    kl.push_back (Benchmark_kernel ("bspline-mi-i-private",
+            &bench_bspline_mi_private, 'i', nv));
+    kl.push_back (Benchmark_kernel ("bspline-warp",
+            &bench_bspline_warp, 0, nv));
+    kl.push_back (Benchmark_kernel ("volume-resample",
+            &bench_volume_resample, 0, 4 * nv));
+    for (const char *f = fdk_flavors; *f; f++) {
+        kl.push_back (Benchmark_kernel (
+                string_format ("fdk-%c", *f), &bench_fdk, *f, nv));
+    }
+    kl.push_back (Benchmark_kernel ("fdk-e",
+            &bench_fdk, 'e', FDK_BATCH_SIZE * nv));
+    plm_long num_rays = (plm_long) bd->proj->dim[0] * bd->proj->dim[1];
+    kl.push_back (Benchmark_kernel ("drr-exact",
+            &bench_drr, 'e', num_rays));
+    kl.push_back (Benchmark_kernel ("drr-uniform",
+            &bench_drr, 'u', num_rays));
+    kl.push_back (Benchmark_kernel ("demons", &bench_demons, 0, nv));
+    kl.push_back (Benchmark_kernel ("demons-single", &bench_demons, 's', nv));
+    kl.push_back (Benchmark_kernel ("dmap", &bench_dmap, 0, nv));
+    kl.push_back (Benchmark_kernel ("gamma", &bench_gamma, 0, nv));
+}
+
+/* A kernel is selected if a requested name is "all", or is
+   a prefix of the kernel name (e.g. "bspline-mse" selects
+   all MSE flavors) */
+static bool
+benchmark_kernel_selected (
+    const Benchmark_parms *parms,
+    const std::string& name)
+{
+    std::vector<std::string>::const_iterator it;
+    for (it = parms->kernels.begin(); it != parms->kernels.end(); ++it) {
+        if (*it == "all" || string_starts_with (name, it->c_str())) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+benchmark_write_report (
+    const Benchmark_parms *parms,
+    const std::list<std::pair<Benchmark_kernel,
+        std::vector<Benchmark_result> > >& results)
+{
+    make_parent_directories (parms->output_fn.c_str());
+    FILE *fp = plm_fopen (parms->output_fn.c_str(), "w");
+    if (!fp) {
+        print_and_exit ("Error opening file %s for write\n",
+            parms->output_fn.c_str());
+    }
+
+    fprintf (fp, "{\n");
+    fprintf (fp, "  \"version\": \"%s\",\n", PLASTIMATCH_VERSION_STRING);
+    fprintf (fp, "  \"dim\": [%d, %d, %d],\n",
+        parms->dim[0], parms->dim[1], parms->dim[2]);
+    fprintf (fp, "  \"repeat\": %d,\n", parms->repeat);
+    fprintf (fp, "  \"max_threads\": %d,\n", benchmark_max_threads ());
+    fprintf (fp, "  \"kernels\": [");
+
+    std::list<std::pair<Benchmark_kernel,
+        std::vector<Benchmark_result> > >::const_iterator it;
+    for (it = results.begin(); it != results.end(); ++it) {
+        const Benchmark_kernel& bk = it->first;
+        const std::vector<Benchmark_result>& br = it->second;
+        fprintf (fp, "%s\n    {\n", it == results.begin() ? "" : ",");
+        fprintf (fp, "      \"name\": \"%s\",\n", bk.name.c_str());
+        fprintf (fp, "      \"voxels\": %lld,\n", (long long) bk.num_vox);
+        fprintf (fp, "      \"runs\": [");
+        for (size_t i = 0; i < br.size(); i++) {
+            double vps = br[i].min_time > 0
+                ? bk.num_vox / br[i].min_time : 0.;
+            double speedup = br[i].min_time > 0
+                ? br[0].min_time / br[i].min_time : 0.;
+            fprintf (fp, "%s\n        { \"threads\": %d, "
+                "\"min_time\": %.6f, \"mean_time\": %.6f, "
+                "\"voxels_per_second\": %.1f, \"speedup\": %.3f }",
+                i == 0 ? "" : ",", br[i].threads,
+                br[i].min_time, br[i].mean_time, vps, speedup);
+        }
+        fprintf (fp, "\n      ]\n    }");
+    }
+    fprintf (fp, "\n  ]\n}\n");
+    fclose (fp);
+}
+
+static void
+do_benchmark (Benchmark_parms *parms)
+{
+    Benchmark_data bd;
+    int max_threads = benchmark_max_threads ();
+
+    printf ("Creating synthetic inputs (%d x %d x %d)\n",
+        parms->dim[0], parms->dim[1], parms->dim[2]);
+    benchmark_setup (&bd, parms);
+
+    std::list<Benchmark_kernel> kl;
+    benchmark_kernel_list (kl, &bd);
+
+    std::list<std::pair<Benchmark_kernel,
+        std::vector<Benchmark_result> > > results;
+    std::list<Benchmark_kernel>::iterator it;
+    for (it = kl.begin(); it != kl.end(); ++it) {
+        if (!benchmark_kernel_selected (parms, it->name)) {
+            continue;
+        }
+        std::vector<Benchmark_result> br;
+        for (size_t t = 0; t < parms->threads.size(); t++) {
+            Benchmark_result r;
+            r.threads = parms->threads[t];
+            r.min_time = DBL_MAX;
+            r.mean_time = 0.;
+            benchmark_set_threads (r.threads);
+
+            /* Warm-up run, not timed */
+            (*it->fn) (&bd, it->flavor);
+            for (int i = 0; i < parms->repeat; i++) {
+                Plm_timer timer;
+                timer.start ();
+                (*it->fn) (&bd, it->flavor);
+                double elapsed = timer.report ();
+                r.mean_time += elapsed;
+                if (elapsed < r.min_time) r.min_time = elapsed;
+            }
+            r.mean_time /= parms->repeat;
+            printf ("BENCHMARK %-18s threads %3d  min %10.6f s"
+                "  mean %10.6f s\n", it->name.c_str(), r.threads,
+                r.min_time, r.mean_time);
+            br.push_back (r);
+        }
+        results.push_back (std::make_pair (*it, br));
+    }
+    benchmark_set_threads (max_threads);
+
+    benchmark_write_report (parms, results);
+}
+
 static void
 usage_fn (dlib::Plm_clp* parser, int argc, char *argv[])
 {
-    printf ("Usage: plastimatch %s [options] input_file\n", argv[1]);
+    printf ("Usage: plastimatch %s [options]\n", argv[1]);
     parser->print_options (std::cout);
     std::cout << std::endl;
 }
 
 static void
 parse_fn (
-    Benchmark_parms* parms, 
-    dlib::Plm_clp* parser, 
-    int argc, 
+    Benchmark_parms* parms,
+    dlib::Plm_clp* parser,
+    int argc,
     char* argv[]
 )
 {
@@ -33,8 +589,23 @@ parse_fn (
     parser->add_default_options ();
 
     /* Output files */
-    parser->add_long_option ("", "output", 
-        "filename for output image", 1, "");
+    parser->add_long_option ("", "output",
+        "filename for output report (json)", 1, "");
+
+    /* Benchmark options */
+    parser->add_long_option ("", "dim",
+        "size of synthetic input volumes in voxels \"x [y z]\"",
+        1, "64");
+    parser->add_long_option ("", "grid-spacing",
+        "b-spline grid spacing in voxels", 1, "10");
+    parser->add_long_option ("", "kernels",
+        "comma separated list of kernels (or kernel name prefixes) "
+        "to run, such as \"bspline-mse,fdk-c,gamma\"", 1, "all");
+    parser->add_long_option ("", "threads",
+        "comma separated list of thread counts, such as \"1,2,4\"; "
+        "default is one thread and all available threads", 1, "");
+    parser->add_long_option ("", "repeat",
+        "number of timed runs of each kernel", 1, "3");
 
     /* Parse options */
     parser->parse (argc,argv);
@@ -48,20 +619,41 @@ parse_fn (
 		"using the --output option"));
     }
 
-    /* Check that one, and only one, input file was given */
-    if (parser->number_of_arguments() == 0) {
-	throw (dlib::error ("Error.  You must specify an input file"));
-	
-    } else if (parser->number_of_arguments() > 1) {
-	std::string extra_arg = (*parser)[1];
+    /* Inputs are synthetic, so no arguments are expected */
+    if (parser->number_of_arguments() > 0) {
+	std::string extra_arg = (*parser)[0];
 	throw (dlib::error ("Error.  Unknown option " + extra_arg));
     }
 
-    /* Copy input filenames to parms struct */
-    parms->input_fn = (*parser)[0];
-
     /* Output files */
     parms->output_fn = parser->get_string("output");
+
+    /* Benchmark options */
+    parser->assign_int13 (parms->dim, "dim");
+    parms->vox_per_rgn = parser->get_int ("grid-spacing");
+    parms->repeat = parser->get_int ("repeat");
+    if (parms->repeat < 1) {
+	throw (dlib::error ("Error.  --repeat must be at least one"));
+    }
+    parms->kernels = string_split (parser->get_string ("kernels"), ',');
+    std::string threads = parser->get_string ("threads");
+    if (threads == "") {
+        int max_threads = benchmark_max_threads ();
+        parms->threads.push_back (1);
+        if (max_threads > 1) {
+            parms->threads.push_back (max_threads);
+        }
+    } else {
+        std::vector<std::string> tl = string_split (threads, ',');
+        for (size_t i = 0; i < tl.size(); i++) {
+            int t = atoi (tl[i].c_str());
+            if (t < 1) {
+                throw (dlib::error ("Error.  Couldn't parse --threads "
+                        "option: " + threads));
+            }
+            parms->threads.push_back (t);
+        }
+    }
 }
 
 void
@@ -71,4 +663,6 @@ do_command_benchmark (int argc, char *argv[])
 
     /* Parse command line parameters */
     plm_clp_parse (&parms, &parse_fn, &usage_fn, argc, argv, 1);
+
+    do_benchmark (&parms);
 }
@@ -56,9 +56,11 @@ static void
 vf_compare (Compare_parms* parms)
 {
     int d;
-    Volume *vol1, *vol2;
+    Volume::Pointer vol1, vol2;
 
-    vol1 = read_mha (parms->img_in_1_fn.c_str());
+    /* The vector fields are only read, so they can be mapped
+       rather than copied into memory */
+    vol1 = read_mha_mapped (parms->img_in_1_fn.c_str());
     if (!vol1) {
 	fprintf (stderr, 
 	    "Sorry, couldn't open file \"%s\" for read.\n", 
@@ -73,7 +75,7 @@ vf_compare (Compare_parms* parms)
 	exit (-1);
     }
 
-    vol2 = read_mha (parms->img_in_2_fn.c_str());
+    vol2 = read_mha_mapped (parms->img_in_2_fn.c_str());
     if (!vol2) {
 	fprintf (stderr, 
 	    "Sorry, couldn't open file \"%s\" for read.\n", 
@@ -96,10 +98,7 @@ vf_compare (Compare_parms* parms)
 	}
     }
 
-    vf_analyze (vol1, vol2);
-
-    delete vol1;
-    delete vol2;
+    vf_analyze (vol1.get(), vol2.get());
 }
 
 static void
@@ -79,9 +79,10 @@ parse_fn (
         "a string that specifies the algorithm used for distance "
         "map calculation, either "
         "\"maurer\", "
+        "\"edt\", "
         "\"danielsson\", "
         " or \"itk-danielsson\" "
-        "(default is \"danielsson\")",
+        "(default is \"maurer\")",
         1, "maurer");
     parser->add_long_option ("", "squared-distance",
         "return the squared distance instead of distance", 0);
@@ -3,6 +3,7 @@
    ----------------------------------------------------------------------- */
 #include "plmcli_config.h"
 
+#include "bspline_xform.h"
 #include "gdcm1_dose.h"
 #include "itk_image_load.h"
 #include "itk_image_stats.h"
@@ -81,6 +82,33 @@ stats_vf_main (Stats_parms* parms, const std::string& current_fn)
     }
 }
 
+static void
+stats_bspline_main (Stats_parms* parms, const std::string& current_fn)
+{
+    Xform xf;
+    xf.load (current_fn);
+    if (xf.m_type != XFORM_GPUIT_BSPLINE) {
+	print_and_exit ("Error: input file %s is not a B-spline transform\n", 
+            current_fn.c_str());
+    }
+    Bspline_xform *bxf = xf.get_gpuit_bsp ();
+
+    double min_val = 0, max_val = 0, sum = 0;
+    for (int i = 0; i < bxf->num_coeff; i++) {
+        float c = bxf->coeff[i];
+        if (i == 0 || c < min_val) min_val = c;
+        if (i == 0 || c > max_val) max_val = c;
+        sum += c;
+    }
+    printf ("%s: %d %d %d knots\n", 
+        plm_file_format_string (PLM_FILE_FMT_BSPLINE_XFORM),
+        (int) bxf->cdims[0], (int) bxf->cdims[1], (int) bxf->cdims[2]);
+    printf ("MIN %f AVE %f MAX %f NUMCOEFF %d\n", 
+	(float) min_val, 
+        (float) (bxf->num_coeff ? sum / bxf->num_coeff : 0), 
+        (float) max_val, bxf->num_coeff);
+}
+
 static void
 stats_pointset_main (Stats_parms* parms, const std::string& current_fn)
 {
@@ -174,6 +202,9 @@ stats_main (Stats_parms* parms)
         case PLM_FILE_FMT_VF:
             stats_vf_main (parms, current_fn);
             break;
+        case PLM_FILE_FMT_BSPLINE_XFORM:
+            stats_bspline_main (parms, current_fn);
+            break;
         case PLM_FILE_FMT_POINTSET:
             stats_pointset_main (parms, current_fn);
             break;
@@ -16,6 +16,7 @@ public:
     std::string vf_in_fn;
     std::string vf_out_fn;
     std::string fixed_img_fn;
+    std::string residual_fn;
     bool have_dim;
     bool have_origin;
     bool have_spacing;
@@ -23,12 +24,15 @@ public:
     float origin[3];
     float spacing[3];
     bool old_algorithm;
+    bool fixed_point;
     int iterations;
+    float tolerance;
 public:
     Vf_invert_parms () {
         vf_in_fn = "";
         vf_out_fn = "";
         fixed_img_fn = "";
+        residual_fn = "";
         for (int d = 0; d < 3; d++) {
             dim[d] = 0;
             origin[d] = 0.f;
@@ -38,7 +42,9 @@ public:
         have_origin = false;
         have_spacing = false;
         old_algorithm = false;
+        fixed_point = false;
         iterations = 20;
+        tolerance = 0.01f;
     }
 };
 
@@ -186,12 +192,20 @@ do_vf_invert_new (Vf_invert_parms* parms)
 #endif
 
     vf_invert.set_iterations (parms->iterations);
+    if (parms->fixed_point) {
+        vf_invert.set_algorithm (VF_INVERT_FIXED_POINT);
+        vf_invert.set_tolerance (parms->tolerance);
+    }
 
     /* Invert the vf */
     vf_invert.run ();
 
     /* Write the output */
     write_mha (parms->vf_out_fn.c_str(), vf_invert.get_output_volume());
+    if (parms->residual_fn != "" && vf_invert.get_residual_volume()) {
+        write_mha (parms->residual_fn.c_str(), 
+            vf_invert.get_residual_volume());
+    }
 #if defined (commentout)
     plm_image_save_vol (parms->vf_out_fn.c_str(), 
         vf_invert.get_output_volume());
@@ -246,6 +260,14 @@ parse_fn (
         "use the old algorithm", 0);
     parser->add_long_option ("", "iterations", 
         "number of iterations to run (default = 20)", 1, "");
+    parser->add_long_option ("", "fixed-point", 
+        "use the multi-resolution fixed point algorithm", 0);
+    parser->add_long_option ("", "tolerance", 
+        "convergence tolerance in mm of the fixed point algorithm "
+        "(default = 0.01)", 1, "");
+    parser->add_long_option ("", "output-residual", 
+        "output image with the residual in mm of the fixed point "
+        "algorithm", 1, "");
 
     /* Parse the command line arguments */
     parser->parse (argc,argv);
@@ -300,6 +322,15 @@ parse_fn (
     if (parser->option ("iterations")) {
         parser->get_value (parms->iterations, "iterations");
     }
+    if (parser->option ("fixed-point")) {
+        parms->fixed_point = true;
+    }
+    if (parser->option ("tolerance")) {
+        parser->get_value (parms->tolerance, "tolerance");
+    }
+    if (parser->option ("output-residual")) {
+        parms->residual_fn = parser->get_string("output-residual");
+    }
 }
 
 void
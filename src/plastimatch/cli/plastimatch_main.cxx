@@ -48,6 +48,7 @@
 #include "pcmd_xf_convert.h"
 #include "pcmd_xio_dvh.h"
 #include "plm_exception.h"
+#include "plm_profiler.h"
 #include "plm_version.h"
 #include "print_and_exit.h"
 
@@ -296,8 +297,12 @@ main (int argc, char *argv[])
         do_command (argc, argv);
     } catch (const Plm_exception& pe) {
         //fprintf (stderr, "%s", pe.what());
+        Plm_profiler::get()->dump ();
         return 1;
     }
 
+    /* Write profile if requested by PLM_PROFILE environment variable */
+    Plm_profiler::get()->dump ();
+
     return 0;
 }
@@ -137,7 +137,6 @@ void compute_dose_ray_desplanques (
     int ijk_ct[3] = {0,0,0};
     double entrance_length = 0;
     double distance = 0; // distance from the aperture to the POI
-    double tmp[3] = {0.0f, 0.0f, 0.0f};
     double PB_density = 1/(beam->rpl_vol->get_aperture()->get_spacing(0) * beam->rpl_vol->get_aperture()->get_spacing(1));
     double ct_density = 0;
     double WER = 0;
@@ -151,14 +150,11 @@ void compute_dose_ray_desplanques (
     float off_axis_factor = 0;
 
     int idx = 0; // index to travel in the dose volume
-    int idx_bev = 0; // second index for reconstructing the final image
     int idx_room = 0;
     int i_min = 0;
     int i_max = 0;
     int j_min = 0;
     int j_max = 0;
-    bool test = true;
-    bool* in = &test;
 
     float* img = (float*) dose_volume->img;
     float* ct_img = (float*) ct_vol->img;
@@ -308,26 +304,34 @@ void compute_dose_ray_desplanques (
         }
     }
 
+    /* Resample the beam's eye view dose into the CT grid.  Each CT 
+       voxel is written once, so the columns are computed 
+       concurrently. */
     float* final_dose_img = (float*) final_dose_volume->img;
-    int ijk[3] = {0,0,0};
-    float ijk_bev[3] = {0,0,0};
-    int ijk_bev_trunk[3];
-    float xyz_bev[3] = {0.0,0.0,0.0};
-    plm_long mijk_f[3];
-    plm_long mijk_r[3];
-    plm_long idx_lower_left = 0;
-    float li_frac1[3];
-    float li_frac2[3];
     const plm_long *dim_ct = ct_vol->dim;
     plm_long dose_bev_dim[3] = { dose_volume->dim[0], dose_volume->dim[1], dose_volume->dim[2]};
 
-    for (ijk[0] = 0; ijk[0] < dim_ct[0]; ijk[0]++)
+#pragma omp parallel for schedule (dynamic, 1)
+    for (int i0 = 0; i0 < (int) dim_ct[0]; i0++)
     {
+        int ijk[3] = {i0,0,0};
+        float ijk_bev[3] = {0,0,0};
+        int ijk_bev_trunk[3];
+        float xyz_bev[3] = {0.0,0.0,0.0};
+        double xyz_room[3] = {0.0f, 0.0f, 0.0f}; 
+        double tmp[3] = {0.0f, 0.0f, 0.0f};
+        plm_long mijk_f[3];
+        plm_long mijk_r[3];
+        plm_long idx_lower_left = 0;
+        float li_frac1[3];
+        float li_frac2[3];
+        bool in = true;
+
         for (ijk[1] = 0; ijk[1] < dim_ct[1]; ijk[1]++)
         {
             for (ijk[2] = 0; ijk[2] < dim_ct[2]; ijk[2]++)
             {
-                idx = ijk[0] + dim_ct[0] *(ijk[1] + ijk[2] * dim_ct[1]);
+                int idx = ijk[0] + dim_ct[0] *(ijk[1] + ijk[2] * dim_ct[1]);
                 if ( ct_img[idx] >= -1000) // in air we have no dose, we let the voxel number at 0!
                 {   
                     final_dose_volume->get_xyz_from_ijk(xyz_room, ijk);
@@ -339,12 +343,11 @@ void compute_dose_ray_desplanques (
                     xyz_bev[0] = (float) -vec3_dot(tmp, vec_prt_tmp);
                     xyz_bev[1] = (float) -vec3_dot(tmp,  vec_pdn_tmp);
                     xyz_bev[2] = (float) vec3_dot(tmp,  vec_nrm_tmp);
-                    dose_volume->get_ijk_from_xyz(ijk_bev, xyz_bev, in);
+                    dose_volume->get_ijk_from_xyz(ijk_bev, xyz_bev, &in);
 
-                    if (*in == true)
+                    if (in == true)
                     {
-                        dose_volume->get_ijk_from_xyz(ijk_bev_trunk, xyz_bev, in);
-                        idx_bev = ijk_bev_trunk[0] + ijk_bev[1]*dose_volume->dim[0] + ijk_bev[2] * dose_volume->dim[0] * dose_volume->dim[1];
+                        dose_volume->get_ijk_from_xyz(ijk_bev_trunk, xyz_bev, &in);
                         li_clamp_3d(ijk_bev, mijk_f, mijk_r, li_frac1, li_frac2, dose_volume);
                         idx_lower_left =  mijk_f[0] + dose_bev_dim[0] *(mijk_f[1] + mijk_f[2] * dose_bev_dim[1]);
                         final_dose_img[idx] += li_value(li_frac1[0], li_frac2[0], li_frac1[1], li_frac2[1], li_frac1[2], li_frac2[2], idx_lower_left, img, dose_volume);
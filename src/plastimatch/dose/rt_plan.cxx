@@ -10,6 +10,7 @@
 #include "dose_volume_functions.h"
 #include "plm_image.h"
 #include "plm_exception.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "print_and_exit.h"
 #include "proj_matrix.h"
@@ -29,6 +30,9 @@
 #include "volume_macros.h"
 
 static void display_progress (float is, float of);
+static void rt_plan_accumulate_dose (
+    Volume::Pointer& total_dose_vol, 
+    const std::vector<Rt_beam*>& beams);
 
 class Rt_plan_private {
 
@@ -409,28 +413,17 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
         printf("ray_data or clipping planes to be copied from rpl volume don't exist\n");
     }
 
-    /*Now we can compute the rpl_volume*/
-    beam->rpl_vol->compute_rpl_PrSTRP_no_rgc ();
-    /* and the others */
-    if(beam->rpl_vol->get_Ray_data() && beam->rpl_vol->get_front_clipping_plane() && beam->rpl_vol->get_back_clipping_plane())
+    /* Now we can compute the rpl_volume, and the others in the 
+       same traversal.  They are geometrically equal, so they get a 
+       copy of the ray_data & clipping planes of the rpl_vol. */
+    if (beam->get_flavor() == 'f' || beam->get_flavor() == 'g' || beam->get_flavor() == 'h')
     {
-        beam->rpl_ct_vol_HU->set_ray(beam->rpl_vol->get_Ray_data());
-        beam->rpl_ct_vol_HU->set_front_clipping_plane(beam->rpl_vol->get_front_clipping_plane());
-        beam->rpl_ct_vol_HU->set_back_clipping_plane(beam->rpl_vol->get_back_clipping_plane());
-        beam->rpl_ct_vol_HU->compute_rpl_HU();
-
-        if (beam->get_flavor() == 'f' || beam->get_flavor() == 'g' || beam->get_flavor() == 'h')
-        {
-            /* We don't do everything again, we just copy the ray_data & clipping planes as all the volumes geometrically equal*/
-        
-            beam->sigma_vol->set_ray(beam->rpl_vol->get_Ray_data());
-            beam->sigma_vol->set_front_clipping_plane(beam->rpl_vol->get_front_clipping_plane());
-            beam->sigma_vol->set_back_clipping_plane(beam->rpl_vol->get_back_clipping_plane());
-        }
+        beam->rpl_vol->compute_rpl_PrSTRP_no_rgc (
+            beam->rpl_ct_vol_HU, beam->sigma_vol);
     }
     else
     {
-        printf("ct or ct_limits to be copied from rpl_vol don't exist\n");
+        beam->rpl_vol->compute_rpl_PrSTRP_no_rgc (beam->rpl_ct_vol_HU, 0);
     }
     return true;
 }
@@ -460,17 +453,15 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
         double time_dose_misc = 0.0;
         double time_dose_reformat = 0.0;
 
-        printf ("Computing rpl_ct\n");
-        beam->rpl_ct_vol_HU->compute_rpl_HU ();
+        /* The rpl_ct_vol_HU and sigma_vol were computed together 
+           with the rpl_vol in prepare_beam_for_calc() */
 
         if (beam->get_flavor() == 'f' || beam->get_flavor() == 'g' || beam->get_flavor() == 'h')
         {
             float sigmaMax = 0;
             float *sigma_max =&sigmaMax; // used to find the max sigma in the volume and add extra margins during the dose creation volume
 
-            printf ("Computing_void_rpl\n");
-
-            beam->sigma_vol->compute_rpl_PrSTRP_no_rgc(); // we compute the rglength in the sigma_volume, without the range compensator as it will be added by a different process
+            /* sigma_vol contains the rglength, without the range compensator as it will be added by a different process */
             Rpl_volume* sigma_vol = beam->sigma_vol;
 
             float* sigma_img = (float*) sigma_vol->get_vol()->img;
@@ -580,32 +571,22 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
                     beam->rpl_vol_lg->set_geometry (beam->get_source_position(), beam->get_isocenter_position(), beam->get_aperture()->vup, beam->get_aperture()->get_distance(), beam->rpl_vol_lg->get_aperture()->get_dim(), beam->rpl_vol_lg->get_aperture()->get_center(), beam->get_aperture()->get_spacing(), beam->get_step_length());
                     beam->rpl_vol_lg->set_ct(beam->rpl_vol->get_ct());
                     beam->rpl_vol_lg->set_ct_limit(beam->rpl_vol->get_ct_limit());
-                    beam->rpl_vol_lg->compute_ray_data();
-                    beam->rpl_vol_lg->compute_rpl_PrSTRP_no_rgc();
 
                     beam->rpl_ct_vol_HU_lg->get_aperture()->set_center(new_center);
                     beam->rpl_ct_vol_HU_lg->get_aperture()->set_dim(new_dim);
                     beam->rpl_ct_vol_HU_lg->get_aperture()->set_distance(beam->rpl_vol->get_aperture()->get_distance());
                     beam->rpl_ct_vol_HU_lg->get_aperture()->set_spacing(beam->rpl_vol->get_aperture()->get_spacing());
                     beam->rpl_ct_vol_HU_lg->set_geometry (beam->get_source_position(), beam->get_isocenter_position(), beam->get_aperture()->vup, beam->get_aperture()->get_distance(), beam->rpl_vol_lg->get_aperture()->get_dim(), beam->rpl_vol_lg->get_aperture()->get_center(), beam->get_aperture()->get_spacing(), beam->get_step_length());
-                    beam->rpl_ct_vol_HU_lg->set_ct(beam->rpl_vol->get_ct());
-                    beam->rpl_ct_vol_HU_lg->set_ct_limit(beam->rpl_vol->get_ct_limit());
-                    beam->rpl_ct_vol_HU_lg->compute_ray_data();
-                    beam->rpl_ct_vol_HU_lg->set_front_clipping_plane(beam->rpl_vol_lg->get_front_clipping_plane());
-                    beam->rpl_ct_vol_HU_lg->set_back_clipping_plane(beam->rpl_vol_lg->get_back_clipping_plane());
-                    beam->rpl_ct_vol_HU_lg->compute_rpl_HU();
 
                     beam->sigma_vol_lg->get_aperture()->set_center(new_center);
                     beam->sigma_vol_lg->get_aperture()->set_dim(new_dim);	
                     beam->sigma_vol_lg->get_aperture()->set_distance(beam->rpl_vol->get_aperture()->get_distance());
                     beam->sigma_vol_lg->get_aperture()->set_spacing(beam->rpl_vol->get_aperture()->get_spacing());
                     beam->sigma_vol_lg->set_geometry (beam->get_source_position(), beam->get_isocenter_position(), beam->get_aperture()->vup, beam->get_aperture()->get_distance(), beam->rpl_vol_lg->get_aperture()->get_dim(), beam->rpl_vol_lg->get_aperture()->get_center(), beam->get_aperture()->get_spacing(), beam->get_step_length());
-                    beam->sigma_vol_lg->set_ct(beam->rpl_vol->get_ct());
-                    beam->sigma_vol_lg->set_ct_limit(beam->rpl_vol->get_ct_limit());
-                    beam->sigma_vol_lg->compute_ray_data();
-                    beam->sigma_vol_lg->set_front_clipping_plane(beam->rpl_vol_lg->get_front_clipping_plane());
-                    beam->sigma_vol_lg->set_back_clipping_plane(beam->rpl_vol_lg->get_back_clipping_plane());
-                    beam->sigma_vol_lg->compute_rpl_PrSTRP_no_rgc();
+
+                    /* The three large volumes are traced together */
+                    beam->rpl_vol_lg->compute_rpl_PrSTRP_no_rgc (
+                        beam->rpl_ct_vol_HU_lg, beam->sigma_vol_lg);
 
                     compute_sigmas (this, beam, ppp->E0, sigma_max, "large", margins);				
                     build_hong_grid(&area, &xy_grid, radius_sample, theta_sample);
@@ -625,19 +606,25 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
                 add_rcomp_length_to_rpl_volume(beam);
             }
 
-            /* scan through patient CT Volume */
-            plm_long ct_ijk[3];
-            double ct_xyz[4];
-            plm_long idx = 0;
-            double idx_ap[2] = {0,0};
-            int idx_ap_int[2] = {0,0};
-            double rest[2] = {0,0};
+            /* scan through patient CT Volume.  Each voxel sums over 
+               all energies of the beam, and is written once, so the 
+               slices are computed concurrently. */
             unsigned char* ap_img = (unsigned char*) beam->get_aperture()->get_aperture_volume()->img;
-            double particle_number = 0;
-            float WER = 0;
-            float rgdepth = 0;
-
-            for (ct_ijk[2] = 0; ct_ijk[2] < ct_vol->dim[2]; ct_ijk[2]++) {
+            std::vector<Rt_depth_dose*> depth_dose = beam->get_mebs()->get_depth_dose();
+            int num_energies = (int) depth_dose.size();
+
+#pragma omp parallel for schedule (dynamic, 1)
+            for (long k = 0; k < (long) ct_vol->dim[2]; k++) {
+                plm_long ct_ijk[3];
+                double ct_xyz[4];
+                double idx_ap[2] = {0,0};
+                int idx_ap_int[2] = {0,0};
+                double rest[2] = {0,0};
+                double particle_number = 0;
+                float WER = 0;
+                float rgdepth = 0;
+
+                ct_ijk[2] = k;
                 for (ct_ijk[1] = 0; ct_ijk[1] < ct_vol->dim[1]; ct_ijk[1]++) {
                     for (ct_ijk[0] = 0; ct_ijk[0] < ct_vol->dim[0]; ct_ijk[0]++) {
                         double dose = 0.0;
@@ -672,10 +659,10 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
                             rgdepth = beam->rpl_vol->get_rgdepth (ct_xyz);
                             WER =  compute_PrWER_from_HU(beam->rpl_ct_vol_HU->get_rgdepth(ct_xyz));
 
-                            for (size_t beam_idx = 0; beam_idx < beam->get_mebs()->get_depth_dose().size(); beam_idx++)
+                            for (int beam_idx = 0; beam_idx < num_energies; beam_idx++)
                             {
                                 particle_number = beam->get_mebs()->get_particle_number_xyz(idx_ap_int, rest, beam_idx, beam->get_aperture()->get_dim());
-                                if (particle_number != 0 && rgdepth >=0 && rgdepth < beam->get_mebs()->get_depth_dose()[beam_idx]->dend) 
+                                if (particle_number != 0 && rgdepth >=0 && rgdepth < depth_dose[beam_idx]->dend) 
                                 {
                                     dose += particle_number * WER * energy_direct (rgdepth, beam, beam_idx);
                                 }
@@ -684,12 +671,12 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
                         }
 
                         /* Insert the dose into the dose volume */
-                        idx = volume_index (dose_vol->dim, ct_ijk);
+                        plm_long idx = volume_index (dose_vol->dim, ct_ijk);
                         dose_img[idx] = dose;
                     }
                 }
             }
-            display_progress ((float)idx, (float)ct_vol->npix);
+            display_progress ((float)ct_vol->npix, (float)ct_vol->npix);
         }
 
 	/* Dose normalization process*/
@@ -764,9 +751,37 @@ Rt_plan::prepare_beam_for_calc (Rt_beam *beam)
         printf ("Dose overhead: %f seconds\n", time_dose_misc); fflush(stdout);
     }
 
+/* Sum the beam doses into the plan dose.  Each voxel adds up the 
+   beams in beam order, so that the result does not depend on 
+   the number of threads. */
+static void
+rt_plan_accumulate_dose (
+    Volume::Pointer& total_dose_vol, 
+    const std::vector<Rt_beam*>& beams)
+{
+    float* total_dose_img = (float*) total_dose_vol->img;
+    int num_beams = (int) beams.size();
+    std::vector<const float*> beam_dose_img (num_beams);
+    for (int b = 0; b < num_beams; b++) {
+        beam_dose_img[b] = 
+            (const float*) beams[b]->get_dose()->get_volume()->img;
+    }
+
+    plm_long npix = total_dose_vol->npix;
+#pragma omp parallel for
+    for (plm_long j = 0; j < npix; j++) {
+        float dose = total_dose_img[j];
+        for (int b = 0; b < num_beams; b++) {
+            dose += beam_dose_img[b][j];
+        }
+        total_dose_img[j] = dose;
+    }
+}
+
 Plm_return_code
 Rt_plan::compute_plan ()
 {
+    PLM_PROFILE_SCOPE ("Rt_plan::compute_plan");
     if (!d_ptr->rt_parms) {
         print_and_exit ("Error: cannot compute_plan without an Rt_parms\n");
     }
@@ -789,14 +804,17 @@ Rt_plan::compute_plan ()
     this->set_patient (ct);
     this->print_verif ();
 
+    /* The patient volume is converted here, before the beams 
+       share it */
     Volume::Pointer ct_vol = this->get_patient_volume ();
     Volume::Pointer dose_vol = ct_vol->clone_empty ();
-    plm_long dim[3] = {dose_vol->dim[0], dose_vol->dim[1], dose_vol->dim[2]};
-    float* total_dose_img = (float*) dose_vol->img;
+    int num_beams = (int) d_ptr->beam_storage.size();
 
-    for (size_t i = 0; i < d_ptr->beam_storage.size(); i++)
+    /* Beam setup may load images and report errors, so it is 
+       done one beam at a time */
+    for (int i = 0; i < num_beams; i++)
     {
-        printf ("\nStart dose calculation Beam %d\n", (int) i + 1);
+        printf ("\nStart dose calculation Beam %d\n", i + 1);
         Rt_beam *beam = d_ptr->beam_storage[i];
 
         /* try to generate plan with the provided parameters */
@@ -859,10 +877,20 @@ Rt_plan::compute_plan ()
             }
         }
 #endif
-            
-        /* Generate dose */
-        this->set_debug (true);
-        this->compute_dose (beam);
+    }
+
+    /* Generate dose.  Each beam is computed into its own dose 
+       volume, so the beams are computed concurrently. */
+    this->set_debug (true);
+#pragma omp parallel for schedule (dynamic, 1) if (num_beams > 1)
+    for (int i = 0; i < num_beams; i++)
+    {
+        this->compute_dose (d_ptr->beam_storage[i]);
+    }
+
+    for (int i = 0; i < num_beams; i++)
+    {
+        Rt_beam *beam = d_ptr->beam_storage[i];
 
         /* Save beam modifiers */
         if (beam->get_aperture_out() != "") {
@@ -914,15 +942,11 @@ Rt_plan::compute_plan ()
             beam->get_mebs()->export_spot_map_as_txt(beam->get_aperture());
         }
 
-        float* beam_dose_img = (float*) d_ptr->beam_storage[i]->get_dose()->get_volume()->img;
-
-        /* Dose cumulation to the plan dose volume */
-        for (int j = 0; j < dim[0] * dim[1] * dim[2]; j++)
-        {
-            total_dose_img[j] += beam_dose_img[j];
-        }
     }
 
+    /* Dose cumulation to the plan dose volume */
+    rt_plan_accumulate_dose (dose_vol, d_ptr->beam_storage);
+
     /* Save dose output */
     Plm_image::Pointer dose = Plm_image::New();
     dose->set_volume (dose_vol);
@@ -142,19 +142,21 @@ process_norm_CBCT (Volume * norm_CBCT, Fdk_parms* parms)
 void
 bowtie_correction (Volume *vol, Fdk_parms *parms)
 {
-    Volume *norm_CBCT;
+    Volume::Pointer norm_CBCT;
     float *img, *norm;
     plm_long ni, nj, nk;
     plm_long i, j, k;
 
+    /* process_norm_CBCT() modifies the image, but the mapping is
+       private, so the file itself is not changed */
     if (parms->full_fan) {
-        norm_CBCT = read_mha (parms->Full_normCBCT_name);
+        norm_CBCT = read_mha_mapped (parms->Full_normCBCT_name);
     } else   {
-        norm_CBCT = read_mha (parms->Half_normCBCT_name);
+        norm_CBCT = read_mha_mapped (parms->Half_normCBCT_name);
     }
 
 #if FFTW_FOUND
-    process_norm_CBCT (norm_CBCT, parms);
+    process_norm_CBCT (norm_CBCT.get(), parms);
 #endif
     img = (float *) vol->img;
     norm = (float *) norm_CBCT->img;
@@ -175,6 +177,4 @@ bowtie_correction (Volume *vol, Fdk_parms *parms)
             }
         }
     }
-    free (norm_CBCT->img);
-    free (norm_CBCT);
 }
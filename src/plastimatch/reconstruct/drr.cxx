@@ -13,7 +13,9 @@
 #include "drr.h"
 #include "drr_cuda.h"
 #include "drr_opencl.h"
+#include "drr_packet.h"
 #include "drr_trilin.h"
+#include "plm_cpu.h"
 #include "plm_int.h"
 #include "plm_math.h"
 #include "proj_image.h"
@@ -136,6 +138,18 @@ drr_ray_trace_exact (
     return cd->accum;
 }
 
+/* Set ray_step proportional to voxel size */
+static float
+drr_uniform_ray_step (const Volume *vol)
+{
+    float ray_step;
+    ray_step = vol->spacing[0];
+    if (vol->dim[1] < ray_step) ray_step = vol->spacing[1];
+    if (vol->dim[2] < ray_step) ray_step = vol->spacing[2];
+    ray_step *= 0.75;
+    return ray_step;
+}
+
 double                            /* Return value: intensity of ray */
 drr_ray_trace_uniform (
     Callback_data *cd,            /* Input: callback data */
@@ -145,13 +159,7 @@ drr_ray_trace_uniform (
     double *p2in                  /* Input: end point for ray */
 )
 {
-    float ray_step;
-
-    /* Set ray_step proportional to voxel size */
-    ray_step = vol->spacing[0];
-    if (vol->dim[1] < ray_step) ray_step = vol->spacing[1];
-    if (vol->dim[2] < ray_step) ray_step = vol->spacing[2];
-    ray_step *= 0.75;
+    float ray_step = drr_uniform_ray_step (vol);
 
 #if defined (commentout)
     printf ("p1 = %f %f %f\n", p1in[0], p1in[1], p1in[2]);
@@ -163,6 +171,148 @@ drr_ray_trace_uniform (
     return cd->accum;
 }
 
+/* Map a ray trace result to the output pixel value */
+static float
+drr_pixel_value (double value, const Drr_options *options)
+{
+    value = value / 10;     /* Translate from mm pixels to cm*gm */
+    if (options->exponential_mapping) {
+        value = exp(-value);
+    }
+    value = value * options->scale;   /* User requested scaling */
+    return (float) value;
+}
+
+/* Fill in the starting state of one lane of a packet.  
+   Returns 1 if the ray intersects the volume. */
+static int
+drr_packet_init_lane (
+    Drr_packet *pk,
+    int lane,
+    Volume *vol, 
+    Volume_limit *vol_limit, 
+    double p1[3], 
+    double p2[3], 
+    Drr_algorithm algorithm
+)
+{
+    if (algorithm == DRR_ALGORITHM_EXACT) {
+        return ray_trace_exact_init (
+            &pk->ai[0][lane], &pk->ai[1][lane], &pk->ai[2][lane],
+            &pk->aidir[0][lane], &pk->aidir[1][lane], &pk->aidir[2][lane],
+            &pk->ao[0][lane], &pk->ao[1][lane], &pk->ao[2][lane],
+            &pk->al[0][lane], &pk->al[1][lane], &pk->al[2][lane],
+            &pk->len[lane], vol, vol_limit, p1, p2);
+    }
+
+    /* Same setup as ray_trace_uniform() */
+    double ip1[3], ip2[3], uv[3];
+    if (!volume_limit_clip_segment (vol_limit, ip1, ip2, p1, p2)) {
+        return 0;
+    }
+    double rlen = vec3_dist (ip1, ip2);
+    vec3_sub3 (uv, ip2, ip1);
+    vec3_normalize1 (uv);
+    for (int d = 0; d < 3; d++) {
+        pk->ip1[d][lane] = ip1[d];
+        pk->phy_step[d][lane] = uv[d] * pk->ray_step;
+    }
+    int num_steps = 0;
+    for (double pt = 0; pt < rlen; pt += pk->ray_step) {
+        num_steps++;
+    }
+    pk->num_steps[lane] = num_steps;
+    return 1;
+}
+
+/* Trace the image in tiles of DRR_TILE_DIM x DRR_TILE_DIM pixels, 
+   each of which is traced as packets of DRR_PACKET_DIM x 
+   DRR_PACKET_DIM rays.  Tiles are handed out dynamically, because 
+   rays which miss the volume are cheap.  This is used for the exact 
+   and uniform algorithms when no ray details are requested. */
+static void
+drr_ray_trace_image_packets (
+    Proj_image *proj, 
+    Volume *vol, 
+    Volume_limit *vol_limit, 
+    double p1[3], 
+    double ul_room[3], 
+    double incr_r[3], 
+    double incr_c[3], 
+    Drr_options *options
+)
+{
+    const int *win = options->image_window;
+    int rows = win[1] - win[0] + 1;
+    int cols = win[3] - win[2] + 1;
+    int tile_rows = (rows + DRR_TILE_DIM - 1) / DRR_TILE_DIM;
+    int tile_cols = (cols + DRR_TILE_DIM - 1) / DRR_TILE_DIM;
+    int num_tiles = tile_rows * tile_cols;
+    Drr_algorithm algorithm = options->algorithm;
+
+    Drr_packet_volume pv;
+    pv.img = (const float*) vol->img;
+    for (int d = 0; d < 3; d++) {
+        pv.dim[d] = vol->dim[d];
+        pv.origin[d] = vol->origin[d];
+        pv.spacing[d] = vol->spacing[d];
+    }
+    pv.inline_hu = (options->hu_conversion == INLINE_CONVERSION);
+    float ray_step = drr_uniform_ray_step (vol);
+
+    void (*packet_kernel) (const Drr_packet_volume*, Drr_packet*) 
+        = (algorithm == DRR_ALGORITHM_EXACT) 
+        ? drr_packet_trace_exact_scalar : drr_packet_trace_uniform_scalar;
+#if (AVX2_FOUND)
+    if (plm_cpu_has_avx2 () && vol->npix < 0x7fffffff) {
+        packet_kernel = (algorithm == DRR_ALGORITHM_EXACT) 
+            ? drr_packet_trace_exact_avx2 : drr_packet_trace_uniform_avx2;
+    }
+#endif
+
+    int t;
+#pragma omp parallel for schedule(dynamic)
+    for (t = 0; t < num_tiles; t++) {
+        int tr0 = win[0] + (t / tile_cols) * DRR_TILE_DIM;
+        int tc0 = win[2] + (t % tile_cols) * DRR_TILE_DIM;
+        for (int pr = 0; pr < DRR_TILE_DIM; pr += DRR_PACKET_DIM) {
+            for (int pc = 0; pc < DRR_TILE_DIM; pc += DRR_PACKET_DIM) {
+                Drr_packet pk;
+                int idx[DRR_PACKET_RAYS];
+                pk.ray_step = ray_step;
+                for (int lane = 0; lane < DRR_PACKET_RAYS; lane++) {
+                    int r = tr0 + pr + lane / DRR_PACKET_DIM;
+                    int c = tc0 + pc + lane % DRR_PACKET_DIM;
+                    pk.active[lane] = 0;
+                    idx[lane] = -1;
+                    if (r > win[1] || c > win[3]) {
+                        continue;
+                    }
+                    idx[lane] = c - win[2] + (r - win[0]) * cols;
+
+                    /* Same arithmetic as drr_ray_trace_image() */
+                    double r_tgt[3], tmp[3], p2[3];
+                    vec3_copy (r_tgt, ul_room);
+                    vec3_scale3 (tmp, incr_r, (double) r);
+                    vec3_add2 (r_tgt, tmp);
+                    vec3_scale3 (tmp, incr_c, (double) c);
+                    vec3_add3 (p2, r_tgt, tmp);
+
+                    pk.active[lane] = drr_packet_init_lane (&pk, lane,
+                        vol, vol_limit, p1, p2, algorithm);
+                }
+                packet_kernel (&pv, &pk);
+                for (int lane = 0; lane < DRR_PACKET_RAYS; lane++) {
+                    if (idx[lane] >= 0) {
+                        proj->img[idx[lane]] = drr_pixel_value (
+                            pk.accum[lane], options);
+                    }
+                }
+            }
+        }
+    }
+}
+
 void
 drr_ray_trace_image (
     Proj_image *proj, 
@@ -181,6 +331,17 @@ drr_ray_trace_image (
 #endif
     int cols = options->image_window[3] - options->image_window[2] + 1;
 
+    /* Exact and uniform rays are traced in packets, unless the 
+       caller wants the details of each ray */
+    if (options->output_details_fn == ""
+        && (options->algorithm == DRR_ALGORITHM_EXACT
+            || options->algorithm == DRR_ALGORITHM_UNIFORM))
+    {
+        drr_ray_trace_image_packets (proj, vol, vol_limit, 
+            p1, ul_room, incr_r, incr_c, options);
+        return;
+    }
+
     FILE *details_fp = 0;
     if (options->output_details_fn != "") {
         details_fp = fopen (options->output_details_fn.c_str(), "w");
@@ -233,13 +394,7 @@ drr_ray_trace_image (
 		print_and_exit ("Error, unknown drr algorithm\n");
 		break;
 	    }
-	    value = value / 10;     /* Translate from mm pixels to cm*gm */
-	    if (options->exponential_mapping) {
-		value = exp(-value);
-	    }
-	    value = value * options->scale;   /* User requested scaling */
-
-	    proj->img[idx] = (float) value;
+	    proj->img[idx] = drr_pixel_value (value, options);
 	}
     }
     if (options->output_details_fn != "") {
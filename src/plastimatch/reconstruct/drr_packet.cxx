@@ -0,0 +1,86 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmreconstruct_config.h"
+
+#include "drr_packet.h"
+#include "ray_trace.h"
+
+/* Same traversal as ray_trace_exact(), with the DRR accumulation
+   of drr_ray_trace_callback() inlined */
+void
+drr_packet_trace_exact_scalar (
+    const Drr_packet_volume *pv, Drr_packet *pk)
+{
+    const float *img = pv->img;
+    plm_long sy = pv->dim[0];
+    plm_long sz = pv->dim[0] * pv->dim[1];
+
+    for (int lane = 0; lane < DRR_PACKET_RAYS; lane++) {
+        pk->accum[lane] = 0.;
+        if (!pk->active[lane]) {
+            continue;
+        }
+        int ai_x = pk->ai[0][lane];
+        int ai_y = pk->ai[1][lane];
+        int ai_z = pk->ai[2][lane];
+        double ao_x = pk->ao[0][lane];
+        double ao_y = pk->ao[1][lane];
+        double ao_z = pk->ao[2][lane];
+        double len = pk->len[lane];
+        double aggr_len = 0.0;
+        double accum = 0.0;
+        do {
+            float pix_density = img[ai_z*sz + ai_y*sy + ai_x];
+            double pix_len;
+            if ((ao_x < ao_y) && (ao_x < ao_z)) {
+                pix_len = ao_x;
+                ao_y -= ao_x;
+                ao_z -= ao_x;
+                ao_x = pk->al[0][lane];
+                ai_x += pk->aidir[0][lane];
+            } else if ((ao_y < ao_z)) {
+                pix_len = ao_y;
+                ao_x -= ao_y;
+                ao_z -= ao_y;
+                ao_y = pk->al[1][lane];
+                ai_y += pk->aidir[1][lane];
+            } else {
+                pix_len = ao_z;
+                ao_x -= ao_z;
+                ao_y -= ao_z;
+                ao_z = pk->al[2][lane];
+                ai_z += pk->aidir[2][lane];
+            }
+            aggr_len += pix_len;
+            if (pv->inline_hu) {
+                pix_density = drr_packet_attenuation (pix_density);
+            }
+            accum += pix_len * pix_density;
+        } while (aggr_len+DRR_LEN_TOLERANCE < len);
+        pk->accum[lane] = accum;
+    }
+}
+
+/* Same sampling as ray_trace_uniform(), with the DRR accumulation
+   of drr_ray_trace_callback() inlined */
+void
+drr_packet_trace_uniform_scalar (
+    const Drr_packet_volume *pv, Drr_packet *pk)
+{
+    for (int lane = 0; lane < DRR_PACKET_RAYS; lane++) {
+        pk->accum[lane] = 0.;
+        if (!pk->active[lane]) {
+            continue;
+        }
+        double accum = 0.0;
+        for (int z = 0; z < pk->num_steps[lane]; z++) {
+            float pix_density = drr_packet_uniform_sample (pv, pk, lane, z);
+            if (pv->inline_hu) {
+                pix_density = drr_packet_attenuation (pix_density);
+            }
+            accum += (double) pk->ray_step * pix_density;
+        }
+        pk->accum[lane] = accum;
+    }
+}
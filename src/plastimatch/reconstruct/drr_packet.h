@@ -0,0 +1,129 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _drr_packet_h_
+#define _drr_packet_h_
+
+#include "plmreconstruct_config.h"
+#include <math.h>
+#include "plm_int.h"
+
+/* -----------------------------------------------------------------------
+   Ray packet kernels used by the CPU DRR renderer.
+
+   The image is split into tiles, and each tile into packets of
+   DRR_PACKET_DIM x DRR_PACKET_DIM neighboring rays.  The caller clips each ray
+   against the volume and fills in its starting state; the kernels
+   then step all rays of the packet together, accumulating 
+   attenuation directly rather than through a per-voxel callback.
+   Lanes whose ray misses the volume, or which lie outside of the
+   image window, are marked inactive.
+   ----------------------------------------------------------------------- */
+#define DRR_PACKET_DIM 4
+#define DRR_PACKET_RAYS (DRR_PACKET_DIM * DRR_PACKET_DIM)
+#define DRR_TILE_DIM 8
+
+class Drr_packet_volume {
+public:
+    const float *img;
+    plm_long dim[3];
+    double origin[3];
+    double spacing[3];
+    bool inline_hu;          /* Map HU to attenuation at each sample */
+};
+
+class Drr_packet {
+public:
+    int active[DRR_PACKET_RAYS];
+
+    /* Exact (Siddon) state, see ray_trace_exact_init() */
+    int ai[3][DRR_PACKET_RAYS];
+    int aidir[3][DRR_PACKET_RAYS];
+    double ao[3][DRR_PACKET_RAYS];
+    double al[3][DRR_PACKET_RAYS];
+    double len[DRR_PACKET_RAYS];
+
+    /* Uniform state, see ray_trace_uniform() */
+    float ray_step;
+    double ip1[3][DRR_PACKET_RAYS];
+    double phy_step[3][DRR_PACKET_RAYS];
+    int num_steps[DRR_PACKET_RAYS];
+
+    /* Output */
+    double accum[DRR_PACKET_RAYS];
+};
+
+/* Scalar kernels, used when the CPU does not support AVX2 */
+PLMRECONSTRUCT_API void drr_packet_trace_exact_scalar (
+    const Drr_packet_volume *pv, Drr_packet *pk);
+PLMRECONSTRUCT_API void drr_packet_trace_uniform_scalar (
+    const Drr_packet_volume *pv, Drr_packet *pk);
+#if (AVX2_FOUND)
+/* Must only be called if plm_cpu_has_avx2() returns true */
+PLMRECONSTRUCT_API void drr_packet_trace_exact_avx2 (
+    const Drr_packet_volume *pv, Drr_packet *pk);
+PLMRECONSTRUCT_API void drr_packet_trace_uniform_avx2 (
+    const Drr_packet_volume *pv, Drr_packet *pk);
+#endif
+
+/* Same as attenuation_lookup_hu() in drr.cxx */
+static inline float
+drr_packet_attenuation (float pix_density)
+{
+    const double min_hu = -800.0;
+    const double mu_h2o = 0.022;
+    if (pix_density <= min_hu) {
+	return 0.0;
+    } else {
+	return (pix_density/1000.0) * mu_h2o + mu_h2o;
+    }
+}
+
+/* Same as li_clamp() */
+static inline void
+drr_packet_li_clamp (float ma, plm_long dmax, plm_long *maf,
+    float *fa1, float *fa2)
+{
+    if (ma < 0.f) {
+        *maf = 0;
+        *fa2 = 0.0f;
+    } else if (ma >= dmax) {
+        *maf = dmax - 1;
+        *fa2 = 1.0f;
+    } else {
+        *maf = (plm_long) floorf (ma);
+        *fa2 = ma - *maf;
+    }
+    *fa1 = 1.0f - *fa2;
+}
+
+/* One sample of ray_trace_uniform(), for a single lane */
+static inline float
+drr_packet_uniform_sample (
+    const Drr_packet_volume *pv, const Drr_packet *pk, int lane, int z)
+{
+    float mijk[3], f1[3], f2[3];
+    plm_long mf[3];
+    for (int d = 0; d < 3; d++) {
+        double ipx = pk->ip1[d][lane] + pk->phy_step[d][lane] * z;
+        mijk[d] = (float) ((ipx - pv->origin[d]) / pv->spacing[d]);
+        drr_packet_li_clamp (mijk[d], pv->dim[d] - 1, &mf[d],
+            &f1[d], &f2[d]);
+    }
+    plm_long sy = pv->dim[0];
+    plm_long sz = pv->dim[0] * pv->dim[1];
+    plm_long mvf = (mf[2] * pv->dim[1] + mf[1]) * pv->dim[0] + mf[0];
+    const float *m = pv->img;
+
+    /* Same order of operations as li_value() */
+    return f1[0] * f1[1] * f1[2] * m[mvf]
+        + f2[0] * f1[1] * f1[2] * m[mvf+1]
+        + f1[0] * f2[1] * f1[2] * m[mvf+sy]
+        + f2[0] * f2[1] * f1[2] * m[mvf+sy+1]
+        + f1[0] * f1[1] * f2[2] * m[mvf+sz]
+        + f2[0] * f1[1] * f2[2] * m[mvf+sz+1]
+        + f1[0] * f2[1] * f2[2] * m[mvf+sz+sy]
+        + f2[0] * f2[1] * f2[2] * m[mvf+sz+sy+1];
+}
+
+#endif
@@ -0,0 +1,237 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+/* This file is compiled with AVX2 and FMA enabled.  Its functions must
+   only be called after checking plm_cpu_has_avx2(). */
+#include "plmreconstruct_config.h"
+#if (AVX2_FOUND)
+#include <immintrin.h>
+
+#include "drr_packet.h"
+#include "ray_trace.h"
+
+/* Narrow a mask of four doubles to a mask of four 32-bit ints */
+static inline __m128i
+mask_pd_to_epi32 (__m256d m)
+{
+    const __m256i perm = _mm256_setr_epi32 (0, 2, 4, 6, 1, 3, 5, 7);
+    return _mm256_castsi256_si128 (
+        _mm256_permutevar8x32_epi32 (_mm256_castpd_si256 (m), perm));
+}
+
+/* Widen a mask of four 32-bit ints to a mask of four doubles */
+static inline __m256d
+mask_epi32_to_pd (__m128i m)
+{
+    return _mm256_castsi256_pd (_mm256_cvtepi32_epi64 (m));
+}
+
+static inline __m128i
+load_active (const Drr_packet *pk, int l0)
+{
+    __m128i a = _mm_loadu_si128 ((const __m128i*) &pk->active[l0]);
+    return _mm_cmpgt_epi32 (a, _mm_setzero_si128 ());
+}
+
+/* Same as drr_packet_attenuation(), for four values */
+static inline __m256d
+attenuation_avx2 (__m128 v)
+{
+    __m256d vd = _mm256_cvtps_pd (v);
+    __m256d att = _mm256_add_pd (
+        _mm256_mul_pd (_mm256_div_pd (vd, _mm256_set1_pd (1000.0)),
+            _mm256_set1_pd (0.022)),
+        _mm256_set1_pd (0.022));
+    /* Result is rounded to float, as in the scalar version */
+    att = _mm256_cvtps_pd (_mm256_cvtpd_ps (att));
+    __m256d keep = _mm256_cmp_pd (vd, _mm256_set1_pd (-800.0), _CMP_GT_OQ);
+    return _mm256_and_pd (att, keep);
+}
+
+/* Trace lanes l0 to l0+3 of the packet.  The four rays are stepped 
+   together; a ray which has left the volume stops contributing, and 
+   the group finishes when all rays have left. */
+static void
+trace_exact_group (
+    const Drr_packet_volume *pv, Drr_packet *pk, int l0)
+{
+    const __m256d zero = _mm256_setzero_pd ();
+    const __m256d tol = _mm256_set1_pd (DRR_LEN_TOLERANCE);
+    const __m128i sy = _mm_set1_epi32 ((int) pv->dim[0]);
+    const __m128i sz = _mm_set1_epi32 ((int) (pv->dim[0] * pv->dim[1]));
+
+    __m128i ai[3], aidir[3];
+    __m256d ao[3], al[3];
+    for (int d = 0; d < 3; d++) {
+        ai[d] = _mm_loadu_si128 ((const __m128i*) &pk->ai[d][l0]);
+        aidir[d] = _mm_loadu_si128 ((const __m128i*) &pk->aidir[d][l0]);
+        ao[d] = _mm256_loadu_pd (&pk->ao[d][l0]);
+        al[d] = _mm256_loadu_pd (&pk->al[d][l0]);
+    }
+    __m256d len = _mm256_loadu_pd (&pk->len[l0]);
+    __m256d aggr_len = zero;
+    __m256d accum = zero;
+    __m128i active = load_active (pk, l0);
+
+    while (_mm_movemask_epi8 (active)) {
+        __m128i idx = _mm_add_epi32 (ai[0], _mm_add_epi32 (
+                _mm_mullo_epi32 (ai[1], sy), _mm_mullo_epi32 (ai[2], sz)));
+        __m128 pix = _mm_mask_i32gather_ps (_mm_setzero_ps (), pv->img, 
+            idx, _mm_castsi128_ps (active), 4);
+        __m256d pix_density = pv->inline_hu 
+            ? attenuation_avx2 (pix) : _mm256_cvtps_pd (pix);
+
+        /* Choose the axis of the nearest crossing */
+        __m256d mx = _mm256_and_pd (
+            _mm256_cmp_pd (ao[0], ao[1], _CMP_LT_OQ),
+            _mm256_cmp_pd (ao[0], ao[2], _CMP_LT_OQ));
+        __m256d my = _mm256_andnot_pd (mx,
+            _mm256_cmp_pd (ao[1], ao[2], _CMP_LT_OQ));
+        __m256d mz = _mm256_andnot_pd (_mm256_or_pd (mx, my),
+            _mm256_castsi256_pd (_mm256_set1_epi64x (-1)));
+        __m256d pix_len = _mm256_blendv_pd (
+            _mm256_blendv_pd (ao[2], ao[1], my), ao[0], mx);
+
+        __m256d sel[3] = { mx, my, mz };
+        for (int d = 0; d < 3; d++) {
+            ao[d] = _mm256_blendv_pd (_mm256_sub_pd (ao[d], pix_len),
+                al[d], sel[d]);
+            ai[d] = _mm_add_epi32 (ai[d],
+                _mm_and_si128 (aidir[d], mask_pd_to_epi32 (sel[d])));
+        }
+
+        __m256d act_pd = mask_epi32_to_pd (active);
+        aggr_len = _mm256_add_pd (aggr_len, _mm256_and_pd (pix_len, act_pd));
+        accum = _mm256_add_pd (accum, _mm256_and_pd (
+                _mm256_mul_pd (pix_len, pix_density), act_pd));
+
+        __m256d more = _mm256_cmp_pd (
+            _mm256_add_pd (aggr_len, tol), len, _CMP_LT_OQ);
+        active = _mm_and_si128 (active, mask_pd_to_epi32 (more));
+    }
+    _mm256_storeu_pd (&pk->accum[l0], accum);
+}
+
+/* AVX2 version of drr_packet_trace_exact_scalar().  Rays are 
+   stepped in groups of four, one ray per double precision lane.  
+   Voxel indices are computed in 32-bit lanes, so the caller must 
+   ensure the volume has fewer than 2^31 voxels. */
+void
+drr_packet_trace_exact_avx2 (
+    const Drr_packet_volume *pv, Drr_packet *pk)
+{
+    for (int l0 = 0; l0 < DRR_PACKET_RAYS; l0 += 4) {
+        trace_exact_group (pv, pk, l0);
+    }
+}
+
+/* Trace lanes l0 to l0+3 of the packet with uniform sampling */
+static void
+trace_uniform_group (
+    const Drr_packet_volume *pv, Drr_packet *pk, int l0)
+{
+    const __m128 zero = _mm_setzero_ps ();
+    const __m128 one = _mm_set1_ps (1.f);
+    const __m128i sy = _mm_set1_epi32 ((int) pv->dim[0]);
+    const __m128i sz = _mm_set1_epi32 ((int) (pv->dim[0] * pv->dim[1]));
+
+    __m256d ip1[3], phy_step[3], origin[3], spacing[3];
+    __m128 dmax[3], dmax_1[3];
+    for (int d = 0; d < 3; d++) {
+        ip1[d] = _mm256_loadu_pd (&pk->ip1[d][l0]);
+        phy_step[d] = _mm256_loadu_pd (&pk->phy_step[d][l0]);
+        origin[d] = _mm256_set1_pd (pv->origin[d]);
+        spacing[d] = _mm256_set1_pd (pv->spacing[d]);
+        dmax[d] = _mm_set1_ps ((float) (pv->dim[d] - 1));
+        dmax_1[d] = _mm_set1_ps ((float) (pv->dim[d] - 2));
+    }
+    const __m256d ray_step = _mm256_set1_pd ((double) pk->ray_step);
+    __m128i num_steps = _mm_loadu_si128 (
+        (const __m128i*) &pk->num_steps[l0]);
+    __m128i lane_active = load_active (pk, l0);
+    int max_steps = 0;
+    for (int lane = l0; lane < l0 + 4; lane++) {
+        if (pk->active[lane] && pk->num_steps[lane] > max_steps) {
+            max_steps = pk->num_steps[lane];
+        }
+    }
+
+    __m256d accum = _mm256_setzero_pd ();
+    for (int z = 0; z < max_steps; z++) {
+        __m128i active = _mm_and_si128 (lane_active,
+            _mm_cmpgt_epi32 (num_steps, _mm_set1_epi32 (z)));
+        __m256d zd = _mm256_set1_pd ((double) z);
+
+        /* Interpolation fractions, same as li_clamp() */
+        __m128i mf[3];
+        __m128 f1[3], f2[3];
+        for (int d = 0; d < 3; d++) {
+            __m256d ipx = _mm256_add_pd (ip1[d],
+                _mm256_mul_pd (phy_step[d], zd));
+            __m128 ma = _mm256_cvtpd_ps (_mm256_div_pd (
+                    _mm256_sub_pd (ipx, origin[d]), spacing[d]));
+            __m128 lo = _mm_cmplt_ps (ma, zero);
+            __m128 hi = _mm_andnot_ps (lo, _mm_cmpge_ps (ma, dmax[d]));
+            __m128 f = _mm_floor_ps (ma);
+            __m128 frac = _mm_sub_ps (ma, f);
+            f = _mm_blendv_ps (f, zero, lo);
+            frac = _mm_blendv_ps (frac, zero, lo);
+            f = _mm_blendv_ps (f, dmax_1[d], hi);
+            frac = _mm_blendv_ps (frac, one, hi);
+            mf[d] = _mm_cvttps_epi32 (f);
+            f2[d] = frac;
+            f1[d] = _mm_sub_ps (one, frac);
+        }
+        __m128i mvf = _mm_add_epi32 (mf[0], _mm_add_epi32 (
+                _mm_mullo_epi32 (mf[1], sy), _mm_mullo_epi32 (mf[2], sz)));
+
+        /* Trilinear interpolation, same order as li_value() */
+        const float *m = pv->img;
+        __m128 mask = _mm_castsi128_ps (active);
+        __m128i i01 = _mm_add_epi32 (mvf, sy);
+        __m128i i10 = _mm_add_epi32 (mvf, sz);
+        __m128i i11 = _mm_add_epi32 (i10, sy);
+        __m128i one_i = _mm_set1_epi32 (1);
+        __m128 v[8];
+        v[0] = _mm_mask_i32gather_ps (zero, m, mvf, mask, 4);
+        v[1] = _mm_mask_i32gather_ps (zero, m, 
+            _mm_add_epi32 (mvf, one_i), mask, 4);
+        v[2] = _mm_mask_i32gather_ps (zero, m, i01, mask, 4);
+        v[3] = _mm_mask_i32gather_ps (zero, m, 
+            _mm_add_epi32 (i01, one_i), mask, 4);
+        v[4] = _mm_mask_i32gather_ps (zero, m, i10, mask, 4);
+        v[5] = _mm_mask_i32gather_ps (zero, m, 
+            _mm_add_epi32 (i10, one_i), mask, 4);
+        v[6] = _mm_mask_i32gather_ps (zero, m, i11, mask, 4);
+        v[7] = _mm_mask_i32gather_ps (zero, m, 
+            _mm_add_epi32 (i11, one_i), mask, 4);
+        __m128 val = zero;
+        for (int c = 0; c < 8; c++) {
+            __m128 fx = (c & 1) ? f2[0] : f1[0];
+            __m128 fy = (c & 2) ? f2[1] : f1[1];
+            __m128 fz = (c & 4) ? f2[2] : f1[2];
+            __m128 t = _mm_mul_ps (_mm_mul_ps (_mm_mul_ps (fx, fy), fz), v[c]);
+            val = (c == 0) ? t : _mm_add_ps (val, t);
+        }
+
+        __m256d pix_density = pv->inline_hu 
+            ? attenuation_avx2 (val) : _mm256_cvtps_pd (val);
+        accum = _mm256_add_pd (accum, _mm256_and_pd (
+                _mm256_mul_pd (ray_step, pix_density),
+                mask_epi32_to_pd (active)));
+    }
+    _mm256_storeu_pd (&pk->accum[l0], accum);
+}
+
+/* AVX2 version of drr_packet_trace_uniform_scalar().  Rays are 
+   sampled in groups of four, one ray per double precision lane. */
+void
+drr_packet_trace_uniform_avx2 (
+    const Drr_packet_volume *pv, Drr_packet *pk)
+{
+    for (int l0 = 0; l0 < DRR_PACKET_RAYS; l0 += 4) {
+        trace_uniform_group (pv, pk, l0);
+    }
+}
+
+#endif /* AVX2_FOUND */
@@ -14,10 +14,14 @@
 #include "bowtie_correction.h"
 #include "delayload.h"
 #include "fdk.h"
+#include "fdk_backproject_row.h"
 #include "fdk_cuda.h"
 #include "fdk_opencl.h"
+#include "fdk_pipeline.h"
 #include "file_util.h"
+#include "plm_cpu.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "proj_image.h"
 #include "proj_image_dir.h"
@@ -385,6 +389,91 @@ project_volume_onto_image_c (Volume* vol, Proj_image* cbi, float scale)
     free (zip);
 }
 
+/* This version backprojects a batch of images in one pass over the
+   volume.  Each row of voxels is handed to a row kernel, which walks
+   the detector coordinates incrementally and accumulates the
+   contribution of all images before updating the volume.  The
+   lookup is nearest neighbor, as in version c.  The images are
+   not modified. */
+void
+project_volume_onto_images_e (
+    Volume* vol, Proj_image** cbi, int num_imgs, float scale)
+{
+    float* img = (float*) vol->img;
+    if (num_imgs <= 0) {
+        return;
+    }
+
+    /* Per image coefficients of the homogeneous detector coordinate,
+       with ic folded in as in version c */
+    double *xc = (double*) malloc (3*num_imgs*sizeof(double));
+    double *yc = (double*) malloc (3*num_imgs*sizeof(double));
+    double *zc = (double*) malloc (3*num_imgs*sizeof(double));
+    double *wc = (double*) malloc (3*num_imgs*sizeof(double));
+    for (int n = 0; n < num_imgs; n++) {
+        const Proj_matrix *pmat = cbi[n]->pmat;
+        const double *m = pmat->matrix;
+        for (int d = 0; d < 2; d++) {
+            xc[3*n+d] = m[4*d+0] + pmat->ic[d] * m[8];
+            yc[3*n+d] = m[4*d+1] + pmat->ic[d] * m[9];
+            zc[3*n+d] = m[4*d+2] + pmat->ic[d] * m[10];
+            wc[3*n+d] = m[4*d+3] + pmat->ic[d] * m[11];
+        }
+        xc[3*n+2] = m[8];
+        yc[3*n+2] = m[9];
+        zc[3*n+2] = m[10];
+        wc[3*n+2] = m[11];
+    }
+
+    void (*row_kernel) (float*, plm_long, const Fdk_backproject_proj*, int)
+        = fdk_backproject_row_scalar;
+#if (AVX2_FOUND)
+    if (plm_cpu_has_avx2 ()) {
+        row_kernel = fdk_backproject_row_avx2;
+    }
+#endif
+
+    plm_long num_rows = vol->dim[1] * vol->dim[2];
+#pragma omp parallel
+    {
+        Fdk_backproject_proj *proj = new Fdk_backproject_proj[num_imgs];
+        for (int n = 0; n < num_imgs; n++) {
+            const Proj_matrix *pmat = cbi[n]->pmat;
+            proj[n].img = cbi[n]->img;
+            proj[n].dim[0] = cbi[n]->dim[0];
+            proj[n].dim[1] = cbi[n]->dim[1];
+            proj[n].weight = (float) (scale * (pmat->sad * pmat->sad)
+                / (pmat->sid * pmat->sid));
+            for (int d = 0; d < 3; d++) {
+                proj[n].step[d] = (float) (vol->spacing[0] * xc[3*n+d]);
+            }
+        }
+
+        plm_long r;
+#pragma omp for schedule(static)
+        for (r = 0; r < num_rows; r++) {
+            plm_long j = r % vol->dim[1];
+            plm_long k = r / vol->dim[1];
+            double x = (double) vol->origin[0];
+            double y = (double) (vol->origin[1] + j * vol->spacing[1]);
+            double z = (double) (vol->origin[2] + k * vol->spacing[2]);
+            for (int n = 0; n < num_imgs; n++) {
+                for (int d = 0; d < 3; d++) {
+                    proj[n].base[d] = (float) (wc[3*n+d] + x * xc[3*n+d]
+                        + y * yc[3*n+d] + z * zc[3*n+d]);
+                }
+            }
+            row_kernel (&img[r * vol->dim[0]], vol->dim[0], proj, num_imgs);
+        }
+        delete[] proj;
+    }
+
+    free (xc);
+    free (yc);
+    free (zc);
+    free (wc);
+}
+
 void
 project_volume_onto_image_b (Volume* vol, Proj_image* cbi, float scale)
 {
@@ -594,31 +683,35 @@ reconstruct_conebeam (
     int i;
     int num_imgs = proj_dir->num_proj_images;
     float scale;
-    double filter_time = 0.0;
     double backproject_time = 0.0;
-    double io_time = 0.0;
     Proj_image* cbi;    /* cbi == cone beam image */
+    Proj_image* batch[FDK_BATCH_SIZE];
+    int num_batch = 0;
     Plm_timer* timer = new Plm_timer;
+    PLM_PROFILE_SCOPE ("reconstruct_conebeam");
 
     /* Arbitrary scale applied to each image */
     scale = (float) (sqrt(3.f) / (double) num_imgs);
     scale = scale * parms->scale;
 
+    /* Images are loaded and filtered by worker threads.  The pool
+       holds a full batch for flavor e, plus one image per worker
+       to be prepared while the batch is backprojected. */
+    int num_workers = parms->loader_threads;
+    if (parms->threading == THREADING_CPU_SINGLE) {
+        num_workers = 0;
+    }
+    Fdk_pipeline pipeline (proj_dir, 
+        parms->filter == FDK_FILTER_TYPE_RAMP, 
+        FDK_BATCH_SIZE + num_workers, num_workers);
+
     for (i = 0; i < num_imgs; i++) {
         printf ("Processing image %d\n", i);
 
-        timer->start ();
-        cbi = proj_dir->load_image (i);
-        io_time += timer->report ();
-
-        /* Apply ramp filter */
-        if (parms->filter == FDK_FILTER_TYPE_RAMP) {
-            timer->start ();
-            proj_image_filter (cbi);
-            filter_time += timer->report ();
-        }
+        cbi = pipeline.get_image ();
     
         // printf ("Projecting Image %d\n", i);
+        Plm_profiler_scope backproject_scope ("fdk_backproject");
         timer->start ();
 
 	switch (parms->flavor) {
@@ -638,17 +731,34 @@ reconstruct_conebeam (
 	case 'd':
 	    project_volume_onto_image_d (vol, cbi, scale);
 	    break;
+	case 'e':
+	    /* Defer backprojection until the batch is full */
+	    batch[num_batch++] = cbi;
+	    cbi = 0;
+	    if (num_batch == FDK_BATCH_SIZE || i == num_imgs - 1) {
+		project_volume_onto_images_e (vol, batch, num_batch, scale);
+		for (int b = 0; b < num_batch; b++) {
+		    pipeline.release_image (batch[b]);
+		}
+		num_batch = 0;
+	    }
+	    break;
 	}
 
         backproject_time += timer->report ();
 
-        delete cbi;
+        if (cbi) {
+            pipeline.release_image (cbi);
+        }
     }
 
+    double io_time = pipeline.get_io_time ();
+    double filter_time = pipeline.get_filter_time ();
     printf ("I/O time (total) = %g\n", io_time);
     printf ("I/O time (per image) = %g\n", io_time / num_imgs);
     printf ("Filter time = %g\n", filter_time);
     printf ("Filter time (per image) = %g\n", filter_time / num_imgs);
+    printf ("Loader wait time = %g\n", pipeline.get_wait_time ());
     printf ("Backprojection time = %g\n", backproject_time);
     printf ("Backprojection time (per image) = %g\n", 
 	backproject_time / num_imgs);
@@ -8,9 +8,13 @@
 #include "plm_int.h"
 #include "threading.h"
 
+class Proj_image;
 class Proj_image_dir;
 class Volume;
 
+/* Number of images backprojected together by flavor "e" */
+#define FDK_BATCH_SIZE 8
+
 enum Fdk_filter_type {
     FDK_FILTER_TYPE_NONE,
     FDK_FILTER_TYPE_RAMP
@@ -33,6 +37,7 @@ public:
     enum Fdk_filter_type filter;
 
     char flavor;
+    int loader_threads;      /* Threads loading and filtering images */
 
     char* input_dir;
     char* output_file;
@@ -56,5 +61,19 @@ PLMRECONSTRUCT_C_API void CUDA_reconstruct_conebeam (
 );
 PLMRECONSTRUCT_C_API void fdk_do_bowtie (Volume* vol, Fdk_parms* parms);
 
+/* Backprojection flavors, exposed for benchmarking */
+PLMRECONSTRUCT_C_API void project_volume_onto_image_a (
+    Volume* vol, Proj_image* cbi, float scale);
+PLMRECONSTRUCT_C_API void project_volume_onto_image_b (
+    Volume* vol, Proj_image* cbi, float scale);
+PLMRECONSTRUCT_C_API void project_volume_onto_image_c (
+    Volume* vol, Proj_image* cbi, float scale);
+PLMRECONSTRUCT_C_API void project_volume_onto_image_d (
+    Volume* vol, Proj_image* cbi, float scale);
+PLMRECONSTRUCT_C_API void project_volume_onto_images_e (
+    Volume* vol, Proj_image** cbi, int num_imgs, float scale);
+PLMRECONSTRUCT_C_API void project_volume_onto_image_reference (
+    Volume* vol, Proj_image* cbi, float scale);
+
 
 #endif
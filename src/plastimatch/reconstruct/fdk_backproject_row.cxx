@@ -0,0 +1,16 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmreconstruct_config.h"
+
+#include "fdk_backproject_row.h"
+
+void
+fdk_backproject_row_scalar (
+    float *vol_row, plm_long num_vox,
+    const Fdk_backproject_proj *proj, int num_proj)
+{
+    for (plm_long v = 0; v < num_vox; v++) {
+        fdk_backproject_row_voxel (vol_row, v, proj, num_proj);
+    }
+}
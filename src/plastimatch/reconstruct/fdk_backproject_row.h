@@ -0,0 +1,71 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _fdk_backproject_row_h_
+#define _fdk_backproject_row_h_
+
+#include "plmreconstruct_config.h"
+#include "plm_int.h"
+
+/* -----------------------------------------------------------------------
+   Row kernel used by FDK flavor "e".
+
+   A row is a run of voxels along x.  Along the row, the homogeneous
+   detector coordinate of a voxel is an affine function of its x index,
+   so for each projection the caller supplies the coordinate of the
+   first voxel (base) and its increment per voxel (step).  The kernel
+   backprojects a whole batch of projections into the row, so that
+   each voxel is read and written once per batch rather than once
+   per projection.
+   ----------------------------------------------------------------------- */
+class Fdk_backproject_proj {
+public:
+    const float *img;        /* Filtered projection image */
+    int dim[2];              /* dim[0] = cols, dim[1] = rows */
+    float weight;            /* (sad/sid)^2 times user scale */
+    float base[3];           /* Detector coordinate of first voxel */
+    float step[3];           /* Increment along row */
+};
+
+/* Scalar kernel, used when the CPU does not support AVX2 */
+PLMRECONSTRUCT_API void fdk_backproject_row_scalar (
+    float *vol_row, plm_long num_vox,
+    const Fdk_backproject_proj *proj, int num_proj);
+#if (AVX2_FOUND)
+/* Must only be called if plm_cpu_has_avx2() returns true */
+PLMRECONSTRUCT_API void fdk_backproject_row_avx2 (
+    float *vol_row, plm_long num_vox,
+    const Fdk_backproject_proj *proj, int num_proj);
+#endif
+
+/* Backproject all projections of the batch into a single voxel.
+   The lookup is nearest neighbor, with the same bounds test as
+   get_pixel_value_c().  This is used by the scalar kernel, and for
+   the leftover voxels of the vector kernel. */
+static inline void
+fdk_backproject_row_voxel (
+    float *vol_row, plm_long v,
+    const Fdk_backproject_proj *proj, int num_proj)
+{
+    float acc = 0.f;
+    for (int p = 0; p < num_proj; p++) {
+        const Fdk_backproject_proj *pp = &proj[p];
+        float a0 = pp->base[0] + v * pp->step[0];
+        float a1 = pp->base[1] + v * pp->step[1];
+        float a2 = pp->base[2] + v * pp->step[2];
+        float dw = 1.f / a2;
+        float r = a1 * dw + 0.5f;
+        float c = a0 * dw + 0.5f;
+        if (r < 0.f || r >= (float) pp->dim[1]
+            || c < 0.f || c >= (float) pp->dim[0])
+        {
+            continue;
+        }
+        int rr = (int) r;
+        int cc = (int) c;
+        acc += pp->weight * dw * dw * pp->img[rr * pp->dim[0] + cc];
+    }
+    vol_row[v] += acc;
+}
+
+#endif
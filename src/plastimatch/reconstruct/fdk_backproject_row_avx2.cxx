@@ -0,0 +1,78 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+/* This file is compiled with AVX2 and FMA enabled.  Its functions must
+   only be called after checking plm_cpu_has_avx2(). */
+#include "plmreconstruct_config.h"
+#if (AVX2_FOUND)
+#include <immintrin.h>
+
+#include "fdk_backproject_row.h"
+
+/* AVX2 version of fdk_backproject_row_scalar().  Eight voxels are
+   processed at once; detector pixels are fetched with a masked gather,
+   so lanes which fall outside the detector never touch memory. */
+void
+fdk_backproject_row_avx2 (
+    float *vol_row, plm_long num_vox,
+    const Fdk_backproject_proj *proj, int num_proj)
+{
+    const __m256 zero = _mm256_setzero_ps ();
+    const __m256 one = _mm256_set1_ps (1.f);
+    const __m256 half = _mm256_set1_ps (0.5f);
+    const __m256 lane = _mm256_setr_ps (0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+
+    plm_long v = 0;
+    for (; v + 8 <= num_vox; v += 8) {
+        __m256 vv = _mm256_add_ps (_mm256_set1_ps ((float) v), lane);
+        __m256 acc = zero;
+        for (int p = 0; p < num_proj; p++) {
+            const Fdk_backproject_proj *pp = &proj[p];
+
+            /* Detector coordinates */
+            __m256 a0 = _mm256_fmadd_ps (vv, _mm256_set1_ps (pp->step[0]),
+                _mm256_set1_ps (pp->base[0]));
+            __m256 a1 = _mm256_fmadd_ps (vv, _mm256_set1_ps (pp->step[1]),
+                _mm256_set1_ps (pp->base[1]));
+            __m256 a2 = _mm256_fmadd_ps (vv, _mm256_set1_ps (pp->step[2]),
+                _mm256_set1_ps (pp->base[2]));
+            __m256 dw = _mm256_div_ps (one, a2);
+            __m256 r = _mm256_fmadd_ps (a1, dw, half);
+            __m256 c = _mm256_fmadd_ps (a0, dw, half);
+
+            /* Same bounds test as get_pixel_value_c() */
+            __m256 inside = _mm256_and_ps (
+                _mm256_cmp_ps (r, zero, _CMP_GE_OQ),
+                _mm256_cmp_ps (r, _mm256_set1_ps ((float) pp->dim[1]),
+                    _CMP_LT_OQ));
+            inside = _mm256_and_ps (inside, _mm256_and_ps (
+                    _mm256_cmp_ps (c, zero, _CMP_GE_OQ),
+                    _mm256_cmp_ps (c, _mm256_set1_ps ((float) pp->dim[0]),
+                        _CMP_LT_OQ)));
+            if (_mm256_testz_ps (inside, inside)) {
+                continue;
+            }
+
+            /* Nearest neighbor lookup */
+            __m256i idx = _mm256_add_epi32 (
+                _mm256_mullo_epi32 (_mm256_cvttps_epi32 (r),
+                    _mm256_set1_epi32 (pp->dim[0])),
+                _mm256_cvttps_epi32 (c));
+            __m256 pix = _mm256_mask_i32gather_ps (zero, pp->img, idx,
+                inside, 4);
+
+            __m256 w = _mm256_mul_ps (_mm256_set1_ps (pp->weight),
+                _mm256_mul_ps (dw, dw));
+            acc = _mm256_fmadd_ps (w, pix, acc);
+        }
+        _mm256_storeu_ps (&vol_row[v],
+            _mm256_add_ps (_mm256_loadu_ps (&vol_row[v]), acc));
+    }
+
+    /* Leftover voxels */
+    for (; v < num_vox; v++) {
+        fdk_backproject_row_voxel (vol_row, v, proj, num_proj);
+    }
+}
+
+#endif /* AVX2_FOUND */
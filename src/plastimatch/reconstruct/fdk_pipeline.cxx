@@ -0,0 +1,245 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmreconstruct_config.h"
+#include <vector>
+
+#include "dlib_threads.h"
+#include "fdk_pipeline.h"
+#include "plm_profiler.h"
+#include "plm_timer.h"
+#include "print_and_exit.h"
+#include "proj_image.h"
+#include "proj_image_dir.h"
+#include "proj_image_filter.h"
+
+/* Image i is always staged in slot (i % pool_size).  Each slot has
+   two binary semaphores: "empty" is held by the producer which
+   owns the slot, and "full" is released once the image is ready.
+   Producers claim indices and empty slots in index order while
+   holding claim_lock, so a slot cannot be taken by an image that
+   is a full pool ahead of the one which is due. */
+class Fdk_pipeline_slot {
+public:
+    Fdk_pipeline_slot () : full (true) {}
+public:
+    Proj_image proj;
+    Dlib_semaphore empty;
+    Dlib_semaphore full;
+};
+
+class Fdk_pipeline_private {
+public:
+    Proj_image_dir *proj_dir;
+    bool filter;
+    int num_imgs;
+    int pool_size;
+    std::vector<Fdk_pipeline_slot*> slots;
+    std::vector<Dlib_thread_function*> workers;
+
+    /* Producer state, protected by claim_lock.  A producer may hold
+       claim_lock while it waits for a slot, so the abort flag has
+       its own lock. */
+    Dlib_semaphore claim_lock;
+    int next_load;
+    Dlib_semaphore abort_lock;
+    bool abort;
+
+    /* Timing, protected by time_lock */
+    Dlib_semaphore time_lock;
+    double io_time;
+    double filter_time;
+
+    /* Consumer state, only touched by the calling thread */
+    int next_get;
+    double wait_time;
+public:
+    Fdk_pipeline_private () {
+        next_load = 0;
+        abort = false;
+        io_time = 0.;
+        filter_time = 0.;
+        next_get = 0;
+        wait_time = 0.;
+    }
+    ~Fdk_pipeline_private () {
+        for (size_t i = 0; i < slots.size(); i++) {
+            delete slots[i];
+        }
+    }
+public:
+    void load_slot (int index, Fdk_pipeline_slot *slot);
+    bool produce_one ();
+};
+
+/* Load and filter image "index" into the slot.  The Proj_image object
+   of the slot is reused, and so is its pixel buffer when the new 
+   image has the same size as the previous one. */
+void
+Fdk_pipeline_private::load_slot (int index, Fdk_pipeline_slot *slot)
+{
+    Plm_timer timer;
+    Proj_image *proj = &slot->proj;
+
+    timer.start ();
+    {
+        PLM_PROFILE_SCOPE ("fdk_load_image");
+        proj_dir->load_image (index, proj);
+    }
+    double load_time = timer.report ();
+
+    double filt_time = 0.;
+    if (filter && proj->have_image ()) {
+        PLM_PROFILE_SCOPE ("fdk_filter_image");
+        timer.start ();
+        proj_image_filter (proj);
+        filt_time = timer.report ();
+    }
+
+    time_lock.grab ();
+    io_time += load_time;
+    filter_time += filt_time;
+    time_lock.release ();
+}
+
+/* Claim the next image, load it, and mark its slot as full.
+   Returns false when there are no more images to load. */
+bool
+Fdk_pipeline_private::produce_one ()
+{
+    claim_lock.grab ();
+    int index = next_load;
+    if (index >= num_imgs) {
+        claim_lock.release ();
+        return false;
+    }
+    next_load ++;
+    Fdk_pipeline_slot *slot = slots[index % pool_size];
+    slot->empty.grab ();
+    claim_lock.release ();
+
+    abort_lock.grab ();
+    bool skip = abort;
+    abort_lock.release ();
+
+    if (!skip) {
+        load_slot (index, slot);
+    }
+    slot->full.release ();
+    return true;
+}
+
+static void
+fdk_pipeline_worker (void *arg)
+{
+    Fdk_pipeline_private *d_ptr = (Fdk_pipeline_private*) arg;
+    while (d_ptr->produce_one ()) {
+    }
+}
+
+Fdk_pipeline::Fdk_pipeline (
+    Proj_image_dir *proj_dir,
+    bool filter,
+    int pool_size,
+    int num_workers
+)
+{
+    d_ptr = new Fdk_pipeline_private;
+    d_ptr->proj_dir = proj_dir;
+    d_ptr->filter = filter;
+    d_ptr->num_imgs = proj_dir->num_proj_images;
+    if (pool_size < 1) {
+        print_and_exit ("Error, Fdk_pipeline needs a pool of at least "
+            "one image\n");
+    }
+    d_ptr->pool_size = pool_size;
+    for (int i = 0; i < pool_size; i++) {
+        d_ptr->slots.push_back (new Fdk_pipeline_slot);
+    }
+    for (int i = 0; i < num_workers; i++) {
+        d_ptr->workers.push_back (
+            new Dlib_thread_function (fdk_pipeline_worker, d_ptr));
+    }
+}
+
+Fdk_pipeline::~Fdk_pipeline ()
+{
+    /* Drain any images which were not consumed, so that workers
+       blocked on a slot can finish */
+    if (d_ptr->workers.size() > 0) {
+        d_ptr->abort_lock.grab ();
+        d_ptr->abort = true;
+        d_ptr->abort_lock.release ();
+        Proj_image *proj;
+        while ((proj = this->get_image ()) != 0) {
+            this->release_image (proj);
+        }
+    }
+
+    /* Deleting a thread function waits for the thread to end */
+    for (size_t i = 0; i < d_ptr->workers.size(); i++) {
+        delete d_ptr->workers[i];
+    }
+    delete d_ptr;
+}
+
+Proj_image*
+Fdk_pipeline::get_image ()
+{
+    int index = d_ptr->next_get;
+    if (index >= d_ptr->num_imgs) {
+        return 0;
+    }
+    d_ptr->next_get ++;
+
+    /* Without workers, the caller loads the image itself */
+    if (d_ptr->workers.size() == 0) {
+        d_ptr->produce_one ();
+    }
+
+    Plm_timer timer;
+    timer.start ();
+    Fdk_pipeline_slot *slot = d_ptr->slots[index % d_ptr->pool_size];
+    slot->full.grab ();
+    d_ptr->wait_time += timer.report ();
+
+    return &slot->proj;
+}
+
+void
+Fdk_pipeline::release_image (Proj_image *proj)
+{
+    for (int i = 0; i < d_ptr->pool_size; i++) {
+        Fdk_pipeline_slot *slot = d_ptr->slots[i];
+        if (&slot->proj == proj) {
+            slot->empty.release ();
+            return;
+        }
+    }
+    print_and_exit ("Error, Fdk_pipeline::release_image () called "
+        "with an image not owned by the pipeline\n");
+}
+
+double
+Fdk_pipeline::get_io_time ()
+{
+    d_ptr->time_lock.grab ();
+    double t = d_ptr->io_time;
+    d_ptr->time_lock.release ();
+    return t;
+}
+
+double
+Fdk_pipeline::get_filter_time ()
+{
+    d_ptr->time_lock.grab ();
+    double t = d_ptr->filter_time;
+    d_ptr->time_lock.release ();
+    return t;
+}
+
+double
+Fdk_pipeline::get_wait_time ()
+{
+    return d_ptr->wait_time;
+}
@@ -0,0 +1,48 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _fdk_pipeline_h_
+#define _fdk_pipeline_h_
+
+#include "plmreconstruct_config.h"
+
+class Fdk_pipeline_private;
+class Proj_image;
+class Proj_image_dir;
+
+/*! \brief
+ * The Fdk_pipeline class loads and ramp filters projection images
+ * on worker threads, while the caller backprojects images which
+ * are already finished.  Images are handed out strictly in
+ * index order, so the reconstruction does not depend on thread timing.
+ * At most pool_size images are in flight; each must be handed back
+ * with release_image() before its slot can be refilled.
+ */
+class PLMRECONSTRUCT_API Fdk_pipeline {
+public:
+    Fdk_pipeline (
+        Proj_image_dir *proj_dir,
+        bool filter,
+        int pool_size,
+        int num_workers
+    );
+    ~Fdk_pipeline ();
+public:
+    Fdk_pipeline_private *d_ptr;
+public:
+    /*! \brief Wait for the next image to become ready, and return it.
+      Returns 0 after the last image has been handed out. */
+    Proj_image* get_image ();
+    /*! \brief Hand an image back to the pool.  Images may be
+      released in any order. */
+    void release_image (Proj_image *proj);
+
+    /*! \brief Time spent loading images, summed over workers */
+    double get_io_time ();
+    /*! \brief Time spent filtering images, summed over workers */
+    double get_filter_time ();
+    /*! \brief Time the caller spent waiting in get_image() */
+    double get_wait_time ();
+};
+
+#endif
@@ -50,6 +50,7 @@
 #include "joint_histogram.h"
 #include "logfile.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "print_and_exit.h"
 #include "string_util.h"
@@ -414,6 +415,7 @@ report_score (
 void
 bspline_score (Bspline_optimize *bod)
 {
+    PLM_PROFILE_SCOPE ("bspline_score");
     Bspline_parms *parms = bod->get_bspline_parms ();
     Bspline_state *bst = bod->get_bspline_state ();
     Bspline_xform *bxf = bod->get_bspline_xform ();
@@ -38,7 +38,6 @@ bspline_landmarks_score_a (
     float land_score, land_grad_coeff;
 
     FILE* landmark_fp = 0;
-    static int it = 0;
     if (parms->debug) {
         char buf[1024];
         
@@ -47,7 +46,6 @@ bspline_landmarks_score_a (
             parms->debug_stage, bst->feval);
         std::string fn = parms->debug_dir + "/" + buf;
         landmark_fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     land_score = 0;
@@ -30,6 +30,7 @@
 #include "logfile.h"
 #include "mha_io.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "volume_macros.h"
 #include "volume.h"
 
@@ -897,6 +898,9 @@ bspline_mi_pvi_6_dc_dv (
 /* B-Spline Registration using Mutual Information
  * Implementation I
  *   -- Histograms are OpenMP accelerated
+ *   -- Per-thread histograms are either full copies merged serially,
+ *        or the thread-private histograms of Joint_histogram 
+ *        (parms->mi_hist_accum == MI_HIST_ACCUM_PRIVATE)
  *   -- Uses OpenMP for Cost & dc_dv computation
  *   -- Uses methods introduced in bspline_score_g_mse
  *        to compute dc_dp more rapidly.
@@ -927,6 +931,7 @@ bspline_score_i_mi (
     double jhis = 0.0f;      /* Joint  histogram incomplete sum */
 
     int num_threads;
+    bool accum_private = (parms->mi_hist_accum == MI_HIST_ACCUM_PRIVATE);
     double* f_hist_omp = NULL;
     double* m_hist_omp = NULL;
     double* j_hist_omp = NULL;
@@ -947,6 +952,10 @@ bspline_score_i_mi (
 #pragma omp master
     {
         num_threads = omp_get_num_threads ();
+    }
+    if (accum_private) {
+        mi_hist->reset_thread_histograms (num_threads);
+    } else {
         f_hist_omp = (double*) malloc (num_threads * sizeof (double) * mi_hist->fixed.bins);
         m_hist_omp = (double*) malloc (num_threads * sizeof (double) * mi_hist->moving.bins);
         j_hist_omp = (double*) malloc (num_threads * sizeof (double) * mi_hist->fixed.bins * mi_hist->moving.bins);
@@ -1013,32 +1022,44 @@ bspline_score_i_mi (
                     midx_f = volume_index (moving->dim, mijk_f);
 
                     /* Add to histogram */
-
-                    bspline_mi_hist_add_pvi_8_omp_v2 (
-                        mi_hist, f_hist_omp, m_hist_omp, j_hist_omp,
-                        fixed, moving, fidx, midx_f, li_1, li_2, thread_num);
+                    if (accum_private) {
+                        mi_hist->add_pvi_8_thread (thread_num,
+                            fixed, moving, fidx, midx_f, li_1, li_2);
+                    } else {
+                        bspline_mi_hist_add_pvi_8_omp_v2 (
+                            mi_hist, f_hist_omp, m_hist_omp, j_hist_omp,
+                            fixed, moving, fidx, midx_f, li_1, li_2, 
+                            thread_num);
+                    }
                 }
             }
         }   // tile
     }   // openmp
 
     /* Merge the OpenMP histogram copies */
-    for (plm_long b=0; b<mi_hist->fixed.bins; b++) {
-        for (int c=0; c<num_threads; c++) {
-            f_hist[b] += f_hist_omp[c*mi_hist->fixed.bins + b];
-        }
-    }
-    for (plm_long b=0; b<mi_hist->moving.bins; b++) {
-        for (int c=0; c<num_threads; c++) {
-            m_hist[b] += m_hist_omp[c*mi_hist->moving.bins + b];
+    if (accum_private) {
+        mi_hist->reduce_thread_histograms ();
+    } else {
+        for (plm_long b=0; b<mi_hist->fixed.bins; b++) {
+            for (int c=0; c<num_threads; c++) {
+                f_hist[b] += f_hist_omp[c*mi_hist->fixed.bins + b];
+            }
         }
-    }
-    for (plm_long j=0; j<mi_hist->fixed.bins; j++) {
-        for (plm_long i=0; i<mi_hist->moving.bins; i++) {
+        for (plm_long b=0; b<mi_hist->moving.bins; b++) {
             for (int c=0; c<num_threads; c++) {
-                j_hist[j*mi_hist->moving.bins+i] += j_hist_omp[c*mi_hist->moving.bins*mi_hist->fixed.bins + j*mi_hist->moving.bins + i];
+                m_hist[b] += m_hist_omp[c*mi_hist->moving.bins + b];
+            }
+        }
+        for (plm_long j=0; j<mi_hist->fixed.bins; j++) {
+            for (plm_long i=0; i<mi_hist->moving.bins; i++) {
+                for (int c=0; c<num_threads; c++) {
+                    j_hist[j*mi_hist->moving.bins+i] += j_hist_omp[c*mi_hist->moving.bins*mi_hist->fixed.bins + j*mi_hist->moving.bins + i];
+                }
             }
         }
+        free (f_hist_omp);
+        free (m_hist_omp);
+        free (j_hist_omp);
     }
 
     /* Compute num_vox and find fullest fixed hist bin */
@@ -1279,13 +1300,12 @@ bspline_score_h_mi (
 #endif
 
     FILE* fp = 0;
-    static int it = 0;
     if (parms->debug) {
         char buf[1024];
-        sprintf (buf, "dump_mi_%02d.txt", it);
+        sprintf (buf, "%02d_dump_mi_%03d_%03d.txt", 
+            parms->debug_stage, bst->it, bst->feval);
         std::string fn = parms->debug_dir + "/" + buf;
         fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     memset (f_hist, 0, mi_hist->fixed.bins * sizeof(double));
@@ -1546,9 +1566,8 @@ bspline_score_g_mi (
 #if 0
     FILE* fp = 0;
     char debug_fn[1024];
-    static int it = 0;
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mi_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mi_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
 #endif
@@ -1778,10 +1797,9 @@ bspline_score_f_mi (
 
 #if 0
     FILE* fp = 0;
-    static int it = 0;
     char debug_fn[1024];
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mi_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mi_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
 #endif
@@ -2072,9 +2090,8 @@ bspline_score_e_mi (
 #if 0
     FILE* fp = 0;
     char debug_fn[1024];
-    static int it = 0;
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mi_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mi_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
 #endif
@@ -2423,9 +2440,8 @@ bspline_score_d_mi (
 #if 0
     FILE* fp = 0;
     char debug_fn[1024];
-    static int it = 0;
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mi_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mi_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
 #endif
@@ -2698,9 +2714,8 @@ bspline_score_c_mi (
 #if 0
     FILE* fp = 0;
     char debug_fn[1024];
-    static int it = 0;
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mi_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mi_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
 #endif
@@ -3017,6 +3032,7 @@ bspline_score_mi (
     Bspline_optimize *bod
 )
 {
+    PLM_PROFILE_SCOPE ("bspline_score_mi");
     Bspline_parms *parms = bod->get_bspline_parms ();
     Bspline_state *bst = bod->get_bspline_state ();
 
@@ -23,6 +23,7 @@
 #include "bspline_macros.h"
 #include "bspline_mse.h"
 #include "bspline_mse.txx"
+#include "bspline_mse_row.h"
 #include "bspline_optimize.h"
 #include "bspline_parms.h"
 #include "bspline_state.h"
@@ -31,7 +32,9 @@
 #include "interpolate_macros.h"
 #include "logfile.h"
 #include "mha_io.h"
+#include "plm_cpu.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "string_util.h"
 #include "volume.h"
@@ -106,8 +109,6 @@ bspline_score_i_mse (
     Volume* fixed_roi  = bst->fixed_roi;
     Volume* moving_roi = bst->moving_roi;
 
-    static int it = 0;
-
     FILE* corr_fp = 0;
 
     if (parms->debug) {
@@ -115,7 +116,6 @@ bspline_score_i_mse (
             parms->debug_dir.c_str(), parms->debug_stage, bst->it, 
             bst->feval);
         corr_fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     // Zero out accumulators
@@ -330,8 +330,6 @@ bspline_score_h_mse (
     float* cond_y = (float*)malloc(cond_size);
     float* cond_z = (float*)malloc(cond_size);
 
-    static int it = 0;
-
     // Zero out accumulators
     score_tile = 0;
     memset(cond_x, 0, cond_size);
@@ -345,7 +343,6 @@ bspline_score_h_mse (
             parms->debug_dir.c_str(), parms->debug_stage, bst->it, 
             bst->feval);
         corr_fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     // Serial across tiles
@@ -546,8 +543,6 @@ bspline_score_g_mse (
     float* cond_y = (float*)malloc(cond_size);
     float* cond_z = (float*)malloc(cond_size);
 
-    static int it = 0;
-
     FILE* corr_fp = 0;
 
     if (parms->debug) {
@@ -555,7 +550,6 @@ bspline_score_g_mse (
             parms->debug_dir.c_str(), parms->debug_stage, bst->it, 
             bst->feval);
         corr_fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     // Zero out accumulators
@@ -768,7 +762,6 @@ bspline_score_c_mse (
        accumulation does not. */
     double score_acc = 0.;
 
-    static int it = 0;
     FILE* val_fp = 0;
     FILE* dc_dv_fp = 0;
     FILE* corr_fp = 0;
@@ -790,7 +783,6 @@ bspline_score_c_mse (
             parms->debug_dir.c_str(), parms->debug_stage, bst->it, 
             bst->feval);
         corr_fp = plm_fopen (fn.c_str(), "wb");
-        it ++;
     }
 
     /* GCS FIX: region of interest is not used */
@@ -929,11 +921,184 @@ bspline_score_l_mse (
     bspline_score_normalize (bod, blu.score_acc);
 }
 
+/* -----------------------------------------------------------------------
+   FUNCTION: bspline_score_m_mse()
+
+   OpenMP across tiles, like "g", but each tile is processed one row 
+   of voxels at a time.  The y and z basis functions are constant 
+   along a row, so the 64 coefficients are condensed into 4 x-taps 
+   once per row, and the gradient is accumulated into 4 x-taps and 
+   expanded into the 64 tile sets at the end of the row.  The row 
+   kernel uses AVX2 if the CPU supports it, otherwise a scalar loop.
+
+   ROI images are not supported; see bspline_score_mse().
+   ----------------------------------------------------------------------- */
 void
 bspline_score_m_mse (
     Bspline_optimize *bod
 )
 {
+    Bspline_state *bst = bod->get_bspline_state ();
+    Bspline_xform *bxf = bod->get_bspline_xform ();
+
+    Volume *fixed = bst->fixed;
+    Volume *moving = bst->moving;
+    Volume *moving_grad = bst->moving_grad;
+    Bspline_score* ssd = &bst->ssd;
+
+    float* f_img = (float*) fixed->img;
+    float* m_img = (float*) moving->img;
+    float* m_grad = (float*) moving_grad->img;
+
+    void (*row_kernel) (Bspline_mse_row*) = bspline_mse_row_scalar;
+#if (AVX2_FOUND)
+    if (plm_cpu_has_avx2 () && moving->npix < 0x7fffffff / 3) {
+        row_kernel = bspline_mse_row_avx2;
+    }
+#endif
+
+    plm_long cond_size = 64*bxf->num_knots*sizeof(float);
+    float* cond_x = (float*)malloc(cond_size);
+    float* cond_y = (float*)malloc(cond_size);
+    float* cond_z = (float*)malloc(cond_size);
+
+    // Zero out accumulators
+    plm_long num_vox = 0;
+    double score_acc = 0.;
+    memset(cond_x, 0, cond_size);
+    memset(cond_y, 0, cond_size);
+    memset(cond_z, 0, cond_size);
+
+    // Parallel across tiles
+    plm_long pidx;
+#pragma omp parallel for reduction (+:num_vox,score_acc)
+    LOOP_THRU_VOL_TILES (pidx, bxf) {
+        plm_long ijk_tile[3];
+        plm_long q[3];
+        plm_long fijk[3];
+        float fxyz[3];
+
+        float sets_x[64];
+        float sets_y[64];
+        float sets_z[64];
+
+        memset(sets_x, 0, 64*sizeof(float));
+        memset(sets_y, 0, 64*sizeof(float));
+        memset(sets_z, 0, 64*sizeof(float));
+
+        // Get tile coordinates from index
+        COORDS_FROM_INDEX (ijk_tile, pidx, bxf->rdims); 
+        const plm_long* c_lut = &bxf->c_lut[pidx*64];
+
+        // Number of voxels in each row, clipped to the roi
+        q[0] = q[1] = q[2] = 0;
+        GET_VOL_COORDS (fijk, ijk_tile, q, bxf);
+        plm_long row_len = bxf->roi_offset[0] + bxf->roi_dim[0] - fijk[0];
+        if (row_len > bxf->vox_per_rgn[0]) {
+            row_len = bxf->vox_per_rgn[0];
+        }
+
+        Bspline_mse_row row;
+        row.num_vox = row_len;
+        row.bx_lut = bxf->bx_lut;
+        row.fstep[0] = fixed->step[3*0+0];
+        row.fstep[1] = fixed->step[3*1+0];
+        row.fstep[2] = fixed->step[3*2+0];
+        row.m_img = m_img;
+        row.m_grad = m_grad;
+        for (int d = 0; d < 3; d++) {
+            row.m_dim[d] = moving->dim[d];
+            row.m_origin[d] = moving->origin[d];
+        }
+        for (int d = 0; d < 9; d++) {
+            row.m_proj[d] = moving->proj[d];
+        }
+
+        // Serial through rows in tile
+        LOOP_THRU_TILE_Z (q, bxf) {
+            LOOP_THRU_TILE_Y (q, bxf) {
+                if (row_len <= 0) continue;
+
+                // Construct coordinates of first voxel in row
+                q[0] = 0;
+                GET_VOL_COORDS (fijk, ijk_tile, q, bxf);
+
+                // Make sure we are inside the image volume
+                if (fijk[1] >= bxf->roi_offset[1] + bxf->roi_dim[1])
+                    continue;
+                if (fijk[2] >= bxf->roi_offset[2] + bxf->roi_dim[2])
+                    continue;
+
+                POSITION_FROM_COORDS (fxyz, fijk, bxf->img_origin, 
+                    fixed->step);
+
+                // Condense coefficients along y and z
+                const float* by_lut = &bxf->by_lut[q[1]*4];
+                const float* bz_lut = &bxf->bz_lut[q[2]*4];
+                memset (row.cx, 0, sizeof(row.cx));
+                int m = 0;
+                for (int k = 0; k < 4; k++) {
+                    for (int j = 0; j < 4; j++) {
+                        float B = by_lut[j] * bz_lut[k];
+                        for (int i = 0; i < 4; i++) {
+                            plm_long cidx = 3*c_lut[m++];
+                            row.cx[0][i] += B * bxf->coeff[cidx+0];
+                            row.cx[1][i] += B * bxf->coeff[cidx+1];
+                            row.cx[2][i] += B * bxf->coeff[cidx+2];
+                        }
+                    }
+                }
+
+                // Run the row kernel
+                row.f_row = &f_img[volume_index (fixed->dim, fijk)];
+                row.fxyz[0] = fxyz[0];
+                row.fxyz[1] = fxyz[1];
+                row.fxyz[2] = fxyz[2];
+                row.score = 0.;
+                row.num_vox_used = 0;
+                memset (row.dc_dx, 0, sizeof(row.dc_dx));
+                row_kernel (&row);
+
+                score_acc += row.score;
+                num_vox += row.num_vox_used;
+
+                // Expand condensed gradient into tile sets
+                m = 0;
+                for (int k = 0; k < 4; k++) {
+                    for (int j = 0; j < 4; j++) {
+                        float B = by_lut[j] * bz_lut[k];
+                        for (int i = 0; i < 4; i++) {
+                            sets_x[m] += B * row.dc_dx[0][i];
+                            sets_y[m] += B * row.dc_dx[1][i];
+                            sets_z[m] += B * row.dc_dx[2][i];
+                            m++;
+                        }
+                    }
+                }
+            } /* LOOP_THRU_TILE_Y */
+        } /* LOOP_THRU_TILE_Z */
+
+        // The tile is now condensed.  Now we will put it in the
+        // proper slot within the control point bin that it belong to.
+        bspline_sort_sets (
+            cond_x, cond_y, cond_z,
+            sets_x, sets_y, sets_z,
+            pidx, bxf
+        );
+    } /* LOOP_THRU_VOL_TILES */
+
+    ssd->curr_num_vox = num_vox;
+
+    /* Now we have a ton of bins and each bin's 64 slots are full.
+     * Let's sum each bin's 64 slots.  The result with be dc_dp. */
+    bspline_condense_smetric_grad (cond_x, cond_y, cond_z, bxf, ssd);
+
+    free (cond_x);
+    free (cond_y);
+    free (cond_z);
+
+    /* Normalize score for MSE */
+    bspline_score_normalize (bod, score_acc);
 }
 
 void
@@ -948,6 +1113,7 @@ bspline_score_mse (
     Bspline_optimize *bod
 )
 {
+    PLM_PROFILE_SCOPE ("bspline_score_mse");
     Bspline_parms *parms = bod->get_bspline_parms ();
     Bspline_state *bst = bod->get_bspline_state ();
 
@@ -0,0 +1,14 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmregister_config.h"
+
+#include "bspline_mse_row.h"
+
+void
+bspline_mse_row_scalar (Bspline_mse_row *row)
+{
+    for (plm_long v = 0; v < row->num_vox; v++) {
+        bspline_mse_row_voxel (row, v);
+    }
+}
@@ -0,0 +1,128 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _bspline_mse_row_h_
+#define _bspline_mse_row_h_
+
+#include "plmregister_config.h"
+#include "plm_int.h"
+
+/* -----------------------------------------------------------------------
+   Row kernel used by MSE implementation "m".
+
+   A row is a run of voxels along x within a single B-spline tile.
+   Within the row, the y and z basis functions are constant, so the
+   caller condenses the 64 control point coefficients into 4 x-taps
+   (cx) before calling the kernel.  The kernel likewise returns the
+   metric gradient condensed to 4 x-taps (dc_dx), which the caller
+   expands into the 64 tile sets.
+   ----------------------------------------------------------------------- */
+class Bspline_mse_row {
+public:
+    /* Input: row geometry */
+    plm_long num_vox;        /* Number of voxels in row */
+    const float *f_row;      /* Fixed image intensity of first voxel */
+    const float *bx_lut;     /* x basis (4 per voxel) of first voxel */
+    float fxyz[3];           /* Position of first voxel (mm) */
+    float fstep[3];          /* Position increment along row (mm) */
+    float cx[3][4];          /* Coefficients condensed along y and z */
+
+    /* Input: moving image */
+    const float *m_img;
+    const float *m_grad;
+    plm_long m_dim[3];
+    float m_origin[3];
+    float m_proj[9];
+
+    /* Output: accumulated over the row */
+    double score;
+    plm_long num_vox_used;
+    float dc_dx[3][4];
+};
+
+/* Scalar kernel, used when the CPU does not support AVX2 */
+PLMREGISTER_API void bspline_mse_row_scalar (Bspline_mse_row *row);
+#if (AVX2_FOUND)
+/* Must only be called if plm_cpu_has_avx2() returns true */
+PLMREGISTER_API void bspline_mse_row_avx2 (Bspline_mse_row *row);
+#endif
+
+/* Process a single voxel of the row.  This is used by the scalar
+   kernel, and for the leftover voxels of the vector kernel.  */
+static inline void
+bspline_mse_row_voxel (Bspline_mse_row *row, plm_long v)
+{
+    const float *b = &row->bx_lut[4*v];
+    float d[3], m[3], mijk[3];
+    for (int d_idx = 0; d_idx < 3; d_idx++) {
+        d[d_idx] = b[0] * row->cx[d_idx][0] + b[1] * row->cx[d_idx][1]
+            + b[2] * row->cx[d_idx][2] + b[3] * row->cx[d_idx][3];
+        m[d_idx] = row->fxyz[d_idx] + v * row->fstep[d_idx]
+            + d[d_idx] - row->m_origin[d_idx];
+    }
+    for (int d_idx = 0; d_idx < 3; d_idx++) {
+        mijk[d_idx] = m[0] * row->m_proj[3*d_idx+0]
+            + m[1] * row->m_proj[3*d_idx+1]
+            + m[2] * row->m_proj[3*d_idx+2];
+    }
+
+    /* Same test as Volume::is_inside() */
+    plm_long mf[3], mr[3], ms[3];
+    float li_1[3], li_2[3];
+    for (int d_idx = 0; d_idx < 3; d_idx++) {
+        float ma = mijk[d_idx];
+        plm_long dmax = row->m_dim[d_idx] - 1;
+        if (ma <= -0.5f || ma >= row->m_dim[d_idx] - 0.5f) {
+            return;
+        }
+        /* Same as li_clamp() */
+        if (ma < 0.f) {
+            mf[d_idx] = 0;
+            mr[d_idx] = 0;
+            li_2[d_idx] = 0.f;
+        } else if (ma >= dmax) {
+            mf[d_idx] = dmax - 1;
+            mr[d_idx] = dmax;
+            li_2[d_idx] = 1.f;
+        } else {
+            mf[d_idx] = (plm_long) ma;
+            mr[d_idx] = (plm_long) (ma + 0.5f);
+            li_2[d_idx] = ma - mf[d_idx];
+        }
+        li_1[d_idx] = 1.f - li_2[d_idx];
+
+        /* Keep both neighbors inside the image when dim is 1 */
+        if (mf[d_idx] < 0) {
+            mf[d_idx] = 0;
+        }
+        ms[d_idx] = (mf[d_idx] < dmax) ? 1 : 0;
+    }
+
+    plm_long sx = ms[0];
+    plm_long sy = ms[1] * row->m_dim[0];
+    plm_long sz = ms[2] * row->m_dim[0] * row->m_dim[1];
+    plm_long mvf = (mf[2] * row->m_dim[1] + mf[1]) * row->m_dim[0] + mf[0];
+    plm_long mvr = (mr[2] * row->m_dim[1] + mr[1]) * row->m_dim[0] + mr[0];
+    const float *mi = row->m_img;
+    float m_val
+        = li_1[2] * (li_1[1] * (li_1[0] * mi[mvf] + li_2[0] * mi[mvf+sx])
+            + li_2[1] * (li_1[0] * mi[mvf+sy] + li_2[0] * mi[mvf+sy+sx]))
+        + li_2[2] * (li_1[1] * (li_1[0] * mi[mvf+sz]
+                + li_2[0] * mi[mvf+sz+sx])
+            + li_2[1] * (li_1[0] * mi[mvf+sz+sy]
+                + li_2[0] * mi[mvf+sz+sy+sx]));
+
+    float diff = m_val - row->f_row[v];
+    row->score += diff * diff;
+    row->num_vox_used ++;
+
+    for (int d_idx = 0; d_idx < 3; d_idx++) {
+        float dc_dv = diff * row->m_grad[3*mvr+d_idx];
+        row->dc_dx[d_idx][0] += dc_dv * b[0];
+        row->dc_dx[d_idx][1] += dc_dv * b[1];
+        row->dc_dx[d_idx][2] += dc_dv * b[2];
+        row->dc_dx[d_idx][3] += dc_dv * b[3];
+    }
+}
+
+#endif
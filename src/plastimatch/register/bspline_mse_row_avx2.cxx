@@ -0,0 +1,243 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+/* This file is compiled with AVX2 and FMA enabled.  Its functions must
+   only be called after checking plm_cpu_has_avx2(). */
+#include "plmregister_config.h"
+#if (AVX2_FOUND)
+#include <immintrin.h>
+
+#include "bspline_mse_row.h"
+
+static inline float
+hsum_ps (__m256 v)
+{
+    __m128 lo = _mm256_castps256_ps128 (v);
+    __m128 hi = _mm256_extractf128_ps (v, 1);
+    lo = _mm_add_ps (lo, hi);
+    lo = _mm_add_ps (lo, _mm_movehl_ps (lo, lo));
+    lo = _mm_add_ss (lo, _mm_shuffle_ps (lo, lo, 0x55));
+    return _mm_cvtss_f32 (lo);
+}
+
+static inline double
+hsum_pd (__m256d v)
+{
+    __m128d lo = _mm256_castpd256_pd128 (v);
+    __m128d hi = _mm256_extractf128_pd (v, 1);
+    lo = _mm_add_pd (lo, hi);
+    lo = _mm_add_sd (lo, _mm_unpackhi_pd (lo, lo));
+    return _mm_cvtsd_f64 (lo);
+}
+
+/* Compute clamped interpolation coordinates along one axis for
+   eight voxels at once.  See li_clamp() for the scalar version. */
+static inline void
+li_clamp_avx2 (
+    __m256 ma,           /* Input:  unrounded coordinate (vox) */
+    __m256 dmax,         /* Input:  dim - 1 */
+    __m256i *maf,        /* Output: floor */
+    __m256i *mar,        /* Output: round */
+    __m256 *li_1,        /* Output: fraction for lower voxel */
+    __m256 *li_2         /* Output: fraction for upper voxel */
+)
+{
+    const __m256 zero = _mm256_setzero_ps ();
+    const __m256 one = _mm256_set1_ps (1.f);
+    const __m256 half = _mm256_set1_ps (0.5f);
+
+    __m256 lo = _mm256_cmp_ps (ma, zero, _CMP_LT_OQ);
+    __m256 hi = _mm256_cmp_ps (ma, dmax, _CMP_GE_OQ);
+
+    __m256 f = _mm256_floor_ps (ma);
+    __m256 r = _mm256_floor_ps (_mm256_add_ps (ma, half));
+    __m256 frac = _mm256_sub_ps (ma, f);
+
+    f = _mm256_blendv_ps (f, zero, lo);
+    r = _mm256_blendv_ps (r, zero, lo);
+    frac = _mm256_blendv_ps (frac, zero, lo);
+
+    f = _mm256_blendv_ps (f, _mm256_sub_ps (dmax, one), hi);
+    r = _mm256_blendv_ps (r, dmax, hi);
+    frac = _mm256_blendv_ps (frac, one, hi);
+
+    *maf = _mm256_cvttps_epi32 (f);
+    *mar = _mm256_cvttps_epi32 (r);
+    *li_2 = frac;
+    *li_1 = _mm256_sub_ps (one, frac);
+}
+
+/* AVX2 version of bspline_mse_row_scalar().  Voxel indices are
+   computed in 32-bit lanes, so the caller must ensure the moving
+   image has fewer than 2^31 voxels. */
+void
+bspline_mse_row_avx2 (Bspline_mse_row *row)
+{
+    const __m256 zero = _mm256_setzero_ps ();
+    const __m256i lane = _mm256_setr_epi32 (0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i b_stride = _mm256_mullo_epi32 (lane, _mm256_set1_epi32 (4));
+
+    __m256 cx[3][4];
+    __m256 dc_acc[3][4];
+    for (int d = 0; d < 3; d++) {
+        for (int i = 0; i < 4; i++) {
+            cx[d][i] = _mm256_set1_ps (row->cx[d][i]);
+            dc_acc[d][i] = zero;
+        }
+    }
+    __m256 lo_bound[3], hi_bound[3], dmax[3], base[3], step[3];
+    for (int d = 0; d < 3; d++) {
+        lo_bound[d] = _mm256_set1_ps (-0.5f);
+        hi_bound[d] = _mm256_set1_ps (row->m_dim[d] - 0.5f);
+        dmax[d] = _mm256_set1_ps ((float) (row->m_dim[d] - 1));
+        base[d] = _mm256_set1_ps (row->fxyz[d] - row->m_origin[d]);
+        step[d] = _mm256_set1_ps (row->fstep[d]);
+    }
+    __m256 proj[9];
+    for (int i = 0; i < 9; i++) {
+        proj[i] = _mm256_set1_ps (row->m_proj[i]);
+    }
+    const __m256i sx = _mm256_set1_epi32 (1);
+    const __m256i sy = _mm256_set1_epi32 ((int) row->m_dim[0]);
+    const __m256i sz = _mm256_set1_epi32 (
+        (int) (row->m_dim[0] * row->m_dim[1]));
+    const __m256i izero = _mm256_setzero_si256 ();
+    __m256i idmax[3];
+    for (int d = 0; d < 3; d++) {
+        idmax[d] = _mm256_set1_epi32 ((int) (row->m_dim[d] - 1));
+    }
+    const __m256i three = _mm256_set1_epi32 (3);
+    __m256d score_lo = _mm256_setzero_pd ();
+    __m256d score_hi = _mm256_setzero_pd ();
+    plm_long num_vox_used = 0;
+
+    plm_long v = 0;
+    for (; v + 8 <= row->num_vox; v += 8) {
+        /* Gather x basis functions for the eight voxels */
+        const float *b_ptr = &row->bx_lut[4*v];
+        __m256 b[4];
+        for (int i = 0; i < 4; i++) {
+            b[i] = _mm256_i32gather_ps (b_ptr + i, b_stride, 4);
+        }
+
+        /* Deformation and position relative to moving origin */
+        __m256 vv = _mm256_add_ps (_mm256_set1_ps ((float) v),
+            _mm256_cvtepi32_ps (lane));
+        __m256 m[3];
+        for (int d = 0; d < 3; d++) {
+            __m256 dd = _mm256_mul_ps (b[0], cx[d][0]);
+            dd = _mm256_fmadd_ps (b[1], cx[d][1], dd);
+            dd = _mm256_fmadd_ps (b[2], cx[d][2], dd);
+            dd = _mm256_fmadd_ps (b[3], cx[d][3], dd);
+            m[d] = _mm256_add_ps (_mm256_fmadd_ps (vv, step[d], base[d]), dd);
+        }
+
+        /* Project into moving image voxel coordinates */
+        __m256 mijk[3];
+        __m256 inside = _mm256_castsi256_ps (_mm256_set1_epi32 (-1));
+        for (int d = 0; d < 3; d++) {
+            __m256 t = _mm256_mul_ps (m[0], proj[3*d+0]);
+            t = _mm256_fmadd_ps (m[1], proj[3*d+1], t);
+            mijk[d] = _mm256_fmadd_ps (m[2], proj[3*d+2], t);
+            inside = _mm256_and_ps (inside,
+                _mm256_cmp_ps (mijk[d], lo_bound[d], _CMP_GT_OQ));
+            inside = _mm256_and_ps (inside,
+                _mm256_cmp_ps (mijk[d], hi_bound[d], _CMP_LT_OQ));
+        }
+        int inside_bits = _mm256_movemask_ps (inside);
+        if (!inside_bits) {
+            continue;
+        }
+
+        /* Interpolation fractions and corner indices */
+        __m256i mf[3], mr[3];
+        __m256 l1[3], l2[3];
+        for (int d = 0; d < 3; d++) {
+            li_clamp_avx2 (mijk[d], dmax[d], &mf[d], &mr[d], &l1[d], &l2[d]);
+        }
+
+        /* When dim is 1, li_clamp gives a floor of -1.  Clamp the 
+           floor, and use a zero step to the upper neighbor, so that 
+           both neighbors stay inside the image. */
+        __m256i ms[3];
+        for (int d = 0; d < 3; d++) {
+            mf[d] = _mm256_max_epi32 (mf[d], izero);
+            ms[d] = _mm256_cmpgt_epi32 (idmax[d], mf[d]);
+        }
+        __m256i ox = _mm256_and_si256 (ms[0], sx);
+        __m256i oy = _mm256_and_si256 (ms[1], sy);
+        __m256i oz = _mm256_and_si256 (ms[2], sz);
+        __m256i mvf = _mm256_add_epi32 (mf[0], _mm256_add_epi32 (
+                _mm256_mullo_epi32 (mf[1], sy),
+                _mm256_mullo_epi32 (mf[2], sz)));
+        __m256i mvr = _mm256_add_epi32 (mr[0], _mm256_add_epi32 (
+                _mm256_mullo_epi32 (mr[1], sy),
+                _mm256_mullo_epi32 (mr[2], sz)));
+
+        /* Lanes outside the moving image fetch voxel zero */
+        __m256i in_i = _mm256_castps_si256 (inside);
+        mvf = _mm256_and_si256 (mvf, in_i);
+        mvr = _mm256_and_si256 (mvr, in_i);
+
+        /* Trilinear interpolation */
+        const float *mi = row->m_img;
+        __m256i i01 = _mm256_add_epi32 (mvf, oy);
+        __m256i i10 = _mm256_add_epi32 (mvf, oz);
+        __m256i i11 = _mm256_add_epi32 (i10, oy);
+        __m256 v000 = _mm256_i32gather_ps (mi, mvf, 4);
+        __m256 v100 = _mm256_i32gather_ps (mi, _mm256_add_epi32 (mvf, ox), 4);
+        __m256 v010 = _mm256_i32gather_ps (mi, i01, 4);
+        __m256 v110 = _mm256_i32gather_ps (mi, _mm256_add_epi32 (i01, ox), 4);
+        __m256 v001 = _mm256_i32gather_ps (mi, i10, 4);
+        __m256 v101 = _mm256_i32gather_ps (mi, _mm256_add_epi32 (i10, ox), 4);
+        __m256 v011 = _mm256_i32gather_ps (mi, i11, 4);
+        __m256 v111 = _mm256_i32gather_ps (mi, _mm256_add_epi32 (i11, ox), 4);
+
+        __m256 y0z0 = _mm256_fmadd_ps (l1[0], v000, _mm256_mul_ps (l2[0], v100));
+        __m256 y1z0 = _mm256_fmadd_ps (l1[0], v010, _mm256_mul_ps (l2[0], v110));
+        __m256 y0z1 = _mm256_fmadd_ps (l1[0], v001, _mm256_mul_ps (l2[0], v101));
+        __m256 y1z1 = _mm256_fmadd_ps (l1[0], v011, _mm256_mul_ps (l2[0], v111));
+        __m256 z0 = _mm256_fmadd_ps (l1[1], y0z0, _mm256_mul_ps (l2[1], y1z0));
+        __m256 z1 = _mm256_fmadd_ps (l1[1], y0z1, _mm256_mul_ps (l2[1], y1z1));
+        __m256 m_val = _mm256_fmadd_ps (l1[2], z0, _mm256_mul_ps (l2[2], z1));
+
+        /* Intensity difference, zero for lanes outside moving image */
+        __m256 diff = _mm256_sub_ps (m_val, _mm256_loadu_ps (&row->f_row[v]));
+        diff = _mm256_and_ps (diff, inside);
+
+        /* Score is accumulated in double precision */
+        __m256 diff2 = _mm256_mul_ps (diff, diff);
+        score_lo = _mm256_add_pd (score_lo,
+            _mm256_cvtps_pd (_mm256_castps256_ps128 (diff2)));
+        score_hi = _mm256_add_pd (score_hi,
+            _mm256_cvtps_pd (_mm256_extractf128_ps (diff2, 1)));
+        for (int k = 0; k < 8; k++) {
+            num_vox_used += (inside_bits >> k) & 1;
+        }
+
+        /* Gradient, using nearest neighbor of moving gradient */
+        __m256i gidx = _mm256_mullo_epi32 (mvr, three);
+        for (int d = 0; d < 3; d++) {
+            __m256 g = _mm256_i32gather_ps (row->m_grad + d, gidx, 4);
+            __m256 dc_dv = _mm256_mul_ps (diff, g);
+            for (int i = 0; i < 4; i++) {
+                dc_acc[d][i] = _mm256_fmadd_ps (dc_dv, b[i], dc_acc[d][i]);
+            }
+        }
+    }
+
+    row->score += hsum_pd (_mm256_add_pd (score_lo, score_hi));
+    row->num_vox_used += num_vox_used;
+    for (int d = 0; d < 3; d++) {
+        for (int i = 0; i < 4; i++) {
+            row->dc_dx[d][i] += hsum_ps (dc_acc[d][i]);
+        }
+    }
+
+    /* Leftover voxels */
+    for (; v < row->num_vox; v++) {
+        bspline_mse_row_voxel (row, v);
+    }
+}
+
+#endif /* AVX2_FOUND */
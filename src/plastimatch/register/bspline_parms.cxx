@@ -24,6 +24,7 @@ Bspline_parms::Bspline_parms ()
     this->mi_hist_type = HIST_EQSP;
     this->mi_hist_fixed_bins = 32;
     this->mi_hist_moving_bins = 32;
+    this->mi_hist_accum = MI_HIST_ACCUM_COPIES;
 
     this->mi_fixed_image_minVal=0;
     this->mi_fixed_image_maxVal=0;
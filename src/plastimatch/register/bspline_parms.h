@@ -69,6 +69,7 @@ public:
     enum Mi_hist_type mi_hist_type;
     plm_long mi_hist_fixed_bins;
     plm_long mi_hist_moving_bins;
+    enum Mi_hist_accum mi_hist_accum;  /* Histogram merge for OpenMP */
 
     /* Image ROI selection */
     float mi_fixed_image_minVal;
@@ -73,6 +73,7 @@ Bspline_regularize::initialize (
 
     switch (reg_parms->implementation) {
     case 'a':
+    case 'e':
 	this->numeric_init (bxf);
         break;
     case 'b':
@@ -82,6 +83,9 @@ Bspline_regularize::initialize (
     case 'd':
 	this->semi_analytic_init (bxf);
         break;
+    case 'f':
+        /* Basis functions are evaluated when computing the score */
+        break;
     default:
         print_and_exit (
             "Error: unknown reg_parms->implementation (%c)\n",
@@ -115,6 +119,13 @@ Bspline_regularize::compute_score (
     case 'd':
         this->compute_score_semi_analytic (bspline_score, reg_parms, this, bxf);
         break;
+    case 'e':
+        this->compute_score_numeric_omp (bspline_score, reg_parms, this, bxf);
+        break;
+    case 'f':
+        this->compute_score_semi_analytic_omp (
+            bspline_score, reg_parms, this, bxf);
+        break;
     default:
         print_and_exit (
             "Error: unknown reg_parms->implementation (%c)\n",
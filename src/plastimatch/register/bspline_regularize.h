@@ -72,6 +72,11 @@ protected:
         const Regularization_parms *parms, 
         const Bspline_regularize *rst,
         const Bspline_xform* bxf);
+    void compute_score_numeric_omp (
+        Bspline_score *bscore, 
+        const Regularization_parms *parms, 
+        const Bspline_regularize *rst,
+        const Bspline_xform* bxf);
 
     void analytic_init (
         const Bspline_xform* bxf);
@@ -112,6 +117,11 @@ protected:
         const Regularization_parms *parms, 
         const Bspline_regularize *rst,
         const Bspline_xform* bxf);
+    void compute_score_semi_analytic_omp (
+        Bspline_score *bscore, 
+        const Regularization_parms *parms, 
+        const Bspline_regularize *rst,
+        const Bspline_xform* bxf);
 };
 
 #endif
@@ -15,6 +15,7 @@
 #include "bspline_score.h"
 #include "bspline_xform.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "volume.h"
 
@@ -501,6 +502,7 @@ Bspline_regularize::compute_score_analytic_omp (
     const Bspline_regularize* rst,
     const Bspline_xform* bxf)
 {
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_analytic_omp");
     plm_long i, n;
 
     double S = 0.0;
@@ -551,6 +553,7 @@ Bspline_regularize::compute_score_analytic (
     const Bspline_regularize* rst,
     const Bspline_xform* bxf)
 {
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_analytic");
     plm_long i, n;
     plm_long knots[64];
 
@@ -6,16 +6,23 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <algorithm>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
 #include "bspline.h"
 #include "bspline_macros.h"
 #include "bspline_regularize.h"
 #include "bspline_regularize_numeric.h"
 #include "bspline_score.h"
+#include "bspline_interpolate.h"
 #include "bspline_xform.h"
 #include "logfile.h"
 #include "mha_io.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "print_and_exit.h"
 #include "volume_macros.h"
@@ -346,12 +353,249 @@ Bspline_regularize::compute_score_numeric (
     const Bspline_regularize *rst,
     const Bspline_xform* bxf)
 {
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_numeric");
     Volume *vf = bspline_compute_vf (bxf);
     bscore->rmetric = 0.0;
     compute_score_numeric_internal (bscore, parms, rst, bxf, vf);
     delete vf;
 }
 
+/* Add the contribution of dc_dv at a single voxel to the 
+   coefficient gradient grad */
+static inline void
+numeric_update_grad_b (
+    float *grad,
+    const Bspline_xform* bxf,
+    plm_long pidx,
+    plm_long qidx,
+    const float dc_dv[3])
+{
+    const float* q_lut = &bxf->q_lut[qidx*64];
+    const plm_long* c_lut = &bxf->c_lut[pidx*64];
+    for (int m = 0; m < 64; m++) {
+        plm_long cidx = 3 * c_lut[m];
+        grad[cidx+0] += dc_dv[0] * q_lut[m];
+        grad[cidx+1] += dc_dv[1] * q_lut[m];
+        grad[cidx+2] += dc_dv[2] * q_lut[m];
+    }
+}
+
+/* Flavor 'e'
+
+   Same finite difference penalty as flavor 'a', but the vector field 
+   is never rendered at full resolution.  Tiles are processed in 
+   parallel.  For each tile, the field is interpolated on the tile 
+   plus a one voxel border, which is enough to evaluate the stencils 
+   centered within the tile.  The stencil gradients are first summed 
+   per voxel of this small box, so that each voxel is scattered to 
+   the control points only once, into a gradient owned by 
+   the thread. */
+void
+Bspline_regularize::compute_score_numeric_omp (
+    Bspline_score *bscore, 
+    const Regularization_parms *parms, 
+    const Bspline_regularize *rst,
+    const Bspline_xform* bxf)
+{
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_numeric_omp");
+
+    /* bspline_interp_pix_b() does not modify the transform */
+    Bspline_xform *bxf_nc = const_cast<Bspline_xform*> (bxf);
+    const plm_long *dim = bxf->roi_dim;
+    const plm_long *vpr = bxf->vox_per_rgn;
+
+    float dx = bxf->img_spacing[0];
+    float dy = bxf->img_spacing[1];
+    float dz = bxf->img_spacing[2];
+    float dxdydz = dx * dy * dz;
+
+    float inv_dxdx = 1.0f / (dx * dx);
+    float inv_dydy = 1.0f / (dy * dy);
+    float inv_dzdz = 1.0f / (dz * dz);
+    float inv_dxdy = 0.25f / (dx*dy);
+    float inv_dxdz = 0.25f / (dx*dz);
+    float inv_dydz = 0.25f / (dy*dz);
+
+    /* Gradient multipliers, as in flavor 'a' */
+    float g_xx = 2 * dxdydz * inv_dxdx;
+    float g_yy = 2 * dxdydz * inv_dydy;
+    float g_zz = 2 * dxdydz * inv_dzdz;
+    float g_xy = 4 * dxdydz * inv_dxdy;
+    float g_xz = 4 * dxdydz * inv_dxdz;
+    float g_yz = 4 * dxdydz * inv_dydz;
+
+    /* Voxel-specific stiffness */
+    const float *fsimg = 0;
+    if (rst->fixed_stiffness) {
+        fsimg = rst->fixed_stiffness->get_raw<float>();
+    }
+
+    Plm_timer* timer = new Plm_timer;
+    timer->start ();
+
+    int num_threads = 1;
+#if (OPENMP_FOUND)
+    num_threads = omp_get_max_threads ();
+#endif
+    plm_long num_coeff = bxf->num_coeff;
+    std::vector<float> thread_grad (num_threads * num_coeff, 0.f);
+    plm_long num_tiles = bxf->rdims[0] * bxf->rdims[1] * bxf->rdims[2];
+    plm_long box_size = (vpr[0] + 2) * (vpr[1] + 2) * (vpr[2] + 2);
+
+    double S = 0.0;
+#pragma omp parallel reduction (+:S)
+    {
+        int thread_num = 0;
+#if (OPENMP_FOUND)
+        thread_num = omp_get_thread_num ();
+#endif
+        float *grad = &thread_grad[thread_num * num_coeff];
+        std::vector<float> vf (3 * box_size);
+        std::vector<float> dc (3 * box_size);
+
+#pragma omp for schedule (dynamic)
+        for (plm_long t = 0; t < num_tiles; t++) {
+            plm_long p[3], r[3];
+            COORDS_FROM_INDEX (p, t, bxf->rdims);
+
+            /* Box is the tile plus a one voxel border, clipped to roi */
+            plm_long lo[3], bd[3];
+            for (int d = 0; d < 3; d++) {
+                lo[d] = std::max (p[d] * vpr[d] - 1, (plm_long) 0);
+                plm_long hi = std::min (p[d] * vpr[d] + vpr[d], dim[d] - 1);
+                bd[d] = hi - lo[d] + 1;
+            }
+            plm_long sx = 3;
+            plm_long sy = 3 * bd[0];
+            plm_long sz = 3 * bd[0] * bd[1];
+
+            /* Interpolate the vector field within the box */
+            plm_long b = 0;
+            for (r[2] = lo[2]; r[2] < lo[2] + bd[2]; r[2]++) {
+                for (r[1] = lo[1]; r[1] < lo[1] + bd[1]; r[1]++) {
+                    for (r[0] = lo[0]; r[0] < lo[0] + bd[0]; r[0]++) {
+                        bspline_interp_pix_b (&vf[b], bxf_nc, 
+                            get_region_index (r, bxf),
+                            get_region_offset (r, bxf));
+                        b += 3;
+                    }
+                }
+            }
+            std::fill (dc.begin(), dc.begin() + b, 0.f);
+
+            /* Evaluate the stencils centered within the tile */
+            plm_long c_lo[3], c_hi[3];
+            for (int d = 0; d < 3; d++) {
+                c_lo[d] = std::max (p[d] * vpr[d], (plm_long) 1);
+                c_hi[d] = std::min (p[d] * vpr[d] + vpr[d], dim[d] - 1);
+            }
+            for (r[2] = c_lo[2]; r[2] < c_hi[2]; r[2]++) {
+                for (r[1] = c_lo[1]; r[1] < c_hi[1]; r[1]++) {
+                    b = (r[2] - lo[2]) * sz + (r[1] - lo[1]) * sy
+                        + (c_lo[0] - lo[0]) * sx;
+                    for (r[0] = c_lo[0]; r[0] < c_hi[0]; r[0]++, b += sx) {
+                        const float *v = &vf[b];
+                        float *g = &dc[b];
+
+                        float stiffness = 1.0f;
+                        if (fsimg) {
+                            stiffness = fsimg[volume_index (
+                                    rst->fixed_stiffness->dim,
+                                    r[0] + bxf->roi_offset[0],
+                                    r[1] + bxf->roi_offset[1],
+                                    r[2] + bxf->roi_offset[2])];
+                        }
+
+                        float d2_sq = 0.0f;
+                        for (int c = 0; c < 3; c++) {
+                            float d2_dx2 = inv_dxdx 
+                                * (v[sx+c] - 2.0f*v[c] + v[-sx+c]);
+                            float d2_dy2 = inv_dydy 
+                                * (v[sy+c] - 2.0f*v[c] + v[-sy+c]);
+                            float d2_dz2 = inv_dzdz 
+                                * (v[sz+c] - 2.0f*v[c] + v[-sz+c]);
+                            float d2_dxdy = inv_dxdy * (
+                                v[-sx-sy+c] - v[-sx+sy+c] 
+                                - v[sx-sy+c] + v[sx+sy+c]);
+                            float d2_dxdz = inv_dxdz * (
+                                v[-sx-sz+c] - v[-sx+sz+c] 
+                                - v[sx-sz+c] + v[sx+sz+c]);
+                            float d2_dydz = inv_dydz * (
+                                v[-sy-sz+c] - v[-sy+sz+c] 
+                                - v[sy-sz+c] + v[sy+sz+c]);
+
+                            d2_sq += d2_dx2*d2_dx2 + d2_dy2*d2_dy2
+                                + d2_dz2*d2_dz2 + 2.0f * (
+                                    d2_dxdy*d2_dxdy + d2_dxdz*d2_dxdz
+                                    + d2_dydz*d2_dydz);
+
+                            float gxx = stiffness * g_xx * d2_dx2;
+                            float gyy = stiffness * g_yy * d2_dy2;
+                            float gzz = stiffness * g_zz * d2_dz2;
+                            float gxy = stiffness * g_xy * d2_dxdy;
+                            float gxz = stiffness * g_xz * d2_dxdz;
+                            float gyz = stiffness * g_yz * d2_dydz;
+
+                            g[c] -= 2.0f * (gxx + gyy + gzz);
+                            g[-sx+c] += gxx;
+                            g[+sx+c] += gxx;
+                            g[-sy+c] += gyy;
+                            g[+sy+c] += gyy;
+                            g[-sz+c] += gzz;
+                            g[+sz+c] += gzz;
+                            g[-sx-sy+c] += gxy;
+                            g[-sx+sy+c] -= gxy;
+                            g[+sx-sy+c] -= gxy;
+                            g[+sx+sy+c] += gxy;
+                            g[-sx-sz+c] += gxz;
+                            g[-sx+sz+c] -= gxz;
+                            g[+sx-sz+c] -= gxz;
+                            g[+sx+sz+c] += gxz;
+                            g[-sy-sz+c] += gyz;
+                            g[-sy+sz+c] -= gyz;
+                            g[+sy-sz+c] -= gyz;
+                            g[+sy+sz+c] += gyz;
+                        }
+                        S += stiffness * d2_sq;
+                    }
+                }
+            }
+
+            /* Scatter the box gradient to the control points */
+            b = 0;
+            for (r[2] = lo[2]; r[2] < lo[2] + bd[2]; r[2]++) {
+                for (r[1] = lo[1]; r[1] < lo[1] + bd[1]; r[1]++) {
+                    for (r[0] = lo[0]; r[0] < lo[0] + bd[0]; r[0]++) {
+                        if (dc[b+0] != 0.f || dc[b+1] != 0.f 
+                            || dc[b+2] != 0.f)
+                        {
+                            numeric_update_grad_b (grad, bxf,
+                                get_region_index (r, bxf),
+                                get_region_offset (r, bxf), &dc[b]);
+                        }
+                        b += 3;
+                    }
+                }
+            }
+        }
+    }
+
+    /* Sum the gradients of all threads */
+#pragma omp parallel for
+    for (plm_long c = 0; c < num_coeff; c++) {
+        float sum = 0.f;
+        for (int t = 0; t < num_threads; t++) {
+            sum += thread_grad[t * num_coeff + c];
+        }
+        bscore->total_grad[c] += sum;
+    }
+
+    /* Integrate */
+    bscore->rmetric = S * dxdydz;
+    bscore->time_rmetric = timer->report ();
+    delete timer;
+}
+
 void
 Bspline_regularize::numeric_init (
     const Bspline_xform* bxf
@@ -3,13 +3,21 @@
    ----------------------------------------------------------------------- */
 #include "plmregister_config.h"
 #include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
 #include "bspline_regularize.h"
 #include "bspline_score.h"
 #include "bspline_xform.h"
 #include "logfile.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "print_and_exit.h"
+#include "volume_macros.h"
 
 /* Flavor 'd' */
 void 
@@ -418,6 +426,7 @@ Bspline_regularize::compute_score_semi_analytic (
     const Bspline_xform* bxf
 )
 {
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_semi_analytic");
     double grad_score;
     plm_long ri, rj, rk;
     plm_long fi, fj, fk;
@@ -495,17 +504,210 @@ Bspline_regularize::compute_score_semi_analytic (
 #endif
 	    }
 	}
-
-	bscore->time_rmetric = timer->report ();
-	//raw_score = grad_score / num_vox;
-	grad_score *= (parms->lambda / num_vox);
-	//printf ("        GRAD_COST %.4f   RAW_GRAD %.4f   [%.3f secs]\n", grad_score, raw_score, interval);
-	bscore->rmetric += grad_score;
     }
+
+    bscore->time_rmetric = timer->report ();
+    //raw_score = grad_score / num_vox;
+    grad_score *= (parms->lambda / num_vox);
+    //printf ("        GRAD_COST %.4f   RAW_GRAD %.4f   [%.3f secs]\n", grad_score, raw_score, interval);
+    bscore->rmetric += grad_score;
     //printf ("SCORE=%.4f\n", bscore->score);
     delete timer;
 }
 
+/* Cubic B-spline basis, and its first and second derivatives, 
+   at n evenly spaced offsets within a region */
+static void
+semi_analytic_basis (float *A, float *Ax, float *Axx, plm_long n)
+{
+    for (plm_long i = 0; i < n; i++) {
+        float ii = ((float) i) / n;
+        float t3 = ii*ii*ii;
+        float t2 = ii*ii;
+        float t1 = ii;
+        A[i*4+0] = (1.0/6.0) * (- 1.0 * t3 + 3.0 * t2 - 3.0 * t1 + 1.0);
+        A[i*4+1] = (1.0/6.0) * (+ 3.0 * t3 - 6.0 * t2            + 4.0);
+        A[i*4+2] = (1.0/6.0) * (- 3.0 * t3 + 3.0 * t2 + 3.0 * t1 + 1.0);
+        A[i*4+3] = (1.0/6.0) * (+ 1.0 * t3);
+
+        Ax[i*4+0] =(1.0/6.0) * (- 3.0 * t2 + 6.0 * t1 - 3.0           );
+        Ax[i*4+1] =(1.0/6.0) * (+ 9.0 * t2 - 12.0* t1                 );
+        Ax[i*4+2] =(1.0/6.0) * (- 9.0 * t2 + 6.0 * t1 + 3.0           );
+        Ax[i*4+3] =(1.0/6.0) * (+ 3.0 * t2);
+
+        Axx[i*4+0]=(1.0/6.0) * (- 6.0 * t1 + 6.0                     );
+        Axx[i*4+1]=(1.0/6.0) * (+18.0 * t1 - 12.0                    );
+        Axx[i*4+2]=(1.0/6.0) * (-18.0 * t1 + 6.0                     );
+        Axx[i*4+3]=(1.0/6.0) * (+ 6.0 * t1);
+    }
+}
+
+/* Flavor 'f'
+
+   Same penalty and gradient as flavor 'd', with tiles processed in 
+   parallel.  Instead of the 64-tap LUTs, the six Hessian components 
+   are evaluated one row of voxels at a time.  Within a row the 
+   y and z basis weights are constant, so the 64 coefficients of 
+   the tile are first condensed to 4 x-taps per component, and 
+   the gradient is accumulated on these taps and expanded to the 
+   64 control points once per row.  The inner loops are short, 
+   fixed-length, and free of indirection, so that the compiler 
+   can vectorize them. */
+void
+Bspline_regularize::compute_score_semi_analytic_omp (
+    Bspline_score *bscore, 
+    const Regularization_parms *parms, 
+    const Bspline_regularize *rst,
+    const Bspline_xform* bxf)
+{
+    PLM_PROFILE_SCOPE ("Bspline_regularize::compute_score_semi_analytic_omp");
+    const plm_long *vpr = bxf->vox_per_rgn;
+    plm_long num_vox = bxf->roi_dim[0] * bxf->roi_dim[1] * bxf->roi_dim[2];
+    float grad_coeff = parms->lambda / num_vox;
+
+    Plm_timer* timer = new Plm_timer;
+    timer->start ();
+
+    /* Basis along each axis */
+    std::vector<float> A (4*vpr[0]), Ax (4*vpr[0]), Axx (4*vpr[0]);
+    std::vector<float> B (4*vpr[1]), By (4*vpr[1]), Byy (4*vpr[1]);
+    std::vector<float> C (4*vpr[2]), Cz (4*vpr[2]), Czz (4*vpr[2]);
+    semi_analytic_basis (&A[0], &Ax[0], &Axx[0], vpr[0]);
+    semi_analytic_basis (&B[0], &By[0], &Byy[0], vpr[1]);
+    semi_analytic_basis (&C[0], &Cz[0], &Czz[0], vpr[2]);
+
+    /* Hessian components, in the order of flavor 'd': the x basis 
+       used by each, and its weight */
+    const float *xb[6] = { 
+        &Axx[0], &A[0], &A[0], &Ax[0], &Ax[0], &A[0] };
+    const float weight[6] = { 1.f, 1.f, 1.f, 2.f, 2.f, 2.f };
+
+    /* Each tile writes its 64 sets into its own slots */
+    plm_long cond_size = 64 * bxf->num_knots;
+    std::vector<float> cond (3 * cond_size, 0.f);
+    plm_long num_tiles = bxf->rdims[0] * bxf->rdims[1] * bxf->rdims[2];
+
+    double S = 0.0;
+#pragma omp parallel for schedule (dynamic) reduction (+:S)
+    for (plm_long t = 0; t < num_tiles; t++) {
+        plm_long p[3];
+        COORDS_FROM_INDEX (p, t, bxf->rdims);
+        const plm_long *c_lut = &bxf->c_lut[64*t];
+
+        /* Coefficients of the tile */
+        float cc[3][64];
+        for (int m = 0; m < 64; m++) {
+            cc[0][m] = bxf->coeff[3*c_lut[m]+0];
+            cc[1][m] = bxf->coeff[3*c_lut[m]+1];
+            cc[2][m] = bxf->coeff[3*c_lut[m]+2];
+        }
+        float sets[3][64];
+        memset (sets, 0, sizeof(sets));
+
+        plm_long q_lim[3];
+        for (int d = 0; d < 3; d++) {
+            q_lim[d] = std::min (vpr[d], bxf->roi_dim[d] - p[d] * vpr[d]);
+        }
+
+        for (plm_long qz = 0; qz < q_lim[2]; qz++) {
+            const float *c = &C[4*qz], *cz = &Cz[4*qz], *czz = &Czz[4*qz];
+            for (plm_long qy = 0; qy < q_lim[1]; qy++) {
+                const float *b = &B[4*qy], *by = &By[4*qy], 
+                    *byy = &Byy[4*qy];
+
+                /* Weights of the 16 (z,y) coefficient rows */
+                float yz[6][16];
+                for (int k = 0; k < 4; k++) {
+                    for (int j = 0; j < 4; j++) {
+                        yz[0][4*k+j] = b[j] * c[k];
+                        yz[1][4*k+j] = byy[j] * c[k];
+                        yz[2][4*k+j] = b[j] * czz[k];
+                        yz[3][4*k+j] = by[j] * c[k];
+                        yz[4][4*k+j] = b[j] * cz[k];
+                        yz[5][4*k+j] = by[j] * cz[k];
+                    }
+                }
+
+                /* Condense coefficients to x-taps */
+                float cx[6][3][4];
+                for (int h = 0; h < 6; h++) {
+                    for (int d = 0; d < 3; d++) {
+                        float t4[4] = { 0.f, 0.f, 0.f, 0.f };
+                        for (int kj = 0; kj < 16; kj++) {
+                            const float *row = &cc[d][4*kj];
+                            for (int i = 0; i < 4; i++) {
+                                t4[i] += yz[h][kj] * row[i];
+                            }
+                        }
+                        for (int i = 0; i < 4; i++) {
+                            cx[h][d][i] = t4[i];
+                        }
+                    }
+                }
+
+                /* Walk the row */
+                float gx[6][3][4];
+                memset (gx, 0, sizeof(gx));
+                double row_score = 0.0;
+                for (plm_long qx = 0; qx < q_lim[0]; qx++) {
+                    for (int h = 0; h < 6; h++) {
+                        const float *a = &xb[h][4*qx];
+                        for (int d = 0; d < 3; d++) {
+                            float hv = a[0] * cx[h][d][0] 
+                                + a[1] * cx[h][d][1]
+                                + a[2] * cx[h][d][2] 
+                                + a[3] * cx[h][d][3];
+                            row_score += weight[h] * hv * hv;
+                            float dc_dv = weight[h] * grad_coeff * hv;
+                            for (int i = 0; i < 4; i++) {
+                                gx[h][d][i] += dc_dv * a[i];
+                            }
+                        }
+                    }
+                }
+                S += row_score;
+
+                /* Expand the x-tap gradient to the 64 sets */
+                for (int h = 0; h < 6; h++) {
+                    for (int d = 0; d < 3; d++) {
+                        for (int kj = 0; kj < 16; kj++) {
+                            float *row = &sets[d][4*kj];
+                            for (int i = 0; i < 4; i++) {
+                                row[i] += yz[h][kj] * gx[h][d][i];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+
+        /* Put the sets in the slots of their control points */
+        for (int m = 0; m < 64; m++) {
+            plm_long kidx = c_lut[m];
+            cond[0*cond_size + 64*kidx + m] = sets[0][m];
+            cond[1*cond_size + 64*kidx + m] = sets[1][m];
+            cond[2*cond_size + 64*kidx + m] = sets[2][m];
+        }
+    }
+
+    /* Sum the slots of each control point */
+#pragma omp parallel for
+    for (plm_long kidx = 0; kidx < bxf->num_knots; kidx++) {
+        for (int d = 0; d < 3; d++) {
+            const float *slots = &cond[d*cond_size + 64*kidx];
+            float sum = 0.f;
+            for (int m = 0; m < 64; m++) {
+                sum += slots[m];
+            }
+            bscore->total_grad[3*kidx+d] += sum;
+        }
+    }
+
+    bscore->rmetric = S * grad_coeff;
+    bscore->time_rmetric = timer->report ();
+    delete timer;
+}
+
 void
 Bspline_regularize::semi_analytic_init (
     const Bspline_xform* bxf
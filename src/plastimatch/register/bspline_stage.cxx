@@ -281,10 +281,18 @@ Bspline_stage::initialize ()
         }
         break;
     case REGULARIZATION_BSPLINE_SEMI_ANALYTIC:
-        parms->reg_parms->implementation = 'd';
+        if (stage->threading_type == THREADING_CPU_OPENMP) {
+            parms->reg_parms->implementation = 'f';
+        } else {
+            parms->reg_parms->implementation = 'd';
+        }
         break;
     case REGULARIZATION_BSPLINE_NUMERIC:
-        parms->reg_parms->implementation = 'a';
+        if (stage->threading_type == THREADING_CPU_OPENMP) {
+            parms->reg_parms->implementation = 'e';
+        } else {
+            parms->reg_parms->implementation = 'a';
+        }
         break;
     default:
         print_and_exit ("Undefined regularization type in gpuit_bspline\n");
@@ -300,6 +308,7 @@ Bspline_stage::initialize ()
     parms->mi_hist_type = stage->mi_hist_type;
     parms->mi_hist_fixed_bins = stage->mi_hist_fixed_bins;
     parms->mi_hist_moving_bins = stage->mi_hist_moving_bins;
+    parms->mi_hist_accum = stage->mi_hist_accum;
 
     /* Other stuff */
     parms->min_its = stage->min_its;
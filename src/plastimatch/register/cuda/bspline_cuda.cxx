@@ -624,7 +624,6 @@ CUDA_bspline_mi_a (
     double* f_hist = mi_hist->f_hist;
     double* m_hist = mi_hist->m_hist;
     double* j_hist = mi_hist->j_hist;
-    static int it=0;        // Holds Iteration Number
     char debug_fn[1024];    // Debug message buffer
     FILE* fp = NULL;        // File Pointer to Debug File
     //int i;                  // Good ol' i
@@ -650,7 +649,7 @@ CUDA_bspline_mi_a (
     ssd = &bst->ssd;
     
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mse_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mse_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
     // ----------------------------------------------------------
@@ -745,7 +744,6 @@ CUDA_bspline_mse_j (
     float ssd_grad_norm;    // Holds the SSD Gradient's Norm
     float ssd_grad_mean;    // Holds the SSD Gradient's Mean
 
-    static int it=0;        // Holds Iteration Number
     char debug_fn[1024];    // Debug message buffer
     FILE* fp = NULL;        // File Pointer to Debug File
     // ----------------------------------------------------------
@@ -754,7 +752,7 @@ CUDA_bspline_mse_j (
     ssd = &bst->ssd;
     
     if (parms->debug) {
-        sprintf (debug_fn, "dump_mse_%02d.txt", it++);
+        sprintf (debug_fn, "dump_mse_%03d_%03d.txt", bst->it, bst->feval);
         fp = fopen (debug_fn, "w");
     }
     // ----------------------------------------------------------
@@ -67,8 +67,9 @@ demons (
         return tmp;
 #endif
     case THREADING_CPU_SINGLE:
+        return demons_c (fixed, moving, moving_grad, vf_init, parms);
     case THREADING_CPU_OPENMP:
     default:
-        return demons_c (fixed, moving, moving_grad, vf_init, parms);
+        return demons_c_omp (fixed, moving, moving_grad, vf_init, parms);
     }
 }
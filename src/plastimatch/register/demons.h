@@ -35,6 +35,13 @@ Volume* demons_c (
         Volume* vf_init,
         Demons_parms* parms
 );
+Volume* demons_c_omp (
+        Volume* fixed,
+        Volume* moving,
+        Volume* moving_grad,
+        Volume* vf_init,
+        Demons_parms* parms
+);
 
 //plmopencl_EXPORT (
 Volume* demons_opencl (
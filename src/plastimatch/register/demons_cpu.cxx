@@ -6,11 +6,15 @@
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#if (SSE2_FOUND)
+#include <xmmintrin.h>
+#endif
 
 #include "demons.h"
 #include "gaussian.h"
 #include "plm_int.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "vf_convolve.h"
 #include "volume.h"
@@ -174,3 +178,290 @@ demons_c (
 
     return vf_smooth;
 }
+
+/* -----------------------------------------------------------------------
+   OpenMP implementation
+
+   Each iteration makes three passes over the vector field.  The first
+   pass computes the displacement estimate one row at a time into a
+   thread-local buffer, and smooths that row along x straight into the 
+   output.  This fuses the estimate with the x convolution, and avoids
+   copying the whole vector field at the start of each iteration.  The
+   y and z convolutions are then done a row at a time, where for each
+   output row the kernel weights contiguous input rows, so the inner
+   loops are vectorized.  All passes are partitioned into contiguous
+   blocks of rows (slabs) across threads.
+   ----------------------------------------------------------------------- */
+/* Find kernel extent for position x on an axis of length dim.
+   Kernel entries j1..j2 apply to input positions i1..i1+j2-j1. */
+static inline void
+demons_kernel_window (
+    plm_long x, plm_long dim, int half_width, 
+    plm_long *i1, plm_long *j1, plm_long *j2)
+{
+    if (x < half_width) {
+	*i1 = 0;
+	*j1 = half_width - x;
+    } else {
+	*i1 = x - half_width;
+	*j1 = 0;
+    }
+    if (x + half_width > dim - 1) {
+	*j2 = half_width + (dim - x) - 1;
+    } else {
+	*j2 = 2 * half_width;
+    }
+}
+
+/* out[i] += k * in[i] */
+static inline void
+demons_row_axpy (float *out, const float *in, float k, plm_long n)
+{
+    plm_long i = 0;
+#if (SSE2_FOUND)
+    __m128 kk = _mm_set1_ps (k);
+    for (; i + 4 <= n; i += 4) {
+	__m128 o = _mm_loadu_ps (out + i);
+	o = _mm_add_ps (o, _mm_mul_ps (kk, _mm_loadu_ps (in + i)));
+	_mm_storeu_ps (out + i, o);
+    }
+#endif
+    for (; i < n; i++) {
+	out[i] += k * in[i];
+    }
+}
+
+/* out[i] /= s */
+static inline void
+demons_row_div (float *out, float s, plm_long n)
+{
+    plm_long i = 0;
+#if (SSE2_FOUND)
+    __m128 ss = _mm_set1_ps (s);
+    for (; i + 4 <= n; i += 4) {
+	_mm_storeu_ps (out + i, _mm_div_ps (_mm_loadu_ps (out + i), ss));
+    }
+#endif
+    for (; i < n; i++) {
+	out[i] /= s;
+    }
+}
+
+/* Smooth one row of an interleaved vector field along x. 
+   Same arithmetic as vf_convolve_x(). */
+static void
+demons_convolve_row_x (
+    float *out, const float *in, plm_long dim_x, 
+    const float *ker, int half_width)
+{
+    for (plm_long x = 0; x < dim_x; x++) {
+	plm_long i, i1, j, j1, j2;
+	demons_kernel_window (x, dim_x, half_width, &i1, &j1, &j2);
+	for (int d = 0; d < 3; d++) {
+	    float ktot = 0.0f;
+	    float acc = 0.0f;
+	    for (i = i1, j = j1; j <= j2; i++, j++) {
+		acc += ker[j] * in[3*i+d];
+		ktot += ker[j];
+	    }
+	    out[3*x+d] = acc / ktot;
+	}
+    }
+}
+
+/* Smooth row (y,z) of an interleaved vector field along y (axis = 1)
+   or z (axis = 2).  Same arithmetic as vf_convolve_y/z(). */
+static void
+demons_convolve_row_yz (
+    float *out, const float *in_img, const plm_long *dim, 
+    plm_long y, plm_long z, int axis, const float *ker, int half_width)
+{
+    plm_long i, i1, j, j1, j2;
+    plm_long n = 3 * dim[0];
+    float ktot = 0.0f;
+
+    demons_kernel_window (axis == 1 ? y : z, dim[axis], half_width, 
+	&i1, &j1, &j2);
+    for (plm_long v = 0; v < n; v++) {
+	out[v] = 0.0f;
+    }
+    for (i = i1, j = j1; j <= j2; i++, j++) {
+	plm_long row = (axis == 1) ? (z * dim[1] + i) : (i * dim[1] + y);
+	demons_row_axpy (out, &in_img[row * n], ker[j], n);
+	ktot += ker[j];
+    }
+    demons_row_div (out, ktot, n);
+}
+
+/* Vector fields are all in mm units */
+Volume*
+demons_c_omp (
+    Volume* fixed, 
+    Volume* moving, 
+    Volume* moving_grad, 
+    Volume* vf_init, 
+    Demons_parms* parms)
+{
+    PLM_PROFILE_SCOPE ("demons_c_omp");
+
+    float f2mo[3];         /* Origin difference (in mm) from fixed to moving */
+    float f2ms[3];         /* Slope to convert fixed to moving */
+    float invmps[3];       /* 1/pixel spacing of moving image */
+    float *kerx, *kery, *kerz;
+    int fw[3];
+    double diff_run;
+    Volume *vf_smooth, *vf_tmp;
+    const float *f_img = (const float*) fixed->img;
+    const float *m_img = (const float*) moving->img;
+    const float *m_grad_img = (const float*) moving_grad->img;
+    float *m_grad_mag_img;
+    const plm_long *fdim = fixed->dim;
+    const plm_long *mdim = moving->dim;
+    plm_long num_rows = fdim[1] * fdim[2];
+    long r;
+
+    /* Allocate memory for vector fields */
+    if (vf_init) {
+	/* If caller has an initial estimate, we copy it */
+	vf_smooth = volume_clone (vf_init);
+	vf_convert_to_interleaved (vf_smooth);
+    } else {
+	/* Otherwise initialize to zero */
+	vf_smooth = new Volume (fixed->dim, fixed->origin, fixed->spacing, 
+	    fixed->direction_cosines, PT_VF_FLOAT_INTERLEAVED, 3);
+    }
+    vf_tmp = new Volume (fixed->dim, fixed->origin, fixed->spacing, 
+	fixed->direction_cosines, PT_VF_FLOAT_INTERLEAVED, 3);
+    m_grad_mag_img = (float*) malloc (moving->npix * sizeof(float));
+
+    /* Create gradient magnitude image */
+#pragma omp parallel for schedule (static)
+    for (long k = 0; k < (long) mdim[2]; k++) {
+	plm_long v = k * mdim[0] * mdim[1];
+	for (plm_long ij = 0; ij < mdim[0] * mdim[1]; ij++, v++) {
+	    const float *vox_grad = &m_grad_img[3*v];
+	    m_grad_mag_img[v] = vox_grad[0] * vox_grad[0] 
+		+ vox_grad[1] * vox_grad[1] + vox_grad[2] * vox_grad[2];
+	}
+    }
+
+    /* Validate filter widths */
+    validate_filter_widths (fw, parms->filter_width);
+
+    /* Create the seperable smoothing kernels for the x, y, and z directions */
+    kerx = create_ker (parms->filter_std / fixed->spacing[0], fw[0]/2);
+    kery = create_ker (parms->filter_std / fixed->spacing[1], fw[1]/2);
+    kerz = create_ker (parms->filter_std / fixed->spacing[2], fw[2]/2);
+    kernel_stats (kerx, kery, kerz, fw);
+
+    /* Compute some variables for converting pixel sizes / origins */
+    for (int d = 0; d < 3; d++) {
+	invmps[d] = 1 / moving->spacing[d];
+	f2mo[d] = (fixed->origin[d] - moving->origin[d]) / moving->spacing[d];
+	f2ms[d] = fixed->spacing[d] / moving->spacing[d];
+    }
+
+    Plm_timer* timer = new Plm_timer;
+    Plm_timer* it_timer = new Plm_timer;
+
+    timer->start ();
+    it_timer->start ();
+
+    /* Main loop through iterations */
+    for (int it = 0; it < parms->max_its; it++) {
+	const float *smooth_img = (const float*) vf_smooth->img;
+	float *tmp_img = (float*) vf_tmp->img;
+	plm_long inliers = 0;
+	double ssd = 0.0;
+
+	/* Estimate displacement, and smooth along x into vf_tmp */
+#pragma omp parallel reduction (+:inliers,ssd)
+	{
+	    float *est = (float*) malloc (3 * fdim[0] * sizeof(float));
+#pragma omp for schedule (static)
+	    for (r = 0; r < (long) num_rows; r++) {
+		plm_long fj = r % fdim[1];
+		plm_long fk = r / fdim[1];
+		plm_long fv = r * fdim[0];
+		float mk = f2mo[2] + fk * f2ms[2];
+		float mj = f2mo[1] + fj * f2ms[1];
+		memcpy (est, &smooth_img[3*fv], 3 * fdim[0] * sizeof(float));
+		for (plm_long fi = 0; fi < fdim[0]; fi++, fv++) {
+		    float mi = f2mo[0] + fi * f2ms[0];
+
+		    /* Find correspondence with nearest neighbor 
+		       interpolation & boundary checking */
+		    const float *dxyz = &smooth_img[3*fv];
+		    int mz = ROUND_INT(mk + invmps[2] * dxyz[2]);
+		    if (mz < 0 || mz >= mdim[2]) continue;
+		    int my = ROUND_INT(mj + invmps[1] * dxyz[1]);
+		    if (my < 0 || my >= mdim[1]) continue;
+		    int mx = ROUND_INT(mi + invmps[0] * dxyz[0]);
+		    if (mx < 0 || mx >= mdim[0]) continue;
+		    plm_long mv = (mz * mdim[1] + my) * mdim[0] + mx;
+
+		    /* Find image difference at this correspondence */
+		    float diff = f_img[fv] - m_img[mv];
+
+		    /* Find spatial gradient at this correspondece */
+		    const float *vox_grad = &m_grad_img[3*mv];
+		    float denom = m_grad_mag_img[mv] + parms->homog * diff * diff;
+
+		    /* Compute SSD for statistics */
+		    inliers++;
+		    ssd += diff * diff;
+
+		    /* Threshold the denominator to stabilize estimation */
+		    if (denom < parms->denominator_eps) continue;
+
+		    /* Compute new estimate of displacement */
+		    float mult = parms->accel * diff / denom;
+		    est[3*fi + 0] += mult * vox_grad[0];
+		    est[3*fi + 1] += mult * vox_grad[1];
+		    est[3*fi + 2] += mult * vox_grad[2];
+		}
+		demons_convolve_row_x (&tmp_img[3 * r * fdim[0]], est, 
+		    fdim[0], kerx, fw[0]/2);
+	    }
+	    free (est);
+	}
+
+	/* Smooth along y into vf_smooth, then along z into vf_tmp */
+	float *smooth_out = (float*) vf_smooth->img;
+#pragma omp parallel for schedule (static)
+	for (r = 0; r < (long) num_rows; r++) {
+	    demons_convolve_row_yz (&smooth_out[3 * r * fdim[0]], tmp_img, 
+		fdim, r % fdim[1], r / fdim[1], 1, kery, fw[1]/2);
+	}
+#pragma omp parallel for schedule (static)
+	for (r = 0; r < (long) num_rows; r++) {
+	    demons_convolve_row_yz (&tmp_img[3 * r * fdim[0]], smooth_out, 
+		fdim, r % fdim[1], r / fdim[1], 2, kerz, fw[2]/2);
+	}
+
+	/* The smoothed field is now in vf_tmp */
+	Volume *swap = vf_smooth;
+	vf_smooth = vf_tmp;
+	vf_tmp = swap;
+
+	double duration = it_timer->report ();
+	printf ("MSE [%4d] %.01f (%.03f) [%6.3f secs]\n", it, ssd/inliers, 
+	    ((float) inliers / fixed->npix), duration);
+	it_timer->start ();
+    }
+
+    free (kerx);
+    free (kery);
+    free (kerz);
+    free (m_grad_mag_img);
+    delete vf_tmp;
+
+    diff_run = timer->report ();
+    printf ("Time for %d iterations = %f (%f sec / it)\n", 
+	parms->max_its, diff_run, diff_run / parms->max_its);
+
+    delete timer;
+    delete it_timer;
+
+    return vf_smooth;
+}
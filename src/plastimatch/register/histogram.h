@@ -16,6 +16,13 @@ enum Mi_hist_type {
     HIST_VOPT
 };
 
+/* How the OpenMP MI implementations combine the histograms
+   accumulated by each thread */
+enum Mi_hist_accum {
+    MI_HIST_ACCUM_COPIES,       /* Per-thread copies, merged serially */
+    MI_HIST_ACCUM_PRIVATE       /* Aligned private copies, tree reduction */
+};
+
 class PLMREGISTER_API Histogram {
 public:
     Histogram (
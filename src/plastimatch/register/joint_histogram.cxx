@@ -4,6 +4,7 @@
 #include "plmregister_config.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include "file_util.h"
 #include "joint_histogram.h"
 #include "logfile.h"
@@ -13,11 +14,177 @@
 #include "volume.h"
 #include "xpm.h"
 
+/* Joint histograms with more bins than this are accumulated sparsely
+   by the thread-private engine */
+#define JH_SPARSE_BINS (128*128)
+/* Thread-private histograms are padded to a multiple of this size */
+#define JH_CACHE_LINE 64
+#define JH_CACHE_LINE_DOUBLES (JH_CACHE_LINE / sizeof(double))
+/* Number of bins handled by one task of the tree reduction */
+#define JH_REDUCE_BLOCK 512
+
+static plm_long
+cache_line_pad (plm_long n)
+{
+    return ((n + JH_CACHE_LINE_DOUBLES - 1) / JH_CACHE_LINE_DOUBLES)
+        * JH_CACHE_LINE_DOUBLES;
+}
+
+/* Open addressing hash table holding the joint histogram votes of
+   one thread, used when the joint histogram is too large to
+   replicate for every thread */
+class Joint_histogram_sparse {
+public:
+    Joint_histogram_sparse () {
+        key = 0;
+        val = 0;
+        capacity = 0;
+        used = 0;
+    }
+    ~Joint_histogram_sparse () {
+        delete[] key;
+        delete[] val;
+    }
+public:
+    plm_long *key;               /* Joint bin, or -1 if slot is empty */
+    double *val;
+    plm_long capacity;           /* Always a power of two */
+    plm_long used;
+public:
+    void clear () {
+        if (!key) {
+            this->allocate (1024);
+            return;
+        }
+        for (plm_long i = 0; i < capacity; i++) {
+            key[i] = -1;
+        }
+        used = 0;
+    }
+    void allocate (plm_long new_capacity) {
+        delete[] key;
+        delete[] val;
+        capacity = new_capacity;
+        key = new plm_long[capacity];
+        val = new double[capacity];
+        for (plm_long i = 0; i < capacity; i++) {
+            key[i] = -1;
+        }
+        used = 0;
+    }
+    void add (plm_long bin, double w) {
+        plm_long mask = capacity - 1;
+        plm_long h = (plm_long) 
+            (((unsigned long long) bin * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
+        while (1) {
+            if (key[h] == bin) {
+                val[h] += w;
+                return;
+            }
+            if (key[h] < 0) {
+                key[h] = bin;
+                val[h] = w;
+                if (++used * 2 > capacity) {
+                    this->grow ();
+                }
+                return;
+            }
+            h = (h + 1) & mask;
+        }
+    }
+    void grow () {
+        plm_long old_capacity = capacity;
+        plm_long *old_key = key;
+        double *old_val = val;
+        key = 0;
+        val = 0;
+        this->allocate (2 * old_capacity);
+        for (plm_long i = 0; i < old_capacity; i++) {
+            if (old_key[i] >= 0) {
+                this->add (old_key[i], old_val[i]);
+            }
+        }
+        delete[] old_key;
+        delete[] old_val;
+    }
+    void merge (const Joint_histogram_sparse& other) {
+        for (plm_long i = 0; i < other.capacity; i++) {
+            if (other.key[i] >= 0) {
+                this->add (other.key[i], other.val[i]);
+            }
+        }
+    }
+};
+
+class Joint_histogram_private {
+public:
+    Joint_histogram_private () {
+        num_threads = 0;
+        sparse = false;
+        f_bins = m_bins = j_bins = 0;
+        stride = 0;
+        raw = 0;
+        block = 0;
+        tables = 0;
+    }
+    ~Joint_histogram_private () {
+        free (raw);
+        delete[] tables;
+    }
+public:
+    int num_threads;
+    bool sparse;
+    plm_long f_bins, m_bins, j_bins;
+    plm_long stride;             /* Doubles per thread */
+    char *raw;
+    double *block;               /* Cache line aligned start of raw */
+    Joint_histogram_sparse *tables;
+public:
+    void allocate (int num_threads, plm_long f_bins, plm_long m_bins,
+        bool sparse)
+    {
+        free (raw);
+        delete[] tables;
+        this->num_threads = num_threads;
+        this->sparse = sparse;
+        this->f_bins = f_bins;
+        this->m_bins = m_bins;
+        this->j_bins = f_bins * m_bins;
+
+        /* Each thread gets [f_hist | m_hist | j_hist], each padded
+           to a whole number of cache lines.  The dense j_hist is
+           omitted in sparse mode. */
+        this->stride = cache_line_pad (f_bins) + cache_line_pad (m_bins);
+        if (!sparse) {
+            this->stride += cache_line_pad (j_bins);
+        }
+        raw = (char*) malloc (num_threads * stride * sizeof(double) 
+            + JH_CACHE_LINE);
+        if (!raw) {
+            print_and_exit ("Error allocating thread-private histograms\n");
+        }
+        size_t misalign = (size_t) raw % JH_CACHE_LINE;
+        block = (double*) (raw + (misalign ? JH_CACHE_LINE - misalign : 0));
+        tables = sparse ? new Joint_histogram_sparse[num_threads] : 0;
+    }
+    double* f_hist (int t) {
+        return block + t * stride;
+    }
+    double* m_hist (int t) {
+        return block + t * stride + cache_line_pad (f_bins);
+    }
+    double* j_hist (int t) {
+        return block + t * stride + cache_line_pad (f_bins)
+            + cache_line_pad (m_bins);
+    }
+};
+
 Joint_histogram::Joint_histogram ()
 {
     this->m_hist = 0;
     this->f_hist = 0;
     this->j_hist = 0;
+    d_ptr = new Joint_histogram_private;
 }
 
 Joint_histogram::Joint_histogram (Mi_hist_type type,
@@ -26,6 +193,7 @@ Joint_histogram::Joint_histogram (Mi_hist_type type,
       fixed (type, fixed_bins), 
       joint (type, moving_bins * fixed_bins)
 {
+    d_ptr = new Joint_histogram_private;
     this->allocate ();
 }
 
@@ -34,6 +202,7 @@ Joint_histogram::~Joint_histogram ()
     delete[] this->f_hist;
     delete[] this->m_hist;
     delete[] this->j_hist;
+    delete d_ptr;
 }
 
 void 
@@ -486,6 +655,162 @@ Joint_histogram::add_pvi_8
     }
 }
 
+void
+Joint_histogram::reset_thread_histograms (int num_threads)
+{
+    Joint_histogram_private *d = d_ptr;
+    bool sparse = this->fixed.bins * this->moving.bins > JH_SPARSE_BINS;
+    if (num_threads != d->num_threads || sparse != d->sparse
+        || this->fixed.bins != d->f_bins || this->moving.bins != d->m_bins)
+    {
+        d->allocate (num_threads, this->fixed.bins, this->moving.bins,
+            sparse);
+    }
+
+    /* Each thread clears its own histograms, so that the pages are 
+       placed near the thread which uses them */
+#pragma omp parallel for schedule (static, 1)
+    for (int t = 0; t < num_threads; t++) {
+        memset (d->f_hist (t), 0, d->stride * sizeof(double));
+        if (d->sparse) {
+            d->tables[t].clear ();
+        }
+    }
+}
+
+bool
+Joint_histogram::thread_histograms_are_sparse () const
+{
+    return d_ptr->sparse;
+}
+
+void
+Joint_histogram::add_pvi_8_thread
+(
+    int thread_num,
+    const Volume *fixed, 
+    const Volume *moving, 
+    plm_long fidx, 
+    plm_long mvf, 
+    const float li_1[3],     /* Fraction of interpolant in lower index */
+    const float li_2[3])     /* Fraction of interpolant in upper index */
+{
+    Joint_histogram_private *d = d_ptr;
+    float w[8];
+    plm_long n[8];
+    plm_long idx_fbin, idx_mbin, idx_jbin, offset_fbin;
+    const float* f_img = (const float*) fixed->img;
+    const float* m_img = (const float*) moving->img;
+    double *f_hist = d->f_hist (thread_num);
+    double *m_hist = d->m_hist (thread_num);
+
+    /* Compute partial volumes from trilinear interpolation weights */
+    w[0] = li_1[0] * li_1[1] * li_1[2];
+    w[1] = li_2[0] * li_1[1] * li_1[2];
+    w[2] = li_1[0] * li_2[1] * li_1[2];
+    w[3] = li_2[0] * li_2[1] * li_1[2];
+    w[4] = li_1[0] * li_1[1] * li_2[2];
+    w[5] = li_2[0] * li_1[1] * li_2[2];
+    w[6] = li_1[0] * li_2[1] * li_2[2];
+    w[7] = li_2[0] * li_2[1] * li_2[2];
+
+    /* Point indices for 8 neighborhood */
+    n[0] = mvf;
+    n[1] = n[0] + 1;
+    n[2] = n[0] + moving->dim[0];
+    n[3] = n[2] + 1;
+    n[4] = n[0] + moving->dim[0]*moving->dim[1];
+    n[5] = n[4] + 1;
+    n[6] = n[4] + moving->dim[0];
+    n[7] = n[6] + 1;
+
+    idx_fbin = floor ((f_img[fidx] - this->fixed.offset) 
+        / this->fixed.delta);
+    if (this->fixed.type == HIST_VOPT) {
+        idx_fbin = this->fixed.key_lut[idx_fbin];
+    }
+    f_hist[idx_fbin]++;
+
+    offset_fbin = idx_fbin * this->moving.bins;
+    for (int idx_pv = 0; idx_pv < 8; idx_pv++) {
+        idx_mbin = floor ((m_img[n[idx_pv]] - this->moving.offset) 
+            / this->moving.delta);
+        if (this->moving.type == HIST_VOPT) {
+            idx_mbin = this->moving.key_lut[idx_mbin];
+        }
+        idx_jbin = offset_fbin + idx_mbin;
+        if (idx_mbin != this->moving.big_bin) {
+            m_hist[idx_mbin] += w[idx_pv];
+        }
+        if (idx_jbin != this->joint.big_bin) {
+            if (d->sparse) {
+                d->tables[thread_num].add (idx_jbin, w[idx_pv]);
+            } else {
+                d->j_hist(thread_num)[idx_jbin] += w[idx_pv];
+            }
+        }
+    }
+}
+
+void
+Joint_histogram::reduce_thread_histograms ()
+{
+    Joint_histogram_private *d = d_ptr;
+    int num_threads = d->num_threads;
+    long num_blocks = (long) ((d->stride + JH_REDUCE_BLOCK - 1) 
+        / JH_REDUCE_BLOCK);
+
+    /* Pairwise tree: at each level, thread t absorbs thread t+s.
+       Dense bins are split into blocks so that every level 
+       has enough tasks to keep all threads busy. */
+    for (int s = 1; s < num_threads; s *= 2) {
+        long num_pairs = (num_threads + 2*s - 1) / (2*s);
+        long num_tasks = num_pairs * num_blocks;
+#pragma omp parallel for
+        for (long k = 0; k < num_tasks; k++) {
+            int t = (int) (k / num_blocks) * 2 * s;
+            if (t + s >= num_threads) {
+                continue;
+            }
+            plm_long b0 = (k % num_blocks) * JH_REDUCE_BLOCK;
+            plm_long b1 = b0 + JH_REDUCE_BLOCK;
+            if (b1 > d->stride) {
+                b1 = d->stride;
+            }
+            double *dst = d->f_hist (t);
+            const double *src = d->f_hist (t + s);
+            for (plm_long b = b0; b < b1; b++) {
+                dst[b] += src[b];
+            }
+        }
+        if (d->sparse) {
+#pragma omp parallel for
+            for (long p = 0; p < num_pairs; p++) {
+                int t = (int) p * 2 * s;
+                if (t + s < num_threads) {
+                    d->tables[t].merge (d->tables[t + s]);
+                }
+            }
+        }
+    }
+
+    /* Thread 0 now holds the totals */
+    memcpy (this->f_hist, d->f_hist (0), this->fixed.bins * sizeof(double));
+    memcpy (this->m_hist, d->m_hist (0), this->moving.bins * sizeof(double));
+    if (d->sparse) {
+        const Joint_histogram_sparse& table = d->tables[0];
+        memset (this->j_hist, 0, this->joint.bins * sizeof(double));
+        for (plm_long i = 0; i < table.capacity; i++) {
+            if (table.key[i] >= 0) {
+                this->j_hist[table.key[i]] = table.val[i];
+            }
+        }
+    } else {
+        memcpy (this->j_hist, d->j_hist (0), 
+            this->joint.bins * sizeof(double));
+    }
+}
+
 /* This algorithm uses a un-normalized score. */
 float
 Joint_histogram::compute_score (int num_vox)
@@ -9,6 +9,7 @@
 #include "histogram.h"
 #include "plm_int.h"
 
+class Joint_histogram_private;
 class Volume;
 
 class PLMREGISTER_API Joint_histogram {
@@ -34,6 +35,26 @@ public:
 
     float compute_score (int num_vox);
 
+    /* Thread-private accumulation.  Each thread adds into its own
+       cache-line aligned histograms, which reduce_thread_histograms()
+       then combines into f_hist, m_hist and j_hist using a pairwise
+       tree.  When the joint histogram is large, threads keep only the
+       joint bins they touch, in a small hash table.  As with the
+       "omp_v2" accumulator of bspline_score_i_mi(), votes for the
+       moving and joint big_bin are not counted; the caller fills
+       these bins in afterwards from the voxel count. */
+    void reset_thread_histograms (int num_threads);
+    void add_pvi_8_thread (
+        int thread_num,
+        const Volume *fixed, 
+        const Volume *moving, 
+        plm_long fidx, 
+        plm_long mvf, 
+        const float li_1[3],
+        const float li_2[3]);
+    void reduce_thread_histograms ();
+    bool thread_histograms_are_sparse () const;
+
 public:
     Histogram moving;
     Histogram fixed;
@@ -41,6 +62,8 @@ public:
     double* m_hist;
     double* f_hist;
     double* j_hist;
+protected:
+    Joint_histogram_private *d_ptr;
 protected:
     void allocate ();
 };
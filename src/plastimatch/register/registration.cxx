@@ -19,6 +19,7 @@
 #include "logfile.h"
 #include "plm_image.h"
 #include "plm_image_header.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "plm_warp.h"
 #include "pointset_warp.h"
@@ -339,6 +340,7 @@ Registration::do_registration_stage (
     Stage_parms* stage            /* Input */
 )
 {
+    PLM_PROFILE_SCOPE ("Registration::do_registration_stage");
     Registration_data::Pointer regd = d_ptr->rdata;
     Registration_parms::Pointer regp = d_ptr->rparms;
     const Xform::Pointer& xf_in = d_ptr->xf_in;
@@ -508,6 +510,10 @@ Registration::run_main_thread ()
             const Process_parms::Pointer& pp = stage->get_process_parms ();
             pp->execute_process (regd);
 
+            /* Processing changes the images, so earlier 
+               subsampled images can't be reused */
+            regd->get_pyramid()->clear ();
+
 #if defined (commentout)
             itk_image_stats (regd->moving_image->itk_float (),
                 &min_val, &max_val, &avg, &non_zero, &num_vox);
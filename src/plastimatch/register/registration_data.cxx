@@ -2,18 +2,18 @@
    See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
    ----------------------------------------------------------------------- */
 #include "plmregister_config.h"
+#include <vector>
 
-#include "distance_map.h"
 #include "logfile.h"
 #include "plm_image.h"
 #include "plm_image_type.h"
 #include "print_and_exit.h"
 #include "registration_data.h"
 #include "registration_parms.h"
+#include "registration_pyramid.h"
 #include "registration_resample.h"
 #include "shared_parms.h"
 #include "stage_parms.h"
-#include "volume_grad.h"
 
 class Registration_data_private
 {
@@ -22,8 +22,10 @@ public:
     std::map <std::string, Registration_similarity_data::Pointer>
         similarity_images;
     std::list<std::string> similarity_indices;
+    Registration_pyramid::Pointer pyramid;
 public:
     Registration_data_private () {
+        pyramid = Registration_pyramid::New ();
     }
     ~Registration_data_private () {
     }
@@ -286,17 +288,10 @@ Registration_data::get_auto_parms ()
     return &d_ptr->auto_parms;
 }
 
-static Volume::Pointer
-make_dmap (const Volume::Pointer& image)
+Registration_pyramid::Pointer&
+Registration_data::get_pyramid ()
 {
-    Plm_image::Pointer pi = Plm_image::New (image);
-    Distance_map dm;
-
-    dm.set_input_image (pi);
-    dm.run ();
-
-    Plm_image im_out (dm.get_output_image());
-    return im_out.get_volume_float ();
+    return d_ptr->pyramid;
 }
 
 void populate_similarity_list (
@@ -306,10 +301,22 @@ void populate_similarity_list (
 )
 {
     const Shared_parms *shared = stage->get_shared_parms();
+    Registration_pyramid::Pointer& pyramid = regd->get_pyramid ();
 
     /* Clear out the list */
     similarity_data.clear ();
 
+    /* Release cached images of inputs which have been replaced */
+    pyramid->prune ();
+
+    lprintf ("RESAMPLE %d %d: (%g %g %g), (%g %g %g)\n", 
+        stage->resample_type,
+        shared->legacy_subsampling,
+        stage->resample_rate_fixed[0], stage->resample_rate_fixed[1], 
+        stage->resample_rate_fixed[2], stage->resample_rate_moving[0], 
+        stage->resample_rate_moving[1], stage->resample_rate_moving[2]
+    );
+
     const std::list<std::string>& similarity_indices
         = regd->get_similarity_indices ();
     std::list<std::string>::const_iterator ind_it;
@@ -318,17 +325,8 @@ void populate_similarity_list (
     {
         Plm_image::Pointer fixed_image = regd->get_fixed_image (*ind_it);
         Plm_image::Pointer moving_image = regd->get_moving_image (*ind_it);
-        Volume::Pointer& fixed = fixed_image->get_volume_float ();
-        Volume::Pointer& moving = moving_image->get_volume_float ();
-
         Metric_state::Pointer ssi = Metric_state::New();
 
-        /* Subsample images */
-        ssi->fixed_ss = registration_resample_volume (
-            fixed, stage, stage->resample_rate_fixed);
-        ssi->moving_ss = registration_resample_volume (
-            moving, stage, stage->resample_rate_moving);
-
         /* Metric */
         const Metric_parms& metric_parms = shared->metric.find(*ind_it)->second;
         ssi->metric_type = metric_parms.metric_type;
@@ -337,22 +335,60 @@ void populate_similarity_list (
         }
         ssi->metric_lambda = metric_parms.metric_lambda;
 
+        /* Input images are used as keys, set them for now */
+        ssi->fixed_ss = fixed_image->get_volume_float ();
+        ssi->moving_ss = moving_image->get_volume_float ();
+
+        /* Append to list */
+        similarity_data.push_back (ssi);
+    }
+
+    /* Fetch the subsampled images from the pyramid.  Images which 
+       are not yet cached are built concurrently, one per thread. */
+    std::vector<Metric_state*> jobs;
+    std::list<Metric_state::Pointer>::iterator it;
+    for (it = similarity_data.begin(); it != similarity_data.end(); ++it) {
+        jobs.push_back ((*it).get());
+        jobs.push_back ((*it).get());
+    }
+    int num_jobs = (int) jobs.size();
+    int hits_before, misses_before;
+    pyramid->get_stats (&hits_before, &misses_before);
+#pragma omp parallel for schedule(dynamic)
+    for (int j = 0; j < num_jobs; j++) {
+        Metric_state *ssi = jobs[j];
+        bool is_moving = (j % 2 == 1);
+        Volume::Pointer vol;
+        if (is_moving) {
+            vol = pyramid->get_level (ssi->moving_ss, stage, 
+                stage->resample_rate_moving);
+        } else {
+            vol = pyramid->get_level (ssi->fixed_ss, stage, 
+                stage->resample_rate_fixed);
+        }
+
         /* Gradient magnitude is MSE on gradient image */
         if (ssi->metric_type == SIMILARITY_METRIC_GM) {
-            ssi->fixed_ss = volume_gradient_magnitude (ssi->fixed_ss);
-            ssi->moving_ss = volume_gradient_magnitude (ssi->moving_ss);
+            vol = pyramid->get_gradient_magnitude (vol);
         }
 
         /* Distance map is MSE on distance map images */
         if (ssi->metric_type == SIMILARITY_METRIC_DMAP) {
-            ssi->fixed_ss = make_dmap (ssi->fixed_ss);
-            ssi->moving_ss = make_dmap (ssi->moving_ss);
+            vol = pyramid->get_distance_map (vol);
         }
 
         /* Make spatial gradient image */
-        ssi->moving_grad = volume_gradient (ssi->moving_ss);
+        if (is_moving) {
+            ssi->moving_grad = pyramid->get_gradient (vol);
+            ssi->moving_ss = vol;
+        } else {
+            ssi->fixed_ss = vol;
+        }
+    }
 
-        /* Append to list */
-        similarity_data.push_back (ssi);
+    int hits, misses;
+    pyramid->get_stats (&hits, &misses);
+    if (hits > hits_before) {
+        lprintf ("PYRAMID reused %d cached images\n", hits - hits_before);
     }
 }
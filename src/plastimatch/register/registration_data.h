@@ -10,6 +10,7 @@
 #include "plm_image.h"
 #include "pointset.h"
 #include "registration_parms.h"
+#include "registration_pyramid.h"
 #include "registration_similarity_data.h"
 #include "smart_pointer.h"
 
@@ -86,6 +87,10 @@ public:
     const std::list<std::string>& get_similarity_indices ();
     
     Stage_parms* get_auto_parms ();
+
+    /*! \brief Get the cache of subsampled images, which is shared 
+      by all stages of this registration */
+    Registration_pyramid::Pointer& get_pyramid ();
 };
 
 void populate_similarity_list (
@@ -742,6 +742,18 @@ Registration_parms::set_key_value (
             goto error_exit;
         }
     }
+    else if (key == "mi_histogram_accumulate") {
+        if (!section_stage) goto key_only_allowed_in_section_stage;
+        if (val == "copies") {
+            stage->mi_hist_accum = MI_HIST_ACCUM_COPIES;
+        }
+        else if (val == "private") {
+            stage->mi_hist_accum = MI_HIST_ACCUM_PRIVATE;
+        }
+        else {
+            goto error_exit;
+        }
+    }
     else if (key == "mattes_fixed_minVal"
         ||key == "mi_fixed_minVal") {
         if (!section_stage) goto key_only_allowed_in_section_stage;
@@ -888,6 +900,21 @@ Registration_parms::set_key_value (
             goto error_exit;
         }
     }
+    else if (key == "gridsearch_subsample") {
+        if (!section_stage) goto key_only_allowed_in_section_stage;
+        if (sscanf (val.c_str(), "%d", &stage->gridsearch_subsample) != 1
+            || stage->gridsearch_subsample < 1) {
+            goto error_exit;
+        }
+    }
+    else if (key == "gridsearch_survivors") {
+        if (!section_stage) goto key_only_allowed_in_section_stage;
+        if (sscanf (val.c_str(), "%g", &stage->gridsearch_survivors) != 1
+            || stage->gridsearch_survivors <= 0.f
+            || stage->gridsearch_survivors > 1.f) {
+            goto error_exit;
+        }
+    }
     else if (key == "gridsearch_strategy") {
         if (!section_stage) goto key_only_allowed_in_section_stage;
         if (val == "global") {
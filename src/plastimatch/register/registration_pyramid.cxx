@@ -0,0 +1,271 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmregister_config.h"
+#include <vector>
+
+#include "distance_map.h"
+#include "dlib_threads.h"
+#include "plm_image.h"
+#include "registration_pyramid.h"
+#include "registration_resample.h"
+#include "shared_parms.h"
+#include "stage_parms.h"
+#include "volume_grad.h"
+
+enum Registration_pyramid_op {
+    PYRAMID_OP_LEVEL,
+    PYRAMID_OP_GRADIENT_MAGNITUDE,
+    PYRAMID_OP_DISTANCE_MAP,
+    PYRAMID_OP_GRADIENT
+};
+
+class Registration_pyramid_entry {
+public:
+    Volume::Pointer source;
+    Registration_pyramid_op op;
+    Resample_type resample_type;
+    bool legacy_subsampling;
+    float resample_rate[3];
+    Volume::Pointer result;
+    bool used;
+public:
+    bool matches (const Registration_pyramid_entry& o) const {
+        if (source.get() != o.source.get() || op != o.op) {
+            return false;
+        }
+        if (op != PYRAMID_OP_LEVEL) {
+            return true;
+        }
+        return resample_type == o.resample_type
+            && legacy_subsampling == o.legacy_subsampling
+            && resample_rate[0] == o.resample_rate[0]
+            && resample_rate[1] == o.resample_rate[1]
+            && resample_rate[2] == o.resample_rate[2];
+    }
+};
+
+class Registration_pyramid_private {
+public:
+    Dlib_semaphore lock;
+    std::vector<Registration_pyramid_entry> entries;
+    int hits;
+    int misses;
+public:
+    Registration_pyramid_private () {
+        hits = 0;
+        misses = 0;
+    }
+    Volume::Pointer lookup (const Registration_pyramid_entry& key) {
+        Volume::Pointer result;
+        lock.grab ();
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].matches (key)) {
+                entries[i].used = true;
+                result = entries[i].result;
+                hits++;
+                break;
+            }
+        }
+        lock.release ();
+        return result;
+    }
+    /* If another thread built the same entry in the meantime,
+       its result is kept, so that all callers share one copy */
+    Volume::Pointer insert (const Registration_pyramid_entry& entry) {
+        Volume::Pointer result;
+        lock.grab ();
+        misses++;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (entries[i].matches (entry)) {
+                entries[i].used = true;
+                result = entries[i].result;
+                break;
+            }
+        }
+        if (!result) {
+            entries.push_back (entry);
+            entries.back().used = true;
+            result = entry.result;
+        }
+        lock.release ();
+        return result;
+    }
+    /* Return true if the entry's source is the result of another 
+       entry, i.e. the entry was derived from a cached level */
+    bool is_derived (size_t i) const {
+        for (size_t j = 0; j < entries.size(); j++) {
+            if (j != i 
+                && entries[j].result.get() == entries[i].source.get())
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    Volume::Pointer get (Registration_pyramid_entry& key);
+};
+
+static Volume::Pointer
+make_dmap (const Volume::Pointer& image)
+{
+    Plm_image::Pointer pi = Plm_image::New (image);
+    Distance_map dm;
+
+    dm.set_input_image (pi);
+    dm.run ();
+
+    Plm_image im_out (dm.get_output_image());
+    return im_out.get_volume_float ();
+}
+
+Volume::Pointer
+Registration_pyramid_private::get (Registration_pyramid_entry& key)
+{
+    Volume::Pointer result = this->lookup (key);
+    if (result) {
+        return result;
+    }
+
+    /* Build outside of the lock, so that different entries
+       can be built concurrently */
+    switch (key.op) {
+    case PYRAMID_OP_LEVEL:
+        key.result = registration_resample_volume (key.source,
+            key.resample_type, key.legacy_subsampling, key.resample_rate);
+        break;
+    case PYRAMID_OP_GRADIENT_MAGNITUDE:
+        key.result = volume_gradient_magnitude (key.source);
+        break;
+    case PYRAMID_OP_DISTANCE_MAP:
+        key.result = make_dmap (key.source);
+        break;
+    case PYRAMID_OP_GRADIENT:
+        key.result = volume_gradient (key.source);
+        break;
+    }
+    if (!key.result) {
+        return key.result;
+    }
+    return this->insert (key);
+}
+
+Registration_pyramid::Registration_pyramid ()
+{
+    d_ptr = new Registration_pyramid_private;
+}
+
+Registration_pyramid::~Registration_pyramid ()
+{
+    delete d_ptr;
+}
+
+Volume::Pointer
+Registration_pyramid::get_level (
+    const Volume::Pointer& vol,
+    const Stage_parms *stage,
+    const float resample_rate[3])
+{
+    const Shared_parms *shared = stage->get_shared_parms ();
+    Registration_pyramid_entry key;
+    key.source = vol;
+    key.op = PYRAMID_OP_LEVEL;
+    key.resample_type = stage->resample_type;
+    key.legacy_subsampling = shared->legacy_subsampling;
+    for (int d = 0; d < 3; d++) {
+        key.resample_rate[d] = resample_rate[d];
+    }
+    return d_ptr->get (key);
+}
+
+static Volume::Pointer
+get_derived (
+    Registration_pyramid_private *d_ptr,
+    const Volume::Pointer& vol,
+    Registration_pyramid_op op)
+{
+    Registration_pyramid_entry key;
+    key.source = vol;
+    key.op = op;
+    key.resample_type = RESAMPLE_AUTO;
+    key.legacy_subsampling = false;
+    key.resample_rate[0] = key.resample_rate[1] = key.resample_rate[2] = 0.f;
+    return d_ptr->get (key);
+}
+
+Volume::Pointer
+Registration_pyramid::get_gradient_magnitude (const Volume::Pointer& vol)
+{
+    return get_derived (d_ptr, vol, PYRAMID_OP_GRADIENT_MAGNITUDE);
+}
+
+Volume::Pointer
+Registration_pyramid::get_distance_map (const Volume::Pointer& vol)
+{
+    return get_derived (d_ptr, vol, PYRAMID_OP_DISTANCE_MAP);
+}
+
+Volume::Pointer
+Registration_pyramid::get_gradient (const Volume::Pointer& vol)
+{
+    return get_derived (d_ptr, vol, PYRAMID_OP_GRADIENT);
+}
+
+void
+Registration_pyramid::prune ()
+{
+    d_ptr->lock.grab ();
+    std::vector<Registration_pyramid_entry>& entries = d_ptr->entries;
+
+    /* Release levels which were not used since the previous prune, 
+       or whose input volume is no longer referenced outside the 
+       cache.  Derived entries are kept for as long as the level 
+       they were made from. */
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (size_t i = 0; i < entries.size(); i++) {
+            if (d_ptr->is_derived (i)) {
+                continue;
+            }
+            /* Count the references to the source held by the cache */
+            long cache_refs = 0;
+            for (size_t j = 0; j < entries.size(); j++) {
+                if (entries[j].source.get() == entries[i].source.get()) {
+                    cache_refs++;
+                }
+                if (entries[j].result.get() == entries[i].source.get()) {
+                    cache_refs++;
+                }
+            }
+            bool unused = !entries[i].used 
+                && entries[i].op == PYRAMID_OP_LEVEL;
+            if (unused || entries[i].source.use_count() <= cache_refs) {
+                entries.erase (entries.begin() + i);
+                changed = true;
+                break;
+            }
+        }
+    }
+    for (size_t i = 0; i < entries.size(); i++) {
+        entries[i].used = false;
+    }
+    d_ptr->lock.release ();
+}
+
+void
+Registration_pyramid::get_stats (int *hits, int *misses)
+{
+    d_ptr->lock.grab ();
+    *hits = d_ptr->hits;
+    *misses = d_ptr->misses;
+    d_ptr->lock.release ();
+}
+
+void
+Registration_pyramid::clear ()
+{
+    d_ptr->lock.grab ();
+    d_ptr->entries.clear ();
+    d_ptr->lock.release ();
+}
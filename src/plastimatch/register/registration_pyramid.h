@@ -0,0 +1,58 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _registration_pyramid_h_
+#define _registration_pyramid_h_
+
+#include "plmregister_config.h"
+#include "smart_pointer.h"
+#include "volume.h"
+
+class Registration_pyramid_private;
+class Stage_parms;
+
+/*! \brief
+ * The Registration_pyramid class caches the resampled images, and
+ * images derived from them, which are used by registration stages.
+ * Consecutive stages with the same resampling share a single copy
+ * of each level, and its gradient, instead of recomputing them.
+ * Levels which a stage does not use are released at the start
+ * of the following stage.
+ * Entries are keyed by the identity of the input volume, which the
+ * cache holds a reference to.  The volumes handed out are shared,
+ * and must not be modified by the caller.  All functions may be
+ * called concurrently from several threads.
+ */
+class PLMREGISTER_API Registration_pyramid {
+public:
+    SMART_POINTER_SUPPORT (Registration_pyramid);
+    Registration_pyramid_private *d_ptr;
+public:
+    Registration_pyramid ();
+    ~Registration_pyramid ();
+public:
+    /*! \brief Return vol resampled according to the stage resample
+      type and resample_rate, as by registration_resample_volume() */
+    Volume::Pointer get_level (
+        const Volume::Pointer& vol,
+        const Stage_parms *stage,
+        const float resample_rate[3]);
+    /*! \brief Return the gradient magnitude image of vol */
+    Volume::Pointer get_gradient_magnitude (const Volume::Pointer& vol);
+    /*! \brief Return the distance map of vol */
+    Volume::Pointer get_distance_map (const Volume::Pointer& vol);
+    /*! \brief Return the spatial gradient image of vol */
+    Volume::Pointer get_gradient (const Volume::Pointer& vol);
+
+    /*! \brief Release levels which were not requested since the
+      previous call, or whose input volume is no longer referenced
+      outside the cache, together with the images derived from them */
+    void prune ();
+    /*! \brief Return the number of requests served from the cache,
+      and the number which had to be built */
+    void get_stats (int *hits, int *misses);
+    /*! \brief Release all entries */
+    void clear ();
+};
+
+#endif
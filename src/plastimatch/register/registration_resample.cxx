@@ -26,7 +26,19 @@ registration_resample_volume (
         stage->resample_rate_moving[1], stage->resample_rate_moving[2]
     );
 
-    switch (stage->resample_type) {
+    return registration_resample_volume (vol, stage->resample_type,
+        shared->legacy_subsampling, resample_rate);
+}
+
+Volume::Pointer
+registration_resample_volume (
+    const Volume::Pointer& vol,
+    Resample_type resample_type,
+    bool legacy_subsampling,
+    const float resample_rate[3]
+)
+{
+    switch (resample_type) {
     case RESAMPLE_AUTO:
     case RESAMPLE_VOXEL_RATE:
         if (resample_rate[0] == 1.0f
@@ -35,7 +47,7 @@ registration_resample_volume (
         {
             return vol->clone ();
         }
-        if (shared->legacy_subsampling) {
+        if (legacy_subsampling) {
             return volume_subsample_vox_legacy (vol, resample_rate);
         } else {
             return volume_subsample_vox (vol, resample_rate);
@@ -50,7 +62,7 @@ registration_resample_volume (
     default:
         print_and_exit ("Unhandled resample_type %d "
             "in registration_resample_volume()\n",
-            stage->resample_type);
+            resample_type);
         break;
     }
 
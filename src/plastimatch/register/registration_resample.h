@@ -15,4 +15,14 @@ registration_resample_volume (
     const float resample_rate[3]
 );
 
+/* Same as above, but without logging, so it may be called from
+   worker threads */
+Volume::Pointer
+registration_resample_volume (
+    const Volume::Pointer& vol,
+    Resample_type resample_type,
+    bool legacy_subsampling,
+    const float resample_rate[3]
+);
+
 #endif
@@ -97,6 +97,7 @@ Stage_parms::Stage_parms ()
     mi_num_spatial_samples = -1;
     mi_num_spatial_samples_pct = 0.3;
     //mi_hist_type = HIST_EQSP;
+    mi_hist_accum = MI_HIST_ACCUM_COPIES;
     /* MI threshold values */
     /*Setting values to zero by default. In this case minVal and 
       maxVal will be calculated from image*/
@@ -139,6 +140,8 @@ Stage_parms::Stage_parms ()
     gridsearch_min_steps[0] = 0;
     gridsearch_min_steps[1] = 0;
     gridsearch_min_steps[2] = 0;
+    gridsearch_subsample = 4;
+    gridsearch_survivors = 0.25;
     /* Landmarks */
     landmark_stiffness = 1.0;
     landmark_flavor = 'a';
@@ -221,6 +224,7 @@ Stage_parms::Stage_parms (const Stage_parms& s)
     mi_num_spatial_samples = s.mi_num_spatial_samples;
     mi_num_spatial_samples_pct = s.mi_num_spatial_samples_pct;
     mi_hist_type = s.mi_hist_type;
+    mi_hist_accum = s.mi_hist_accum;
     /* MI threshold values */
     mi_fixed_image_minVal = s.mi_fixed_image_minVal;
     mi_fixed_image_maxVal = s.mi_fixed_image_maxVal;
@@ -262,6 +266,8 @@ Stage_parms::Stage_parms (const Stage_parms& s)
     gridsearch_min_steps[0] = s.gridsearch_min_steps[0];
     gridsearch_min_steps[1] = s.gridsearch_min_steps[1];
     gridsearch_min_steps[2] = s.gridsearch_min_steps[2];
+    gridsearch_subsample = s.gridsearch_subsample;
+    gridsearch_survivors = s.gridsearch_survivors;
     /* Landmarks */
     landmark_stiffness = s.landmark_stiffness;
     landmark_flavor = s.landmark_flavor;
@@ -11,7 +11,7 @@
 #include <stdlib.h>
 
 #include "bspline.h"            /* for enums */
-// #include "bspline_mi_hist.h"    /* for enums */
+#include "histogram.h"          /* for enums */
 #include "plm_image_type.h"
 #include "plm_return_code.h"
 #include "process_parms.h"
@@ -173,6 +173,7 @@ public:
     int mi_num_spatial_samples;
     float mi_num_spatial_samples_pct;
     enum Mi_hist_type mi_hist_type;
+    enum Mi_hist_accum mi_hist_accum;
     float mi_fixed_image_minVal;
     float mi_fixed_image_maxVal;
     float mi_moving_image_minVal;
@@ -202,6 +203,8 @@ public:
     Gridsearch_step_size_type gridsearch_step_size_type;
     float gridsearch_step_size[3];
     int gridsearch_min_steps[3];
+    int gridsearch_subsample;
+    float gridsearch_survivors;
     /* Landmarks */
     float landmark_stiffness; //strength of attraction between landmarks
     char landmark_flavor;
@@ -5,6 +5,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
+#include <algorithm>
+#include <vector>
 
 #include "interpolate.h"
 #include "interpolate_macros.h"
@@ -46,6 +48,29 @@ public:
     void do_score (
         const Stage_parms* stage,
         const float dxyz[3]);
+    float compute_score (
+        const Stage_parms* stage,
+        const float dxyz[3],
+        int subsample,
+        float prune_score,
+        float *metric_scores);
+    void report_score (
+        const float dxyz[3],
+        float acc_score,
+        const float *metric_scores);
+    bool can_prune ();
+};
+
+/* Orders candidate indices by their coarse score */
+class Translation_grid_search_order
+{
+public:
+    const std::vector<float>& score;
+    Translation_grid_search_order (const std::vector<float>& score)
+        : score (score) {}
+    bool operator() (int a, int b) const {
+        return score[a] < score[b];
+    }
 };
 
 void
@@ -156,19 +181,93 @@ Translation_grid_search::do_search (
         auto_parms->gridsearch_step_size[d] = 0.6 * search_step[d];
     }
 
-    /* Run grid search */
+    /* List the candidate translations */
+    std::vector<float> cand;
     for (plm_long k = 0; k < num_steps[2]; k++) {
         for (plm_long j = 0; j < num_steps[1]; j++) {
             for (plm_long i = 0; i < num_steps[0]; i++) {
-                float translation[3] = {
-                    search_min[0] + i * search_step[0],
-                    search_min[1] + j * search_step[1],
-                    search_min[2] + k * search_step[2] };
-                this->do_score (stage, translation);
+                cand.push_back (search_min[0] + i * search_step[0]);
+                cand.push_back (search_min[1] + j * search_step[1]);
+                cand.push_back (search_min[2] + k * search_step[2]);
+            }
+        }
+    }
+    int num_cand = (int) (cand.size() / 3);
+    int num_metrics = (int) this->similarity_data.size();
+    if (num_cand == 0) {
+        return;
+    }
+
+    /* Coarse pass.  Score all candidates on a subsampled fixed image, 
+       and sort them so that the most promising are evaluated first. */
+    int subsample = stage->gridsearch_subsample;
+    std::vector<float> coarse_score (num_cand, 0.f);
+    if (subsample > 1) {
+#pragma omp parallel for schedule(dynamic)
+        for (int c = 0; c < num_cand; c++) {
+            coarse_score[c] = this->compute_score (
+                stage, &cand[3*c], subsample, FLT_MAX, 0);
+        }
+    }
+    std::vector<int> order (num_cand);
+    for (int c = 0; c < num_cand; c++) {
+        order[c] = c;
+    }
+    std::stable_sort (order.begin(), order.end(), 
+        Translation_grid_search_order (coarse_score));
+
+    /* With a single MSE metric, every candidate is evaluated in full, 
+       but evaluation is abandoned once it can no longer beat the best 
+       score found so far.  The result is the same as an exhaustive 
+       search.  Other metrics can't be bounded this way, so only the 
+       best fraction of candidates from the coarse pass survive. */
+    bool prune = this->can_prune ();
+    int num_full = num_cand;
+    if (!prune && subsample > 1) {
+        num_full = (int) ceil (stage->gridsearch_survivors * num_cand);
+        num_full = std::max (1, std::min (num_cand, num_full));
+    }
+
+    /* Full pass */
+    std::vector<float> full_score (num_cand, FLT_MAX);
+    std::vector<float> metric_scores (num_cand * num_metrics, FLT_MAX);
+    std::vector<char> evaluated (num_cand, 0);
+    float shared_best = this->best_score;
+#pragma omp parallel for schedule(dynamic)
+    for (int n = 0; n < num_full; n++) {
+        int c = order[n];
+        float prune_score = FLT_MAX;
+        if (prune) {
+#pragma omp critical (translation_grid_search_best)
+            prune_score = shared_best;
+        }
+        float score = this->compute_score (stage, &cand[3*c], 1, 
+            prune_score, &metric_scores[c*num_metrics]);
+        full_score[c] = score;
+        if (prune && score == FLT_MAX) {
+            continue;
+        }
+        evaluated[c] = 1;
+        if (prune) {
+#pragma omp critical (translation_grid_search_best)
+            if (score < shared_best) {
+                shared_best = score;
             }
         }
     }
 
+    /* Report scores and choose the winner in grid order, so that 
+       ties are broken the same way regardless of thread timing */
+    for (int c = 0; c < num_cand; c++) {
+        if (evaluated[c]) {
+            this->report_score (&cand[3*c], full_score[c], 
+                &metric_scores[c*num_metrics]);
+        } else {
+            lprintf ("[%g %g %g] pruned\n", 
+                cand[3*c+0], cand[3*c+1], cand[3*c+2]);
+        }
+    }
+
     /* Find the best translation */
     TranslationTransformType::ParametersType xfp(3);
     xfp[0] = this->best_translation[0];
@@ -186,33 +285,68 @@ Translation_grid_search::do_score (
     const Stage_parms* stage,
     const float dxyz[3])
 {
-    lprintf ("[%g %g %g]",
-        dxyz[0], dxyz[1], dxyz[2]);
+    std::vector<float> metric_scores (this->similarity_data.size());
+    float acc_score = this->compute_score (
+        stage, dxyz, 1, FLT_MAX, &metric_scores[0]);
+    this->report_score (dxyz, acc_score, &metric_scores[0]);
+}
 
+/* Compute the score for a single translation.  This is called 
+   concurrently from several threads, and therefore doesn't log or 
+   modify the search state.  If prune_score is less than FLT_MAX, 
+   there must be a single MSE metric, and FLT_MAX is returned if the 
+   score is known to exceed prune_score. */
+float
+Translation_grid_search::compute_score (
+    const Stage_parms* stage,
+    const float dxyz[3],
+    int subsample,
+    float prune_score,
+    float *metric_scores)
+{
     std::list<Metric_state::Pointer>::iterator it;
     float acc_score = 0.f;
+    int m = 0;
     for (it = this->similarity_data.begin(); 
-         it != this->similarity_data.end(); ++it)
+         it != this->similarity_data.end(); ++it, ++m)
     {
         const Metric_state::Pointer& ssi = *it;
         float score = 0.f;
         switch (ssi->metric_type) {
         case SIMILARITY_METRIC_MSE:
         case SIMILARITY_METRIC_GM:
-            score = translation_mse (stage, ssi, dxyz);
+            score = translation_mse (stage, ssi, dxyz, 
+                subsample, prune_score);
             break;
         case SIMILARITY_METRIC_MI_MATTES:
         case SIMILARITY_METRIC_MI_VW:
-            score = translation_mi (stage, ssi, dxyz);
+            score = translation_mi (stage, ssi, dxyz, subsample);
             break;
         default:
-            print_and_exit ("Metric %d not implemented with grid search\n");
+            print_and_exit ("Metric %d not implemented with grid search\n",
+                ssi->metric_type);
             break;
         }
-        lprintf (" %g", score);
+        if (metric_scores) {
+            metric_scores[m] = score;
+        }
         acc_score += score;
     }
+    return acc_score;
+}
 
+/* Log the score of a translation, and keep it if it is the best */
+void
+Translation_grid_search::report_score (
+    const float dxyz[3],
+    float acc_score,
+    const float *metric_scores)
+{
+    lprintf ("[%g %g %g]",
+        dxyz[0], dxyz[1], dxyz[2]);
+    for (size_t m = 0; m < this->similarity_data.size(); m++) {
+        lprintf (" %g", metric_scores[m]);
+    }
     if (this->similarity_data.size() > 1) {
         lprintf (" | %g", acc_score);
     }
@@ -226,6 +360,22 @@ Translation_grid_search::do_score (
     lprintf ("\n");
 }
 
+/* Early termination is only exact for a single MSE-type metric */
+bool
+Translation_grid_search::can_prune ()
+{
+    if (this->similarity_data.size() != 1) {
+        return false;
+    }
+    switch (this->similarity_data.front()->metric_type) {
+    case SIMILARITY_METRIC_MSE:
+    case SIMILARITY_METRIC_GM:
+        return true;
+    default:
+        return false;
+    }
+}
+
 Xform::Pointer
 translation_grid_search_stage (
     Registration_data* regd, 
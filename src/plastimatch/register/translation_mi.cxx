@@ -20,23 +20,18 @@
 #include "volume_resample.h"
 #include "xform.h"
 
-float
-translation_mi (
-    const Stage_parms *stage,
-    const Metric_state::Pointer& ssi,
+/* Add one fixed image voxel to the joint histogram.
+   Returns false if the voxel maps outside the moving image. */
+static inline bool
+translation_mi_voxel (
+    Joint_histogram *mi_hist,
+    Volume *fixed,
+    Volume *moving,
+    const plm_long fijk[3],
+    const float fxyz[3],
     const float dxyz[3])
 {
-    Volume *fixed = ssi->fixed_ss.get();
-    Volume *moving = ssi->moving_ss.get();
-    Joint_histogram *mi_hist = new Joint_histogram (
-        stage->mi_hist_type,
-        stage->mi_hist_fixed_bins,
-        stage->mi_hist_moving_bins);
-    mi_hist->initialize (fixed, moving);
-    mi_hist->reset_histograms ();
-        
-    plm_long fijk[3], fidx;       /* Indices within fixed image (vox) */
-    float fxyz[3];                /* Position within fixed image (mm) */
+    plm_long fidx;                /* Index within fixed image (vox) */
     float mijk[3];                /* Indices within moving image (vox) */
     float mxyz[3];                /* Position within moving image (mm) */
     plm_long mijk_f[3], midx_f;   /* Floor */
@@ -44,42 +39,83 @@ translation_mi (
     float li_1[3];                /* Fraction of interpolant in lower index */
     float li_2[3];                /* Fraction of interpolant in upper index */
 
-    plm_long num_vox = 0;
-    
-    /* PASS 1 - Accumulate histogram */
-    LOOP_Z (fijk, fxyz, fixed) {
-        LOOP_Y (fijk, fxyz, fixed) {
-            LOOP_X (fijk, fxyz, fixed) {
+    /* Compute moving image coordinate of fixed image voxel */
+    mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
+    mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
+    mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
+    mijk[2] = PROJECT_Z (mxyz, moving->proj);
+    mijk[1] = PROJECT_Y (mxyz, moving->proj);
+    mijk[0] = PROJECT_X (mxyz, moving->proj);
 
-                /* Compute moving image coordinate of fixed image voxel */
-                mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
-                mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
-                mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
-                mijk[2] = PROJECT_Z (mxyz, moving->proj);
-                mijk[1] = PROJECT_Y (mxyz, moving->proj);
-                mijk[0] = PROJECT_X (mxyz, moving->proj);
+    if (!moving->is_inside (mijk)) return false;
 
-                if (!moving->is_inside (mijk)) continue;
+    /* Get tri-linear interpolation fractions */
+    li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
 
-                /* Get tri-linear interpolation fractions */
-                li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
-                    
-                /* Find the fixed image linear index */
-                fidx = volume_index (fixed->dim, fijk);
+    /* Find the fixed image linear index */
+    fidx = volume_index (fixed->dim, fijk);
 
-                /* Find linear index the corner voxel used to identifiy the
-                 * neighborhood of the moving image voxels corresponding
-                 * to the current fixed image voxel */
-                midx_f = volume_index (moving->dim, mijk_f);
+    /* Find linear index the corner voxel used to identifiy the
+     * neighborhood of the moving image voxels corresponding
+     * to the current fixed image voxel */
+    midx_f = volume_index (moving->dim, mijk_f);
 
-                /* Add to histogram */
-                mi_hist->add_pvi_8 (fixed, moving, fidx, midx_f, li_1, li_2);
+    /* Add to histogram */
+    mi_hist->add_pvi_8 (fixed, moving, fidx, midx_f, li_1, li_2);
+    return true;
+}
 
-                num_vox++;
+float
+translation_mi (
+    const Stage_parms *stage,
+    const Metric_state::Pointer& ssi,
+    const float dxyz[3],
+    int subsample)
+{
+    Volume *fixed = ssi->fixed_ss.get();
+    Volume *moving = ssi->moving_ss.get();
+    Joint_histogram mi_hist (
+        stage->mi_hist_type,
+        stage->mi_hist_fixed_bins,
+        stage->mi_hist_moving_bins);
+    mi_hist.initialize (fixed, moving);
+    mi_hist.reset_histograms ();
+        
+    plm_long fijk[3];             /* Indices within fixed image (vox) */
+    float fxyz[3];                /* Position within fixed image (mm) */
+    plm_long num_vox = 0;
+    
+    /* PASS 1 - Accumulate histogram */
+    if (subsample > 1) {
+        for (fijk[2] = 0; fijk[2] < fixed->dim[2]; fijk[2] += subsample) {
+            for (fijk[1] = 0; fijk[1] < fixed->dim[1]; fijk[1] += subsample) {
+                for (fijk[0] = 0; fijk[0] < fixed->dim[0];
+                     fijk[0] += subsample)
+                {
+                    POSITION_FROM_COORDS (fxyz, fijk, 
+                        fixed->origin, fixed->step);
+                    if (translation_mi_voxel (&mi_hist, 
+                            fixed, moving, fijk, fxyz, dxyz))
+                    {
+                        num_vox++;
+                    }
+                }
+            }
+        }
+    } else {
+        LOOP_Z (fijk, fxyz, fixed) {
+            LOOP_Y (fijk, fxyz, fixed) {
+                LOOP_X (fijk, fxyz, fixed) {
+                    if (translation_mi_voxel (&mi_hist, 
+                            fixed, moving, fijk, fxyz, dxyz))
+                    {
+                        num_vox++;
+                    }
+                }
             }
         }
     }
 
     /* Compute score */
-    return mi_hist->compute_score (num_vox);
+    return mi_hist.compute_score (num_vox);
 }
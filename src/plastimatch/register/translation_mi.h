@@ -9,10 +9,14 @@
 
 class Stage_parms;
 
+/* Mutual information of the fixed image against the moving image 
+   shifted by dxyz.  If subsample is greater than one, only every 
+   subsample'th voxel in each direction is added to the histogram. */
 float
 translation_mi (
     const Stage_parms *stage,
     const Metric_state::Pointer& ssi,
-    const float dxyz[3]);
+    const float dxyz[3],
+    int subsample = 1);
 
 #endif
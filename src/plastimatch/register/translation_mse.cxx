@@ -19,67 +19,118 @@
 #include "volume_resample.h"
 #include "xform.h"
 
-float
-translation_mse (
-    const Stage_parms *stage,
-    const Metric_state::Pointer& ssi,
+/* Add the squared intensity difference of one fixed image voxel.
+   Returns false if the voxel maps outside the moving image. */
+static inline bool
+translation_mse_voxel (
+    double *score_acc,
+    Volume *fixed,
+    Volume *moving,
+    const plm_long fijk[3],
+    const float fxyz[3],
     const float dxyz[3])
 {
-    plm_long fijk[3], fv;         /* Indices within fixed image (vox) */
-    float fxyz[3];                /* Position within fixed image (mm) */
     float mijk[3];                /* Indices within moving image (vox) */
     float mxyz[3];                /* Position within moving image (mm) */
-
     float li_1[3];                /* Fraction of interpolant in lower index */
     float li_2[3];                /* Fraction of interpolant in upper index */
     plm_long mijk_f[3], mvf;      /* Floor */
     plm_long mijk_r[3];           /* Round */
     float m_val;
 
-    Volume *fixed = ssi->fixed_ss.get();
-    Volume *moving = ssi->moving_ss.get();
-    float* f_img = (float*) fixed->img;
-    float* m_img = (float*) moving->img;
+    const float* f_img = (const float*) fixed->img;
+    const float* m_img = (const float*) moving->img;
 
-    double score_acc = 0.0;
-    plm_long num_vox = 0;
+    /* Compute moving image coordinate of fixed image voxel */
+    mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
+    mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
+    mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
+    mijk[2] = PROJECT_Z (mxyz, moving->proj);
+    mijk[1] = PROJECT_Y (mxyz, moving->proj);
+    mijk[0] = PROJECT_X (mxyz, moving->proj);
 
-    LOOP_Z (fijk, fxyz, fixed) {
-        LOOP_Y (fijk, fxyz, fixed) {
-            LOOP_X (fijk, fxyz, fixed) {
+    if (!moving->is_inside (mijk)) return false;
 
-                /* Compute moving image coordinate of fixed image voxel */
-                mxyz[2] = fxyz[2] + dxyz[2] - moving->origin[2];
-                mxyz[1] = fxyz[1] + dxyz[1] - moving->origin[1];
-                mxyz[0] = fxyz[0] + dxyz[0] - moving->origin[0];
-                mijk[2] = PROJECT_Z (mxyz, moving->proj);
-                mijk[1] = PROJECT_Y (mxyz, moving->proj);
-                mijk[0] = PROJECT_X (mxyz, moving->proj);
+    /* Compute interpolation fractions */
+    li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
 
-                if (!moving->is_inside (mijk)) continue;
+    /* Find linear index of "corner voxel" in moving image */
+    mvf = volume_index (moving->dim, mijk_f);
 
-                /* Compute interpolation fractions */
-                li_clamp_3d (mijk, mijk_f, mijk_r, li_1, li_2, moving);
+    /* Compute moving image intensity using linear interpolation */
+    /* Macro is slightly faster than function */
+    LI_VALUE (m_val, 
+        li_1[0], li_2[0],
+        li_1[1], li_2[1],
+        li_1[2], li_2[2],
+        mvf, m_img, moving);
 
-                /* Find linear index of "corner voxel" in moving image */
-                mvf = volume_index (moving->dim, mijk_f);
+    /* Compute intensity difference */
+    float diff = m_val - f_img[volume_index (fixed->dim, fijk)];
 
-                /* Compute moving image intensity using linear interpolation */
-                /* Macro is slightly faster than function */
-                LI_VALUE (m_val, 
-                    li_1[0], li_2[0],
-                    li_1[1], li_2[1],
-                    li_1[2], li_2[2],
-                    mvf, m_img, moving);
+    *score_acc += diff * diff;
+    return true;
+}
 
-                /* Compute linear index of fixed image voxel */
-                fv = volume_index (fixed->dim, fijk);
+float
+translation_mse (
+    const Stage_parms *stage,
+    const Metric_state::Pointer& ssi,
+    const float dxyz[3],
+    int subsample,
+    float prune_score)
+{
+    plm_long fijk[3];             /* Indices within fixed image (vox) */
+    float fxyz[3];                /* Position within fixed image (mm) */
 
-                /* Compute intensity difference */
-                float diff = m_val - f_img[fv];
+    Volume *fixed = ssi->fixed_ss.get();
+    Volume *moving = ssi->moving_ss.get();
+
+    double score_acc = 0.0;
+    plm_long num_vox = 0;
+
+    if (subsample > 1) {
+        /* Coarse score, using every subsample'th voxel in each direction */
+        for (fijk[2] = 0; fijk[2] < fixed->dim[2]; fijk[2] += subsample) {
+            for (fijk[1] = 0; fijk[1] < fixed->dim[1]; fijk[1] += subsample) {
+                for (fijk[0] = 0; fijk[0] < fixed->dim[0];
+                     fijk[0] += subsample)
+                {
+                    POSITION_FROM_COORDS (fxyz, fijk, 
+                        fixed->origin, fixed->step);
+                    if (translation_mse_voxel (&score_acc, 
+                            fixed, moving, fijk, fxyz, dxyz))
+                    {
+                        num_vox++;
+                    }
+                }
+            }
+        }
+    } else {
+        plm_long slice_vox = fixed->dim[0] * fixed->dim[1];
+        LOOP_Z (fijk, fxyz, fixed) {
+            LOOP_Y (fijk, fxyz, fixed) {
+                LOOP_X (fijk, fxyz, fixed) {
+                    if (translation_mse_voxel (&score_acc, 
+                            fixed, moving, fijk, fxyz, dxyz))
+                    {
+                        num_vox++;
+                    }
+                }
+            }
 
-                score_acc += diff * diff;
-                num_vox++;
+            /* The sum of squares can only grow, and the most it can 
+               be divided by is the number of voxels seen so far plus 
+               all remaining voxels.  If even that lower bound exceeds 
+               prune_score, this translation can't win. */
+            if (prune_score < FLT_MAX) {
+                plm_long max_vox = num_vox 
+                    + (fixed->dim[2] - fijk[2] - 1) * slice_vox;
+                if (max_vox > 0 
+                    && (float) (score_acc / max_vox) > prune_score)
+                {
+                    return FLT_MAX;
+                }
             }
         }
     }
@@ -5,12 +5,20 @@
 #define _translation_mse_h_
 
 #include "plmregister_config.h"
+#include <float.h>
 #include "volume.h"
 
+/* Mean squared error of the fixed image against the moving image 
+   shifted by dxyz.  If subsample is greater than one, only every 
+   subsample'th voxel in each direction is used.  For a full evaluation, 
+   the computation is abandoned and FLT_MAX returned as soon as the 
+   score is certain to exceed prune_score. */
 float
 translation_mse (
     const Stage_parms *stage,
     const Metric_state::Pointer& ssi,
-    const float dxyz[3]);
+    const float dxyz[3],
+    int subsample = 1,
+    float prune_score = FLT_MAX);
 
 #endif
@@ -5,6 +5,10 @@
 #include <list>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
 #include "itkImageMaskSpatialObject.h"
 #include "itkVotingBinaryIterativeHoleFillingImageFilter.h"
@@ -12,6 +16,7 @@
 #include "dir_list.h"
 #include "dice_statistics.h"
 #include "distance_map.h"
+#include "dlib_threads.h"
 #include "file_util.h"
 #include "hausdorff_distance.h"
 #include "itk_adjust.h"
@@ -29,6 +34,7 @@
 #include "path_util.h"
 #include "plm_image.h"
 #include "plm_image_header.h"
+#include "plm_profiler.h"
 #include "plm_timer.h"
 #include "plm_warp.h"
 #include "print_and_exit.h"
@@ -41,6 +47,29 @@
 #include "string_util.h"
 #include "xform.h"
 
+/* B-spline registration results are stored in the binary
+   coefficient format, which loads much faster than text.
+   Other transforms, and results written by older versions,
+   use xf.txt. */
+static std::string
+mabs_xform_filename (const std::string& dir, const Xform *xf)
+{
+    if (xf->get_type() == XFORM_GPUIT_BSPLINE) {
+        return string_format ("%s/xf.bxf", dir.c_str());
+    }
+    return string_format ("%s/xf.txt", dir.c_str());
+}
+
+static std::string
+mabs_find_xform (const std::string& dir)
+{
+    std::string fn = string_format ("%s/xf.bxf", dir.c_str());
+    if (file_exists (fn)) {
+        return fn;
+    }
+    return string_format ("%s/xf.txt", dir.c_str());
+}
+
 class Mabs_private {
 public:
     /* These are the input parameters */
@@ -158,6 +187,11 @@ public:
     double time_warp_img;
     double time_warp_str;
 
+    /* Registration jobs may run concurrently.  These protect 
+       the timers, and the reference structure and statistics. */
+    Dlib_semaphore time_lock;
+    Dlib_semaphore stats_lock;
+
 public:
     Mabs_private () {
         parms = 0;
@@ -191,6 +225,11 @@ public:
         time_warp_img = 0;
         time_warp_str = 0;
     }
+    void add_time (double& timer_value, double elapsed) {
+        time_lock.grab ();
+        timer_value += elapsed;
+        time_lock.release ();
+    }
     void clear_vote_map () {
         std::map<std::string, Mabs_vote*>::iterator it;
         for (it = vote_map.begin(); it != vote_map.end(); ++it) {
@@ -460,6 +499,191 @@ Mabs::check_seg_checkpoint (std::string folder)
     }
 }
 
+/* One atlas of the registration loop.  The atlas is loaded by the 
+   prefetch thread, and its image and structures are released 
+   once the last of its jobs is complete. */
+class Mabs_registration_atlas {
+public:
+    Mabs_registration_atlas () : loaded (true) {
+        relevant = false;
+        jobs_remaining = 0;
+    }
+public:
+    std::string path;
+    std::string atlas_id;
+    std::string atlas_input_path;
+    std::string atlas_output_path;
+    Rt_study::Pointer rtds;
+    bool relevant;
+
+    /* Number of jobs not yet complete, protected by the 
+       scheduler lock */
+    int jobs_remaining;
+
+    /* Released by the prefetch thread once rtds is ready */
+    Dlib_semaphore loaded;
+
+    /* Warping or extracting the atlas structures may convert them 
+       in place, so jobs sharing this atlas take turns */
+    Dlib_semaphore rtss_lock;
+};
+
+/* One registration of one atlas */
+class Mabs_registration_job {
+public:
+    Mabs_registration_atlas *atlas;
+    std::string command_file;
+    std::string registration_id;
+    std::string curr_output_dir;
+    std::string reg_checkpoint_fn;
+};
+
+/* Atlas i is always staged in slot (i % num_slots).  The prefetch 
+   thread grabs the slot before loading the atlas, and the job which 
+   completes the atlas releases it.  This bounds the number of atlases 
+   held in memory, while the next atlas is read from disk during 
+   the registrations of the current ones.  Jobs are claimed in 
+   atlas order, so a job never waits for an atlas which can only 
+   be loaded after it finishes. */
+class Mabs_registration_scheduler {
+public:
+    Mabs *mabs;
+    std::vector<Mabs_registration_atlas*> atlases;
+    std::vector<Mabs_registration_job> jobs;
+    std::vector<Dlib_semaphore*> slots;
+    int threads_per_job;
+
+    /* Worker state, protected by lock */
+    Dlib_semaphore lock;
+    size_t next_job;
+public:
+    Mabs_registration_scheduler () {
+        mabs = 0;
+        threads_per_job = 0;
+        next_job = 0;
+    }
+    ~Mabs_registration_scheduler () {
+        for (size_t i = 0; i < atlases.size(); i++) {
+            delete atlases[i];
+        }
+        for (size_t i = 0; i < slots.size(); i++) {
+            delete slots[i];
+        }
+    }
+public:
+    void load_atlases ();
+    void run_jobs ();
+};
+
+/* Load the atlases, in order, as slots become available */
+void
+Mabs_registration_scheduler::load_atlases ()
+{
+    Mabs_private *d_ptr = mabs->d_ptr;
+    Plm_timer timer;
+
+    for (size_t i = 0; i < atlases.size(); i++) {
+        Mabs_registration_atlas *atlas = atlases[i];
+        slots[i % slots.size()]->grab ();
+
+        printf ("%s\n -> %s\n -> %s\n", atlas->path.c_str(), 
+            dirname (atlas->path).c_str(), atlas->atlas_id.c_str());
+
+        /* Load image & structures from "prep" directory.  The image 
+           is converted here, so that the jobs can share it. */
+        PLM_PROFILE_SCOPE ("mabs_load_atlas");
+        timer.start();
+        atlas->rtds = Rt_study::New ();
+        atlas->rtds->load_rt_study_dir (atlas->atlas_input_path);
+        atlas->rtds->get_image()->itk_float ();
+        d_ptr->add_time (d_ptr->time_io, timer.report());
+
+        /* Inspect the structures -- we might be able to skip the 
+           atlas if it has no relevant structures */
+        Segmentation::Pointer rtss = atlas->rtds->get_segmentation();
+        for (size_t j = 0; j < rtss->get_num_structures(); j++) {
+            std::string ori_name = rtss->get_structure_name (j);
+            std::string mapped_name = d_ptr->map_structure_name (ori_name);
+            if (mapped_name != "") {
+                atlas->relevant = true;
+                break;
+            }
+        }
+        if (!atlas->relevant) {
+            lprintf ("No relevant structures. Skipping.\n");
+        }
+        atlas->loaded.release ();
+    }
+}
+
+static void
+mabs_registration_prefetch (void *arg)
+{
+    Mabs_registration_scheduler *sched 
+        = (Mabs_registration_scheduler*) arg;
+    sched->load_atlases ();
+}
+
+/* Claim and run jobs until none are left */
+void
+Mabs_registration_scheduler::run_jobs ()
+{
+#if (OPENMP_FOUND)
+    int saved_threads = omp_get_max_threads ();
+    if (threads_per_job > 0) {
+        omp_set_num_threads (threads_per_job);
+    }
+#endif
+
+    while (1) {
+        lock.grab ();
+        size_t job_idx = next_job;
+        if (job_idx >= jobs.size()) {
+            lock.release ();
+            break;
+        }
+        next_job ++;
+        lock.release ();
+
+        Mabs_registration_job& job = jobs[job_idx];
+        Mabs_registration_atlas *atlas = job.atlas;
+
+        /* Wait for the prefetch thread to load the atlas */
+        atlas->loaded.grab ();
+        atlas->loaded.release ();
+
+        if (atlas->relevant) {
+            mabs->run_registration_job (job);
+        }
+
+        /* The last job of an atlas frees it, and makes room 
+           for the next atlas to be loaded */
+        lock.grab ();
+        bool atlas_done = (--atlas->jobs_remaining == 0);
+        lock.release ();
+        if (atlas_done) {
+            size_t atlas_idx = 0;
+            while (atlases[atlas_idx] != atlas) {
+                atlas_idx ++;
+            }
+            atlas->rtds.reset ();
+            slots[atlas_idx % slots.size()]->release ();
+        }
+    }
+
+#if (OPENMP_FOUND)
+    omp_set_num_threads (saved_threads);
+#endif
+}
+
+static void
+mabs_registration_worker (void *arg)
+{
+    Mabs_registration_scheduler *sched 
+        = (Mabs_registration_scheduler*) arg;
+    sched->run_jobs ();
+}
+
 /* ------------------------------------------------------------------------- *
    This function runs a registration for a group of atlases against 
    a single reference image.
@@ -470,49 +694,33 @@ Mabs::check_seg_checkpoint (std::string folder)
    d_ptr->output_dir         directory containing output results
                              (e.g. .../prealign or .../mabs-train)
    d_ptr->registration_list  list of registration command files
+
+   Each pair of atlas and registration command file is a job.  
+   Up to parms->registration_jobs jobs run at the same time, 
+   each using parms->registration_threads_per_job threads.
  * ------------------------------------------------------------------------- */
 void
 Mabs::run_registration_loop ()
 {
-    Plm_timer timer;
+    PLM_PROFILE_SCOPE ("Mabs::run_registration_loop");
+    Mabs_registration_scheduler sched;
+    sched.mabs = this;
 
-    /* Loop through images in the atlas */
+    /* Make the list of jobs.  Registrations which are already 
+       complete are skipped, and atlases with nothing left to do 
+       are not loaded at all. */
     std::list<std::string>::iterator atl_it;
     for (atl_it = d_ptr->atlas_list.begin();
          atl_it != d_ptr->atlas_list.end(); atl_it++)
     {
-        Rt_study rtds;
-        std::string path = *atl_it;
-        std::string input_dir = dirname (path);
-        std::string atlas_id = basename (path);
-        printf ("%s\n -> %s\n -> %s\n",
-            path.c_str(), input_dir.c_str(), atlas_id.c_str());
-        std::string atlas_input_path = string_format ("%s/%s",
-            input_dir.c_str(), atlas_id.c_str());
-        std::string atlas_output_path = string_format ("%s/%s",
-            d_ptr->output_dir.c_str(), atlas_id.c_str());
-
-        /* Load image & structures from "prep" directory */
-        timer.start();
-        rtds.load_rt_study_dir (atlas_input_path);
-        d_ptr->time_io += timer.report();
-
-        /* Inspect the structures -- we might be able to skip the 
-           atlas if it has no relevant structures */
-        bool can_skip = true;
-        Segmentation::Pointer rtss = rtds.get_segmentation();
-        for (size_t i = 0; i < rtss->get_num_structures(); i++) {
-            std::string ori_name = rtss->get_structure_name (i);
-            std::string mapped_name = d_ptr->map_structure_name (ori_name);
-            if (mapped_name != "") {
-                can_skip = false;
-                break;
-            }
-        }
-        if (can_skip) {
-            lprintf ("No relevant structures. Skipping.\n");
-            continue;
-        }
+        Mabs_registration_atlas *atlas = new Mabs_registration_atlas;
+        atlas->path = *atl_it;
+        std::string input_dir = dirname (atlas->path);
+        atlas->atlas_id = basename (atlas->path);
+        atlas->atlas_input_path = string_format ("%s/%s",
+            input_dir.c_str(), atlas->atlas_id.c_str());
+        atlas->atlas_output_path = string_format ("%s/%s",
+            d_ptr->output_dir.c_str(), atlas->atlas_id.c_str());
 
         /* Loop through each registration parameter set */
         std::list<std::string>::iterator reg_it;
@@ -520,215 +728,296 @@ Mabs::run_registration_loop ()
              reg_it != d_ptr->registration_list.end(); reg_it++) 
         {
             /* Set up files & directories for this job */
-            std::string command_file = *reg_it;
-            std::string curr_output_dir;
-            std::string registration_id;
-            registration_id = basename (command_file);
-            curr_output_dir = string_format ("%s/%s",
-                atlas_output_path.c_str(),
-                registration_id.c_str());
+            Mabs_registration_job job;
+            job.atlas = atlas;
+            job.command_file = *reg_it;
+            job.registration_id = basename (job.command_file);
+            job.curr_output_dir = string_format ("%s/%s",
+                atlas->atlas_output_path.c_str(),
+                job.registration_id.c_str());
 
             /* Check if this registration is already complete.
                We might be able to skip it. */
-            std::string reg_checkpoint_fn = string_format (
-                "%s/checkpoint.txt", curr_output_dir.c_str());
-            if (file_exists (reg_checkpoint_fn)) {
+            job.reg_checkpoint_fn = string_format (
+                "%s/checkpoint.txt", job.curr_output_dir.c_str());
+            if (file_exists (job.reg_checkpoint_fn)) {
                 lprintf ("Registration parms complete for %s\n",
-                    curr_output_dir.c_str());
+                    job.curr_output_dir.c_str());
                 continue;
             }
+            sched.jobs.push_back (job);
+            atlas->jobs_remaining ++;
+        }
+        if (atlas->jobs_remaining == 0) {
+            delete atlas;
+            continue;
+        }
+        sched.atlases.push_back (atlas);
+    }
+    if (sched.jobs.size() == 0) {
+        return;
+    }
 
-            /* Set up the registration data structure */
-            Registration reg;
-            Registration_parms::Pointer regp = reg.get_registration_parms ();
-            Registration_data::Pointer regd = reg.get_registration_data ();
-
-            /* Parse the registration command string */
-            std::string command_string = slurp_file (command_file);
-            int rc = reg.set_command_string (command_string);
-            if (rc != PLM_SUCCESS) {
-                lprintf ("Skipping command file \"%s\" "
-                    "due to parse error.\n", command_file.c_str());
-                continue;
-            }
+    /* Decide how many jobs to run at once, and how many threads 
+       each of them gets */
+    int num_jobs = d_ptr->parms->registration_jobs;
+    if (num_jobs < 1) {
+        num_jobs = 1;
+    }
+    if ((size_t) num_jobs > sched.jobs.size()) {
+        num_jobs = (int) sched.jobs.size();
+    }
+    sched.threads_per_job = d_ptr->parms->registration_threads_per_job;
+#if (OPENMP_FOUND)
+    if (sched.threads_per_job <= 0 && num_jobs > 1) {
+        sched.threads_per_job = omp_get_max_threads () / num_jobs;
+        if (sched.threads_per_job < 1) {
+            sched.threads_per_job = 1;
+        }
+    }
+#endif
+    lprintf ("MABS running %d registration jobs, %d at a time\n",
+        (int) sched.jobs.size(), num_jobs);
 
-            /* Give some feedback about which registration we are 
-               going to run */
-            lprintf ("** TASK: %s %s %s\n",
-                d_ptr->ref_id.c_str(),
-                atlas_id.c_str(),
-                registration_id.c_str());
+    /* Keep the atlases of all running jobs, and one more, in memory */
+    for (int i = 0; i < num_jobs + 1; i++) {
+        sched.slots.push_back (new Dlib_semaphore);
+    }
 
-            /* Set input files */
-            Plm_image::Pointer fixed_image = Plm_image::New ();
-            fixed_image->set_itk (
-                d_ptr->ref_rtds->get_image()->itk_float());
-            reg.set_fixed_image (fixed_image);
-            Plm_image::Pointer moving_image = Plm_image::New ();
-            moving_image->set_itk (
-                rtds.get_image()->itk_float());
-            reg.set_moving_image (moving_image);
-            
-            /* PAOLO ZAFFINO: align centers of gravity */
-            if (d_ptr->input_roi_for_cog_prealignment != NULL) {
-                
-                /* Add STAGE only if a segment command is executed. Is it needed or we can define it into the configuration file? */
-                std::string command_string_plus_cog = "[STAGE]\nxform=align_center_of_gravity\n";
-                command_string_plus_cog.append(command_string);
-                int rc_cog = reg.set_command_string (command_string_plus_cog);
-                if (rc_cog != PLM_SUCCESS) {
-                    lprintf ("Skipping centers of gravity prealignment addition to command file \"%s\" \n", command_file.c_str());
-                    continue;
-                }
-             
-                /* Set fixed ROI */
-                reg.set_fixed_roi(d_ptr->input_roi_for_cog_prealignment); 
-               
-                /* Set moving ROI*/ 
-                std::string target_roi_name;
-                if (d_ptr->executed_command == "segment") {
-                    target_roi_name = strip_extension(basename(d_ptr->prealign_roi_cmd_name));
-                }
-                else if (d_ptr->executed_command == "prealign") {
-                    target_roi_name = d_ptr->parms->prealign_roi_cfg_name;
-                }
+    /* The fixed image is shared by all jobs, convert it up front */
+    d_ptr->ref_rtds->get_image()->itk_float ();
 
-                size_t target_roi_index = -1;
-                for (size_t i = 0; i < rtss->get_num_structures(); i++) {
-                    std::string struct_name = rtss->get_structure_name (i);
+    /* The calling thread runs jobs too.  Deleting a thread function 
+       waits for the thread to end. */
+    Dlib_thread_function *prefetch 
+        = new Dlib_thread_function (mabs_registration_prefetch, &sched);
+    std::vector<Dlib_thread_function*> workers;
+    for (int i = 1; i < num_jobs; i++) {
+        workers.push_back (
+            new Dlib_thread_function (mabs_registration_worker, &sched));
+    }
+    sched.run_jobs ();
+    for (size_t i = 0; i < workers.size(); i++) {
+        delete workers[i];
+    }
+    delete prefetch;
+}
 
-                    if (struct_name == target_roi_name) {
-                        target_roi_index = i;
-                        break;
-                    }
-                }
-                if (target_roi_index != -1) {
-                    Plm_image::Pointer moving_roi = Plm_image::New ();
-                    moving_roi->set_itk (rtss->get_structure_image (target_roi_index));
-                    reg.set_moving_roi(moving_roi);
-                }
-                else if (target_roi_index == -1) {
-                    lprintf("No moving ROI set!\n");
-                }
-            }
+/* Run a single registration, warp the atlas structures, and 
+   evaluate them against the reference structures.  Several jobs 
+   may run at the same time. */
+void
+Mabs::run_registration_job (const Mabs_registration_job& job)
+{
+    PLM_PROFILE_SCOPE ("Mabs::run_registration_job");
+    Plm_timer timer;
+    Mabs_registration_atlas *atlas = job.atlas;
+    Rt_study::Pointer rtds = atlas->rtds;
+    Segmentation::Pointer rtss = rtds->get_segmentation();
+    const std::string& atlas_id = atlas->atlas_id;
+    const std::string& command_file = job.command_file;
+    const std::string& registration_id = job.registration_id;
+    const std::string& curr_output_dir = job.curr_output_dir;
+
+    /* Set up the registration data structure */
+    Registration reg;
+    Registration_parms::Pointer regp = reg.get_registration_parms ();
+    Registration_data::Pointer regd = reg.get_registration_data ();
+
+    /* Parse the registration command string */
+    std::string command_string = slurp_file (command_file);
+    int rc = reg.set_command_string (command_string);
+    if (rc != PLM_SUCCESS) {
+        lprintf ("Skipping command file \"%s\" "
+            "due to parse error.\n", command_file.c_str());
+        return;
+    }
 
-            /* Run the registration */
-            lprintf ("DO_REGISTRATION_PURE\n");
-            lprintf ("regp->num_stages = %d\n", regp->num_stages);
-            timer.start();
-            Xform::Pointer xf_out = reg.do_registration_pure ();
-            d_ptr->time_reg += timer.report();
+    /* Give some feedback about which registration we are 
+       going to run */
+    lprintf ("** TASK: %s %s %s\n",
+        d_ptr->ref_id.c_str(),
+        atlas_id.c_str(),
+        registration_id.c_str());
+
+    /* Set input files */
+    Plm_image::Pointer fixed_image = Plm_image::New ();
+    fixed_image->set_itk (
+        d_ptr->ref_rtds->get_image()->itk_float());
+    reg.set_fixed_image (fixed_image);
+    Plm_image::Pointer moving_image = Plm_image::New ();
+    moving_image->set_itk (
+        rtds->get_image()->itk_float());
+    reg.set_moving_image (moving_image);
+
+    /* PAOLO ZAFFINO: align centers of gravity */
+    if (d_ptr->input_roi_for_cog_prealignment != NULL) {
+
+        /* Add STAGE only if a segment command is executed. Is it needed or we can define it into the configuration file? */
+        std::string command_string_plus_cog = "[STAGE]\nxform=align_center_of_gravity\n";
+        command_string_plus_cog.append(command_string);
+        int rc_cog = reg.set_command_string (command_string_plus_cog);
+        if (rc_cog != PLM_SUCCESS) {
+            lprintf ("Skipping centers of gravity prealignment addition to command file \"%s\" \n", command_file.c_str());
+            return;
+        }
 
-            /* Warp the output image */
-            lprintf ("Warp output image...\n");
-            Plm_image_header fixed_pih (fixed_image);
-            Plm_image::Pointer warped_image = Plm_image::New();
-            timer.start();
-            plm_warp (warped_image, 0, xf_out, &fixed_pih, 
-                moving_image, 
-                regp->default_value, 0, 1);
-            d_ptr->time_warp_img += timer.report();
-            
-            /* Warp the structures */
-            lprintf ("Warp structures...\n");
-            Plm_image_header source_pih (rtds.get_image());
-            timer.start();
-            //rtss->warp (xf_out, &fixed_pih);
-            Segmentation::Pointer warped_rtss 
-                = rtss->warp_nondestructive (xf_out, &fixed_pih);
-            d_ptr->time_warp_str += timer.report();
+        /* Set fixed ROI */
+        reg.set_fixed_roi(d_ptr->input_roi_for_cog_prealignment); 
 
-            /* Save some debugging information */
-            if (d_ptr->write_registration_files) {
-                timer.start();
-                std::string fn;
-                lprintf ("Saving registration_files\n");
-                if (d_ptr->write_warped_images) {
-                    fn = string_format ("%s/img.nrrd", 
-                        curr_output_dir.c_str());
-                    warped_image->save_image (fn.c_str());
-                }
+        /* Set moving ROI*/ 
+        std::string target_roi_name;
+        if (d_ptr->executed_command == "segment") {
+            target_roi_name = strip_extension(basename(d_ptr->prealign_roi_cmd_name));
+        }
+        else if (d_ptr->executed_command == "prealign") {
+            target_roi_name = d_ptr->parms->prealign_roi_cfg_name;
+        }
 
-                fn = string_format ("%s/xf.txt", curr_output_dir.c_str());
-                xf_out->save (fn.c_str());
+        size_t target_roi_index = -1;
+        for (size_t i = 0; i < rtss->get_num_structures(); i++) {
+            std::string struct_name = rtss->get_structure_name (i);
 
-                if (d_ptr->parms->write_warped_structures) {
-                    fn = string_format ("%s/structures", 
-                        curr_output_dir.c_str());
-                    warped_rtss->save_prefix (fn, "nrrd");
-                }
-                d_ptr->time_io += timer.report();
+            if (struct_name == target_roi_name) {
+                target_roi_index = i;
+                break;
             }
+        }
+        if (target_roi_index != -1) {
+            Plm_image::Pointer moving_roi = Plm_image::New ();
+            atlas->rtss_lock.grab ();
+            moving_roi->set_itk (rtss->get_structure_image (target_roi_index));
+            atlas->rtss_lock.release ();
+            reg.set_moving_roi(moving_roi);
+        }
+        else if (target_roi_index == -1) {
+            lprintf("No moving ROI set!\n");
+        }
+    }
 
-            /* Loop through structures for this atlas image */
-            lprintf ("Process structures...\n");
-            for (size_t i = 0; i < warped_rtss->get_num_structures(); i++) {
-                /* Check structure name, make sure it is something we 
-                   want to segment */
-                std::string ori_name = warped_rtss->get_structure_name (i);
-                std::string mapped_name = d_ptr->map_structure_name (ori_name);
-                if (mapped_name == "") {
-                    continue;
-                }
+    /* Run the registration */
+    lprintf ("DO_REGISTRATION_PURE\n");
+    lprintf ("regp->num_stages = %d\n", regp->num_stages);
+    timer.start();
+    Xform::Pointer xf_out = reg.do_registration_pure ();
+    d_ptr->add_time (d_ptr->time_reg, timer.report());
 
-                /* Extract structure as binary mask */
-                timer.start();
-                UCharImageType::Pointer structure_image 
-                    = warped_rtss->get_structure_image (i);
-                d_ptr->time_extract += timer.report();
+    /* Warp the output image */
+    lprintf ("Warp output image...\n");
+    Plm_image_header fixed_pih (fixed_image);
+    Plm_image::Pointer warped_image = Plm_image::New();
+    timer.start();
+    plm_warp (warped_image, 0, xf_out, &fixed_pih, 
+        moving_image, 
+        regp->default_value, 0, 1);
+    d_ptr->add_time (d_ptr->time_warp_img, timer.report());
+
+    /* Warp the structures.  The image is warped separately, so that 
+       other jobs sharing this atlas are only blocked while the 
+       structures are being warped. */
+    lprintf ("Warp structures...\n");
+    timer.start();
+    atlas->rtss_lock.grab ();
+    Segmentation::Pointer warped_rtss 
+        = rtss->warp_nondestructive (xf_out, &fixed_pih);
+    atlas->rtss_lock.release ();
+    d_ptr->add_time (d_ptr->time_warp_str, timer.report());
+
+    /* Save some debugging information */
+    if (d_ptr->write_registration_files) {
+        timer.start();
+        std::string fn;
+        lprintf ("Saving registration_files\n");
+        if (d_ptr->write_warped_images) {
+            fn = string_format ("%s/img.nrrd", 
+                curr_output_dir.c_str());
+            warped_image->save_image (fn.c_str());
+        }
 
-                /* Make the distance map */
-                if (d_ptr->compute_distance_map 
-                    && d_ptr->parms->fusion_criteria == "gaussian")
-                {
-                    timer.start();
-                    lprintf ("Computing distance map...\n");
-                    this->compute_dmap (structure_image,
-                        curr_output_dir, mapped_name);
-                }
+        /* Remove the result of a previous run, which might
+           otherwise be found first when loading */
+        remove (string_format ("%s/xf.bxf", curr_output_dir.c_str()).c_str());
+        remove (string_format ("%s/xf.txt", curr_output_dir.c_str()).c_str());
+        fn = mabs_xform_filename (curr_output_dir, xf_out.get());
+        xf_out->save (fn.c_str());
 
-                /* Extract reference structure as binary mask. */
-                timer.start();
-                lprintf ("Extracting reference image (%s)\n",
-                    mapped_name.c_str());
-                d_ptr->extract_reference_image (mapped_name);
-                lprintf ("Done extracting reference image.\n");
-                d_ptr->time_extract += timer.report();
+        if (d_ptr->parms->write_warped_structures) {
+            fn = string_format ("%s/structures", 
+                curr_output_dir.c_str());
+            warped_rtss->save_prefix (fn, "nrrd");
+        }
+        d_ptr->add_time (d_ptr->time_io, timer.report());
+    }
 
-                /* Compute Dice, etc. */
-                timer.start();
-                if (d_ptr->have_ref_structure) {
-
-                    std::string stats_string 
-                        = d_ptr->stats.compute_statistics (
-                            registration_id,
-                            d_ptr->ref_structure_image,
-                            structure_image);
-                    std::string reg_log_string = string_format (
-                        "target=%s,atlas=%s,reg=%s,struct=%s,%s\n",
-                        d_ptr->ref_id.c_str(), 
-                        atlas_id.c_str(),
-                        registration_id.c_str(),
-                        mapped_name.c_str(), 
-                        stats_string.c_str());
-                    lprintf ("%s", reg_log_string.c_str());
-
-                    /* Update reg_dice file */
-                    std::string reg_dice_log_fn = string_format (
-                        "%s/reg_dice.csv",
-                        d_ptr->output_dir.c_str());
-                    FILE *fp = fopen (reg_dice_log_fn.c_str(), "a");
-                    fprintf (fp, "%s", reg_log_string.c_str());
-                    fclose (fp);
-                }
-            }
+    /* Loop through structures for this atlas image */
+    lprintf ("Process structures...\n");
+    for (size_t i = 0; i < warped_rtss->get_num_structures(); i++) {
+        /* Check structure name, make sure it is something we 
+           want to segment */
+        std::string ori_name = warped_rtss->get_structure_name (i);
+        std::string mapped_name = d_ptr->map_structure_name (ori_name);
+        if (mapped_name == "") {
+            continue;
+        }
+
+        /* Extract structure as binary mask */
+        timer.start();
+        UCharImageType::Pointer structure_image 
+            = warped_rtss->get_structure_image (i);
+        d_ptr->add_time (d_ptr->time_extract, timer.report());
+
+        /* Make the distance map */
+        if (d_ptr->compute_distance_map 
+            && d_ptr->parms->fusion_criteria == "gaussian")
+        {
+            lprintf ("Computing distance map...\n");
+            this->compute_dmap (structure_image,
+                curr_output_dir, mapped_name);
+        }
 
-            /* Create checkpoint file which means that this registration
-               is complete */
-            touch_file (reg_checkpoint_fn);
+        /* The reference structure and the statistics are shared 
+           by all jobs */
+        d_ptr->stats_lock.grab ();
 
-        } /* end for each registration parameter */
-    } /* end for each atlas image */
+        /* Extract reference structure as binary mask. */
+        timer.start();
+        lprintf ("Extracting reference image (%s)\n",
+            mapped_name.c_str());
+        d_ptr->extract_reference_image (mapped_name);
+        lprintf ("Done extracting reference image.\n");
+        d_ptr->add_time (d_ptr->time_extract, timer.report());
+
+        /* Compute Dice, etc. */
+        if (d_ptr->have_ref_structure) {
+
+            std::string stats_string 
+                = d_ptr->stats.compute_statistics (
+                    registration_id,
+                    d_ptr->ref_structure_image,
+                    structure_image);
+            std::string reg_log_string = string_format (
+                "target=%s,atlas=%s,reg=%s,struct=%s,%s\n",
+                d_ptr->ref_id.c_str(), 
+                atlas_id.c_str(),
+                registration_id.c_str(),
+                mapped_name.c_str(), 
+                stats_string.c_str());
+            lprintf ("%s", reg_log_string.c_str());
+
+            /* Update reg_dice file */
+            std::string reg_dice_log_fn = string_format (
+                "%s/reg_dice.csv",
+                d_ptr->output_dir.c_str());
+            FILE *fp = fopen (reg_dice_log_fn.c_str(), "a");
+            fprintf (fp, "%s", reg_log_string.c_str());
+            fclose (fp);
+        }
+        d_ptr->stats_lock.release ();
+    }
+
+    /* Create checkpoint file which means that this registration
+       is complete */
+    touch_file (job.reg_checkpoint_fn);
 }
 
 void
@@ -1468,14 +1757,14 @@ Mabs::compute_dmap (
     al.push_back (std::make_pair (
             std::numeric_limits<float>::max(), 0));
     itk_adjust (dmap_image, al);
-    d_ptr->time_dmap += timer.report();
+    d_ptr->add_time (d_ptr->time_dmap, timer.report());
 
     if (d_ptr->write_distance_map_files) {
         timer.start();
         std::string fn = string_format ("%s/dmap_%s.nrrd", 
             curr_output_dir.c_str(), mapped_name.c_str());
         itk_image_save (dmap_image, fn.c_str());
-        d_ptr->time_io += timer.report();
+        d_ptr->add_time (d_ptr->time_io, timer.report());
     }
 
     return dmap_image;
@@ -1508,9 +1797,7 @@ Mabs::no_voting (
 
     /* Load xform */
     timer.start();
-    std::string xf_fn = string_format ("%s/%s",
-        curr_output_dir.c_str(),
-        "xf.txt");
+    std::string xf_fn = mabs_find_xform (curr_output_dir);
     lprintf ("Loading xform: %s\n", xf_fn.c_str());
     Xform::Pointer xf = xform_load (xf_fn);
     d_ptr->time_io += timer.report();
@@ -1624,9 +1911,7 @@ Mabs::gaussian_segmentation_vote (
 
     /* Load xform */
     timer.start();
-    std::string xf_fn = string_format ("%s/%s",
-        curr_output_dir.c_str(),
-        "xf.txt");
+    std::string xf_fn = mabs_find_xform (curr_output_dir);
     lprintf ("Loading xform: %s\n", xf_fn.c_str());
     Xform::Pointer xf = xform_load (xf_fn);
     d_ptr->time_io += timer.report();
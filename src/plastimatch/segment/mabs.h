@@ -10,6 +10,7 @@
 
 class Mabs_private;
 class Mabs_parms;
+class Mabs_registration_job;
 class Mabs_seg_weights;
 class Mabs_seg_weights_list;
 
@@ -19,6 +20,7 @@ public:
     ~Mabs ();
 public:
     Mabs_private *d_ptr;
+    friend class Mabs_registration_scheduler;
 
 protected:
     bool check_seg_checkpoint (std::string folder);
@@ -31,6 +33,7 @@ protected:
         const std::string& curr_output_dir,
         const std::string& mapped_name);
     void run_registration_loop ();
+    void run_registration_job (const Mabs_registration_job& job);
     void run_single_registration ();
     void run_segmentation (const Mabs_seg_weights_list& seg_weights);
     void run_segmentation_train (const Mabs_seg_weights& seg_weights);
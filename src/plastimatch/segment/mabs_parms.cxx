@@ -291,6 +291,21 @@ Mabs_parms_parser::set_key_value (
         if (key == "registration_config") {
             mp->registration_config = val;
         }
+        else if (key == "registration_jobs") {
+            if (sscanf (val.c_str(), "%d", &mp->registration_jobs) != 1
+                || mp->registration_jobs < 1)
+            {
+                goto error_exit;
+            }
+        }
+        else if (key == "registration_threads_per_job") {
+            if (sscanf (val.c_str(), "%d", 
+                    &mp->registration_threads_per_job) != 1
+                || mp->registration_threads_per_job < 0)
+            {
+                goto error_exit;
+            }
+        }
         else {
             goto error_exit;
         }
@@ -423,6 +438,10 @@ Mabs_parms::Mabs_parms ()
     this->write_warped_images = true;
     this->write_warped_structures = true;
 
+    /* [REGISTRATION] */
+    this->registration_jobs = 1;
+    this->registration_threads_per_job = 0;
+
     /* [OPTIMIZATION-RESULT-REG] */
     this->optimization_result_reg = "";
 
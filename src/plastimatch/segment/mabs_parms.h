@@ -77,6 +77,8 @@ public:
 
     /* [REGISTRATION] */
     std::string registration_config;
+    int registration_jobs;
+    int registration_threads_per_job; // 0 to divide threads among jobs
 
     /* [STRUCTURES] */
     std::map<std::string, std::string> structure_map;
@@ -16,7 +16,7 @@ print_usage (void)
     printf (
 	"Usage: demons [options] fixed moving\n"
 	"Options:\n"
-	" -A algorithm         Either \"cpu\" or \"cuda\" (default=cpu)\n"
+	" -A algorithm         Either \"cpu\", \"single\" or \"cuda\" (default=cpu)\n"
 	" -a accel             Acceleration factor (default=1)\n"
 	" -e denom_eps         Minimum allowed denominator magnitude (default=1)\n"
 	" -f \"i j k\"           Width of smoothing kernel (voxels)\n"
@@ -59,6 +59,10 @@ parse_args (Demons_options* options, int argc, char* argv[])
 		continue;
 	    }
 #endif
+	    if (!strcmp(argv[i], "single")) {
+		parms->threading = THREADING_CPU_SINGLE;
+		continue;
+	    }
 	    /* Default */
 	    parms->threading = THREADING_CPU_OPENMP;
 	}
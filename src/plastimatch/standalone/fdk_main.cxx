@@ -18,6 +18,7 @@
 #include "fdk_util.h"
 #include "mha_io.h"
 #include "plm_math.h"
+#include "plm_profiler.h"
 #include "print_and_exit.h"
 #include "proj_image_dir.h"
 #include "threading.h"
@@ -92,6 +93,9 @@ main (int argc, char* argv[])
     /* Free memory */
     delete vol;
 
+    /* Write profile if requested by PLM_PROFILE environment variable */
+    Plm_profiler::get()->dump ();
+
 //    UNLOAD_LIBRARY (libplmopencl);
 
     printf(" done.\n\n");
@@ -25,7 +25,9 @@ print_usage (void)
 	" -I indir               The input directory\n"
 	" -O outfile             The output file\n"
         " -x \"x0 y0\"             Panel offset (in pixels)\n"
-        " -X flavor              Implementation flavor (0,a,b,c,d) (default=c)\n"
+        " -X flavor              Implementation flavor (0,a,b,c,d,e) (default=c)\n"
+        " -L threads             Threads for loading and filtering images,\n"
+        "                          0 to load in the main thread (default=2)\n"
     );
     exit (1);
 }
@@ -51,6 +53,7 @@ set_default_parms (Fdk_parms* parms)
     parms->input_dir = ".";
     parms->output_file = "output.mha";
     parms->flavor = 'c';
+    parms->loader_threads = 2;
     parms->full_fan=1;
     parms->Full_normCBCT_name="Full_norm.mh5";
     parms->Full_radius=120;
@@ -136,7 +139,18 @@ fdk_parse_args (Fdk_parms* parms, int argc, char* argv[])
 	    parms->flavor = argv[i][0];
 	    if (parms->flavor != '0' && parms->flavor != 'a'
 		&& parms->flavor != 'b' && parms->flavor != 'c'
-		&& parms->flavor != 'd') {
+		&& parms->flavor != 'd' && parms->flavor != 'e') {
+		print_usage ();
+	    }
+	}
+	else if (!strcmp (argv[i], "-L")) {
+	    if (i == (argc-1) || argv[i+1][0] == '-') {
+		fprintf(stderr, "option %s requires an argument\n", argv[i]);
+		exit(1);
+	    }
+	    i++;
+	    rc = sscanf (argv[i], "%d", &parms->loader_threads);
+	    if (rc != 1 || parms->loader_threads < 0) {
 		print_usage ();
 	    }
 	}
@@ -78,6 +78,17 @@ file_size (const char *filename)
     return (uint64_t) fs.st_size;
 }
 
+/* Return the modification time in seconds since the epoch, 
+   or 0 if the file does not exist */
+int64_t
+file_modified_time (const char *filename)
+{
+    struct stat fs;
+    if (stat (filename, &fs) != 0) return 0;
+
+    return (int64_t) fs.st_mtime;
+}
+
 void 
 touch_file (const std::string& filename)
 {
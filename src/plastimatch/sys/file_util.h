@@ -12,6 +12,7 @@
 PLMSYS_API int file_exists (const char *filename);
 PLMSYS_API int file_exists (const std::string& filename);
 PLMSYS_API uint64_t file_size (const char *filename);
+PLMSYS_API int64_t file_modified_time (const char *filename);
 PLMSYS_API int is_directory (const char *dir);
 PLMSYS_API int is_directory (const std::string& dir);
 PLMSYS_API void touch_file (const std::string& filename);
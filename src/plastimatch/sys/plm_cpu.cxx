@@ -0,0 +1,46 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmsys_config.h"
+#if defined (_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "plm_cpu.h"
+
+static bool
+cpu_supports_avx2 ()
+{
+#if !(AVX2_FOUND)
+    return false;
+#elif defined (_MSC_VER)
+    int info[4];
+    __cpuid (info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    /* OSXSAVE, AVX and FMA */
+    __cpuid (info, 1);
+    if ((info[2] & 0x18001000) != 0x18001000) {
+        return false;
+    }
+    /* OS must save ymm registers */
+    if ((_xgetbv (0) & 0x6) != 0x6) {
+        return false;
+    }
+    __cpuidex (info, 7, 0);
+    return (info[1] & 0x20) != 0;
+#elif defined (__GNUC__)
+    __builtin_cpu_init ();
+    return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+#else
+    return false;
+#endif
+}
+
+bool
+plm_cpu_has_avx2 ()
+{
+    static const bool have_avx2 = cpu_supports_avx2 ();
+    return have_avx2;
+}
@@ -0,0 +1,14 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _plm_cpu_h_
+#define _plm_cpu_h_
+
+#include "plmsys_config.h"
+
+/* Returns true if the build includes AVX2 kernels, and the CPU and
+   operating system can run them.  The result is cached after
+   the first call. */
+PLMSYS_API bool plm_cpu_has_avx2 ();
+
+#endif
@@ -0,0 +1,284 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#include "plmsys_config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#include "dlib_threads.h"
+#include "file_util.h"
+#include "logfile.h"
+#include "path_util.h"
+#include "plm_profiler.h"
+#include "plm_timer.h"
+
+#if defined (_MSC_VER)
+#define PLM_THREAD_LOCAL __declspec(thread)
+#else
+#define PLM_THREAD_LOCAL __thread
+#endif
+
+class Plm_profiler_node {
+public:
+    Plm_profiler_node (const char *name, Plm_profiler_node *parent) {
+        this->name = name;
+        this->parent = parent;
+        this->calls = 0;
+        this->total_time = 0.;
+        this->start_time = 0.;
+    }
+    ~Plm_profiler_node () {
+        for (size_t i = 0; i < children.size(); i++) {
+            delete children[i];
+        }
+    }
+public:
+    const char *name;
+    Plm_profiler_node *parent;
+    std::vector<Plm_profiler_node*> children;
+    unsigned long calls;
+    double total_time;
+    double start_time;
+public:
+    Plm_profiler_node* get_child (const char *name) {
+        for (size_t i = 0; i < children.size(); i++) {
+            if (children[i]->name == name
+                || !strcmp (children[i]->name, name))
+            {
+                return children[i];
+            }
+        }
+        Plm_profiler_node *child = new Plm_profiler_node (name, this);
+        children.push_back (child);
+        return child;
+    }
+    double self_time () const {
+        double t = total_time;
+        for (size_t i = 0; i < children.size(); i++) {
+            t -= children[i]->total_time;
+        }
+        return t > 0. ? t : 0.;
+    }
+};
+
+/* Each thread owns one of these.  Only the owning thread modifies it,
+   so entering and leaving regions requires no locking. */
+class Plm_profiler_thread {
+public:
+    Plm_profiler_thread (Plm_profiler_private *owner, int index)
+        : root ("root", 0)
+    {
+        this->owner = owner;
+        this->index = index;
+        this->current = &root;
+    }
+public:
+    Plm_profiler_private *owner;
+    int index;
+    Plm_profiler_node root;
+    Plm_profiler_node *current;
+};
+
+static PLM_THREAD_LOCAL Plm_profiler_thread *thread_profile = 0;
+
+class Plm_profiler_private {
+public:
+    Plm_profiler_private () {
+        const char *env = getenv ("PLM_PROFILE");
+        if (env && env[0]) {
+            output_fn = env;
+        }
+        enabled = (output_fn != "");
+    }
+    ~Plm_profiler_private () {
+        for (size_t i = 0; i < threads.size(); i++) {
+            delete threads[i];
+        }
+    }
+public:
+    bool enabled;
+    std::string output_fn;
+    Plm_timer timer;
+    Dlib_semaphore threads_lock;
+    std::vector<Plm_profiler_thread*> threads;
+public:
+    Plm_profiler_thread* get_thread () {
+        Plm_profiler_thread *tp = thread_profile;
+        if (tp && tp->owner == this) {
+            return tp;
+        }
+        threads_lock.grab ();
+        tp = new Plm_profiler_thread (this, (int) threads.size());
+        threads.push_back (tp);
+        threads_lock.release ();
+        thread_profile = tp;
+        return tp;
+    }
+};
+
+Plm_profiler::Plm_profiler ()
+{
+    d_ptr = new Plm_profiler_private;
+}
+
+Plm_profiler::~Plm_profiler ()
+{
+    delete d_ptr;
+}
+
+Plm_profiler*
+Plm_profiler::get ()
+{
+    static Plm_profiler profiler;
+    return &profiler;
+}
+
+bool
+Plm_profiler::is_enabled () const
+{
+    return d_ptr->enabled;
+}
+
+void
+Plm_profiler::set_output_file (const std::string& fn)
+{
+    d_ptr->output_fn = fn;
+    d_ptr->enabled = (fn != "");
+}
+
+void
+Plm_profiler::enter (const char* name)
+{
+    Plm_profiler_thread *tp = d_ptr->get_thread ();
+    Plm_profiler_node *node = tp->current->get_child (name);
+    node->start_time = d_ptr->timer.report ();
+    tp->current = node;
+}
+
+void
+Plm_profiler::leave ()
+{
+    Plm_profiler_thread *tp = d_ptr->get_thread ();
+    Plm_profiler_node *node = tp->current;
+    if (node == &tp->root) {
+        /* Unbalanced leave, ignore */
+        return;
+    }
+    node->total_time += d_ptr->timer.report () - node->start_time;
+    node->calls ++;
+    tp->current = node->parent;
+}
+
+void
+Plm_profiler::dump ()
+{
+    if (!d_ptr->enabled) {
+        return;
+    }
+    if (extension_is (d_ptr->output_fn, ".json")) {
+        this->dump_json (d_ptr->output_fn);
+    } else {
+        this->dump_folded (d_ptr->output_fn);
+    }
+}
+
+static void
+json_write_node (FILE *fp, const Plm_profiler_node *node, int indent)
+{
+    fprintf (fp, "%*s{\"name\": \"%s\", \"calls\": %lu, "
+        "\"total_time\": %g, \"self_time\": %g",
+        indent, "", node->name, node->calls,
+        node->total_time, node->self_time());
+    if (node->children.size() > 0) {
+        fprintf (fp, ",\n%*s \"children\": [\n", indent, "");
+        for (size_t i = 0; i < node->children.size(); i++) {
+            json_write_node (fp, node->children[i], indent + 2);
+            fprintf (fp, "%s\n", i + 1 < node->children.size() ? "," : "");
+        }
+        fprintf (fp, "%*s ]", indent, "");
+    }
+    fprintf (fp, "}");
+}
+
+void
+Plm_profiler::dump_json (const std::string& fn)
+{
+    FILE *fp = plm_fopen (fn, "w");
+    if (!fp) {
+        logfile_printf ("Warning, couldn't open %s for write\n", fn.c_str());
+        return;
+    }
+    d_ptr->threads_lock.grab ();
+    fprintf (fp, "{\n  \"elapsed_time\": %g,\n  \"threads\": [\n",
+        d_ptr->timer.report ());
+    for (size_t t = 0; t < d_ptr->threads.size(); t++) {
+        const Plm_profiler_thread *tp = d_ptr->threads[t];
+        fprintf (fp, "    {\"thread\": %d, \"regions\": [\n", tp->index);
+        for (size_t i = 0; i < tp->root.children.size(); i++) {
+            json_write_node (fp, tp->root.children[i], 6);
+            fprintf (fp, "%s\n",
+                i + 1 < tp->root.children.size() ? "," : "");
+        }
+        fprintf (fp, "    ]}%s\n", t + 1 < d_ptr->threads.size() ? "," : "");
+    }
+    fprintf (fp, "  ]\n}\n");
+    d_ptr->threads_lock.release ();
+    fclose (fp);
+}
+
+/* Folded stack format, one line per call path, e.g.
+   "thread_0;bspline_score;Bspline_regularize::compute_score 1520"
+   where the count is the self time in microseconds. */
+static void
+folded_write_node (FILE *fp, const Plm_profiler_node *node,
+    const std::string& prefix)
+{
+    std::string path = prefix + ";" + node->name;
+    unsigned long usec = (unsigned long) (node->self_time() * 1e6 + 0.5);
+    if (usec > 0) {
+        fprintf (fp, "%s %lu\n", path.c_str(), usec);
+    }
+    for (size_t i = 0; i < node->children.size(); i++) {
+        folded_write_node (fp, node->children[i], path);
+    }
+}
+
+void
+Plm_profiler::dump_folded (const std::string& fn)
+{
+    FILE *fp = plm_fopen (fn, "w");
+    if (!fp) {
+        logfile_printf ("Warning, couldn't open %s for write\n", fn.c_str());
+        return;
+    }
+    d_ptr->threads_lock.grab ();
+    for (size_t t = 0; t < d_ptr->threads.size(); t++) {
+        const Plm_profiler_thread *tp = d_ptr->threads[t];
+        char prefix[32];
+        sprintf (prefix, "thread_%d", tp->index);
+        for (size_t i = 0; i < tp->root.children.size(); i++) {
+            folded_write_node (fp, tp->root.children[i], prefix);
+        }
+    }
+    d_ptr->threads_lock.release ();
+    fclose (fp);
+}
+
+Plm_profiler_scope::Plm_profiler_scope (const char* name)
+{
+    Plm_profiler *profiler = Plm_profiler::get ();
+    this->active = profiler->is_enabled ();
+    if (this->active) {
+        profiler->enter (name);
+    }
+}
+
+Plm_profiler_scope::~Plm_profiler_scope ()
+{
+    if (this->active) {
+        Plm_profiler::get()->leave ();
+    }
+}
@@ -0,0 +1,65 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+#ifndef _plm_profiler_h_
+#define _plm_profiler_h_
+
+#include "plmsys_config.h"
+#include <string>
+
+class Plm_profiler_private;
+
+/*! \brief
+ * The Plm_profiler class accumulates wall clock time spent in named,
+ * nested regions of code.  Each thread keeps its own call tree,
+ * so regions may be entered from within worker threads without locking.
+ * Profiling is off unless an output file is given, either by calling
+ * set_output_file() or by setting the PLM_PROFILE environment variable.
+ * A file name ending in ".json" receives a JSON call tree, any other
+ * name receives folded stacks suitable for flamegraph.pl.
+ */
+class PLMSYS_API Plm_profiler {
+public:
+    Plm_profiler ();
+    ~Plm_profiler ();
+public:
+    Plm_profiler_private *d_ptr;
+public:
+    /*! \brief Return the process-wide profiler */
+    static Plm_profiler* get ();
+
+    bool is_enabled () const;
+    void set_output_file (const std::string& fn);
+
+    /*! \brief Open a region named "name" below the current region of
+      the calling thread.  The name must outlive the profiler,
+      normally it is a string literal. */
+    void enter (const char* name);
+    /*! \brief Close the innermost open region of the calling thread */
+    void leave ();
+
+    /*! \brief Write the accumulated call trees to the output file.
+      This is a no-op when profiling is disabled. */
+    void dump ();
+    void dump_json (const std::string& fn);
+    void dump_folded (const std::string& fn);
+};
+
+/*! \brief
+ * The Plm_profiler_scope class opens a profiler region in its
+ * constructor and closes it in its destructor.
+ */
+class PLMSYS_API Plm_profiler_scope {
+public:
+    Plm_profiler_scope (const char* name);
+    ~Plm_profiler_scope ();
+private:
+    bool active;
+};
+
+#define PLM_PROFILE_CAT2(a,b) a##b
+#define PLM_PROFILE_CAT(a,b) PLM_PROFILE_CAT2(a,b)
+#define PLM_PROFILE_SCOPE(name) \
+    Plm_profiler_scope PLM_PROFILE_CAT(plm_profiler_scope_,__LINE__) (name)
+
+#endif
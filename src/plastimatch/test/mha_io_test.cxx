@@ -0,0 +1,189 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+/* Round trip an mha file through the slab writer, slab reader,
+   and mapped reader, and check that the voxels are unchanged. */
+#include "plm_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+#include "mha_io.h"
+#include "volume.h"
+#include "volume_header.h"
+
+/* Number of slices per slab, chosen so that the last slab is short */
+#define SLAB_SLICES 5
+
+/* Number of bytes of junk before the voxels in the detached data file */
+#define JUNK_BYTES 128
+
+static bool
+check_same (const char* test, const Volume* v1, const Volume* v2)
+{
+    if (!v1 || !v2) {
+        printf ("%s: could not read volume\n", test);
+        return false;
+    }
+    if (v1->pix_type != v2->pix_type || v1->npix != v2->npix) {
+        printf ("%s: volume type or size differs\n", test);
+        return false;
+    }
+    for (int d = 0; d < 3; d++) {
+        if (v1->dim[d] != v2->dim[d]
+            || v1->origin[d] != v2->origin[d]
+            || v1->spacing[d] != v2->spacing[d])
+        {
+            printf ("%s: volume geometry differs\n", test);
+            return false;
+        }
+    }
+    if (memcmp (v1->img, v2->img, v1->npix * v1->pix_size)) {
+        printf ("%s: voxels differ\n", test);
+        return false;
+    }
+    printf ("%s: ok\n", test);
+    return true;
+}
+
+/* Write with the slab writer, a few slices at a time */
+static bool
+write_slabs (const char* fn, const Volume* vol)
+{
+    Mha_slab_writer writer;
+    Volume_header vh;
+    vh.set (vol->dim, vol->origin, vol->spacing, vol->direction_cosines);
+    if (!writer.open (fn, vh, vol->pix_type)) {
+        return false;
+    }
+    plm_long slice_bytes = vol->dim[0] * vol->dim[1] * vol->pix_size;
+    for (plm_long k = 0; k < vol->dim[2]; k += SLAB_SLICES) {
+        plm_long slab_dim[3] = { vol->dim[0], vol->dim[1], SLAB_SLICES };
+        if (k + SLAB_SLICES > vol->dim[2]) {
+            slab_dim[2] = vol->dim[2] - k;
+        }
+        Volume slab (slab_dim, vol->origin, vol->spacing,
+            vol->direction_cosines, vol->pix_type, 1);
+        memcpy (slab.img, (char*) vol->img + k * slice_bytes,
+            slab_dim[2] * slice_bytes);
+        writer.write_slab (&slab);
+    }
+    return writer.close ();
+}
+
+/* Read with the slab reader, last slab first so that it seeks */
+static Volume::Pointer
+read_slabs (const char* fn)
+{
+    Mha_slab_reader reader;
+    if (!reader.open (fn)) {
+        return Volume::Pointer ();
+    }
+    Volume_header vh;
+    reader.get_volume_header (&vh);
+    Volume::Pointer vol (new Volume (vh, reader.get_pixel_type(), 1));
+    plm_long slice_bytes = vol->dim[0] * vol->dim[1] * vol->pix_size;
+    plm_long last = ((vol->dim[2] - 1) / SLAB_SLICES) * SLAB_SLICES;
+    for (plm_long k = last; k >= 0; k -= SLAB_SLICES) {
+        Volume::Pointer slab = reader.read_slab (k, SLAB_SLICES);
+        if (!slab) {
+            return Volume::Pointer ();
+        }
+        memcpy ((char*) vol->img + k * slice_bytes, slab->img,
+            slab->dim[2] * slice_bytes);
+    }
+    return vol;
+}
+
+/* Write an mhd header, and a raw file with the voxels at the end */
+static bool
+write_detached (const char* mhd_fn, const char* raw_fn, const Volume* vol)
+{
+    /* The data file name is relative to the header */
+    const char* raw_name = strrchr (raw_fn, '/');
+    raw_name = raw_name ? raw_name + 1 : raw_fn;
+
+    FILE *fp = fopen (raw_fn, "wb");
+    if (!fp) {
+        return false;
+    }
+    char junk[JUNK_BYTES];
+    memset (junk, 0xff, JUNK_BYTES);
+    fwrite (junk, 1, JUNK_BYTES, fp);
+    fwrite (vol->img, vol->pix_size, vol->npix, fp);
+    fclose (fp);
+
+    fp = fopen (mhd_fn, "w");
+    if (!fp) {
+        return false;
+    }
+    fprintf (fp,
+        "ObjectType = Image\n"
+        "NDims = 3\n"
+        "BinaryData = True\n"
+        "BinaryDataByteOrderMSB = False\n"
+        "Offset = %g %g %g\n"
+        "ElementSpacing = %g %g %g\n"
+        "DimSize = %d %d %d\n"
+        "%s"
+        "ElementType = %s\n"
+        "HeaderSize = -1\n"
+        "ElementDataFile = %s\n",
+        vol->origin[0], vol->origin[1], vol->origin[2],
+        vol->spacing[0], vol->spacing[1], vol->spacing[2],
+        (int) vol->dim[0], (int) vol->dim[1], (int) vol->dim[2],
+        vol->pix_type == PT_VF_FLOAT_INTERLEAVED
+        ? "ElementNumberOfChannels = 3\n" : "",
+        vol->pix_type == PT_SHORT ? "MET_SHORT"
+        : vol->pix_type == PT_UCHAR ? "MET_UCHAR" : "MET_FLOAT",
+        raw_name);
+    fclose (fp);
+    return true;
+}
+
+int
+main (int argc, char* argv[])
+{
+    if (argc != 3) {
+        printf ("Usage: mha_io_test infile outprefix\n");
+        exit (1);
+    }
+    std::string prefix = argv[2];
+    std::string slab_fn = prefix + "-slab.mha";
+    std::string mhd_fn = prefix + "-detached.mhd";
+    std::string raw_fn = prefix + "-detached.raw";
+
+    Volume::Pointer vol (read_mha (argv[1]));
+    if (!vol) {
+        printf ("Error, could not read %s\n", argv[1]);
+        exit (1);
+    }
+
+    bool ok = true;
+    if (!write_slabs (slab_fn.c_str(), vol.get())) {
+        printf ("Error, could not write %s\n", slab_fn.c_str());
+        exit (1);
+    }
+    Volume::Pointer v_read (read_mha (slab_fn.c_str()));
+    ok &= check_same ("slab writer", vol.get(), v_read.get());
+    Volume::Pointer v_mapped = read_mha_mapped (slab_fn.c_str());
+    ok &= check_same ("mapped reader", v_read.get(), v_mapped.get());
+    Volume::Pointer v_slabs = read_slabs (slab_fn.c_str());
+    ok &= check_same ("slab reader", v_read.get(), v_slabs.get());
+
+    if (!write_detached (mhd_fn.c_str(), raw_fn.c_str(), vol.get())) {
+        printf ("Error, could not write %s\n", mhd_fn.c_str());
+        exit (1);
+    }
+    Volume::Pointer v_detached (read_mha (mhd_fn.c_str()));
+    ok &= check_same ("detached reader", vol.get(), v_detached.get());
+    v_mapped = read_mha_mapped (mhd_fn.c_str());
+    ok &= check_same ("detached mapped reader", vol.get(), v_mapped.get());
+
+    if (!ok) {
+        exit (1);
+    }
+    printf ("All tests passed\n");
+    return 0;
+}
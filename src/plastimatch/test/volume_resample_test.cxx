@@ -0,0 +1,147 @@
+/* -----------------------------------------------------------------------
+   See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
+   ----------------------------------------------------------------------- */
+/* Resample a rotated volume onto an axis aligned geometry, and 
+   compare against values computed voxel by voxel.  The output rows 
+   are longer than one resampling block, and not a multiple of it. */
+#include "plm_config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "volume.h"
+#include "volume_header.h"
+#include "volume_resample.h"
+
+/* Linear test function, which linear interpolation reproduces exactly */
+static float
+test_fn (const float xyz[3])
+{
+    return 1.f + 0.5f * xyz[0] - 0.25f * xyz[1] + 0.125f * xyz[2];
+}
+
+static void
+voxel_position (float xyz[3], const float origin[3], const float step[9],
+    plm_long i, plm_long j, plm_long k)
+{
+    for (int r = 0; r < 3; r++) {
+        xyz[r] = origin[r] + step[3*r+0] * i + step[3*r+1] * j
+            + step[3*r+2] * k;
+    }
+}
+
+int
+main (int argc, char* argv[])
+{
+    /* The input is rotated 90 degrees about z, so that its second 
+       axis runs along -x.  Columns of the direction cosines are the
+       directions of the volume axes. */
+    plm_long dim_in[3] = { 5, 90, 4 };
+    float origin_in[3] = { 10.f, -4.f, 3.f };
+    float spacing_in[3] = { 2.f, 1.5f, 3.f };
+    float dc_in[9] = {
+        0.f, -1.f, 0.f,
+        1.f,  0.f, 0.f,
+        0.f,  0.f, 1.f
+    };
+    Volume::Pointer vol_in = Volume::New (dim_in, origin_in, spacing_in,
+        dc_in, PT_FLOAT, 1);
+    float *img_in = (float*) vol_in->img;
+    for (plm_long k = 0; k < dim_in[2]; k++) {
+        for (plm_long j = 0; j < dim_in[1]; j++) {
+            for (plm_long i = 0; i < dim_in[0]; i++) {
+                float xyz[3];
+                voxel_position (xyz, vol_in->origin, vol_in->step, i, j, k);
+                img_in[vol_in->index (i, j, k)] = test_fn (xyz);
+            }
+        }
+    }
+
+    /* The output is axis aligned, and extends past the input on 
+       every side.  Its rows of 70 voxels span two blocks. */
+    plm_long dim_out[3] = { 70, 13, 7 };
+    float origin_out[3] = { -130.f, -6.f, 1.f };
+    float spacing_out[3] = { 2.1f, 1.f, 2.f };
+    float dc_out[9] = {
+        1.f, 0.f, 0.f,
+        0.f, 1.f, 0.f,
+        0.f, 0.f, 1.f
+    };
+    Volume_header vh;
+    vh.set (dim_out, origin_out, spacing_out, dc_out);
+
+    Volume::Pointer vol_li = volume_resample (vol_in, &vh);
+    Volume::Pointer vol_nn = volume_resample_nn (vol_in, &vh);
+    const float *img_li = (const float*) vol_li->img;
+    const float *img_nn = (const float*) vol_nn->img;
+
+    int num_inside = 0, num_errors = 0;
+    for (plm_long k = 0; k < dim_out[2]; k++) {
+        for (plm_long j = 0; j < dim_out[1]; j++) {
+            for (plm_long i = 0; i < dim_out[0]; i++) {
+                float xyz[3];
+                voxel_position (xyz, vol_li->origin, vol_li->step, i, j, k);
+                plm_long v = vol_li->index (i, j, k);
+
+                /* Input voxel coordinates, found by projecting onto
+                   each input axis */
+                float ijk[3];
+                for (int c = 0; c < 3; c++) {
+                    ijk[c] = 0.f;
+                    for (int r = 0; r < 3; r++) {
+                        ijk[c] += dc_in[3*r+c] * (xyz[r] - origin_in[r]);
+                    }
+                    ijk[c] /= spacing_in[c];
+                }
+                bool inside = true;
+                for (int c = 0; c < 3; c++) {
+                    if (ijk[c] <= -0.5f || ijk[c] >= dim_in[c] - 0.5f) {
+                        inside = false;
+                    }
+                }
+
+                float exp_li = 0.f, exp_nn = 0.f;
+                if (inside) {
+                    num_inside++;
+                    /* Linear interpolation is exact, except where it
+                       is clamped at the edge of the input */
+                    float cxyz[3];
+                    float cijk[3];
+                    for (int c = 0; c < 3; c++) {
+                        cijk[c] = ijk[c];
+                        if (cijk[c] < 0.f) cijk[c] = 0.f;
+                        if (cijk[c] > dim_in[c] - 1) cijk[c] = dim_in[c] - 1;
+                    }
+                    for (int r = 0; r < 3; r++) {
+                        cxyz[r] = origin_in[r];
+                        for (int c = 0; c < 3; c++) {
+                            cxyz[r] += vol_in->step[3*r+c] * cijk[c];
+                        }
+                    }
+                    exp_li = test_fn (cxyz);
+                    exp_nn = img_in[vol_in->index (
+                            (plm_long) floorf (ijk[0] + 0.5f),
+                            (plm_long) floorf (ijk[1] + 0.5f),
+                            (plm_long) floorf (ijk[2] + 0.5f))];
+                }
+                if (fabs (img_li[v] - exp_li) > 1e-3
+                    || fabs (img_nn[v] - exp_nn) > 1e-3)
+                {
+                    printf ("Mismatch at (%d,%d,%d): "
+                        "linear %g (expected %g), nn %g (expected %g)\n",
+                        (int) i, (int) j, (int) k, img_li[v], exp_li,
+                        img_nn[v], exp_nn);
+                    num_errors++;
+                }
+            }
+        }
+    }
+
+    printf ("Inside voxels: %d of %d\n", num_inside,
+        (int) (dim_out[0] * dim_out[1] * dim_out[2]));
+    printf ("Errors: %d\n", num_errors);
+    if (num_inside == 0 || num_errors > 0) {
+        exit (1);
+    }
+    return 0;
+}
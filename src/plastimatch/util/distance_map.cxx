@@ -2,11 +2,17 @@
    See COPYRIGHT.TXT and LICENSE.TXT for copyright and license information
    ----------------------------------------------------------------------- */
 #include "plm_config.h"
+#include <algorithm>
+#include <float.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
+#include <vector>
 #include "itkImage.h"
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 
 #include "image_boundary.h"
 #include "distance_map.h"
@@ -33,6 +39,7 @@ public:
     FloatImageType::Pointer output;
 public:
     void run_native_danielsson ();
+    void run_native_edt ();
     void run_itk_signed_danielsson ();
     void run_itk_signed_maurer ();
     void run_itk_signed_native ();
@@ -340,6 +347,177 @@ Distance_map_private::run_native_danielsson ()
     this->output = dmap->itk_float ();
 }
 
+/* Lower envelope of parabolas, after Felzenszwalb and Huttenlocher, 
+   "Distance Transforms of Sampled Functions".  The input f holds 
+   the squared distance at each sample of a line, the output g 
+   is the minimum over q of f[q] + (sp*(i-q))^2.  Samples at or 
+   above cutoff can never produce a value below cutoff, so they are 
+   left out of the envelope, and output values are limited to cutoff.
+   Scratch arrays v and z must hold n and n+1 entries. */
+static void
+edt_line (
+    const float *f,
+    float *g,
+    plm_long n,
+    float sp,
+    float cutoff,
+    plm_long *v,
+    double *z)
+{
+    double sp2 = (double) sp * sp;
+    plm_long k = -1;
+    for (plm_long q = 0; q < n; q++) {
+        if (f[q] >= cutoff) {
+            continue;
+        }
+        if (k < 0) {
+            k = 0;
+            v[0] = q;
+            z[0] = -DBL_MAX;
+            z[1] = DBL_MAX;
+            continue;
+        }
+        double fq = f[q] + sp2 * q * q;
+        double s;
+        while (1) {
+            plm_long p = v[k];
+            s = (fq - (f[p] + sp2 * p * p)) / (2 * sp2 * (q - p));
+            if (s > z[k]) {
+                break;
+            }
+            k--;
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k+1] = DBL_MAX;
+    }
+
+    /* No sample within cutoff */
+    if (k < 0) {
+        for (plm_long q = 0; q < n; q++) {
+            g[q] = cutoff;
+        }
+        return;
+    }
+
+    k = 0;
+    for (plm_long q = 0; q < n; q++) {
+        while (z[k+1] < q) {
+            k++;
+        }
+        double d = (double) (q - v[k]);
+        double val = f[v[k]] + sp2 * d * d;
+        g[q] = (val < cutoff) ? (float) val : cutoff;
+    }
+}
+
+void
+Distance_map_private::run_native_edt ()
+{
+    /* Compute boundary of image
+       vb = volume of boundary, imgb = img of boundary */
+    Plm_image pib (do_image_boundary (this->input));
+    Volume::Pointer vb = pib.get_volume_uchar();
+    unsigned char *imgb = (unsigned char*) vb->img;
+
+    /* Convert image to native volume 
+       vs = volume of set, imgs = img of set */
+    Plm_image pi (this->input);
+    Volume::Pointer vs = pi.get_volume_uchar();
+    unsigned char *imgs = (unsigned char*) vs->img;
+
+    /* All intermediate values are squared distances, which are 
+       limited to the square of the maximum distance.  This does not 
+       change any value below the limit, but allows lines which are 
+       far from the boundary to be skipped. */
+    float cutoff = FLT_MAX;
+    if (this->maximum_distance < sqrtf (FLT_MAX)) {
+        cutoff = this->maximum_distance * this->maximum_distance;
+    }
+
+    /* Fill in output image, initially with squared distance 
+       zero on the boundary and cutoff elsewhere */
+    Plm_image::Pointer dmap = Plm_image::New (
+        new Plm_image (
+            new Volume (Volume_header (vb), PT_FLOAT, 1)));
+    Volume::Pointer dmap_vol = dmap->get_volume_float ();
+    float *dm = (float*) dmap_vol->img;
+    for (plm_long v = 0; v < vb->npix; v++) {
+        dm[v] = imgb[v] ? 0.f : cutoff;
+    }
+
+    /* One pass per axis.  Each pass updates independent lines 
+       of voxels, which are distributed among threads. */
+    plm_long max_dim = std::max (vb->dim[0], 
+        std::max (vb->dim[1], vb->dim[2]));
+    for (int d = 0; d < 3; d++) {
+        plm_long n = vb->dim[d];
+        plm_long num_lines = vb->npix / n;
+        plm_long stride = 1;
+        if (d == 1) stride = vb->dim[0];
+        if (d == 2) stride = vb->dim[0] * vb->dim[1];
+        float sp = fabs (vb->spacing[d]);
+
+#pragma omp parallel
+        {
+            std::vector<float> f (max_dim);
+            std::vector<float> g (max_dim);
+            std::vector<plm_long> vtx (max_dim);
+            std::vector<double> z (max_dim + 1);
+#pragma omp for schedule (static)
+            for (plm_long l = 0; l < num_lines; l++) {
+                plm_long base;
+                if (d == 0) {
+                    base = l * n;
+                } else if (d == 1) {
+                    base = (l / vb->dim[0]) * vb->dim[0] * vb->dim[1]
+                        + l % vb->dim[0];
+                } else {
+                    base = l;
+                }
+                bool empty = true;
+                for (plm_long q = 0; q < n; q++) {
+                    f[q] = dm[base + q * stride];
+                    if (f[q] < cutoff) {
+                        empty = false;
+                    }
+                }
+                if (empty) {
+                    continue;
+                }
+                edt_line (&f[0], &g[0], n, sp, cutoff, &vtx[0], &z[0]);
+                for (plm_long q = 0; q < n; q++) {
+                    dm[base + q * stride] = g[q];
+                }
+            }
+        }
+    }
+
+    /* Convert to distance, truncate, and apply sign */
+    float max_dist = this->use_squared_distance ? cutoff 
+        : this->maximum_distance;
+#pragma omp parallel for
+    for (plm_long v = 0; v < vb->npix; v++) {
+        float val = dm[v];
+        if (!this->use_squared_distance) {
+            val = sqrtf (val);
+        }
+        if (val >= max_dist) {
+            val = max_dist;
+        }
+        if ((this->inside_is_positive && !imgs[v])
+            || (!this->inside_is_positive && imgs[v]))
+        {
+            val = -val;
+        }
+        dm[v] = val;
+    }
+
+    /* Fixate distance map into private class */
+    this->output = dmap->itk_float ();
+}
+
 void
 Distance_map_private::run_itk_signed_danielsson ()
 {
@@ -365,6 +543,9 @@ Distance_map_private::run ()
     case Distance_map::DANIELSSON:
         this->run_native_danielsson ();
         break;
+    case Distance_map::EDT:
+        this->run_native_edt ();
+        break;
     case Distance_map::ITK_DANIELSSON:
         this->run_itk_signed_danielsson ();
         break;
@@ -434,6 +615,11 @@ Distance_map::set_algorithm (const std::string& algorithm)
     if (algorithm == "danielsson" || algorithm == "native_danielsson") {
         d_ptr->algorithm = Distance_map::DANIELSSON;
     }
+    else if (algorithm == "edt" || algorithm == "native_edt"
+        || algorithm == "native-edt")
+    {
+        d_ptr->algorithm = Distance_map::EDT;
+    }
     else if (algorithm == "itk-danielsson") {
         d_ptr->algorithm = Distance_map::ITK_DANIELSSON;
     }
@@ -22,6 +22,7 @@ public:
     /*! \brief Different distance map algorithms. */
     enum Algorithm {
         DANIELSSON,
+        EDT,
         ITK_DANIELSSON,
         ITK_MAURER,
     };
@@ -43,9 +44,12 @@ public:
     /*! \brief Choose whether the inside is positive or negative.  
       The default is inside negative */
     void set_inside_is_positive (bool inside_is_positive);
-    /*! \brief Choose which algorithm to use */
+    /*! \brief Choose which algorithm to use.  The default is 
+      "danielsson".  The "edt" algorithm is an exact separable 
+      Euclidean distance transform. */
     void set_algorithm (const std::string& algorithm);
-    /*! \brief Set maximum distance */
+    /*! \brief Set maximum distance.  Distances are truncated to this 
+      value.  Not supported by the ITK algorithms. */
     void set_maximum_distance (float max_distance);
     ///@}
 
@@ -3,6 +3,7 @@
    ----------------------------------------------------------------------- */
 #include "plmutil_config.h"
 #include <time.h>
+#include <vector>
 #include "itkSubtractImageFilter.h"
 #include "itkImageRegionIterator.h"
 
@@ -13,6 +14,7 @@
 #include "make_string.h"
 #include "plm_image.h"
 #include "plm_image_header.h"
+#include "plm_int.h"
 #include "print_and_exit.h"
 #include "rt_study.h"
 #include "rtss_roi.h"
@@ -68,6 +70,96 @@ Dvh::set_dvh_parameters (enum Dvh_normalization normalization,
     d_ptr->bin_width = bin_width;
 }
 
+/* Index of the lowest set bit of a non-zero word */
+static inline int
+dvh_lowest_bit (uint64_t word)
+{
+#if defined (__GNUC__)
+    return __builtin_ctzll (word);
+#else
+    int b = 0;
+    while (!(word & 1)) {
+        word >>= 1;
+        b++;
+    }
+    return b;
+#endif
+}
+
+/* Load up to eight bytes of a voxel's structure bits into a word,
+   with bit n of the word being structure bit n */
+static inline uint64_t
+dvh_load_word (const unsigned char *s, int num_bytes)
+{
+    uint64_t word = 0;
+    if (num_bytes > 8) {
+        num_bytes = 8;
+    }
+    for (int i = 0; i < num_bytes; i++) {
+        word |= ((uint64_t) s[i]) << (8 * i);
+    }
+    return word;
+}
+
+/* Find the bounding box of voxels which belong to any structure.
+   Returns false if the structure image is empty. */
+static bool
+dvh_structure_bounding_box (
+    const unsigned char *ss_buf,
+    int vec_len,
+    const plm_long dim[3],
+    plm_long bb_min[3],
+    plm_long bb_max[3])
+{
+    plm_long k_min = dim[2], k_max = -1;
+    plm_long j_min = dim[1], j_max = -1;
+    plm_long i_min = dim[0], i_max = -1;
+
+#pragma omp parallel
+    {
+        plm_long t_min[3] = { dim[0], dim[1], dim[2] };
+        plm_long t_max[3] = { -1, -1, -1 };
+
+#pragma omp for schedule(static)
+        for (plm_long k = 0; k < dim[2]; k++) {
+            for (plm_long j = 0; j < dim[1]; j++) {
+                const unsigned char *s 
+                    = &ss_buf[((k * dim[1] + j) * dim[0]) * vec_len];
+                for (plm_long i = 0; i < dim[0]; i++, s += vec_len) {
+                    bool any = false;
+                    for (int w = 0; w < vec_len; w++) {
+                        if (s[w]) {
+                            any = true;
+                            break;
+                        }
+                    }
+                    if (!any) {
+                        continue;
+                    }
+                    plm_long ijk[3] = { i, j, k };
+                    for (int d = 0; d < 3; d++) {
+                        if (ijk[d] < t_min[d]) t_min[d] = ijk[d];
+                        if (ijk[d] > t_max[d]) t_max[d] = ijk[d];
+                    }
+                }
+            }
+        }
+
+#pragma omp critical
+        {
+            if (t_min[0] < i_min) i_min = t_min[0];
+            if (t_min[1] < j_min) j_min = t_min[1];
+            if (t_min[2] < k_min) k_min = t_min[2];
+            if (t_max[0] > i_max) i_max = t_max[0];
+            if (t_max[1] > j_max) j_max = t_max[1];
+            if (t_max[2] > k_max) k_max = t_max[2];
+        }
+    }
+    bb_min[0] = i_min; bb_min[1] = j_min; bb_min[2] = k_min;
+    bb_max[0] = i_max; bb_max[1] = j_max; bb_max[2] = k_max;
+    return k_max >= 0;
+}
+
 void
 Dvh::run ()
 {
@@ -94,35 +186,77 @@ Dvh::run ()
                 "255 255 0", i+1, i);
         }
     }
+    const size_t num_structures = ss_list->num_structures;
+    const int num_bins = d_ptr->num_bins;
 
     /* Create histogram */
     std::cout << "Creating Histogram..." << std::endl;
     printf ("Your Histogram will have %d bins and will be %f Gy large\n",
         d_ptr->num_bins, d_ptr->bin_width);
-    hist = (int*) malloc (sizeof(int) * ss_list->num_structures 
-        * d_ptr->num_bins);
-    memset (hist, 0, sizeof(int) * ss_list->num_structures 
-        * d_ptr->num_bins);
-    struct_vox = (int*) malloc (sizeof(int) * ss_list->num_structures);
-    memset (struct_vox, 0, sizeof(int) * ss_list->num_structures);
-   
-    /* Is voxel size the same? */
+    hist = (int*) malloc (sizeof(int) * num_structures * num_bins);
+    memset (hist, 0, sizeof(int) * num_structures * num_bins);
+    struct_vox = (int*) malloc (sizeof(int) * num_structures);
+    memset (struct_vox, 0, sizeof(int) * num_structures);
+
+    /* For each bit of the ss image, list the structures which use it */
+    const int vec_len = ss_img->GetVectorLength();
+    std::vector< std::vector<int> > bit_structures (vec_len * 8);
+    for (size_t sno = 0; sno < num_structures; sno++) {
+        int curr_bit = ss_list->slist[sno]->bit;
+        if (curr_bit < 0) {
+            continue;
+        }
+        if (curr_bit >= vec_len * 8) {
+            print_and_exit (
+                "Error: bit %d was requested from image of %d bits\n", 
+                curr_bit, vec_len * 8);
+        }
+        bit_structures[curr_bit].push_back ((int) sno);
+    }
+
+    /* Only voxels within the bounding box of the structures 
+       contribute to the histogram */
+    for (int d = 0; d < 3; d++) {
+        ss_dim[d] = ss_img->GetLargestPossibleRegion().GetSize()[d];
+        ss_ori[d] = ss_img->GetOrigin()[d];
+        ss_spacing[d] = ss_img->GetSpacing()[d];
+        dose_spacing[d] = dose_img->GetSpacing()[d];
+    }
+    const unsigned char *ss_buf = ss_img->GetBufferPointer ();
+    plm_long bb_min[3], bb_max[3];
+    bool have_bbox = dvh_structure_bounding_box (
+        ss_buf, vec_len, ss_dim, bb_min, bb_max);
+    if (have_bbox) {
+        printf ("Structure bounding box: (%d %d %d) to (%d %d %d)\n",
+            (int) bb_min[0], (int) bb_min[1], (int) bb_min[2], 
+            (int) bb_max[0], (int) bb_max[1], (int) bb_max[2]);
+    }
+
+    /* Is dose geometry the same? */
     std::cout << "checking voxel size..." << std::endl;
-    dose_spacing[0]=dose_img->GetSpacing()[0];
-    dose_spacing[1]=dose_img->GetSpacing()[1];
-    dose_spacing[2]=dose_img->GetSpacing()[2];
     std::cout << dose_spacing[0] << " " 
         << dose_spacing[1] << " " << dose_spacing[2] << "\n";
-    ss_spacing[0]=ss_img->GetSpacing()[0];
-    ss_spacing[1]=ss_img->GetSpacing()[1];
-    ss_spacing[2]=ss_img->GetSpacing()[2];
     std::cout << ss_spacing[0] << " " 
         << ss_spacing[1] << " " << ss_spacing[2] << "\n";
+    bool same_geometry = true;
+    for (int d = 0; d < 3; d++) {
+        if (dose_spacing[d] != ss_spacing[d]
+            || dose_img->GetOrigin()[d] != ss_ori[d]
+            || (plm_long) dose_img->GetLargestPossibleRegion().GetSize()[d]
+            != ss_dim[d])
+        {
+            same_geometry = false;
+        }
+    }
 
-    if (dose_spacing[0] != ss_spacing[0] 
-        || dose_spacing[1] != ss_spacing[1] 
-        || dose_spacing[2] != ss_spacing[2])
-    {
+    /* The dose is looked up at ss voxel (i,j,k) as 
+       dose_buf[(k-dose_off[2])*..., (j-dose_off[1])*..., i-dose_off[0]] */
+    plm_long dose_off[3] = { 0, 0, 0 };
+    plm_long dose_dim[3] = { ss_dim[0], ss_dim[1], ss_dim[2] };
+    if (!have_bbox) {
+        std::cout << "Structure image is empty.\n";
+    }
+    else if (!same_geometry) {
         std::cout << "dose voxel " 
             << dose_spacing[0] << " " 
             << dose_spacing[1] << " " 
@@ -133,16 +267,16 @@ Dvh::run ()
             << ss_spacing[2] << std::endl;
         std::cout << "Resampling" << std::endl;
 
-        /*resample volume*/
-        ss_ori[0]=ss_img->GetOrigin()[0];
-        ss_ori[1]=ss_img->GetOrigin()[1];
-        ss_ori[2]=ss_img->GetOrigin()[2];
-        ss_dim[0]=ss_img->GetLargestPossibleRegion().GetSize()[0];
-        ss_dim[1]=ss_img->GetLargestPossibleRegion().GetSize()[1];
-        ss_dim[2]=ss_img->GetLargestPossibleRegion().GetSize()[2];
+        /* Resample dose onto the ss geometry, within bounding box */
+        float bb_ori[3];
+        for (int d = 0; d < 3; d++) {
+            dose_off[d] = bb_min[d];
+            dose_dim[d] = bb_max[d] - bb_min[d] + 1;
+            bb_ori[d] = ss_ori[d] + bb_min[d] * ss_spacing[d];
+        }
 
         /* GCS FIX: Direction cosines */
-        Plm_image_header pih (ss_dim, ss_ori, ss_spacing, 0);
+        Plm_image_header pih (dose_dim, bb_ori, ss_spacing, 0);
         FloatImageType::Pointer resampled 
             = resample_image (dose_img, &pih, 0, 1);
         dose_img=resampled;
@@ -151,55 +285,72 @@ Dvh::run ()
         std::cout 
             << "Dose and ss-img have the same size. Resample not necessary.\n";
     }
+    const float *dose_buf = dose_img->GetBufferPointer ();
 
-    /* Declare iterators */
-    typedef itk::ImageRegionConstIterator < FloatImageType > 
-        FloatIteratorType;
-    FloatIteratorType it_d (dose_img, dose_img->GetRequestedRegion ());
-    typedef itk::ImageRegionConstIterator < UCharVecImageType > 
-        UCharVecIteratorType;
-    UCharVecIteratorType it_s (ss_img, ss_img->GetRequestedRegion ());
-
-    /* Loop through dose & ss images */
-    for (it_d.GoToBegin(), it_s.GoToBegin(); 
-         !it_d.IsAtEnd(); 
-         ++it_d, ++it_s)
+    /* Loop through dose & ss images.  Each thread accumulates into
+       its own histogram, which are summed at the end. */
+    const float bin_width = d_ptr->bin_width;
+    const bool dose_in_cgy = (d_ptr->dose_units == DVH_UNITS_CGY);
+#pragma omp parallel if (have_bbox)
     {
-        float d = it_d.Get();
-	itk::VariableLengthVector<unsigned char> s = it_s.Get();
+        std::vector<int> t_hist (num_structures * num_bins, 0);
+        std::vector<int> t_struct_vox (num_structures, 0);
 
-        /* Convert from cGy to Gy */
-        if (d_ptr->dose_units == DVH_UNITS_CGY) {
-            d = d / 100;
-        }
+#pragma omp for schedule(static)
+        for (plm_long k = bb_min[2]; k <= bb_max[2]; k++) {
+            for (plm_long j = bb_min[1]; j <= bb_max[1]; j++) {
+                plm_long ss_idx = (k * ss_dim[1] + j) * ss_dim[0];
+                plm_long dose_idx = ((k - dose_off[2]) * dose_dim[1] 
+                    + (j - dose_off[1])) * dose_dim[0] - dose_off[0];
+                for (plm_long i = bb_min[0]; i <= bb_max[0]; i++) {
+                    const unsigned char *s = &ss_buf[(ss_idx + i) * vec_len];
+                    int tbin = -1;
+                    for (int w = 0; w < vec_len; w += 8) {
+                        uint64_t word = dvh_load_word (s + w, vec_len - w);
+                        while (word) {
+                            int curr_bit = 8 * w + dvh_lowest_bit (word);
+                            word &= word - 1;
+                            const std::vector<int>& sl 
+                                = bit_structures[curr_bit];
+                            if (sl.empty()) {
+                                continue;
+                            }
 
-        /* Compute the bin */
-        bin = (int) floor ((d+(0.5*d_ptr->bin_width)) / d_ptr->bin_width);
-        if (bin < 0) {
-            bin = 0;
-        } else if (bin > (d_ptr->num_bins-1)) {
-            bin = d_ptr->num_bins - 1;
-        }
+                            /* Compute the bin, once per voxel */
+                            if (tbin < 0) {
+                                float d = dose_buf[dose_idx + i];
 
-        for (size_t sno = 0; sno < ss_list->num_structures; sno++) {
-            Rtss_roi *curr_structure = ss_list->slist[sno];
-                    
-            /* Is this pixel in the current structure? */
-            int curr_bit = curr_structure->bit;
-            unsigned int uchar_no = curr_bit / 8;
-            unsigned int bit_no = curr_bit % 8;
-            unsigned char bit_mask = 1 << bit_no;
-            if (uchar_no > ss_img->GetVectorLength()) {
-                print_and_exit (
-                    "Error: bit %d was requested from image of %d bits\n", 
-                    curr_bit, ss_img->GetVectorLength() * 8);
+                                /* Convert from cGy to Gy */
+                                if (dose_in_cgy) {
+                                    d = d / 100;
+                                }
+                                tbin = (int) floor ((d+(0.5*bin_width)) 
+                                    / bin_width);
+                                if (tbin < 0) {
+                                    tbin = 0;
+                                } else if (tbin > (num_bins-1)) {
+                                    tbin = num_bins - 1;
+                                }
+                            }
+
+                            /* Update histogram & structure size */
+                            for (size_t n = 0; n < sl.size(); n++) {
+                                t_struct_vox[sl[n]] ++;
+                                t_hist[tbin*num_structures + sl[n]] ++;
+                            }
+                        }
+                    }
+                }
             }
-            bool in_struct = s[uchar_no] & bit_mask;
+        }
 
-            /* If so, update histogram & structure size */
-            if (in_struct) {
-                struct_vox[sno] ++;
-                hist[bin*ss_list->num_structures + sno] ++;
+#pragma omp critical
+        {
+            for (size_t n = 0; n < t_hist.size(); n++) {
+                hist[n] += t_hist[n];
+            }
+            for (size_t sno = 0; sno < num_structures; sno++) {
+                struct_vox[sno] += t_struct_vox[sno];
             }
         }
     }
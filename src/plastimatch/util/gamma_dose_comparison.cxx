@@ -6,6 +6,11 @@
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <float.h>
+#include <vector>
+#if (OPENMP_FOUND)
+#include <omp.h>
+#endif
 #include "itkImageRegionIteratorWithIndex.h"
 #include "itkImageRegion.h"
 
@@ -16,7 +21,9 @@
 #include "plm_image.h"
 #include "plm_image_header.h"
 #include "plm_math.h"
+#include "print_and_exit.h"
 #include "string_util.h"
+#include "volume.h"
 
 //21 = 20 +1, to make a room for >2.0 histogram
 #define MAX_NUM_HISTOGRAM_BIN 21
@@ -447,383 +454,328 @@ Gamma_dose_comparison_private::find_reference_max_dose ()
     lprintf ("Gamma dose max is %f\n", this->dose_max);
 }
 
-void 
-Gamma_dose_comparison_private::do_gamma_analysis ()
-{ 
-    float spacing_in[3], origin_in[3];
-    plm_long dim_in[3];
-    Plm_image_header pih;
-    float gamma;
+/* Interp-search.  Look for the point on the line between compare 
+   voxel k2 and each of its neighbors k3 which is closest to the 
+   reference point r1 in gamma space. */
+static void
+gamma_interp_search (
+    float *gamma,
+    const float gamma_comp_r1[4],
+    const plm_long k2[3],
+    float level2,
+    float ref_dose_general,
+    const float f[3],
+    float f3,
+    const plm_long sub2_offset[3],
+    const plm_long dim[3],
+    const float *img_2)
+{
+    float gamma_comp_r2[4]; // r2 = current searching point
+    float gamma_comp_r3[4]; // r3: sub2-region moving point
+    float gamma_comp_rn[4]; // rn: normal_vector point (will give the smallest gamma value in gamma space)
+
+    gamma_comp_r2[0] = k2[0] * sqrt(f[0]);
+    gamma_comp_r2[1] = k2[1] * sqrt(f[1]);
+    gamma_comp_r2[2] = k2[2] * sqrt(f[2]);
+    gamma_comp_r2[3] = level2 / ref_dose_general * sqrt(f3);
+
+    //maximum 3x3x3 iterations
+    plm_long k3[3];
+    for (k3[2] = k2[2] - sub2_offset[2]; k3[2] <= k2[2] + sub2_offset[2]; k3[2]++) {
+        if (k3[2] < 0 || k3[2] >= dim[2]) continue;
+        for (k3[1] = k2[1] - sub2_offset[1]; k3[1] <= k2[1] + sub2_offset[1]; k3[1]++) {
+            if (k3[1] < 0 || k3[1] >= dim[1]) continue;
+            for (k3[0] = k2[0] - sub2_offset[0]; k3[0] <= k2[0] + sub2_offset[0]; k3[0]++) {
+                if (k3[0] < 0 || k3[0] >= dim[0]) continue;
+                float level3 = img_2[volume_index (dim, k3)]; //Dose in Gy
+
+                gamma_comp_r3[0] = k3[0] * sqrt(f[0]);
+                gamma_comp_r3[1] = k3[1] * sqrt(f[1]);
+                gamma_comp_r3[2] = k3[2] * sqrt(f[2]);
+                gamma_comp_r3[3] = level3 / ref_dose_general * sqrt(f3);
 
-    FloatImageType::Pointer itk_1 = img_in1->itk_float();
-    FloatImageType::Pointer itk_2 = img_in2->itk_float();
-    UCharImageType::Pointer mask_img;
-    if (img_mask) {
-        mask_img = img_mask->itk_uchar();
-    }
+                //in 4D space, find the normal vector and its crossection point on the line (r2-r3)
+                // vector equation for the line: rx = r2 + t(r3-r2)
+                //VECTOR PRODUCT[(rx - r1),(r2-r3)] = 0 
+                float sum_up = 0.0;
+                float sum_down = 0.0;
+                for (int i = 0; i < 4; i++)	{
+                    sum_up += (gamma_comp_r2[i] - gamma_comp_r3[i])*(gamma_comp_r2[i] - gamma_comp_r1[i]);
+                    sum_down += (gamma_comp_r2[i] - gamma_comp_r3[i])*(gamma_comp_r2[i] - gamma_comp_r3[i]);
+                }
+
+                float scalar_t = sum_up / sum_down;
+
+                //Only interpolation is allowed. exterapolation should not be used.
+                if (scalar_t > 0.0 && scalar_t < 1.0){
+                    for (int i = 0; i < 4; i++)	{
+                        gamma_comp_rn[i] = gamma_comp_r2[i] + scalar_t * (gamma_comp_r3[i] - gamma_comp_r2[i]);
+                    }
 
-    pih.set_from_itk_image (itk_1);
-    pih.get_dim (dim_in);
-    pih.get_origin (origin_in);
-    pih.get_spacing (spacing_in);
-
-    // Create ITK image for gamma output, "pass", "fail" and combined 
-    FloatImageType::SizeType sz;
-    FloatImageType::IndexType st;
-    FloatImageType::RegionType rg;
-    FloatImageType::PointType og;
-    FloatImageType::SpacingType sp;
-    FloatImageType::DirectionType dc;
-    for (int d1 = 0; d1 < 3; d1++) {
-        st[d1] = 0;
-        sz[d1] = dim_in[d1];
-        sp[d1] = spacing_in[d1];
-        og[d1] = origin_in[d1];
+                    float gg = (gamma_comp_r1[0] - gamma_comp_rn[0])*(gamma_comp_r1[0] - gamma_comp_rn[0]) +
+                        (gamma_comp_r1[1] - gamma_comp_rn[1])*(gamma_comp_r1[1] - gamma_comp_rn[1]) +
+                        (gamma_comp_r1[2] - gamma_comp_rn[2])*(gamma_comp_r1[2] - gamma_comp_rn[2]) +
+                        (gamma_comp_r1[3] - gamma_comp_rn[3])*(gamma_comp_r1[3] - gamma_comp_rn[3]);
+                    // in this subregion, only minimum value is take.
+                    if (gg < *gamma) *gamma = gg;
+                }
+            }
+        }
     }
-    rg.SetSize (sz);
-    rg.SetIndex (st);
-    dc = pih.GetDirection();
-
-    FloatImageType::Pointer gamma_img = FloatImageType::New();
-    UCharImageType::Pointer gamma_labelmap = UCharImageType::New();
-
-    gamma_img->SetRegions (rg);
-    gamma_img->SetOrigin (og);
-    gamma_img->SetSpacing (sp);
-    gamma_img->SetDirection (dc);
-    gamma_img->Allocate();
-
-    gamma_labelmap->SetRegions (rg);
-    gamma_labelmap->SetOrigin (og);
-    gamma_labelmap->SetSpacing (sp);
-    gamma_labelmap->SetDirection (dc);
-    gamma_labelmap->Allocate();
-
-    typedef itk::ImageRegionIteratorWithIndex< UCharImageType > UCharIteratorType;
-    typedef itk::ImageRegionIteratorWithIndex< FloatImageType > FloatIteratorType;
-    typedef itk::ImageRegion<3> FloatRegionType;
-    
-    FloatRegionType all_of_img1 = itk_1->GetLargestPossibleRegion();
-    FloatRegionType all_of_img2 = itk_2->GetLargestPossibleRegion();
-    FloatRegionType subset_of_img2, sub2set_of_img2;
+}
 
+/* One entry of the search neighborhood.  The entries are sorted by 
+   distance, so the search can stop at the first entry which is too 
+   far away to improve gamma. */
+class Gamma_search_offset {
+public:
+    plm_long d[3];
+    float dr2;        /* Squared spatial distance, scaled by dta */
+    float dr2_min;    /* Lower bound of squared distance reachable 
+                         by interp-search from this entry */
+    bool operator< (const Gamma_search_offset& other) const {
+        return dr2 < other.dr2;
+    }
+};
 
-    FloatIteratorType itk_1_iterator (itk_1, all_of_img1);
-    FloatIteratorType gamma_img_iterator (gamma_img, gamma_img->GetLargestPossibleRegion());
-    UCharIteratorType mask_img_iterator;
-    if (mask_img) {
-        mask_img_iterator = UCharIteratorType (mask_img, mask_img->GetLargestPossibleRegion());
+void 
+Gamma_dose_comparison_private::do_gamma_analysis ()
+{ 
+    Volume::Pointer vol_1 = img_in1->get_volume_float ();
+    Volume::Pointer vol_2 = img_in2->get_volume_float ();
+    Volume::Pointer vol_mask;
+    if (img_mask) {
+        vol_mask = img_mask->get_volume_uchar ();
     }
 
-    FloatImageType::IndexType k1, k2, k3; //k1: img1_pos (index), k2: img2_pos(moving, index), k3: img2_pos (moving, subregion2 for interp-search)
-    FloatImageType::IndexType sub1_start, sub2_start;
-    FloatImageType::OffsetType offset, sub2_offset;
-    FloatImageType::SizeType region_size, sub2_region_size;
-    FloatPoint3DType phys;
+    /* The compare image and mask have been resampled onto the 
+       reference image geometry */
+    const plm_long *dim_in = vol_1->dim;
+    for (int d = 0; d < 3; d++) {
+        if (vol_2->dim[d] != dim_in[d] 
+            || (vol_mask && vol_mask->dim[d] != dim_in[d]))
+        {
+            print_and_exit ("Error, gamma images have different geometry\n");
+        }
+    }
+    const float *img_1 = (const float*) vol_1->img;
+    const float *img_2 = (const float*) vol_2->img;
+    const unsigned char *img_mask_uc = vol_mask 
+        ? (const unsigned char*) vol_mask->img : 0;
 
-    //int reg_pixsize; 
-    float level1, level2, level3, dr2, dd2, gg;
-    float f0,f1,f2,f3;
-    float fixedlevel2;//corresponding position pixel value of level1 to apply threshold
-	
+    /* Create native volume for gamma output */
+    Volume::Pointer vol_gamma = Volume::New (vol_1->dim, vol_1->origin,
+        vol_1->spacing, vol_1->direction_cosines, PT_FLOAT, 1);
+    float *img_gamma = (float*) vol_gamma->img;
 
-    ////interpolated voxel position (float) for interp-search
-    //float sub2_interp_index[3];	
-    //float dose_diff1, dose_diff2, dose_diff3;
-    //float p_factor;//interpolation factor for interp-search
-	
     // vox-to-mm-to-gamma conversion factors
-    // strictly, these should come from IMAGE2, not 1
-    f0 = spacing_in[0]/this->dta_tolerance; f0=f0*f0;
-    f1 = spacing_in[1]/this->dta_tolerance; f1=f1*f1;
-    f2 = spacing_in[2]/this->dta_tolerance; f2=f2*f2;
-
-    // if this is 2D, f(dim) is forced to be 0 not to contribute to
-    // gamma value below:
-    if (dim_in[0] == 1)
-        f0 = 0.0;
-    if (dim_in[1] == 1)
-        f1 = 0.0;
-    if (dim_in[2] == 1)
-        f2 = 0.0;
+    float f[3], f3;
+    for (int d = 0; d < 3; d++) {
+        f[d] = vol_1->spacing[d] / this->dta_tolerance;
+        f[d] = f[d] * f[d];
+        // if this is 2D, f(dim) is forced to be 0 not to contribute to
+        // gamma value below:
+        if (dim_in[d] == 1) {
+            f[d] = 0.0;
+        }
+    }
 
     // dose_difference_tolerance: e.g.: 0.03
-    // hence, dose_tol [Gy]
-    // To add local-gamma feature, this should be modified
-    // float dose_tol = this->reference_dose * this->dose_difference_tolerance;
     f3 = 1. / this->dose_difference_tolerance;
     f3 = f3*f3;
-    
+
     // compute search region size
     float gmax_dist = this->dta_tolerance * this->gamma_max;
-    offset[0] = (int) ceil (gmax_dist /fabs(spacing_in[0]));
-    offset[1] = (int) ceil (gmax_dist /fabs(spacing_in[1]));
-    offset[2] = (int) ceil (gmax_dist /fabs(spacing_in[2]));	
-
-    // for interp-search
-    sub2_offset[0] = 1.0;
-    sub2_offset[1] = 1.0;
-    sub2_offset[2] = 1.0;
-
-    // for 2D image this might not be necessary if itk image can deal 
-    // with boundary condition
-    for (int i = 0; i < 3; i++)	{
-        if (dim_in[i] == 1)	{
-            offset[i] = 0.0;
-            sub2_offset[i] = 0.0;
+    plm_long offset[3], sub2_offset[3];
+    for (int d = 0; d < 3; d++) {
+        offset[d] = (plm_long) ceil (gmax_dist / fabs(vol_1->spacing[d]));
+        sub2_offset[d] = 1;
+        if (dim_in[d] == 1) {
+            offset[d] = 0;
+            sub2_offset[d] = 0;
+        }
+    }
+
+    /* Build the search stencil, sorted by distance.  Interp-search 
+       looks at points up to one voxel diagonal away from the stencil 
+       entry, so its lower bound is reduced by that much, plus 
+       a margin for rounding. */
+    float interp_reach = sqrt (f[0] * sub2_offset[0] 
+        + f[1] * sub2_offset[1] + f[2] * sub2_offset[2]) + 1e-3;
+    std::vector<Gamma_search_offset> stencil;
+    for (plm_long dk = -offset[2]; dk <= offset[2]; dk++) {
+        for (plm_long dj = -offset[1]; dj <= offset[1]; dj++) {
+            for (plm_long di = -offset[0]; di <= offset[0]; di++) {
+                Gamma_search_offset so;
+                so.d[0] = di;
+                so.d[1] = dj;
+                so.d[2] = dk;
+                so.dr2 = (di*di)*f[0] + (dj*dj)*f[1] + (dk*dk)*f[2];
+                float dr = sqrt (so.dr2) - interp_reach;
+                so.dr2_min = this->b_interp_search 
+                    ? (dr > 0.f ? dr * dr : 0.f) : so.dr2;
+                stencil.push_back (so);
+            }
         }
     }
+    std::stable_sort (stencil.begin(), stencil.end());
+    const int num_stencil = (int) stencil.size();
+
+    /* Squared gamma values at or above gamma_max_sq are clipped to 
+       gamma_max, so there is no need to search beyond it */
+    float gamma_max_sq = this->gamma_max * this->gamma_max;
+    while ((float) sqrt (gamma_max_sq) < this->gamma_max) {
+        gamma_max_sq = nextafterf (gamma_max_sq, FLT_MAX);
+    }
 
     //analysis_threshold in Gy
     float analysis_threshold_in_Gy = this->analysis_thresh * this->reference_dose;
     //default: if no option of analysis threshold is used: analysis_threshold = 0.0
     lprintf("analysis threshold = %3.2f Gy \n", analysis_threshold_in_Gy);
 
-    gamma_img_iterator.GoToBegin();
-    if (mask_img) {
-        mask_img_iterator.GoToBegin();
-    }
-	
     //This value is -1.0 in OmniproIMRT
-    float NoProcessGammaValue = 0.0f;
-
-    int idx_histo = 0;
-    int num_histo_bin = MAX_NUM_HISTOGRAM_BIN-1; //last slot is reserved for > max_gamma cases	
-    plm_long voxels_processed = 0;
-
-    voxels_in_image = pih.get_num_voxels ();
-    voxels_in_mask = 0;
-
-    //For interp-search option
-    //Convert all the components to scaled ones
-    //From now on, scaled gamma coordinate is used.
-    float gamma_comp_r1[4]; // 0,1,2,3 --> X, Y, Z, dose with scaling, r1 = ref point
-    float gamma_comp_r2[4]; // 0,1,2,3 --> X, Y, Z, dose with scaling r2 = current searching point
-    float gamma_comp_r3[4]; //r3: sub2-region moving point		
-    float gamma_comp_rn[4]; //rn: normal_vector point (will give the smallest gamma value in gamma space)
-
-    float ref_dose_general;//in local gamma option, this should be a local dose, not a reference dose.
-
-    float sum_up = 0.0;
-    float sum_down = 0.0;
-
-    int i = 0;
-
-    for (itk_1_iterator.GoToBegin(); 
-         !itk_1_iterator.IsAtEnd(); 
-         ++itk_1_iterator)
+    const float NoProcessGammaValue = 0.0f;
+    const int num_histo_bin = MAX_NUM_HISTOGRAM_BIN-1; //last slot is reserved for > max_gamma cases	
+
+    voxels_in_image = vol_1->npix;
+    plm_long num_in_mask = 0;
+    plm_long num_analysis = 0;
+    plm_long num_pass = 0;
+    const plm_long num_rows = dim_in[1] * dim_in[2];
+    plm_long rows_done = 0;
+
+    /* Each thread processes whole rows, and keeps its own statistics */
+#pragma omp parallel reduction(+:num_in_mask,num_analysis,num_pass)
     {
-        voxels_processed++;
-        // skip masked out voxels
-        // (mask may be interpolated so we use a value of 0.5 for threshold)
-        if (mask_img) {
-            unsigned char mask_value = mask_img_iterator.Get();
-            ++mask_img_iterator;
-            // if voxel not inside mask, gamma value is 0.0 (passed)
-            if (mask_value == 0) {
-                //YK: is 0.0 Safe? how about -1.0?
-                gamma_img_iterator.Set (NoProcessGammaValue);
-                ++gamma_img_iterator;
-                continue;
-            }
+        int histo[MAX_NUM_HISTOGRAM_BIN];
+        for (int h = 0; h < MAX_NUM_HISTOGRAM_BIN; h++) {
+            histo[h] = 0;
         }
-        voxels_in_mask ++;
-
-        //calculate gamma for this voxel of input image
-        level1 = itk_1_iterator.Get();
-
-        if (b_local_gamma)
-            ref_dose_general = level1;
-        else //global, default
-            ref_dose_general = this->reference_dose;	//by default, this is coming from ref dose (max dose if not defined)
-                       
-        k1 = itk_1_iterator.GetIndex();
-        itk_1->TransformIndexToPhysicalPoint(k1, phys);
-        itk_2->TransformPhysicalPointToIndex(phys, k2);
-
-        
-        if (b_ref_only_threshold) //don't care the corresponding pixel value
-            fixedlevel2 = -1.0;            
-        else
-            fixedlevel2 = itk_2->GetPixel(k2);//just for comparison to corresponding value
-            
-
-        //if this option is on, computation will be much faster because dose comparison will not be perforemd.
-        if (!this->b_compute_full_region){
-            if (this->have_analysis_thresh){
-                //if (level1 < analysis_threshold_in_Gy){
-                if (level1 < analysis_threshold_in_Gy && fixedlevel2 < analysis_threshold_in_Gy){
-                    gamma_img_iterator.Set (NoProcessGammaValue);//YK: is 0.0 Safe? how about -1.0?
-                    ++gamma_img_iterator;
-                    continue;//skip the rest of the loop. This point will not be counted in analysis
-                }			
-            }
-        }		
-
-        /*k1=itk_1_iterator.GetIndex();
-        itk_1->TransformIndexToPhysicalPoint( k1, phys );
-        itk_2->TransformPhysicalPointToIndex( phys, k2 );		*/
-
-        //k2 is the voxel index of the k1's physical (mm) position in img2
-    
-        // set subset_of_img2 to the following region:  
-        // k1[0]-region_size < k2[0] < k1[0]+region_size, same for y,z
-        // assume (approx) same pix spacing in img1 and img2
-        // crop the region by the entire image to be safe		
-        
-        sub1_start = k2 - offset;
-        subset_of_img2.SetIndex(sub1_start);
-        region_size[0] = 2 * offset[0] + 1;
-        region_size[1] = 2 * offset[1] + 1;
-        region_size[2] = 2 * offset[2] + 1; //seems to be fine even in 2D case
-
-        subset_of_img2.SetSize (region_size);
-        subset_of_img2.Crop (all_of_img2);
-
-        FloatIteratorType itk_2_iterator (itk_2, subset_of_img2);
-
-        // calculate gamma, take a minimum of ... over the subset_of_img2
-        gamma = 1e20;
-
-        for (itk_2_iterator.GoToBegin(); 
-             !itk_2_iterator.IsAtEnd(); 
-             ++itk_2_iterator)
-        {
-            //original method: w/o interp-search option
-
-            //k2: moving index from sub1_start
-            k2 = itk_2_iterator.GetIndex();
-            level2 = itk_2_iterator.Get();
-			
-            dr2 = (k2[0]-k1[0])*(k2[0]-k1[0])*f0 +
-                (k2[1]-k1[1])*(k2[1]-k1[1])*f1 +
-                (k2[2]-k1[2])*(k2[2]-k1[2])*f2 ;
-            //dd2: (dose diff./D)^2						
-            //dd2 = ((level1 - level2) / reference_dose) * ((level1 - level2) / reference_dose) * f3; // (if local gamma is on, {[(d1-d2)/d1]*100 (%) / tol_dose(%)}^2)            								
-            dd2 = ((level1 - level2) / ref_dose_general) * ((level1 - level2) / ref_dose_general) * f3; // (if local gamma is on, {[(d1-d2)/d1]*100 (%) / tol_dose(%)}^2)            								
-
-            gg = dr2 + dd2;
-            // in this subregion, only minimum value is take.
-            if (gg < gamma) gamma=gg;			
-
-            if (!this->b_interp_search)
-                continue;
-
-            ///////////////////interp-search begin////////////////
-            //if some option is on (e.g. interp-search)
-            sub2_start = k2 - sub2_offset;
-
-            //for 3x3x3 region of interp-search (in 3D)
-            sub2_region_size[0] = 2 * sub2_offset[0] + 1;
-            sub2_region_size[1] = 2 * sub2_offset[1] + 1;
-            sub2_region_size[2] = 2 * sub2_offset[2] + 1;
-
-            sub2set_of_img2.SetIndex(sub2_start);
-            sub2set_of_img2.SetSize(sub2_region_size);
-            sub2set_of_img2.Crop(all_of_img2);
-
-            FloatIteratorType sub2_iterator(itk_2, sub2set_of_img2);
-
-            //scaling to go to the gamma calculation space. all components (x,y,z,d) are now in sampe weighting / space
-            gamma_comp_r1[0] = k1[0] * sqrt(f0);
-            gamma_comp_r1[1] = k1[1] * sqrt(f1);
-            gamma_comp_r1[2] = k1[2] * sqrt(f2);
-            gamma_comp_r1[3] = level1 / ref_dose_general * sqrt(f3);
-
-            gamma_comp_r2[0] = k2[0] * sqrt(f0);
-            gamma_comp_r2[1] = k2[1] * sqrt(f1);
-            gamma_comp_r2[2] = k2[2] * sqrt(f2);
-            gamma_comp_r2[3] = level2 / ref_dose_general * sqrt(f3);
-
-            //maximum 3x3x3 iterations
-            for (sub2_iterator.GoToBegin();
-                 !sub2_iterator.IsAtEnd();
-                 ++sub2_iterator)
-            {
-                k3 = sub2_iterator.GetIndex(); //voxel position (pix)
-                level3 = sub2_iterator.Get(); //Dose in Gy
-
-                gamma_comp_r3[0] = k3[0] * sqrt(f0);
-                gamma_comp_r3[1] = k3[1] * sqrt(f1);
-                gamma_comp_r3[2] = k3[2] * sqrt(f2);
-                gamma_comp_r3[3] = level3 / ref_dose_general * sqrt(f3);
-
-                //in 4D space, find the normal vector and its crossection point on the line (r2-r3)
-                // vector equation for the line: rx = r2 + t(r3-r2)
-                //VECTOR PRODUCT[(rx - r1),(r2-r3)] = 0 
 
-                //if t is determined, then we can get the point for gamma calculation.
-                sum_up = 0.0;
-                sum_down = 0.0;
-
-                for (i = 0; i < 4; i++)	{
-                    sum_up += (gamma_comp_r2[i] - gamma_comp_r3[i])*(gamma_comp_r2[i] - gamma_comp_r1[i]);
-                    sum_down += (gamma_comp_r2[i] - gamma_comp_r3[i])*(gamma_comp_r2[i] - gamma_comp_r3[i]);
+#pragma omp for schedule(dynamic)
+        for (plm_long row = 0; row < num_rows; row++) {
+            plm_long k1[3];
+            k1[1] = row % dim_in[1];
+            k1[2] = row / dim_in[1];
+            for (k1[0] = 0; k1[0] < dim_in[0]; k1[0]++) {
+                plm_long v1 = (row * dim_in[0]) + k1[0];
+
+                // skip masked out voxels
+                // if voxel not inside mask, gamma value is 0.0 (passed)
+                if (img_mask_uc && img_mask_uc[v1] == 0) {
+                    img_gamma[v1] = NoProcessGammaValue;
+                    continue;
+                }
+                num_in_mask ++;
+
+                //calculate gamma for this voxel of input image
+                float level1 = img_1[v1];
+                float ref_dose_general = b_local_gamma 
+                    ? level1 : this->reference_dose;
+
+                float fixedlevel2 = b_ref_only_threshold ? -1.0f : img_2[v1];
+                bool below_threshold = this->have_analysis_thresh 
+                    && level1 < analysis_threshold_in_Gy 
+                    && fixedlevel2 < analysis_threshold_in_Gy;
+
+                //if this option is on, computation will be much faster because dose comparison will not be perforemd.
+                if (!this->b_compute_full_region && below_threshold) {
+                    img_gamma[v1] = NoProcessGammaValue;
+                    continue;
                 }
 
-                float scalar_t = sum_up / sum_down;
+                float gamma_comp_r1[4];
+                if (b_interp_search) {
+                    gamma_comp_r1[0] = k1[0] * sqrt(f[0]);
+                    gamma_comp_r1[1] = k1[1] * sqrt(f[1]);
+                    gamma_comp_r1[2] = k1[2] * sqrt(f[2]);
+                    gamma_comp_r1[3] = level1 / ref_dose_general * sqrt(f3);
+                }
 
-                //Only interpolation is allowed. exterapolation should not be used.
-                if (scalar_t > 0.0 && scalar_t < 1.0){
-                    for (i = 0; i < 4; i++)	{
-                        gamma_comp_rn[i] = gamma_comp_r2[i] + scalar_t * (gamma_comp_r3[i] - gamma_comp_r2[i]);
+                // calculate gamma, take a minimum over the neighborhood
+                float gamma = 1e20;
+                for (int s = 0; s < num_stencil; s++) {
+                    const Gamma_search_offset& so = stencil[s];
+                    if (so.dr2_min >= gamma || so.dr2_min >= gamma_max_sq) {
+                        break;
                     }
+                    plm_long k2[3];
+                    k2[0] = k1[0] + so.d[0];
+                    k2[1] = k1[1] + so.d[1];
+                    k2[2] = k1[2] + so.d[2];
+                    if (k2[0] < 0 || k2[0] >= dim_in[0]
+                        || k2[1] < 0 || k2[1] >= dim_in[1]
+                        || k2[2] < 0 || k2[2] >= dim_in[2])
+                    {
+                        continue;
+                    }
+                    float level2 = img_2[volume_index (dim_in, k2)];
 
-                    gg = (gamma_comp_r1[0] - gamma_comp_rn[0])*(gamma_comp_r1[0] - gamma_comp_rn[0]) +
-                        (gamma_comp_r1[1] - gamma_comp_rn[1])*(gamma_comp_r1[1] - gamma_comp_rn[1]) +
-                        (gamma_comp_r1[2] - gamma_comp_rn[2])*(gamma_comp_r1[2] - gamma_comp_rn[2]) +
-                        (gamma_comp_r1[3] - gamma_comp_rn[3])*(gamma_comp_r1[3] - gamma_comp_rn[3]);
-                    // in this subregion, only minimum value is take.
+                    //dd2: (dose diff./D)^2
+                    float dd2 = ((level1 - level2) / ref_dose_general) * ((level1 - level2) / ref_dose_general) * f3;
+                    float gg = so.dr2 + dd2;
                     if (gg < gamma) gamma = gg;
-                }//only scalar_t is in btw. 0 and 1 (interpolation)
-            }// end of sub2_iteration for interp-search
-        }
-        gamma = sqrt(gamma);
 
-        //gamma_max: e.g. 2.0
-        if (gamma > this->gamma_max) {
-            gamma = this->gamma_max;
-        }
-        gamma_img_iterator.Set (gamma);
-        ++gamma_img_iterator;
+                    if (!this->b_interp_search)
+                        continue;
 
-        /*determine gamma histogram bin */		
-        idx_histo = floor(gamma / gamma_max * (double)num_histo_bin);
-	
-        /* Get statistics */
-        if (this->have_analysis_thresh) {
-            //if (level1 > analysis_threshold_in_Gy) {            
-            /* include this voxel */
-            /*fixedlevel2 = -1 if include hig dose Comp is off*/
-            if (!(level1 < analysis_threshold_in_Gy && fixedlevel2 < analysis_threshold_in_Gy)){
-                this->analysis_num_vox ++;
-                if (gamma <= 1) {
-                    this->analysis_num_pass ++;
+                    gamma_interp_search (&gamma, gamma_comp_r1, k2, level2,
+                        ref_dose_general, f, f3, sub2_offset, dim_in, img_2);
+                }
+                gamma = sqrt(gamma);
+
+                //gamma_max: e.g. 2.0
+                if (gamma > this->gamma_max) {
+                    gamma = this->gamma_max;
+                }
+                img_gamma[v1] = gamma;
+
+                /* Get statistics.  If no analysis threshold was used, 
+                   every dose point will be counted as analysis point */
+                if (!below_threshold) {
+                    num_analysis ++;
+                    if (gamma <= 1) {
+                        num_pass ++;
+                    }
+                    int idx_histo = floor(gamma / gamma_max * (double)num_histo_bin);
+                    histo[idx_histo]++;
                 }
-                arr_gamma_histo[idx_histo]++;
             }
-        }
-        //if no analysis threshold was used: every dose point will be counted as analysis point
-        else{
-            this->analysis_num_vox++;
-            if (gamma <= 1) {
-                this->analysis_num_pass++;
+
+            /* The count is read and written in a critical section, 
+               because atomic capture is not available in OpenMP 2.0 */
+            plm_long rows_done_now;
+#pragma omp critical (gamma_progress)
+            {
+                rows_done_now = ++rows_done;
+            }
+
+            /* Progress is only reported from the calling thread */
+            bool report_progress = (progress_callback != 0);
+#if (OPENMP_FOUND)
+            report_progress = report_progress && omp_get_thread_num() == 0;
+#endif
+            if (report_progress) {
+                progress_callback ((float) rows_done_now / (float) num_rows);
             }
-            arr_gamma_histo[idx_histo]++;
         }
 
-        if (progress_callback && voxels_processed % 1000 == 0) {
-            progress_callback (
-                (float) voxels_processed / (float) this->voxels_in_image);
+#pragma omp critical
+        for (int h = 0; h < MAX_NUM_HISTOGRAM_BIN; h++) {
+            arr_gamma_histo[h] += histo[h];
         }
     }
 
+    this->voxels_in_mask = num_in_mask;
+    this->analysis_num_vox += num_analysis;
+    this->analysis_num_pass += num_pass;
+
     /* One last time, just to be sure */
     if (progress_callback) {
         progress_callback (1.0);
     }
 
-    this->gamma_image->set_itk (gamma_img);	
+    this->gamma_image->set_volume (vol_gamma);
 }
 
 void 
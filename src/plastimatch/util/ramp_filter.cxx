@@ -7,6 +7,7 @@
 #include <string.h>
 #include "fftw3.h"
 
+#include "dlib_threads.h"
 #include "ramp_filter.h"
 #include "print_and_exit.h"
 
@@ -24,6 +25,10 @@ static const unsigned int MARGIN = 5;
 #error "MARGIN IS DEFINED"
 #endif
 
+/* Protects the FFTW planner, so that images can be filtered
+   concurrently on different threads */
+static Dlib_semaphore fftw_planner_lock;
+
 /* GCS: Dec 12, 2009 
    Change from unsigned short to float,
    Change to destructive update
@@ -96,20 +101,24 @@ ramp_filter (
     for (i = 0; i < width; ++i)
         ramp[i] *= (cos (i * DEGTORAD * 360 / width) + 1) / 2;
 
+    /* One pair of plans is shared by all rows.  The FFTW planner is
+       not thread safe, so planning is serialized; execution is not. */
+    fftw_planner_lock.grab ();
+    fftp = fftw_plan_dft_1d (width, in, fft, 
+	FFTW_FORWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+    ifftp = fftw_plan_dft_1d (width, fft, ifft, 
+	FFTW_BACKWARD, FFTW_ESTIMATE | FFTW_UNALIGNED);
+    fftw_planner_lock.release ();
+    if (!fftp) {
+	print_and_exit ("Error creating fft plan\n");
+    }
+    if (!ifftp) {
+	print_and_exit ("Error creating ifft plan\n");
+    }
+
     for (r = 0; r < height; ++r)
     {
-	fftp = fftw_plan_dft_1d (width, in + r * width, fft + r * width, 
-	    FFTW_FORWARD, FFTW_ESTIMATE);
-	if (!fftp) {
-	    print_and_exit ("Error creating fft plan\n");
-	}
-	ifftp = fftw_plan_dft_1d (width, fft + r * width, ifft + r * width, 
-	    FFTW_BACKWARD, FFTW_ESTIMATE);
-	if (!ifftp) {
-	    print_and_exit ("Error creating ifft plan\n");
-	}
-
-        fftw_execute (fftp);
+        fftw_execute_dft (fftp, in + r * width, fft + r * width);
 
         // Apply ramp
         for (c = 0; c < width; ++c) {
@@ -117,12 +126,14 @@ ramp_filter (
             fft[r * width + c][1] *= ramp[c];
         }
 
-        fftw_execute (ifftp);
-
-	fftw_destroy_plan (fftp);
-	fftw_destroy_plan (ifftp);
+        fftw_execute_dft (ifftp, fft + r * width, ifft + r * width);
     }
 
+    fftw_planner_lock.grab ();
+    fftw_destroy_plan (fftp);
+    fftw_destroy_plan (ifftp);
+    fftw_planner_lock.release ();
+
     for (i = 0; i < N; ++i)
         ifft[i][0] /= width;
 
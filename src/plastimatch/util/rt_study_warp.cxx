@@ -142,10 +142,8 @@ save_ss_img (
 }
 
 static void
-warp_and_save_ss (
+rasterize_ss (
     Rt_study *rt_study,  
-    const Xform::Pointer& xf, 
-    Plm_image_header *pih, 
     Warp_parms *parms)
 {
     if (!rt_study->have_segmentation()) {
@@ -183,35 +181,43 @@ warp_and_save_ss (
         } else {
             pih.set_from_gpuit (cxt->m_dim, cxt->m_offset, cxt->m_spacing, 0);
         }
-        lprintf ("Warp_and_save_ss: seg->rasterize\n");
+        lprintf ("Rasterize_ss: seg->rasterize\n");
         seg->rasterize (&pih,
             parms->output_labelmap_fn != "",
             parms->xor_contours);
     }
+}
 
-    /* Do the warp */
-    if (parms->xf_in_fn != "") {
-        lprintf ("Warp_and_save_ss: seg->warp\n");
-        seg->warp (xf, pih, parms);
+static void
+save_ss (
+    Rt_study *rt_study,  
+    const Xform::Pointer& xf, 
+    Plm_image_header *pih, 
+    Warp_parms *parms)
+{
+    if (!rt_study->have_segmentation()) {
+        return;
     }
 
+    Segmentation::Pointer seg = rt_study->get_segmentation();
+
     /* If we are warping, re-extract polylines into cxt */
     /* GCS FIX: This is only necessary if we are outputting polylines. 
        Otherwise it is wasting users time. */
     if (parms->xf_in_fn != "") {
-        lprintf ("Warp_and_save_ss: seg->cxt_re_extract\n");
+        lprintf ("Save_ss: seg->cxt_re_extract\n");
         seg->cxt_re_extract ();
     }
 
     /* If we need to reduce the number of points (aka if simplify-perc 
        was set), purge the excessive points...*/
     if (parms->simplify_perc > 0. && parms->simplify_perc < 100.) {
-        lprintf ("Warp_and_save_ss: do_simplify\n");
+        lprintf ("Save_ss: do_simplify\n");
         do_simplify(rt_study, parms->simplify_perc);
     }
 
     /* Save non-dicom formats, such as mha, cxt, xio */
-    lprintf ("Warp_and_save_ss: save_ss_img\n");
+    lprintf ("Save_ss: save_ss_img\n");
     save_ss_img (rt_study, xf.get(), pih, parms);
 }
 
@@ -342,7 +348,44 @@ rt_study_warp (Rt_study *rt_study, Plm_file_format file_type, Warp_parms *parms)
         }
     }
 
-    /* Warp the image and create vf */
+    /* Preprocess structure sets */
+    if (rt_study->have_segmentation()) {
+        Segmentation::Pointer seg = rt_study->get_segmentation();
+
+        /* Convert ss_img to cxt */
+        lprintf ("Rt_study_warp: Convert ss_img to cxt.\n");
+        seg->convert_ss_img_to_cxt ();
+
+        /* Delete empty structures */
+        if (parms->prune_empty) {
+            lprintf ("Rt_study_warp: Prune empty structures.\n");
+            seg->prune_empty ();
+        }
+
+        /* Set the DICOM reference info -- this sets the internal geometry 
+           of the ss_image so we rasterize on the same slices as the CT? */
+        lprintf ("Rt_study_warp: Apply dicom_dir.\n");
+        seg->apply_dicom_dir (rt_study->get_rt_study_metadata());
+        
+        /* Set the output geometry */
+        lprintf ("Rt_study_warp: Set geometry from PIH.\n");
+        seg->set_geometry (&pih);
+
+        /* Set rasterization geometry */
+        lprintf ("Rt_study_warp: Set rasterization geometry.\n");
+        seg->get_structure_set()->set_rasterization_geometry ();
+    }
+
+    /* Rasterize structure set */
+    lprintf ("Rt_study_warp: rasterize ss.\n");
+    rasterize_ss (rt_study, parms);
+
+    /* Warp the image, dose, and structure set together, so that the 
+       transform is evaluated only once.  The vf is created when 
+       the image is warped. */
+    std::vector<Plm_warp_target> targets;
+    Plm_image::Pointer im_out;
+    Plm_image::Pointer dose_out;
     if (rt_study->have_image()
         && (parms->xf_in_fn != ""
             || pih_changed)
@@ -350,12 +393,36 @@ rt_study_warp (Rt_study *rt_study, Plm_file_format file_type, Warp_parms *parms)
             || parms->output_vf_fn != ""
             || parms->output_dicom != ""))
     {
-        Plm_image::Pointer im_out = Plm_image::New();
         lprintf ("Rt_study_warp: Warping m_img\n");
-        plm_warp (im_out, &vf, xform, &pih, rt_study->get_image(), 
-            parms->default_val, parms->use_itk, parms->interp_lin);
+        im_out = Plm_image::New();
+        targets.push_back (Plm_warp_target (im_out, rt_study->get_image(),
+                parms->default_val, parms->interp_lin));
+    }
+    if (rt_study->has_dose()
+        && parms->xf_in_fn != ""
+        && (parms->output_dose_img_fn != ""
+            || parms->output_xio_dirname != ""
+            || parms->output_dicom != ""))
+    {
+        lprintf ("Rt_study_warp: Warping dose\n");
+        dose_out = Plm_image::New();
+        targets.push_back (Plm_warp_target (dose_out, rt_study->get_dose(),
+                0, 1));
+    }
+    DeformationFieldType::Pointer *vf_ptr = im_out ? &vf : 0;
+    if (rt_study->have_segmentation() && parms->xf_in_fn != "") {
+        lprintf ("Rt_study_warp: Warping ss\n");
+        rt_study->get_segmentation()->warp (xform, &pih, targets, vf_ptr,
+            parms->use_itk);
+    } else {
+        plm_warp_multi (targets, vf_ptr, xform, &pih, parms->use_itk);
+    }
+    if (im_out) {
         rt_study->set_image (im_out);
     }
+    if (dose_out) {
+        rt_study->set_dose (dose_out);
+    }
 
     /* Save output image */
     if (parms->output_img_fn != "" && rt_study->have_image()) {
@@ -366,20 +433,6 @@ rt_study_warp (Rt_study *rt_study, Plm_file_format file_type, Warp_parms *parms)
             parms->output_type);
     }
 
-    /* Warp the dose image */
-    if (rt_study->has_dose()
-        && parms->xf_in_fn != ""
-        && (parms->output_dose_img_fn != ""
-            || parms->output_xio_dirname != ""
-            || parms->output_dicom != ""))
-    {
-        lprintf ("Rt_study_warp: Warping dose\n");
-        Plm_image::Pointer im_out = Plm_image::New();
-        plm_warp (im_out, 0, xform, &pih, rt_study->get_dose(), 0, 
-            parms->use_itk, 1);
-        rt_study->set_dose (im_out);
-    }
-
     /* Scale the dose image */
     if (rt_study->has_dose() && parms->have_dose_scale) {
         rt_study->get_dose_volume_float()->scale_inplace (parms->dose_scale);
@@ -419,37 +472,9 @@ rt_study_warp (Rt_study *rt_study, Plm_file_format file_type, Warp_parms *parms)
         itk_image_save (vf, parms->output_vf_fn.c_str());
     }
 
-    /* Preprocess structure sets */
-    if (rt_study->have_segmentation()) {
-        Segmentation::Pointer seg = rt_study->get_segmentation();
-
-        /* Convert ss_img to cxt */
-        lprintf ("Rt_study_warp: Convert ss_img to cxt.\n");
-        seg->convert_ss_img_to_cxt ();
-
-        /* Delete empty structures */
-        if (parms->prune_empty) {
-            lprintf ("Rt_study_warp: Prune empty structures.\n");
-            seg->prune_empty ();
-        }
-
-        /* Set the DICOM reference info -- this sets the internal geometry 
-           of the ss_image so we rasterize on the same slices as the CT? */
-        lprintf ("Rt_study_warp: Apply dicom_dir.\n");
-        seg->apply_dicom_dir (rt_study->get_rt_study_metadata());
-        
-        /* Set the output geometry */
-        lprintf ("Rt_study_warp: Set geometry from PIH.\n");
-        seg->set_geometry (&pih);
-
-        /* Set rasterization geometry */
-        lprintf ("Rt_study_warp: Set rasterization geometry.\n");
-        seg->get_structure_set()->set_rasterization_geometry ();
-    }
-
-    /* Warp and save structure set (except dicom) */
-    lprintf ("Rt_study_warp: warp and save ss.\n");
-    warp_and_save_ss (rt_study, xform, &pih, parms);
+    /* Save structure set (except dicom) */
+    lprintf ("Rt_study_warp: save ss.\n");
+    save_ss (rt_study, xform, &pih, parms);
 
     /* Save dicom */
     if (parms->output_dicom != "") {
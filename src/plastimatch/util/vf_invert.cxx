@@ -5,6 +5,8 @@
 #if (OPENMP_FOUND)
 #include <omp.h>
 #endif
+#include <math.h>
+#include <vector>
 
 #include "geometry_chooser.h"
 #include "itk_image_load.h"
@@ -21,18 +23,157 @@ class Vf_invert_private {
 public:
     Vf_invert_private () {
         iterations = 20;
+        algorithm = VF_INVERT_PASTE_SMOOTH;
+        tolerance = 0.01f;
         vf_out = 0;
+        residual = 0;
     }
     ~Vf_invert_private () {
         delete vf_out;
+        delete residual;
     }
 public:
     int iterations;
+    Vf_invert_algorithm algorithm;
+    float tolerance;
     Geometry_chooser gchooser;
     DeformationFieldType::Pointer input_vf;
     Volume *vf_out;
+    Volume *residual;
+public:
+    void run_paste_smooth (const Volume_header& vh, Volume *vf_in);
+    void run_fixed_point (const Volume_header& vh, const Volume *vf_in);
 };
 
+/* Trilinear interpolation of an interleaved vector field at a 
+   position in world coordinates.  Positions outside of the field 
+   are clamped to its boundary. */
+static void
+vf_invert_interpolate (
+    float val[3],            /* Output: interpolated vector */
+    const Volume *vf,        /* Input:  interleaved vector field */
+    const float xyz[3]       /* Input:  position (mm) */
+)
+{
+    const float *img = (const float*) vf->img;
+    float rel[3] = {
+        xyz[0] - vf->origin[0],
+        xyz[1] - vf->origin[1],
+        xyz[2] - vf->origin[2]
+    };
+    float ijk[3] = {
+        PROJECT_X (rel, vf->proj),
+        PROJECT_Y (rel, vf->proj),
+        PROJECT_Z (rel, vf->proj)
+    };
+    const plm_long vox_stride[3] = { 1, vf->dim[0], vf->dim[0] * vf->dim[1] };
+    plm_long stride[3];
+    float f2[3];
+    plm_long v = 0;
+    for (int d = 0; d < 3; d++) {
+        if (vf->dim[d] < 2) {
+            stride[d] = 0;
+            f2[d] = 0.f;
+            continue;
+        }
+        float a = ijk[d];
+        if (a < 0.f) {
+            a = 0.f;
+        } else if (a > vf->dim[d] - 1) {
+            a = (float) (vf->dim[d] - 1);
+        }
+        plm_long af = (plm_long) a;
+        if (af > vf->dim[d] - 2) {
+            af = vf->dim[d] - 2;
+        }
+        f2[d] = a - af;
+        stride[d] = vox_stride[d];
+        v += af * vox_stride[d];
+    }
+    float f1[3] = { 1.f - f2[0], 1.f - f2[1], 1.f - f2[2] };
+    float w[8] = {
+        f1[0] * f1[1] * f1[2], f2[0] * f1[1] * f1[2],
+        f1[0] * f2[1] * f1[2], f2[0] * f2[1] * f1[2],
+        f1[0] * f1[1] * f2[2], f2[0] * f1[1] * f2[2],
+        f1[0] * f2[1] * f2[2], f2[0] * f2[1] * f2[2]
+    };
+    plm_long idx[8] = {
+        v, v + stride[0],
+        v + stride[1], v + stride[1] + stride[0],
+        v + stride[2], v + stride[2] + stride[0],
+        v + stride[2] + stride[1], v + stride[2] + stride[1] + stride[0]
+    };
+    val[0] = val[1] = val[2] = 0.f;
+    for (int c = 0; c < 8; c++) {
+        val[0] += w[c] * img[3*idx[c]+0];
+        val[1] += w[c] * img[3*idx[c]+1];
+        val[2] += w[c] * img[3*idx[c]+2];
+    }
+}
+
+/* Solve v(x) = -u(x + v(x)) by fixed point iteration at each voxel 
+   of vf_inv, starting from the estimate already in vf_inv.  Voxels 
+   are independent, so they are processed in parallel.  Returns 
+   the number of voxels whose residual is above tolerance. */
+static plm_long
+vf_invert_fixed_point_level (
+    Volume *vf_inv,          /* In/out: inverse vector field */
+    Volume *residual,        /* Output: residual in mm, may be null */
+    const Volume *vf_in,     /* Input:  forward vector field */
+    int max_its,             /* Input:  maximum iterations per voxel */
+    float tolerance,         /* Input:  residual tolerance in mm */
+    double *mean_its         /* Output: mean iterations per voxel */
+)
+{
+    float *img_inv = (float*) vf_inv->img;
+    float *img_res = residual ? (float*) residual->img : 0;
+    long num_unconverged = 0;
+    double total_its = 0.;
+
+#pragma omp parallel for schedule (dynamic, 1) reduction (+:num_unconverged,total_its)
+    LOOP_Z_OMP (k, vf_inv) {
+        plm_long ijk[3];
+        float xyz[3];
+        ijk[2] = k;
+        for (ijk[1] = 0; ijk[1] < vf_inv->dim[1]; ijk[1]++) {
+            for (ijk[0] = 0; ijk[0] < vf_inv->dim[0]; ijk[0]++) {
+                POSITION_FROM_COORDS (xyz, ijk, vf_inv->origin, 
+                    vf_inv->step);
+                plm_long v = volume_index (vf_inv->dim, ijk);
+                float *inv = &img_inv[3*v];
+                float resid;
+                int it = 0;
+                while (1) {
+                    float p[3] = {
+                        xyz[0] + inv[0], xyz[1] + inv[1], xyz[2] + inv[2]
+                    };
+                    float u[3];
+                    vf_invert_interpolate (u, vf_in, p);
+                    float r[3] = { inv[0] + u[0], inv[1] + u[1], inv[2] + u[2] };
+                    resid = sqrtf (r[0]*r[0] + r[1]*r[1] + r[2]*r[2]);
+                    if (resid <= tolerance || it == max_its) {
+                        break;
+                    }
+                    inv[0] = -u[0];
+                    inv[1] = -u[1];
+                    inv[2] = -u[2];
+                    it++;
+                }
+                if (resid > tolerance) {
+                    num_unconverged++;
+                }
+                total_its += it;
+                if (img_res) {
+                    img_res[v] = resid;
+                }
+            }
+        }
+    }
+
+    *mean_its = vf_inv->npix ? total_its / vf_inv->npix : 0.;
+    return num_unconverged;
+}
+
 Vf_invert::Vf_invert () {
     this->d_ptr = new Vf_invert_private;
 }
@@ -100,6 +241,18 @@ Vf_invert::set_iterations (int iterations)
     d_ptr->iterations = iterations;
 }
 
+void 
+Vf_invert::set_algorithm (Vf_invert_algorithm algorithm)
+{
+    d_ptr->algorithm = algorithm;
+}
+
+void 
+Vf_invert::set_tolerance (float tolerance)
+{
+    d_ptr->tolerance = tolerance;
+}
+
 void 
 Vf_invert::run ()
 {
@@ -107,12 +260,6 @@ Vf_invert::run ()
     const Plm_image_header *pih = d_ptr->gchooser.get_geometry ();
     Volume_header vh (pih);
 
-    /* Create mask volume */
-    Volume *mask = new Volume (vh, PT_UCHAR, 1);
-
-    /* Create tmp volume */
-    Volume *vf_inv = new Volume (vh, PT_VF_FLOAT_INTERLEAVED, 1);
-
     /* Convert input vf to native, interleaved format */
     Xform xf_itk;
     xf_itk.set_itk_vf (d_ptr->input_vf);
@@ -122,12 +269,124 @@ Vf_invert::run ()
     Volume::Pointer vf_in = xf->get_gpuit_vf ();
     vf_convert_to_interleaved (vf_in.get());
 
-    /* Populate mask & tmp volume */
+    delete d_ptr->vf_out;
+    delete d_ptr->residual;
+    d_ptr->vf_out = 0;
+    d_ptr->residual = 0;
+    if (d_ptr->algorithm == VF_INVERT_FIXED_POINT) {
+        d_ptr->run_fixed_point (vh, vf_in.get());
+    } else {
+        d_ptr->run_paste_smooth (vh, vf_in.get());
+    }
+
+    /* We're done with input volume now. */
+    delete xf;
+}
+
+void 
+Vf_invert_private::run_fixed_point (
+    const Volume_header& vh, 
+    const Volume *vf_in
+)
+{
+    /* Build the resolution pyramid.  Each coarser level halves the 
+       number of voxels along each axis, down to about 16 voxels. */
+    std::vector<Volume*> levels;
+    levels.push_back (new Volume (vh, PT_VF_FLOAT_INTERLEAVED, 3));
+    while (levels.size() < 4) {
+        const Volume *fine = levels.back ();
+        bool can_coarsen = true;
+        plm_long dim[3];
+        float spacing[3];
+        for (int d = 0; d < 3; d++) {
+            dim[d] = fine->dim[d];
+            spacing[d] = fine->spacing[d];
+            if (fine->dim[d] == 1) {
+                continue;
+            }
+            if (fine->dim[d] < 32) {
+                can_coarsen = false;
+            }
+            dim[d] = (fine->dim[d] + 1) / 2;
+            spacing[d] = fine->spacing[d] * fine->dim[d] / dim[d];
+        }
+        if (!can_coarsen) {
+            break;
+        }
+        levels.push_back (new Volume (dim, fine->origin, spacing, 
+                fine->direction_cosines, PT_VF_FLOAT_INTERLEAVED, 3));
+    }
+
+    /* Solve from coarse to fine.  Each level is initialized by 
+       interpolating the solution of the level below it. */
+    this->residual = new Volume (vh, PT_FLOAT, 1);
+    plm_long num_unconverged = 0;
+    for (int l = (int) levels.size() - 1; l >= 0; l--) {
+        Volume *vf_inv = levels[l];
+        if (l < (int) levels.size() - 1) {
+            const Volume *coarse = levels[l+1];
+            float *img_inv = (float*) vf_inv->img;
+#pragma omp parallel for 
+            LOOP_Z_OMP (k, vf_inv) {
+                plm_long ijk[3];
+                float xyz[3];
+                ijk[2] = k;
+                for (ijk[1] = 0; ijk[1] < vf_inv->dim[1]; ijk[1]++) {
+                    for (ijk[0] = 0; ijk[0] < vf_inv->dim[0]; ijk[0]++) {
+                        POSITION_FROM_COORDS (xyz, ijk, vf_inv->origin, 
+                            vf_inv->step);
+                        plm_long v = volume_index (vf_inv->dim, ijk);
+                        vf_invert_interpolate (&img_inv[3*v], coarse, xyz);
+                    }
+                }
+            }
+            delete levels[l+1];
+        }
+        double mean_its;
+        num_unconverged = vf_invert_fixed_point_level (vf_inv, 
+            l == 0 ? this->residual : 0, vf_in, 
+            this->iterations, this->tolerance, &mean_its);
+        printf ("Level %d (%d x %d x %d), mean iterations %g\n", l, 
+            (int) vf_inv->dim[0], (int) vf_inv->dim[1], 
+            (int) vf_inv->dim[2], mean_its);
+    }
+
+    /* Report the residual */
+    const float *img_res = (const float*) this->residual->img;
+    double sum_res = 0.;
+    float max_res = 0.f;
+    for (plm_long v = 0; v < this->residual->npix; v++) {
+        sum_res += img_res[v];
+        if (img_res[v] > max_res) {
+            max_res = img_res[v];
+        }
+    }
+    printf ("Residual: mean %g mm, max %g mm, %d voxels above %g mm\n",
+        this->residual->npix ? sum_res / this->residual->npix : 0., 
+        max_res, (int) num_unconverged, this->tolerance);
+
+    /* Save the output image! */
+    this->vf_out = levels[0];
+}
+
+void 
+Vf_invert_private::run_paste_smooth (
+    const Volume_header& vh, 
+    Volume *vf_in
+)
+{
+    /* Create mask volume */
+    Volume *mask = new Volume (vh, PT_UCHAR, 1);
+
+    /* Create tmp volume */
+    Volume *vf_inv = new Volume (vh, PT_VF_FLOAT_INTERLEAVED, 1);
+
+    /* Populate mask & tmp volume.  This is done serially, because 
+       several input voxels can land on the same output voxel. */
     unsigned char *img_mask = (unsigned char*) mask->img;
     float *img_in = (float*) vf_in->img;
     float *img_inv = (float*) vf_inv->img;
 
-#pragma omp parallel for 
     LOOP_Z_OMP (k, vf_in) {
         plm_long fijk[3];      /* Index within fixed image (vox) */
         float fxyz[3];         /* Position within fixed image (mm) */
@@ -158,14 +417,11 @@ Vf_invert::run ()
                 img_inv[3*midx+0] = -img_in[3*v+0];
                 img_inv[3*midx+1] = -img_in[3*v+1];
                 img_inv[3*midx+2] = -img_in[3*v+2];
-                img_mask[midx] ++;
+                img_mask[midx] = 1;
             }
         }
     }
 
-    /* We're done with input volume now. */
-    delete xf;
-
     /* Create tmp & output volumes */
     Volume *vf_out = new Volume (vh, PT_VF_FLOAT_INTERLEAVED, 3);
     float *img_out = (float*) vf_out->img;
@@ -174,8 +430,8 @@ Vf_invert::run ()
 
     /* Iterate, pasting and smoothing */
     printf ("Paste and smooth loop\n");
-    for (int it = 0; it < d_ptr->iterations; it++) {
-        printf ("Iteration %d/%d\n", it, d_ptr->iterations);
+    for (int it = 0; it < this->iterations; it++) {
+        printf ("Iteration %d/%d\n", it, this->iterations);
         /* Paste */
         for (plm_long v = 0, k = 0; k < vf_out->dim[2]; k++) {
             for (plm_long j = 0; j < vf_out->dim[1]; j++) {
@@ -208,7 +464,7 @@ Vf_invert::run ()
     delete vf_smooth;
 
     /* Save the output image! */
-    d_ptr->vf_out = vf_out;
+    this->vf_out = vf_out;
 }
 
 const Volume*
@@ -216,3 +472,9 @@ Vf_invert::get_output_volume ()
 {
     return d_ptr->vf_out;
 }
+
+const Volume*
+Vf_invert::get_residual_volume ()
+{
+    return d_ptr->residual;
+}
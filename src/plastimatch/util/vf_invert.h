@@ -9,6 +9,11 @@
 
 class Vf_invert_private;
 
+enum Vf_invert_algorithm {
+    VF_INVERT_PASTE_SMOOTH,
+    VF_INVERT_FIXED_POINT
+};
+
 class PLMUTIL_API Vf_invert {
 public:
     Vf_invert ();
@@ -45,8 +50,20 @@ public:
       of the output vector field. */
     void set_direction_cosines (const float direction_cosines[9]);
     /*! \brief Set the number of iterations to run the inversion 
-      routine (default is 20 iterations). */
+      routine (default is 20 iterations).  For the fixed point 
+      algorithm, this is the maximum number of iterations per voxel 
+      at each resolution level. */
     void set_iterations (int iterations);
+    /*! \brief Choose the inversion algorithm.  The default is 
+      VF_INVERT_PASTE_SMOOTH, which scatters the negated input 
+      vectors and smooths them into the holes.  VF_INVERT_FIXED_POINT 
+      solves v(x) = -u(x + v(x)) at each voxel, using trilinear 
+      interpolation of the input field, starting from the solution 
+      at a coarser resolution. */
+    void set_algorithm (Vf_invert_algorithm algorithm);
+    /*! \brief Set the convergence tolerance in mm of the fixed 
+      point algorithm (default is 0.01 mm). */
+    void set_tolerance (float tolerance);
     ///@}
 
     /*! \name Execution */
@@ -59,6 +76,10 @@ public:
     ///@{
     /*! \brief Return the inverse vector field as a Volume*. */
     const Volume* get_output_volume ();
+    /*! \brief Return the residual |v(x) + u(x + v(x))| in mm at 
+      each voxel, as a float Volume*.  This is only computed by the 
+      fixed point algorithm, otherwise it returns null. */
+    const Volume* get_residual_volume ();
     ///@}
 };
 